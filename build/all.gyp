@@ -59,6 +59,8 @@
         '../net/instaweb/test.gyp:mod_pagespeed_speed_test',
         'install.gyp:*',
         '<(DEPTH)/pagespeed/kernel.gyp:redis_cache_cluster_setup',
+        '<(DEPTH)/pagespeed/kernel.gyp:replay_cache_trace',
+        '<(DEPTH)/pagespeed/kernel.gyp:train_cache_dictionary',
       ]
     },
     {
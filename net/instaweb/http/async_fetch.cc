@@ -395,6 +395,7 @@ ConditionalSharedAsyncFetch::ConditionalSharedAsyncFetch(
     MessageHandler* handler)
     : SharedAsyncFetch(base_fetch),
       handler_(handler),
+      cached_response_headers_(base_fetch->request_context()->options()),
       serving_cached_value_(false),
       added_conditional_headers_to_request_(false),
       num_conditional_refreshes_(NULL) {
@@ -403,21 +404,20 @@ ConditionalSharedAsyncFetch::ConditionalSharedAsyncFetch(
     // conditional.
     if (!request_headers()->Has(HttpAttributes::kIfModifiedSince) &&
         !request_headers()->Has(HttpAttributes::kIfNoneMatch)) {
-      ResponseHeaders cached_response_headers(request_context()->options());
-      cached_value->ExtractHeaders(&cached_response_headers, handler_);
+      cached_value->ExtractHeaders(&cached_response_headers_, handler_);
       // Check that the cached response is a 200.
-      if (cached_response_headers.status_code() == HttpStatus::kOK) {
+      if (cached_response_headers_.status_code() == HttpStatus::kOK) {
         // Copy the Etag and Last-Modified if any into the If-None-Match and
         // If-Modified-Since request headers. Also, ensure that the Etag wasn't
         // added by us.
-        const char* etag = cached_response_headers.Lookup1(
+        const char* etag = cached_response_headers_.Lookup1(
             HttpAttributes::kEtag);
         if (etag != NULL && !StringCaseStartsWith(etag,
                                                   HTTPCache::kEtagPrefix)) {
           request_headers()->Add(HttpAttributes::kIfNoneMatch, etag);
           added_conditional_headers_to_request_ = true;
         }
-        const char* last_modified = cached_response_headers.Lookup1(
+        const char* last_modified = cached_response_headers_.Lookup1(
             HttpAttributes::kLastModified);
         if (last_modified != NULL) {
           request_headers()->Add(HttpAttributes::kIfModifiedSince,
@@ -441,8 +441,9 @@ void ConditionalSharedAsyncFetch::HandleHeadersComplete() {
     // and stop passing any events through to the base fetch.
     serving_cached_value_ = true;
     int64 implicit_cache_ttl_ms = response_headers()->implicit_cache_ttl_ms();
-    response_headers()->Clear();
-    cached_value_.ExtractHeaders(response_headers(), handler_);
+    // The cached headers were parsed when the conditional request was set
+    // up; copy them rather than parsing cached_value_ a second time.
+    response_headers()->CopyFrom(cached_response_headers_);
     if (response_headers()->is_implicitly_cacheable()) {
       response_headers()->SetCacheControlMaxAge(implicit_cache_ttl_ms);
       response_headers()->ComputeCaching();
@@ -293,7 +293,9 @@ class CacheFindCallback : public HTTPCache::Callback {
     switch (find_result.status) {
       case HTTPCache::kFound: {
         VLOG(1) << "Found in cache: " << url_ << " (" << fragment_ << ")";
-        http_value()->ExtractHeaders(response_headers(), handler_);
+        // response_headers() is shared with base_fetch_, and the HTTPCache
+        // already parsed and validated the cached headers into it while
+        // linking http_value(), so there is no need to extract them again.
 
         bool is_imminently_expiring = false;
 
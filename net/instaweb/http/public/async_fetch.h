@@ -383,6 +383,9 @@ class ConditionalSharedAsyncFetch : public SharedAsyncFetch {
   // Note that this is only used while serving the cached response.
   MessageHandler* handler_;
   HTTPValue cached_value_;
+  // Headers parsed from cached_value_, kept so a 304 can be served without
+  // re-parsing them.
+  ResponseHeaders cached_response_headers_;
   // Indicates that we received a 304 from the origin and are serving out the
   // cached value.
   bool serving_cached_value_;
@@ -1704,6 +1704,7 @@
         '<(DEPTH)/pagespeed/system/admin_site.cc',
         '<(DEPTH)/pagespeed/system/apr_mem_cache.cc',
         '<(DEPTH)/pagespeed/system/redis_cache.cc',
+        '<(DEPTH)/pagespeed/system/async_redis_cache.cc',
         '<(DEPTH)/pagespeed/system/apr_thread_compatible_pool.cc',
         '<(DEPTH)/pagespeed/system/controller_manager.cc',
         '<(DEPTH)/pagespeed/system/external_server_spec.cc',
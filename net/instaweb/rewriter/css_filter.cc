@@ -75,6 +75,7 @@
 #include "pagespeed/kernel/util/simple_random.h"
 #include "pagespeed/opt/logging/enums.pb.h"
 #include "pagespeed/opt/logging/log_record.h"
+#include "webutil/css/arena.h"
 #include "webutil/css/parser.h"
 
 namespace net_instaweb {
@@ -87,6 +88,15 @@ namespace {
 const char kInlineCspMessage[] =
     "Avoiding modifying inline style with CSP present";
 
+// Returns true if the start of an inline <style> has something that only a
+// full rewrite of the whole element handles: URLs to rewrite, or an @import
+// to flatten (which, like @charset, is only valid before other rules).
+bool NeedsWholeStyleRewrite(StringPiece css, MessageHandler* handler) {
+  return (CssTagScanner::HasUrl(css) ||
+          CssTagScanner::HasImport(css, handler) ||
+          (FindIgnoreCase(css, "@charset") != StringPiece::npos));
+}
+
 // A simple transformer that resolves URLs against a base. Unlike
 // RewriteDomainTransformer, does not do any mapping or trimming.
 class SimpleAbsolutifyTransformer : public CssTagScanner::Transformer {
@@ -159,6 +169,8 @@ const char CssFilter::kRewritesDropped[] = "css_filter_rewrites_dropped";
 const char CssFilter::kTotalBytesSaved[] = "css_filter_total_bytes_saved";
 const char CssFilter::kTotalOriginalBytes[] = "css_filter_total_original_bytes";
 const char CssFilter::kUses[] = "css_filter_uses";
+const char CssFilter::kInlineBlocksStreamed[] =
+    "css_filter_inline_blocks_streamed";
 const char CssFilter::kCharsetMismatch[] = "flatten_imports_charset_mismatch";
 const char CssFilter::kInvalidUrl[]      = "flatten_imports_invalid_url";
 const char CssFilter::kLimitExceeded[]   = "flatten_imports_limit_exceeded";
@@ -407,6 +419,12 @@ bool CssFilter::Context::RewriteCssText(const GoogleUrl& css_base_gurl,
   // Load stylesheet w/o expanding background attributes and preserving as
   // much content as possible from the original document.
   Css::Parser parser(in_text);
+  // Parse into an arena, freed along with this context, to save an allocation
+  // per node of the (often large) stylesheet.
+  if (css_arena_.get() == NULL) {
+    css_arena_.reset(new Css::Arena);
+  }
+  parser.set_arena(css_arena_.get());
   parser.set_preservation_mode(true);
   // We avoid quirks-mode so that we do not "fix" something we shouldn't have.
   parser.set_quirks_mode(false);
@@ -844,6 +862,12 @@ CssFilter::CssFilter(RewriteDriver* driver,
     : RewriteFilter(driver),
       in_style_element_(false),
       style_element_(NULL),
+      style_char_node_(NULL),
+      style_streamed_(false),
+      style_held_for_rewrite_(false),
+      style_parse_failed_(false),
+      style_streamed_in_bytes_(0),
+      style_streamed_out_bytes_(0),
       cache_extender_(cache_extender),
       image_rewrite_filter_(image_rewriter),
       image_combiner_(image_combiner) {
@@ -856,6 +880,8 @@ CssFilter::CssFilter(RewriteDriver* driver,
   total_bytes_saved_ = stats->GetUpDownCounter(CssFilter::kTotalBytesSaved);
   total_original_bytes_ = stats->GetVariable(CssFilter::kTotalOriginalBytes);
   num_uses_ = stats->GetVariable(CssFilter::kUses);
+  num_inline_blocks_streamed_ =
+      stats->GetVariable(CssFilter::kInlineBlocksStreamed);
   num_flatten_imports_charset_mismatch_ = stats->GetVariable(kCharsetMismatch);
   num_flatten_imports_invalid_url_ = stats->GetVariable(kInvalidUrl);
   num_flatten_imports_limit_exceeded_ = stats->GetVariable(kLimitExceeded);
@@ -875,6 +901,7 @@ void CssFilter::InitStats(Statistics* statistics) {
   statistics->AddUpDownCounter(CssFilter::kTotalBytesSaved);
   statistics->AddVariable(CssFilter::kTotalOriginalBytes);
   statistics->AddVariable(CssFilter::kUses);
+  statistics->AddVariable(CssFilter::kInlineBlocksStreamed);
   statistics->AddVariable(CssFilter::kCharsetMismatch);
   statistics->AddVariable(CssFilter::kInvalidUrl);
   statistics->AddVariable(CssFilter::kLimitExceeded);
@@ -937,6 +964,7 @@ void CssFilter::AddRelatedOptions(StringPieceVector* target) {
 
 void CssFilter::StartDocumentImpl() {
   in_style_element_ = false;
+  ResetStyleStream();
   meta_tag_charset_.clear();
 }
 
@@ -978,6 +1006,16 @@ void CssFilter::StartElementImpl(HtmlElement* element) {
 
 void CssFilter::Characters(HtmlCharactersNode* characters_node) {
   if (in_style_element_ && driver()->can_rewrite_resources()) {
+    if (driver()->split_style_at_flush()) {
+      // This may be only part of the style.  Decide what to do with it at
+      // the flush or the </style>, whichever comes first.
+      if (style_char_node_ != NULL) {
+        style_held_text_.append(style_char_node_->contents());
+        style_char_node_->mutable_contents()->clear();
+      }
+      style_char_node_ = characters_node;
+      return;
+    }
     // Note: HtmlParse should guarantee that we only get one CharactersNode
     // per <style> block even if it is split by a flush. However, this code
     // will still mostly work if we somehow got multiple CharacterNodes.
@@ -990,6 +1028,9 @@ void CssFilter::EndElementImpl(HtmlElement* element) {
   if (in_style_element_) {
     CHECK(style_element_ == element);  // HtmlParse should not pass unmatching.
     in_style_element_ = false;
+    if (driver()->split_style_at_flush() && driver()->can_rewrite_resources()) {
+      FinishStyleText(element);
+    }
   }
   if (driver()->IsRewritable(element)) {
     resource_tag_scanner::UrlCategoryVector attributes;
@@ -1010,6 +1051,117 @@ void CssFilter::EndElementImpl(HtmlElement* element) {
   }
 }
 
+void CssFilter::Flush() {
+  if (in_style_element_ && (style_char_node_ != NULL)) {
+    StreamStyleText();
+  }
+  // The node is about to be written out, so the next window gets a new one.
+  style_char_node_ = NULL;
+}
+
+void CssFilter::StreamStyleText() {
+  if (driver()->content_security_policy().HasDirectiveOrDefaultSrc(
+        CspDirective::kStyleSrc)) {
+    // Leave it as it is; StartInlineRewrite will refuse the last piece too.
+    return;
+  }
+
+  GoogleString* contents = style_char_node_->mutable_contents();
+  style_held_text_.append(*contents);
+  contents->clear();
+  if (!style_held_for_rewrite_) {
+    // Once some of the style has gone out, only URLs need to be held for
+    // the full rewrite: anything before them is complete statements, so
+    // what's left can be rewritten on its own.  An @import there is invalid
+    // and mustn't be flattened, so leave it to piecewise minification.
+    StringPiece text(style_held_text_);
+    style_held_for_rewrite_ =
+        style_streamed_ ? CssTagScanner::HasUrl(text) :
+        NeedsWholeStyleRewrite(text, driver()->message_handler());
+  }
+  if (style_held_for_rewrite_) {
+    return;
+  }
+
+  size_t complete_size = CssMinify::CompleteStatementsSize(style_held_text_);
+  if (complete_size == 0) {
+    return;
+  }
+  MinifyStyleText(StringPiece(style_held_text_.data(), complete_size),
+                  contents);
+  style_held_text_.erase(0, complete_size);
+  if (!style_streamed_) {
+    style_streamed_ = true;
+    num_inline_blocks_streamed_->Add(1);
+  }
+}
+
+void CssFilter::FinishStyleText(HtmlElement* style_element) {
+  if (style_char_node_ == NULL) {
+    if (style_held_text_.empty()) {
+      ResetStyleStream();
+      return;
+    }
+    // Nothing arrived after the last flush but the </style>.
+    style_char_node_ = driver()->NewCharactersNode(style_element, "");
+    driver()->InsertNodeBeforeCurrent(style_char_node_);
+  }
+
+  GoogleString* contents = style_char_node_->mutable_contents();
+  contents->insert(0, style_held_text_);
+  if (style_streamed_ && !style_held_for_rewrite_) {
+    GoogleString text;
+    text.swap(*contents);
+    MinifyStyleText(text, contents);
+  } else {
+    StartInlineRewrite(style_char_node_, style_element);
+  }
+  if (style_streamed_) {
+    RecordStreamedStyle();
+  }
+  ResetStyleStream();
+}
+
+void CssFilter::RecordStreamedStyle() {
+  // Mirror what Context::RewriteCssFromRoot and SerializeCss would have
+  // counted for the block.  If the rest of it went through
+  // StartInlineRewrite, that rewrite counts the block itself, so only add
+  // the bytes that went out before it.
+  total_original_bytes_->Add(style_streamed_in_bytes_);
+  total_bytes_saved_->Add(style_streamed_in_bytes_ - style_streamed_out_bytes_);
+  if (style_parse_failed_) {
+    num_parse_failures_->Add(1);
+  } else if (!style_held_for_rewrite_) {
+    num_blocks_rewritten_->Add(1);
+    num_uses_->Add(1);
+  }
+}
+
+void CssFilter::MinifyStyleText(StringPiece css, GoogleString* out) {
+  GoogleString minified;
+  StringWriter writer(&minified);
+  CssMinify minify(&writer, driver()->message_handler());
+  bool parsed = minify.ParseStylesheet(css);
+  if (parsed && (minified.size() < css.size())) {
+    out->swap(minified);
+  } else {
+    css.CopyToString(out);
+  }
+  style_parse_failed_ |= !parsed;
+  style_streamed_in_bytes_ += css.size();
+  style_streamed_out_bytes_ += out->size();
+}
+
+void CssFilter::ResetStyleStream() {
+  style_char_node_ = NULL;
+  style_held_text_.clear();
+  style_streamed_ = false;
+  style_held_for_rewrite_ = false;
+  style_parse_failed_ = false;
+  style_streamed_in_bytes_ = 0;
+  style_streamed_out_bytes_ = 0;
+}
+
 void CssFilter::StartInlineRewrite(HtmlCharactersNode* char_node,
                                    HtmlElement* parent_element) {
   if (driver()->content_security_policy().HasDirectiveOrDefaultSrc(
@@ -2400,6 +2400,58 @@ TEST_F(CssFilterTest, FlushInEndTag) {
             output_buffer_);
 }
 
+TEST_F(CssFilterTest, StreamInlineCssAcrossFlush) {
+  options()->ClearSignatureForTesting();
+  options()->set_stream_inline_css(true);
+  server_context()->ComputeSignature(options());
+
+  SetupWriter();
+  rewrite_driver()->StartParse(kTestDomain);
+  rewrite_driver()->ParseText("<html><body><style>.a { color: red; }\n.b { co");
+  rewrite_driver()->Flush();
+  // The complete ruleset goes out minified; the rest waits for more text.
+  EXPECT_EQ("<html><body><style>.a{color:red}", output_buffer_);
+  rewrite_driver()->ParseText("lor: red; }</style></body></html>");
+  rewrite_driver()->FinishParse();
+
+  EXPECT_EQ("<html><body><style>.a{color:red}.b{color:red}</style>"
+            "</body></html>",
+            output_buffer_);
+  EXPECT_EQ(1, statistics()->GetVariable(
+      CssFilter::kInlineBlocksStreamed)->Get());
+  // Streamed text is counted like a block rewritten in one piece: 37 bytes in,
+  // 26 out.
+  EXPECT_EQ(1, statistics()->GetVariable(CssFilter::kBlocksRewritten)->Get());
+  EXPECT_EQ(0, statistics()->GetVariable(CssFilter::kParseFailures)->Get());
+  EXPECT_EQ(37, statistics()->GetVariable(
+      CssFilter::kTotalOriginalBytes)->Get());
+  EXPECT_EQ(11, statistics()->GetUpDownCounter(
+      CssFilter::kTotalBytesSaved)->Get());
+}
+
+TEST_F(CssFilterTest, StreamInlineCssHoldsUrlsForFullRewrite) {
+  options()->ClearSignatureForTesting();
+  options()->set_stream_inline_css(true);
+  server_context()->ComputeSignature(options());
+
+  SetupWriter();
+  rewrite_driver()->StartParse(kTestDomain);
+  rewrite_driver()->ParseText(
+      "<html><body><style>.a { background: url(a.png) }\n.b { co");
+  rewrite_driver()->Flush();
+  // URLs need the whole-element rewrite, so nothing goes out early.
+  EXPECT_EQ("<html><body><style>", output_buffer_);
+  rewrite_driver()->ParseText("lor: red; }</style></body></html>");
+  rewrite_driver()->FinishParse();
+
+  EXPECT_EQ("<html><body><style>.a{background:url(a.png)}.b{color:red}"
+            "</style></body></html>",
+            output_buffer_);
+  EXPECT_EQ(0, statistics()->GetVariable(
+      CssFilter::kInlineBlocksStreamed)->Get());
+  EXPECT_EQ(1, statistics()->GetVariable(CssFilter::kBlocksRewritten)->Get());
+}
+
 // See: http://www.alistapart.com/articles/alternate/
 //  and http://www.w3.org/TR/html4/present/styles.html#h-14.3.1
 TEST_F(CssFilterTest, AlternateStylesheet) {
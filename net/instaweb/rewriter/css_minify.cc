@@ -49,6 +49,95 @@ bool CssMinify::Stylesheet(const Css::Stylesheet& stylesheet,
   return minifier.ok_;
 }
 
+size_t CssMinify::CompleteStatementsSize(StringPiece stylesheet_text) {
+  const char* text = stylesheet_text.data();
+  size_t size = stylesheet_text.size();
+  size_t complete = 0;
+  // The closing bracket expected for each open block, innermost last.
+  GoogleString closers;
+  // Whether anything but whitespace has been seen since 'complete', and if
+  // so whether that statement is an at-rule.  A ';' only ends an at-rule;
+  // at the top level of a ruleset it is just part of a (bad) selector.
+  bool in_statement = false;
+  bool in_at_rule = false;
+  for (size_t i = 0; i < size; ++i) {
+    char c = text[i];
+    if (closers.empty() && !in_statement) {
+      if (IsHtmlSpace(c)) {
+        continue;
+      }
+      if ((c == '/') && (i + 1 < size) && (text[i + 1] == '*')) {
+        // Comments between statements belong to neither.
+      } else {
+        in_statement = true;
+        in_at_rule = (c == '@');
+      }
+    }
+    switch (c) {
+      case '\\':
+        ++i;  // Skip the escaped character.
+        break;
+      case '"':
+      case '\'': {
+        // A string ends at its matching quote.  An unescaped newline makes
+        // it a bad string, which the parser recovers from in ways we don't
+        // want to second-guess, so stop looking.
+        for (++i; (i < size) && (text[i] != c); ++i) {
+          if (text[i] == '\\') {
+            ++i;
+          } else if (text[i] == '\n') {
+            return complete;
+          }
+        }
+        if (i >= size) {
+          return complete;
+        }
+        break;
+      }
+      case '/':
+        if ((i + 1 < size) && (text[i + 1] == '*')) {
+          StringPiece rest(text + i + 2, size - i - 2);
+          stringpiece_ssize_type end = rest.find("*/");
+          if (end == StringPiece::npos) {
+            return complete;
+          }
+          i += end + 3;  // Leave i on the final '/'.
+        }
+        break;
+      case '{':
+        closers.push_back('}');
+        break;
+      case '(':
+        closers.push_back(')');
+        break;
+      case '[':
+        closers.push_back(']');
+        break;
+      case '}':
+      case ')':
+      case ']':
+        // A bracket that doesn't close the innermost block is just a token.
+        if (!closers.empty() && (closers[closers.size() - 1] == c)) {
+          closers.resize(closers.size() - 1);
+          if (closers.empty() && (c == '}')) {
+            complete = i + 1;
+            in_statement = false;
+          }
+        }
+        break;
+      case ';':
+        if (closers.empty() && in_at_rule) {
+          complete = i + 1;
+          in_statement = false;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  return complete;
+}
+
 bool CssMinify::ParseStylesheet(StringPiece stylesheet_text) {
   ok_ = true;
   Css::Parser parser(stylesheet_text);
@@ -53,6 +53,7 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_writer.h"
+#include "webutil/css/arena.h"
 #include "webutil/css/parser.h"
 #include "webutil/css/tostring.h"
 
@@ -62,7 +63,7 @@ extern const char* CSS_console_css;
 
 namespace {
 
-static void BM_MinifyCss(int iters, int size) {
+static void MinifyCss(int iters, int size, bool use_arena) {
   GoogleString in_text;
   for (int i = 0; i < size; i += strlen(CSS_console_css)) {
     in_text += CSS_console_css;
@@ -71,7 +72,9 @@ static void BM_MinifyCss(int iters, int size) {
 
   NullMessageHandler handler;
   for (int i = 0; i < iters; ++i) {
+    scoped_ptr<Css::Arena> arena(use_arena ? new Css::Arena : NULL);
     Css::Parser parser(in_text);
+    parser.set_arena(arena.get());
     parser.set_preservation_mode(true);
     parser.set_quirks_mode(false);
     scoped_ptr<Css::Stylesheet> stylesheet(parser.ParseRawStylesheet());
@@ -81,8 +84,18 @@ static void BM_MinifyCss(int iters, int size) {
     CssMinify::Stylesheet(*stylesheet, &writer, &handler);
   }
 }
+
+static void BM_MinifyCss(int iters, int size) {
+  MinifyCss(iters, size, false);
+}
 BENCHMARK_RANGE(BM_MinifyCss, 1<<6, 1<<18);
 
+// As above, but with the stylesheet parsed into an arena, as CssFilter does.
+static void BM_MinifyCssArena(int iters, int size) {
+  MinifyCss(iters, size, true);
+}
+BENCHMARK_RANGE(BM_MinifyCssArena, 1<<6, 1<<18);
+
 // Common-case, all chars are normal alpha-num that don't need to be escaped.
 static void BM_EscapeStringNormal(int iters, int size) {
   GoogleString ident(size, 'A');
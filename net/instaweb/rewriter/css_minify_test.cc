@@ -288,5 +288,28 @@ TEST_F(CssMinifyTest, CssUnicodeRangeDescriptor) {
       minified);
 }
 
+TEST_F(CssMinifyTest, CompleteStatementsSize) {
+  EXPECT_EQ(0, CssMinify::CompleteStatementsSize(""));
+  EXPECT_EQ(0, CssMinify::CompleteStatementsSize(" a { color: red"));
+  EXPECT_EQ(6, CssMinify::CompleteStatementsSize("a{b:c}d{e:f"));
+  EXPECT_EQ(12, CssMinify::CompleteStatementsSize("a{b:c}d{e:f}  "));
+  EXPECT_EQ(16, CssMinify::CompleteStatementsSize(
+      "@import 'x.css';a{"));
+  EXPECT_EQ(23, CssMinify::CompleteStatementsSize(
+      "@media print{a{b:c}d{}} e{"));
+
+  // A ';' only ends an at-rule.
+  EXPECT_EQ(3, CssMinify::CompleteStatementsSize("a{}; b{"));
+  // Brackets inside strings, comments, escapes and other blocks don't count.
+  EXPECT_EQ(0, CssMinify::CompleteStatementsSize("a{content:'}'"));
+  EXPECT_EQ(0, CssMinify::CompleteStatementsSize("a{/* } */"));
+  EXPECT_EQ(0, CssMinify::CompleteStatementsSize("a\\{}"));
+  EXPECT_EQ(11, CssMinify::CompleteStatementsSize("a{b:url(})}/*}"));
+  EXPECT_EQ(16, CssMinify::CompleteStatementsSize("a{content:\"\\\"}\"}"));
+  // Nothing is trusted past an unterminated comment or a bad string.
+  EXPECT_EQ(3, CssMinify::CompleteStatementsSize("a{}/* b{}"));
+  EXPECT_EQ(3, CssMinify::CompleteStatementsSize("a{}b{c:'d\ne'}f{}"));
+}
+
 }  // namespace
 }  // namespace net_instaweb
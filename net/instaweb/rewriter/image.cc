@@ -278,6 +278,12 @@ class ImageImpl : public Image {
       const PngReaderInterface& png_reader,
       const GoogleString& image_data);
 
+  // Writes the best-compressed PNG for image_data into output_contents_,
+  // searching in parallel if options_->png_search_workers is set.
+  bool BestCompressPng(
+      const PngReaderInterface& png_reader,
+      const GoogleString& image_data);
+
   // Converts image_data, readable via png_reader, to a jpeg if
   // possible or a png if not, using the settings in options_.
   bool OptimizePngOrConvertToJpeg(
@@ -295,6 +301,22 @@ class ImageImpl : public Image {
       bool has_transparency,
       ConversionVariables::VariableType var_type);
 
+  // Decodes the original image, resizes it to new_dim, and encodes it as
+  // 'format' with 'config' into 'output'. Rows stream from the reader
+  // through the resizer to the writer, so memory holds only the rows the
+  // resize kernel needs plus whatever the writer buffers. On failure, sets
+  // resize_debug_message_ and returns false.
+  bool StreamResizedImage(const ImageDim& new_dim, ImageFormat format,
+                          const void* config, GoogleString* output);
+
+  // Resizes the original JPEG to new_dim straight into output_contents_,
+  // as WebP if the options allow it or else as JPEG, instead of encoding an
+  // intermediate JPEG that ComputeOutputContents() would decode again.
+  // Other formats still go through the intermediate image (see ResizeTo).
+  // Returns false if that was not allowed or failed, leaving the state as
+  // it was apart from conversion attempts.
+  bool ResizeJpegToOutput(const ImageDim& new_dim);
+
   // Convert the JPEG in original_jpeg to WebP format in
   // compressed_webp using the quality specified in
   // configured_quality.
@@ -684,8 +706,68 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
     return false;
   }
 
+  // Only JPEGs are resized straight into their final format. PNGs and GIFs
+  // are resized into an intermediate PNG which ComputeOutputContents() then
+  // optimizes: PNG optimization tries several encodings of the whole image,
+  // and whether a PNG becomes JPEG, lossy or lossless WebP or stays PNG is
+  // decided by analyzing the resized image for transparency and photo
+  // content.
+  bool resized_to_output = false;
+  if (original_format == pagespeed::image_compression::IMAGE_JPEG) {
+    resized_to_output = ResizeJpegToOutput(new_dim);
+  }
+
+  if (!resized_to_output) {
+    const ImageFormat resized_format = GetOutputImageFormat(original_format);
+    JpegCompressionOptions jpeg_config;
+    PngCompressParams png_config(PNG_FILTER_NONE, Z_DEFAULT_STRATEGY, false);
+    const void* config = NULL;
+    switch (resized_format) {
+      case pagespeed::image_compression::IMAGE_JPEG:
+        jpeg_config.lossy = true;
+        jpeg_config.lossy_options.quality = EstimateQualityForResizedJpeg();
+        config = &jpeg_config;
+        break;
+
+      case pagespeed::image_compression::IMAGE_PNG:
+        config = &png_config;
+        break;
+
+      default:
+        resize_debug_message_ =
+            StringPrintf("Cannot resize%s: Unsupported image format",
+                         debug_message_url_.c_str());
+        PS_LOG_DFATAL(handler_, "Unsupported image format");
+        return false;
+    }
+
+    // Resize the image and save the results in 'resized_image_'.
+    if (!StreamResizedImage(new_dim, resized_format, config,
+                            &resized_image_)) {
+      resized_image_.clear();
+      return false;
+    }
+    output_valid_ = false;
+    rewrite_attempted_ = false;
+    output_contents_.clear();
+  }
+
+  changed_ = true;
+  resized_dimensions_ = new_dim;
+  resize_debug_message_ = StringPrintf(
+      "Resized image%s from %dx%d to %dx%d",
+      debug_message_url_.c_str(),
+      dims_.width(), dims_.height(),
+      resized_dimensions_.width(), resized_dimensions_.height());
+  return true;
+}
+
+bool ImageImpl::StreamResizedImage(const ImageDim& new_dim,
+                                   ImageFormat format,
+                                   const void* config,
+                                   GoogleString* output) {
   scoped_ptr<ScanlineReaderInterface> image_reader(
-      CreateScanlineReader(original_format,
+      CreateScanlineReader(ImageTypeToImageFormat(image_type()),
                            original_contents_.data(),
                            original_contents_.length(),
                            handler_.get()));
@@ -706,51 +788,20 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
     return false;
   }
 
-  // Create a writer.
-  scoped_ptr<ScanlineWriterInterface> writer;
-  const ImageFormat resized_format = GetOutputImageFormat(original_format);
-  switch (resized_format) {
-    case pagespeed::image_compression::IMAGE_JPEG:
-      {
-        JpegCompressionOptions jpeg_config;
-        jpeg_config.lossy = true;
-        jpeg_config.lossy_options.quality = EstimateQualityForResizedJpeg();
-        writer.reset(CreateScanlineWriter(resized_format,
-                                          resizer.GetPixelFormat(),
-                                          resizer.GetImageWidth(),
-                                          resizer.GetImageHeight(),
-                                          &jpeg_config,
-                                          &resized_image_,
-                                          handler_.get()));
-      }
-      break;
-
-    case pagespeed::image_compression::IMAGE_PNG:
-      {
-        PngCompressParams png_config(PNG_FILTER_NONE, Z_DEFAULT_STRATEGY,
-                                     false);
-        writer.reset(CreateScanlineWriter(resized_format,
-                                          resizer.GetPixelFormat(),
-                                          resizer.GetImageWidth(),
-                                          resizer.GetImageHeight(),
-                                          &png_config,
-                                          &resized_image_,
-                                          handler_.get()));
-      }
-      break;
-
-    default:
-      resize_debug_message_ =
-          StringPrintf("Cannot resize%s: Unsupported image format",
-                       debug_message_url_.c_str());
-      PS_LOG_DFATAL(handler_, "Unsupported image format");
-  }
-
+  scoped_ptr<ScanlineWriterInterface> writer(
+      CreateScanlineWriter(format,
+                           resizer.GetPixelFormat(),
+                           resizer.GetImageWidth(),
+                           resizer.GetImageHeight(),
+                           config,
+                           output,
+                           handler_.get()));
   if (writer == NULL) {
     return false;
   }
 
-  // Resize the image and save the results in 'resized_image_'.
+  // Each output row pulls only the input rows it covers through the reader,
+  // so neither the original nor the resized image is ever fully decoded.
   void* scanline = NULL;
   while (resizer.HasMoreScanLines()) {
     if (!resizer.ReadNextScanline(&scanline)) {
@@ -772,20 +823,83 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
                      debug_message_url_.c_str());
     return false;
   }
-
-  changed_ = true;
-  output_valid_ = false;
-  rewrite_attempted_ = false;
-  output_contents_.clear();
-  resized_dimensions_ = new_dim;
-  resize_debug_message_ = StringPrintf(
-      "Resized image%s from %dx%d to %dx%d",
-      debug_message_url_.c_str(),
-      dims_.width(), dims_.height(),
-      resized_dimensions_.width(), resized_dimensions_.height());
   return true;
 }
 
+bool ImageImpl::ResizeJpegToOutput(const ImageDim& new_dim) {
+  // This replaces the conversions ComputeOutputContents() would make on a
+  // resized JPEG, in the same order, so it must count against the same
+  // budget.
+  if (MayConvert() &&
+      options_->convert_jpeg_to_webp &&
+      (options_->preferred_webp != WEBP_NONE)) {
+    ConversionTimeoutHandler timeout_handler(
+        options_->webp_conversion_timeout_ms, timer_, handler_.get());
+    WebpConfiguration webp_config;
+    webp_config.lossless = false;
+    webp_config.method = 3;
+    // Use the quality that converting the intermediate JPEG would have,
+    // i.e., the configured one capped by that of the intermediate JPEG.
+    if (options_->webp_quality > 0) {
+      webp_config.quality = options_->webp_quality;
+    }
+    webp_config.quality = std::min(webp_config.quality,
+        static_cast<float>(EstimateQualityForResizedJpeg()));
+    webp_config.alpha_quality = 0;
+    webp_config.alpha_compression = 0;
+    webp_config.progress_hook = ConversionTimeoutHandler::Continue;
+    webp_config.user_data = &timeout_handler;
+
+    timeout_handler.Start(&output_contents_);
+    bool ok = StreamResizedImage(new_dim,
+                                 pagespeed::image_compression::IMAGE_WEBP,
+                                 &webp_config, &output_contents_);
+    timeout_handler.Stop();
+
+    bool was_timed_out = timeout_handler.was_timed_out();
+    int64 time_elapsed_ms = timeout_handler.time_elapsed_ms();
+    UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+                    Image::ConversionVariables::FROM_JPEG,
+                    options_->webp_conversion_variables);
+    UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+                    Image::ConversionVariables::OPAQUE,
+                    options_->webp_conversion_variables);
+    VLOG(1) << "Image conversion: " << ok << " jpeg->webp for " << url_;
+    if (ok) {
+      image_type_ = IMAGE_WEBP;
+      output_valid_ = true;
+      rewrite_attempted_ = true;
+      return true;
+    }
+    output_contents_.clear();
+    PS_LOG_INFO(handler_, "Failed to create webp!");
+  }
+
+  if (MayConvert()) {
+    // ConvertToJpegOptions() decides progressive encoding by the size of
+    // the resized image.
+    ImageDim old_resized_dimensions = resized_dimensions_;
+    resized_dimensions_ = new_dim;
+    JpegCompressionOptions jpeg_options;
+    ConvertToJpegOptions(*options_.get(), &jpeg_options);
+    // Resizing re-encodes anyway, so this is the only lossy generation.
+    jpeg_options.lossy = true;
+    jpeg_options.lossy_options.quality = EstimateQualityForResizedJpeg();
+    bool ok = StreamResizedImage(new_dim,
+                                 pagespeed::image_compression::IMAGE_JPEG,
+                                 &jpeg_options, &output_contents_);
+    VLOG(1) << "Image conversion: " << ok << " jpeg->jpeg for " << url_;
+    if (ok) {
+      output_valid_ = true;
+      rewrite_attempted_ = true;
+      return true;
+    }
+    output_contents_.clear();
+    resized_dimensions_ = old_resized_dimensions;
+  }
+  return false;
+}
+
 void ImageImpl::UndoChange() {
   if (changed_) {
     output_valid_ = false;
@@ -1137,11 +1251,7 @@ inline bool ImageImpl::ComputeOutputContentsFromGifOrPng(
     }
 
     if (!ok && fall_back_to_png) {
-      ok = MayConvert() &&
-          PngOptimizer::OptimizePngBestCompression(*png_reader,
-                                                   string_for_image,
-                                                   &output_contents_,
-                                                   handler_.get());
+      ok = MayConvert() && BestCompressPng(*png_reader, string_for_image);
       output_type = IMAGE_PNG;
     }
   }
@@ -1229,17 +1339,28 @@ bool ImageImpl::ConvertPngToWebp(
 bool ImageImpl::OptimizePng(
     const PngReaderInterface& png_reader,
     const GoogleString& image_data) {
-  bool ok = MayConvert() &&
-      PngOptimizer::OptimizePngBestCompression(png_reader,
-                                               image_data,
-                                               &output_contents_,
-                                               handler_.get());
+  bool ok = MayConvert() && BestCompressPng(png_reader, image_data);
   if (ok) {
     image_type_ = IMAGE_PNG;
   }
   return ok;
 }
 
+bool ImageImpl::BestCompressPng(
+    const PngReaderInterface& png_reader,
+    const GoogleString& image_data) {
+  if (options_->png_search_workers != NULL) {
+    return PngOptimizer::OptimizePngBestCompressionInParallel(
+        png_reader, image_data, &output_contents_,
+        options_->png_search_workers, options_->thread_system,
+        handler_.get());
+  }
+  return PngOptimizer::OptimizePngBestCompression(png_reader,
+                                                  image_data,
+                                                  &output_contents_,
+                                                  handler_.get());
+}
+
 bool ImageImpl::OptimizePngOrConvertToJpeg(
     const PngReaderInterface& png_reader,
     const GoogleString& image_data) {
@@ -920,6 +920,11 @@ Image::CompressionOptions* ImageRewriteFilter::ImageOptionsForLoadedResource(
       !options->Enabled(RewriteOptions::kJpegSubsampling);
   image_options->webp_conversion_timeout_ms =
       options->image_webp_timeout_ms();
+  if (options->image_png_parallel_search()) {
+    image_options->png_search_workers =
+        server_context()->low_priority_rewrite_workers();
+  }
+  image_options->thread_system = server_context()->thread_system();
 
   return image_options;
 }
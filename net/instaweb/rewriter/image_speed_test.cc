@@ -41,12 +41,18 @@
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/stdio_file_system.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/image_types.pb.h"
+#include "pagespeed/kernel/image/image_analysis.h"
+#include "pagespeed/kernel/image/image_resizer.h"
 #include "pagespeed/kernel/image/image_util.h"
+#include "pagespeed/kernel/image/scanline_interface.h"
+#include "pagespeed/kernel/image/scanline_status.h"
+#include "pagespeed/kernel/image/scanline_utils.h"
 
 namespace net_instaweb {
 
@@ -226,6 +232,165 @@ static void BM_ResizeGifToWebp(int iters) {
 }
 BENCHMARK(BM_ResizeGifToWebp);
 
+// Serves the same few rows of noise for every scanline, so that resizing
+// benchmarks measure the resizer rather than a decoder.
+class SyntheticScanlineReader
+    : public pagespeed::image_compression::ScanlineReaderInterface {
+ public:
+  SyntheticScanlineReader(pagespeed::image_compression::PixelFormat format,
+                          int width, int height, MessageHandler* handler)
+      : format_(format),
+        width_(width),
+        height_(height),
+        bytes_per_row_(width * pagespeed::image_compression::
+                       GetNumChannelsFromPixelFormat(format, handler)),
+        row_(0) {
+    uint32 seed = 1;
+    for (int i = 0; i < kNumDistinctRows * bytes_per_row_; ++i) {
+      seed = seed * 1103515245 + 12345;
+      pixels_.push_back(static_cast<char>(seed >> 24));
+    }
+  }
+
+  virtual bool Reset() {
+    row_ = 0;
+    return true;
+  }
+  virtual size_t GetBytesPerScanline() { return bytes_per_row_; }
+  virtual bool HasMoreScanLines() { return row_ < height_; }
+  virtual pagespeed::image_compression::ScanlineStatus InitializeWithStatus(
+      const void* image_buffer, size_t buffer_length) {
+    row_ = 0;
+    return pagespeed::image_compression::ScanlineStatus(
+        pagespeed::image_compression::SCANLINE_STATUS_SUCCESS);
+  }
+  virtual pagespeed::image_compression::ScanlineStatus
+      ReadNextScanlineWithStatus(void** out_scanline_bytes) {
+    *out_scanline_bytes =
+        &pixels_[(row_ % kNumDistinctRows) * bytes_per_row_];
+    ++row_;
+    return pagespeed::image_compression::ScanlineStatus(
+        pagespeed::image_compression::SCANLINE_STATUS_SUCCESS);
+  }
+  virtual size_t GetImageHeight() { return height_; }
+  virtual size_t GetImageWidth() { return width_; }
+  virtual pagespeed::image_compression::PixelFormat GetPixelFormat() {
+    return format_;
+  }
+  virtual bool IsProgressive() { return false; }
+
+ private:
+  static const int kNumDistinctRows = 7;
+
+  const pagespeed::image_compression::PixelFormat format_;
+  const int width_;
+  const int height_;
+  const int bytes_per_row_;
+  int row_;
+  GoogleString pixels_;
+
+  DISALLOW_COPY_AND_ASSIGN(SyntheticScanlineReader);
+};
+
+// Shrinks a 2048x1536 image to 'width' pixels wide, preserving the aspect
+// ratio.
+static void ResizeSynthetic(int iters,
+                            pagespeed::image_compression::PixelFormat format,
+                            int width, bool use_simd) {
+  NullMessageHandler handler;
+  SyntheticScanlineReader reader(format, 2048, 1536, &handler);
+  pagespeed::image_compression::ScanlineResizer resizer(&handler);
+  if (!use_simd) {
+    resizer.SetKernelsForTesting(
+        pagespeed::image_compression::ScanlineResizer::kKernelsScalar);
+  }
+  for (int i = 0; i < iters; ++i) {
+    reader.Reset();
+    ASSERT_TRUE(resizer.Initialize(&reader, width,
+                                   pagespeed::image_compression::
+                                   ScanlineResizer::kPreserveAspectRatio));
+    while (resizer.HasMoreScanLines()) {
+      void* scanline = NULL;
+      ASSERT_TRUE(resizer.ReadNextScanline(&scanline));
+    }
+  }
+}
+
+static void BM_ResizeGrayScalar(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::GRAY_8, 300, false);
+}
+BENCHMARK(BM_ResizeGrayScalar);
+
+static void BM_ResizeGraySimd(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::GRAY_8, 300, true);
+}
+BENCHMARK(BM_ResizeGraySimd);
+
+// A thumbnail, where each output pixel covers a run of 32 input pixels.
+static void BM_ResizeGrayThumbnailScalar(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::GRAY_8, 64, false);
+}
+BENCHMARK(BM_ResizeGrayThumbnailScalar);
+
+static void BM_ResizeGrayThumbnailSimd(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::GRAY_8, 64, true);
+}
+BENCHMARK(BM_ResizeGrayThumbnailSimd);
+
+static void BM_ResizeRgbScalar(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::RGB_888, 300, false);
+}
+BENCHMARK(BM_ResizeRgbScalar);
+
+static void BM_ResizeRgbSimd(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::RGB_888, 300, true);
+}
+BENCHMARK(BM_ResizeRgbSimd);
+
+static void BM_ResizeRgbaScalar(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::RGBA_8888, 300, false);
+}
+BENCHMARK(BM_ResizeRgbaScalar);
+
+static void BM_ResizeRgbaSimd(int iters) {
+  ResizeSynthetic(iters, pagespeed::image_compression::RGBA_8888, 300, true);
+}
+BENCHMARK(BM_ResizeRgbaSimd);
+
+// Classifies a 2048x1536 RGB image, either exhaustively or by sampling with
+// the given budget.
+static void ClassifySynthetic(int iters, bool sampled, int max_samples) {
+  NullMessageHandler handler;
+  SyntheticScanlineReader reader(pagespeed::image_compression::RGB_888,
+                                 2048, 1536, &handler);
+  for (int i = 0; i < iters; ++i) {
+    reader.Reset();
+    if (sampled) {
+      ASSERT_TRUE(pagespeed::image_compression::IsPhotoSampled(
+          &reader, max_samples, &handler));
+    } else {
+      ASSERT_TRUE(pagespeed::image_compression::IsPhoto(&reader, &handler));
+    }
+  }
+}
+
+static void BM_IsPhotoExhaustive(int iters) {
+  ClassifySynthetic(iters, false, 0);
+}
+BENCHMARK(BM_IsPhotoExhaustive);
+
+// Same pixels as IsPhoto(), but streamed and vectorized.
+static void BM_IsPhotoSampledAllPixels(int iters) {
+  ClassifySynthetic(iters, true, 0);
+}
+BENCHMARK(BM_IsPhotoSampledAllPixels);
+
+static void BM_IsPhotoSampled(int iters) {
+  ClassifySynthetic(iters, true,
+                    pagespeed::image_compression::kPhotoSampleCount);
+}
+BENCHMARK(BM_IsPhotoSampled);
+
 }  // namespace
 
 }  // namespace net_instaweb
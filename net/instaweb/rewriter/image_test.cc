@@ -292,6 +292,11 @@ class ImageTest : public ImageTestBase {
     EXPECT_TRUE(image->output_contents_.empty());
   }
 
+  void ExpectValidOutput(Image* image) {
+    EXPECT_TRUE(image->output_valid_);
+    EXPECT_FALSE(image->output_contents_.empty());
+  }
+
   void ExpectContentType(ImageType image_type, Image* image) {
     EXPECT_EQ(image_type, image->image_type_);
   }
@@ -1296,10 +1301,43 @@ TEST_F(ImageTest, ResizeTo) {
   ImageDim new_dim;
   new_dim.set_width(10);
   new_dim.set_height(10);
-  image->ResizeTo(new_dim);
+  EXPECT_TRUE(image->ResizeTo(new_dim));
 
-  ExpectEmptyOutput(image.get());
+  // A photo is resized straight into its final format, so the output is
+  // ready without a separate recompression pass.
+  ExpectValidOutput(image.get());
   ExpectContentType(IMAGE_JPEG, image.get());
+  GoogleString resized = image->Contents().as_string();
+  ImagePtr resized_image(ImageFromString(IMAGE_JPEG, kPuzzle, resized, false));
+  ExpectDimensions(IMAGE_JPEG, resized.size(), 10, 10, resized_image.get());
+}
+
+TEST_F(ImageTest, ResizeJpegToWebp) {
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  ConversionVarChecker conversion_var_checker(options);
+  options->preferred_webp = WEBP_LOSSY;
+  options->convert_jpeg_to_webp = true;
+  options->webp_quality = 75;
+  options->jpeg_quality = 85;
+
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  ImageDim new_dim;
+  new_dim.set_width(10);
+  new_dim.set_height(10);
+  EXPECT_TRUE(image->ResizeTo(new_dim));
+
+  // The resized JPEG is encoded as WebP directly, with no intermediate
+  // JPEG to convert.
+  ExpectValidOutput(image.get());
+  EXPECT_EQ(ContentType::kWebp, image->content_type()->type());
+  EXPECT_GT(buffer.size(), image->output_size());
+  EXPECT_EQ(1, options->conversions_attempted);
+  conversion_var_checker.Test(0, 0, 0,   // gif
+                              0, 0, 0,   // png
+                              0, 1, 0,   // jpeg
+                              0, 0, 0,   // gif animated
+                              true);
 }
 
 TEST_F(ImageTest, CompressJpegUsingLossyOrLossless) {
@@ -42,7 +42,10 @@
 #include "pagespeed/kernel/base/benchmark.h"
 #include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/null_statistics.h"
+#include "pagespeed/kernel/base/null_writer.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/js/js_minify.h"
 #include "pagespeed/kernel/js/js_tokenizer.h"
 
 namespace net_instaweb {
@@ -51,12 +54,21 @@ extern const char* JS_console_js;
 
 namespace {
 
-void TestMinifyJavascript(bool use_experimental_minifier, int iters, int size) {
+// Size of the pieces BM_MinifyJavascriptStreaming feeds to the minifier,
+// roughly what a fetch hands over at a time.
+const int kStreamingChunkSize = 4096;
+
+GoogleString MakeInput(int size) {
   GoogleString in_text;
   for (int i = 0; i < size; i += strlen(JS_console_js)) {
     in_text += JS_console_js;
   }
   in_text.resize(size);
+  return in_text;
+}
+
+void TestMinifyJavascript(bool use_experimental_minifier, int iters, int size) {
+  const GoogleString in_text = MakeInput(size);
 
   NullStatistics stats;
   JavascriptRewriteConfig::InitStats(&stats);
@@ -83,6 +95,22 @@ static void BM_MinifyJavascriptOld(int iters, int size) {
 }
 BENCHMARK_RANGE(BM_MinifyJavascriptOld, 1<<6, 1<<18);
 
+static void BM_MinifyJavascriptStreaming(int iters, int size) {
+  const GoogleString in_text = MakeInput(size);
+  const StringPiece input(in_text);
+  pagespeed::js::JsTokenizerPatterns js_tokenizer_patterns;
+  NullWriter writer;
+  NullMessageHandler handler;
+  for (int i = 0; i < iters; ++i) {
+    pagespeed::js::JsStreamingMinifier minifier(&js_tokenizer_patterns, NULL);
+    for (size_t pos = 0; pos < input.size(); pos += kStreamingChunkSize) {
+      minifier.Add(input.substr(pos, kStreamingChunkSize), &writer, &handler);
+    }
+    minifier.Finish(&writer, &handler);
+  }
+}
+BENCHMARK_RANGE(BM_MinifyJavascriptStreaming, 1<<6, 1<<18);
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -45,6 +45,7 @@
 
 namespace Css {
 
+class Arena;
 class Stylesheet;
 
 }  // namespace Css
@@ -100,6 +101,7 @@ class CssFilter : public RewriteFilter {
   virtual void StartElementImpl(HtmlElement* element);
   virtual void Characters(HtmlCharactersNode* characters);
   virtual void EndElementImpl(HtmlElement* element);
+  virtual void Flush();
 
   virtual const char* Name() const { return "CssFilter"; }
   virtual const char* id() const { return RewriteOptions::kCssFilterId; }
@@ -114,6 +116,7 @@ class CssFilter : public RewriteFilter {
   static const char kTotalBytesSaved[];
   static const char kTotalOriginalBytes[];
   static const char kUses[];
+  static const char kInlineBlocksStreamed[];
   static const char kCharsetMismatch[];
   static const char kInvalidUrl[];
   static const char kLimitExceeded[];
@@ -158,6 +161,31 @@ class CssFilter : public RewriteFilter {
   void StartInlineRewrite(HtmlCharactersNode* text,
                           HtmlElement* parent_element);
 
+  // Called at a flush inside a <style> that HtmlParse is splitting at flushes.
+  // Rewrites the text seen so far in place: the complete statements are
+  // minified and the rest is held back for the next window.  If the text has
+  // something only the full rewrite can handle (see StartInlineRewrite), the
+  // rest of the element is held back for that instead.
+  void StreamStyleText();
+
+  // Called at the </style> of an element that HtmlParse is splitting at
+  // flushes.  Puts the held-back text into the last window's Characters
+  // node, and either rewrites it there with StartInlineRewrite or, if some
+  // of the element went out already, minifies it synchronously.
+  void FinishStyleText(HtmlElement* style_element);
+
+  // Writes 'css', which must consist of complete statements, to *out
+  // minified, or as is if it doesn't parse cleanly or minifying doesn't help.
+  // This is synchronous and does not go through Context, so unlike a whole
+  // inline block, the result is never cached: every request minifies the
+  // streamed text afresh.
+  void MinifyStyleText(StringPiece css, GoogleString* out);
+
+  // Adds a streamed block to the same statistics a Context rewrite updates.
+  void RecordStreamedStyle();
+
+  void ResetStyleStream();
+
   // Starts the asynchronous rewrite process for inline CSS inside the given
   // element's given style attribute.
   void StartAttributeRewrite(HtmlElement* element,
@@ -189,6 +217,16 @@ class CssFilter : public RewriteFilter {
   // This is meaningless if in_style_element_ is false:
   HtmlElement* style_element_;  // The element we are in.
 
+  // State for a <style> that reaches us a flush window at a time; see
+  // HtmlParse::set_split_style_at_flush.
+  HtmlCharactersNode* style_char_node_;  // Its text in this flush window.
+  GoogleString style_held_text_;  // Text held back from earlier windows.
+  bool style_streamed_;  // Has some of it gone out minified already?
+  bool style_held_for_rewrite_;  // Is the rest waiting for StartInlineRewrite?
+  bool style_parse_failed_;  // Did any streamed text fail to parse?
+  int64 style_streamed_in_bytes_;  // Text passed through MinifyStyleText,
+  int64 style_streamed_out_bytes_;  // and what it wrote.
+
   // The charset extracted from a meta tag, if any.
   GoogleString meta_tag_charset_;
 
@@ -224,6 +262,8 @@ class CssFilter : public RewriteFilter {
   // # of uses of rewritten CSS (updating <link> href= attributes,
   // <style> contents or style= attributes).
   Variable* num_uses_;
+  // # of <style> blocks minified a flush window at a time.
+  Variable* num_inline_blocks_streamed_;
   // # of times CSS was not flattened because of a charset mismatch.
   Variable* num_flatten_imports_charset_mismatch_;
   // # of times CSS was not flattened because of an invalid @import URL.
@@ -365,6 +405,8 @@ class CssFilter::Context : public SingleRewriteContext {
   scoped_ptr<CssImageRewriter> css_image_rewriter_;
   ImageRewriteFilter* image_rewrite_filter_;
   CssResourceSlotFactory slot_factory_;
+  // Holds the nodes of the stylesheet we parse, so must outlive hierarchy_.
+  scoped_ptr<Css::Arena> css_arena_;
   CssHierarchy hierarchy_;
   bool css_rewritten_;
   bool has_utf8_bom_;
@@ -72,6 +72,14 @@ class CssMinify {
                            Writer* writer,
                            MessageHandler* handler);
 
+  // Returns the length of the longest prefix of 'stylesheet_text' made up of
+  // complete top-level statements: rulesets and block at-rules through their
+  // closing '}', and other at-rules through their ';'.  Strings, comments,
+  // escapes and nested blocks are skipped over, so the text past this point
+  // can be parsed separately without changing the meaning of either part.
+  // Returns 0 if no statement is complete yet.
+  static size_t CompleteStatementsSize(StringPiece stylesheet_text);
+
   // Establishes a string-vector to collect all parsed URLs.
   void set_url_collector(StringVector* urls) { url_collector_ = urls; }
 
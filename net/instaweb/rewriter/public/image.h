@@ -34,6 +34,8 @@
 namespace net_instaweb {
 class Histogram;
 class MessageHandler;
+class QueuedWorkerPool;
+class ThreadSystem;
 class Timer;
 class Variable;
 struct ContentType;
@@ -109,6 +111,8 @@ class Image {
           jpeg_num_progressive_scans(
               RewriteOptions::kDefaultImageJpegNumProgressiveScans),
           webp_conversion_timeout_ms(-1),
+          png_search_workers(NULL),
+          thread_system(NULL),
           conversions_attempted(0),
           preserve_lossless(false),
           webp_conversion_variables(NULL) {}
@@ -135,6 +139,10 @@ class Image {
     bool use_transparent_for_blank_image;
     int64 jpeg_num_progressive_scans;
     int64 webp_conversion_timeout_ms;
+    // If non-NULL, best-compression PNG encodes search their candidate
+    // parameters in parallel on these workers and the calling thread.
+    QueuedWorkerPool* png_search_workers;
+    ThreadSystem* thread_system;
 
     // These fields are set by the conversion routines to report
     // characteristics of the conversion process.
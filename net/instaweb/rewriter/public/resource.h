@@ -261,6 +261,11 @@ class Resource : public RefCounted<Resource> {
   // successful.
   bool Link(HTTPValue* source, MessageHandler* handler);
 
+  // Like Link, but for a source whose headers have already been parsed
+  // and validated, e.g. by an HTTPCache lookup.  The headers are copied
+  // into response_headers_ rather than being parsed out of source again.
+  void LinkParsed(HTTPValue* source, const ResponseHeaders& headers);
+
   // Freshen a soon-to-expire resource so that we minimize the number
   // of cache misses when serving live traffic.
   // Note that callback may be NULL, and all subclasses must handle this.
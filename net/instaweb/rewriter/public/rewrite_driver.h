@@ -1092,6 +1092,18 @@ class RewriteDriver : public HtmlParse {
               options()->Enabled(RewriteOptions::kComputeCriticalCss))));
   }
 
+  // Return true if an inline <style> that spans a flush should reach the
+  // filters a flush window at a time, so CssFilter can minify it as it
+  // streams in.  Filters that need a style's complete contents rule it out.
+  bool StreamInlineCssEnabled() const {
+    return (options()->stream_inline_css() &&
+            options()->Enabled(RewriteOptions::kRewriteCss) &&
+            !options()->Enabled(RewriteOptions::kOutlineCss) &&
+            !options()->Enabled(RewriteOptions::kInlineImportToLink) &&
+            !options()->Enabled(RewriteOptions::kPrioritizeCriticalCss) &&
+            !options()->Enabled(RewriteOptions::kComputeCriticalCss));
+  }
+
   // We expect to this method to be called on the HTML parser thread.
   // Returns the number of images whose low quality images are inlined in the
   // html page.
@@ -129,6 +129,14 @@ class RewriteDriverFactory {
   // fecher to return cached versions.
   void set_force_caching(bool u) { force_caching_ = u; }
 
+  // Turns on QueuedWorkerPool::EnableWorkStealing for worker pools with
+  // more than one thread.  Off by default: stealing only pays for itself
+  // when several cores contend on the pool mutex, and costs a little
+  // bookkeeping otherwise.  Must be called before WorkerPool().
+  void set_worker_pool_work_stealing(bool x) {
+    worker_pool_work_stealing_ = x;
+  }
+
   // You can call set_base_url_async_fetcher to set up real async fetching
   // for real serving or for modeling of live traffic.
   //
@@ -449,6 +457,7 @@ class RewriteDriverFactory {
   GoogleString filename_prefix_;
   GoogleString slurp_directory_;
   bool force_caching_;
+  bool worker_pool_work_stealing_;
   bool slurp_read_only_;
   bool slurp_print_urls_;
 
@@ -314,6 +314,7 @@ class RewriteOptions {
   static const char kImageLimitRenderedAreaPercent[];
   static const char kImageLimitResizeAreaPercent[];
   static const char kImageMaxRewritesAtOnce[];
+  static const char kImagePngParallelSearch[];
   static const char kImagePreserveURLs[];
   static const char kImageRecompressionQuality[];
   static const char kImageResolutionLimitBytes[];
@@ -391,6 +392,7 @@ class RewriteOptions {
   static const char kServeStaleWhileRevalidateThresholdSec[];
   static const char kServeXhrAccessControlHeaders[];
   static const char kStickyQueryParameters[];
+  static const char kStreamInlineCss[];
   static const char kSupportNoScriptEnabled[];
   static const char kTestOnlyPrioritizeCriticalCssDontApplyOriginalCss[];
   static const char kUrlSigningKey[];
@@ -2195,6 +2197,11 @@ class RewriteOptions {
     set_option(x, &css_preserve_urls_);
   }
 
+  bool stream_inline_css() const { return stream_inline_css_.value(); }
+  void set_stream_inline_css(bool x) {
+    set_option(x, &stream_inline_css_);
+  }
+
   bool image_preserve_urls() const {
     return CheckBandwidthOption(image_preserve_urls_);
   }
@@ -2345,6 +2352,13 @@ class RewriteOptions {
     set_option(x, &image_webp_quality_for_save_data_);
   }
 
+  bool image_png_parallel_search() const {
+    return image_png_parallel_search_.value();
+  }
+  void set_image_png_parallel_search(bool x) {
+    set_option(x, &image_png_parallel_search_);
+  }
+
   int64 image_webp_timeout_ms() const {
     return image_webp_timeout_ms_.value();
   }
@@ -3693,6 +3707,12 @@ class RewriteOptions {
   Option<bool> js_preserve_urls_;
   Option<bool> image_preserve_urls_;
 
+  // Minify inline <style> blocks a flush window at a time.  Off by default:
+  // the streamed text bypasses the rewrite cache and is minified again on
+  // every request, which only pays off where flush latency matters more
+  // than CPU.
+  Option<bool> stream_inline_css_;
+
   Option<int64> image_inline_max_bytes_;
   Option<int64> js_inline_max_bytes_;
   Option<int64> js_outline_min_bytes_;
@@ -3735,6 +3755,9 @@ class RewriteOptions {
   Option<int64> image_webp_quality_for_save_data_;
   Option<int64> image_webp_timeout_ms_;
 
+  // Whether to search PNG compression parameters on several threads.
+  Option<bool> image_png_parallel_search_;
+
   Option<int> image_max_rewrites_at_once_;
   Option<int> max_url_segment_size_;  // For http://a/b/c.d, use strlen("c.d").
   Option<int> max_url_size_;          // This is strlen("http://a/b/c.d").
@@ -264,6 +264,15 @@ bool Resource::Link(HTTPValue* value, MessageHandler* handler) {
   return value_.Link(contents_and_headers, &response_headers_, handler);
 }
 
+void Resource::LinkParsed(HTTPValue* value, const ResponseHeaders& headers) {
+  DCHECK(UseHttpCache());
+  extracted_state_ = kExtractNotComputed;
+  extracted_contents_.clear();
+  extracted_headers_ = nullptr;
+  value_.Link(value);
+  response_headers_.CopyFrom(headers);
+}
+
 void Resource::LinkFallbackValue(HTTPValue* value) {
   DCHECK(UseHttpCache());
   if (!value->Empty()) {
@@ -660,6 +660,7 @@ void RewriteDriver::FlushAsync(Function* callback) {
   // Figure out which filters should be enabled and whether any enabled filter
   // can modify urls.
   DetermineFiltersBehavior();
+  SplitOpenStyle();
 
   for (FilterList::iterator it = early_pre_render_filters_.begin();
       it != early_pre_render_filters_.end(); ++it) {
@@ -1771,11 +1772,14 @@ class CacheCallback : public OptionsAwareHTTPCacheCallback {
       RewriteStats* stats = driver_->server_context()->rewrite_stats();
       stats->cached_resource_fetches()->Add(1);
 
+      // The HTTPCache has already parsed the cached headers into our
+      // response_headers() while validating the entry, so copy those rather
+      // than re-parsing the serialized form for the fetch and the resource.
       HTTPValue* value = http_value();
-      bool success = (value->ExtractContents(&content) &&
-                      value->ExtractHeaders(response_headers, handler_));
+      bool success = value->ExtractContents(&content);
       if (success) {
-        output_resource_->Link(value, handler_);
+        response_headers->CopyFrom(*this->response_headers());
+        output_resource_->LinkParsed(value, *response_headers);
         output_resource_->SetWritten(true);
         async_fetch_->set_content_length(content.size());
         async_fetch_->FixCacheControlForGoogleCache();
@@ -2180,6 +2184,7 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
   if (ret) {
     DCHECK(filters_added_);
     set_buffer_events(true);  // Release buffer when AMPness is discovered.
+    set_split_style_at_flush(StreamInlineCssEnabled());
     base_was_set_ = false;
     if (is_url_valid()) {
       base_url_.Reset(google_url());
@@ -75,6 +75,7 @@ RewriteDriverFactory::RewriteDriverFactory(
     : url_async_fetcher_(NULL),
       js_tokenizer_patterns_(process_context.js_tokenizer_patterns()),
       force_caching_(false),
+      worker_pool_work_stealing_(false),
       slurp_read_only_(false),
       slurp_print_urls_(false),
 #ifdef NDEBUG
@@ -417,6 +418,9 @@ QueuedWorkerPool* RewriteDriverFactory::WorkerPool(WorkerPoolCategory pool) {
     }
 
     worker_pools_[pool] = CreateWorkerPool(pool, name);
+    if (worker_pool_work_stealing_ && worker_pools_[pool]->max_workers() > 1) {
+      worker_pools_[pool]->EnableWorkStealing();
+    }
     worker_pools_[pool]->set_queue_size_stat(
         rewrite_stats()->thread_queue_depth(pool));
     if (pool == kLowPriorityRewriteWorkers) {
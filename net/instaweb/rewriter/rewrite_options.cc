@@ -167,6 +167,7 @@ const char RewriteOptions::kImageWebpRecompressionQualityForSmallScreens[] =
     "WebpRecompressionQualityForSmallScreens";
 const char RewriteOptions::kImageWebpAnimatedRecompressionQuality[] =
     "WebpAnimatedRecompressionQuality";
+const char RewriteOptions::kImagePngParallelSearch[] = "PngParallelSearch";
 const char RewriteOptions::kImageWebpQualityForSaveData[] =
     "WebpQualityForSaveData";
 const char RewriteOptions::kImageWebpTimeoutMs[] = "WebpTimeoutMs";
@@ -267,6 +268,7 @@ const char RewriteOptions::kServeStaleWhileRevalidateThresholdSec[] =
 const char RewriteOptions::kServeXhrAccessControlHeaders[] =
     "ServeXhrAccessControlHeaders";
 const char RewriteOptions::kStickyQueryParameters[] = "StickyQueryParameters";
+const char RewriteOptions::kStreamInlineCss[] = "StreamInlineCss";
 const char RewriteOptions::kSupportNoScriptEnabled[] = "SupportNoScriptEnabled";
 const char
     RewriteOptions::kTestOnlyPrioritizeCriticalCssDontApplyOriginalCss[] =
@@ -1527,6 +1529,12 @@ void RewriteOptions::AddProperties() {
       kImagePreserveURLs,
       kDirectoryScope,
       "Disable the rewriting of Image URLs.", true);
+  AddBaseProperty(
+      false, &RewriteOptions::stream_inline_css_, "sicss",
+      kStreamInlineCss,
+      kDirectoryScope,
+      "Minify inline style blocks that span a flush as they stream in.",
+      true);
   AddBaseProperty(
       false, &RewriteOptions::js_preserve_urls_, "jpu",
       kJsPreserveURLs,
@@ -1807,6 +1815,13 @@ void RewriteOptions::AddProperties() {
       kImageWebpTimeoutMs,
       kLegacyProcessScope,
       NULL, true);  // TODO(jmarantz): write help & doc for mod_pagespeed.
+  AddBaseProperty(
+      false,
+      &RewriteOptions::image_png_parallel_search_, "ipps",
+      kImagePngParallelSearch,
+      kDirectoryScope,
+      "Encode the candidate compression settings for a PNG image on several "
+      "threads at once, skipping those predicted to lose.", true);
   AddBaseProperty(
       kDefaultMaxInlinedPreviewImagesIndex,
       &RewriteOptions::max_inlined_preview_images_index_, "mdii",
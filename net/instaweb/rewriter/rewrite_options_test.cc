@@ -980,6 +980,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kImageLimitRenderedAreaPercent,
     RewriteOptions::kImageLimitResizeAreaPercent,
     RewriteOptions::kImageMaxRewritesAtOnce,
+    RewriteOptions::kImagePngParallelSearch,
     RewriteOptions::kImagePreserveURLs,
     RewriteOptions::kImageRecompressionQuality,
     RewriteOptions::kImageResolutionLimitBytes,
@@ -1059,6 +1060,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
     RewriteOptions::kServeWebpToAnyAgent,
     RewriteOptions::kServeXhrAccessControlHeaders,
     RewriteOptions::kStickyQueryParameters,
+    RewriteOptions::kStreamInlineCss,
     RewriteOptions::kSupportNoScriptEnabled,
     RewriteOptions::kTestOnlyPrioritizeCriticalCssDontApplyOriginalCss,
     RewriteOptions::kUrlSigningKey,
@@ -1705,6 +1707,16 @@ TEST_F(RewriteOptionsTest, PreserveURLDefaults) {
   EXPECT_FALSE(options_.js_preserve_urls());
 }
 
+TEST_F(RewriteOptionsTest, StreamInlineCssDefault) {
+  // Streamed inline CSS is not cached, so it costs CPU on every request and
+  // has to be asked for.
+  EXPECT_FALSE(options_.stream_inline_css());
+  EXPECT_EQ(RewriteOptions::kOptionOk,
+            options_.SetOptionFromName(RewriteOptions::kStreamInlineCss,
+                                       "on"));
+  EXPECT_TRUE(options_.stream_inline_css());
+}
+
 TEST_F(RewriteOptionsTest, RewriteDeadlineTest) {
   EXPECT_EQ(RewriteOptions::kDefaultRewriteDeadlineMs,
             options_.rewrite_deadline_ms());
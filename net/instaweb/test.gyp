@@ -225,6 +225,7 @@
         'spriter/libpng_image_library_test.cc',
         '<(DEPTH)/pagespeed/system/apr_mem_cache_test.cc',
         '<(DEPTH)/pagespeed/system/redis_cache_test.cc',
+        '<(DEPTH)/pagespeed/system/async_redis_cache_test.cc',
         '<(DEPTH)/pagespeed/system/redis_cache_cluster_test.cc',
         '<(DEPTH)/pagespeed/system/admin_site_test.cc',
         '<(DEPTH)/pagespeed/system/system_message_handler_test.cc',
@@ -267,6 +268,7 @@
         '<(DEPTH)/pagespeed/kernel/base/ref_counted_ptr_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/sha1_signature_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/shared_string_test.cc',
+        '<(DEPTH)/pagespeed/kernel/base/slab_pool_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/source_map_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/split_statistics_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/split_writer_test.cc',
@@ -280,21 +282,26 @@
         '<(DEPTH)/pagespeed/kernel/base/wildcard_group.cc',
         '<(DEPTH)/pagespeed/kernel/base/wildcard_group_test.cc',
         '<(DEPTH)/pagespeed/kernel/base/wildcard_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/admission_filter_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/async_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_batcher_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_key_prepender.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_key_prepender_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/cache_stats_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/compression_dictionary_builder_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/delay_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/fallback_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/file_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/frequency_sketch_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/in_memory_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/key_value_codec_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/mock_time_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_context_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/purge_set_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/segment_file_cache_test.cc',
+        '<(DEPTH)/pagespeed/kernel/cache/sharded_lru_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/threadsafe_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/write_through_cache_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/amp_document_filter_test.cc',
@@ -504,6 +511,7 @@
         'test_util',
         '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_console_css_data2c',
         '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_console_js_data2c',
+        '<(DEPTH)/net/instaweb/instaweb.gyp:instaweb_system',
         '<(DEPTH)/pagespeed/kernel.gyp:pthread_system',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_base_core',
         '<(DEPTH)/pagespeed/kernel.gyp:pagespeed_http',
@@ -528,8 +536,22 @@
         '<(DEPTH)/pagespeed/kernel/cache/compressed_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/cache/lru_cache_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/html/html_parse_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_cache_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_lock_manager_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/thread/queued_worker_pool_speed_test.cc',
+        '<(DEPTH)/pagespeed/kernel/thread/scheduler_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/deque_speed_test.cc',
         '<(DEPTH)/pagespeed/kernel/util/url_escaper_speed_test.cc',
+        '<(DEPTH)/pagespeed/system/redis_cache_speed_test.cc',
+        '<(DEPTH)/pagespeed/system/serf_url_async_fetcher_speed_test.cc',
+      ],
+      'conditions': [
+        ['support_posix_shared_mem != 1', {
+          'sources!' : [
+            '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_cache_speed_test.cc',
+            '<(DEPTH)/pagespeed/kernel/sharedmem/shared_mem_lock_manager_speed_test.cc',
+          ],
+        }]
       ],
     },
     {
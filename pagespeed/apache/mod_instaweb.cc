@@ -168,6 +168,8 @@ const char kModPagespeedRetainComment[] = "ModPagespeedRetainComment";
 const char kModPagespeedRunExperiment[] = "ModPagespeedRunExperiment";
 const char kModPagespeedShardDomain[] = "ModPagespeedShardDomain";
 const char kModPagespeedSpeedTracking[] = "ModPagespeedIncreaseSpeedTracking";
+const char kModPagespeedWorkerPoolWorkStealing[] =
+    "ModPagespeedWorkerPoolWorkStealing";
 const char kModPagespeedStaticAssetPrefix[] = "ModPagespeedStaticAssetPrefix";
 const char kModPagespeedStatisticsDomains[] = "ModPagespeedStatisticsDomains";
 const char kModPagespeedTrackOriginalContentLength[] =
@@ -1790,6 +1792,8 @@ static const command_rec mod_pagespeed_filter_cmds[] = {
         "Add X-Original-Content-Length headers to rewritten resources"),
   APACHE_CONFIG_OPTION(kModPagespeedUsePerVHostStatistics,
         "If true, keep track of statistics per VHost and not just globally"),
+  APACHE_CONFIG_OPTION(kModPagespeedWorkerPoolWorkStealing,
+        "If true, rewrite worker threads steal queued work from each other"),
   APACHE_CONFIG_OPTION(kModPagespeedBlockingRewriteRefererUrls,
                        "wildcard_spec for referer urls which trigger blocking "
                        "rewrites"),
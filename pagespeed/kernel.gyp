@@ -49,6 +49,7 @@
         'kernel/base/null_shared_mem.cc',
         'kernel/base/null_writer.cc',
         'kernel/base/print_message_handler.cc',
+        'kernel/base/slab_pool.cc',
         'kernel/base/statistics.cc',
         'kernel/base/stdio_file_system.cc',
         'kernel/base/string_convert.cc',
@@ -190,18 +191,23 @@
       'target_name': 'pagespeed_cache',
       'type': '<(library)',
       'sources': [
+        'kernel/cache/admission_filter_cache.cc',
         'kernel/cache/async_cache.cc',
         'kernel/cache/cache_batcher.cc',
         'kernel/cache/cache_stats.cc',
         'kernel/cache/compressed_cache.cc',
+        'kernel/cache/compression_dictionary_builder.cc',
         'kernel/cache/delegating_cache_callback.cc',
         'kernel/cache/fallback_cache.cc',
         'kernel/cache/file_cache.cc',
+        'kernel/cache/frequency_sketch.cc',
         'kernel/cache/in_memory_cache.cc',
         'kernel/cache/key_value_codec.cc',
         'kernel/cache/lru_cache.cc',
         'kernel/cache/purge_context.cc',
         'kernel/cache/purge_set.cc',
+        'kernel/cache/segment_file_cache.cc',
+        'kernel/cache/sharded_lru_cache.cc',
         'kernel/cache/threadsafe_cache.cc',
         'kernel/cache/write_through_cache.cc',
        ],
@@ -483,6 +489,35 @@
         '<(DEPTH)/third_party/apr/apr.gyp:apr',
       ],
     },
+    {
+      'target_name': 'train_cache_dictionary',
+      'type': 'executable',
+      'sources': [
+        'kernel/cache/train_cache_dictionary_main.cc',
+      ],
+      'include_dirs': [
+        '<(DEPTH)',
+      ],
+      'dependencies': [
+        'pagespeed_cache',
+        'util_gflags',
+      ],
+    },
+    {
+      'target_name': 'replay_cache_trace',
+      'type': 'executable',
+      'sources': [
+        'kernel/cache/replay_cache_trace_main.cc',
+      ],
+      'include_dirs': [
+        '<(DEPTH)',
+      ],
+      'dependencies': [
+        'pagespeed_base_test_infrastructure',
+        'pagespeed_cache',
+        'util_gflags',
+      ],
+    },
     {
       'target_name': 'tcp_connection_for_testing',
       'type': '<(library)',
@@ -519,6 +554,7 @@
       'dependencies': [
         ':pagespeed_image_optimizer_pb',
         ':pagespeed_image_types_pb',
+        ':pagespeed_thread',
         '<(DEPTH)/base/base.gyp:base',
         '<(DEPTH)/build/libwebp.gyp:libwebp_enc',
         '<(DEPTH)/build/libwebp.gyp:libwebp_dec',
@@ -605,6 +641,7 @@
         'kernel/sharedmem/inprocess_shared_mem.cc',
         'kernel/sharedmem/shared_circular_buffer.cc',
         'kernel/sharedmem/shared_dynamic_string_map.cc',
+        'kernel/sharedmem/shared_futex.cc',
         'kernel/sharedmem/shared_mem_cache.cc',
         'kernel/sharedmem/shared_mem_cache_data.cc',
         'kernel/sharedmem/shared_mem_lock_manager.cc',
@@ -100,6 +100,10 @@ class FileSystem {
     // Note: This returns num bytes read, NOT a success bool.
     virtual int Read(char* buf, int size, MessageHandler* handler) = 0;
 
+    // Moves the read position to offset bytes from the start of the file,
+    // returning true if successful.
+    virtual bool Seek(int64 offset, MessageHandler* handler) = 0;
+
     // Reads entire file into buf, returning true if successful.  Calling this
     // with max_file_size=kUnlimitedSize doesn't limit the read size, but it's
     // dangerous, since we can OOM if the file somehow ended up being much
@@ -150,6 +150,25 @@ void FileSystemTest::TestAppend() {
   CheckRead(filename, "Hello world!");
 }
 
+// Write a file, then read pieces of it from various offsets.
+void FileSystemTest::TestSeek() {
+  GoogleString filename = WriteNewFile("/seek.txt", "0123456789");
+  FileSystem::InputFile* ifile =
+      file_system()->OpenInputFile(filename.c_str(), &handler_);
+  ASSERT_TRUE(ifile != nullptr);
+  char buf[4];
+  EXPECT_TRUE(ifile->Seek(6, &handler_));
+  EXPECT_EQ(4, ifile->Read(buf, sizeof(buf), &handler_));
+  EXPECT_EQ("6789", StringPiece(buf, sizeof(buf)));
+  EXPECT_TRUE(ifile->Seek(2, &handler_));
+  EXPECT_EQ(3, ifile->Read(buf, 3, &handler_));
+  EXPECT_EQ("234", StringPiece(buf, 3));
+  EXPECT_TRUE(ifile->Seek(0, &handler_));
+  EXPECT_EQ(1, ifile->Read(buf, 1, &handler_));
+  EXPECT_EQ('0', buf[0]);
+  EXPECT_TRUE(file_system()->Close(ifile, &handler_));
+}
+
 // Write a temp file, rename it, then read it.
 void FileSystemTest::TestRename() {
   GoogleString from_text = "Now is time time";
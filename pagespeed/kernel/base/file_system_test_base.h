@@ -95,6 +95,7 @@ class FileSystemTest : public testing::Test {
   void TestWriteRead();
   void TestTemp();
   void TestAppend();
+  void TestSeek();
   void TestRename();
   void TestRemove();
   void TestExists();
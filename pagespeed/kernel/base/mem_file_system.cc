@@ -61,6 +61,14 @@ class MemInputFile : public FileSystem::InputFile {
     return size;
   }
 
+  bool Seek(int64 offset, MessageHandler* message_handler) override {
+    if (offset < 0 || offset > static_cast<int64>(contents_.length())) {
+      return false;
+    }
+    offset_ = offset;
+    return true;
+  }
+
   bool ReadFile(GoogleString* buf, int64 max_file_size,
                 MessageHandler* message_handler) override {
     if (max_file_size != FileSystem::kUnlimitedSize &&
@@ -83,6 +83,10 @@ TEST_F(MemFileSystemTest, TestAppend) {
   TestAppend();
 }
 
+TEST_F(MemFileSystemTest, TestSeek) {
+  TestSeek();
+}
+
 // Write a temp file, rename it, then read it.
 TEST_F(MemFileSystemTest, TestRename) {
   TestRename();
@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/base/slab_pool.h"
+
+#include <new>
+
+#include "base/logging.h"
+
+namespace net_instaweb {
+
+SlabPool::SlabPool()
+    : next_(NULL),
+      end_(NULL),
+      num_allocations_(0),
+      num_system_allocations_(0) {
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    free_lists_[i] = NULL;
+  }
+}
+
+SlabPool::~SlabPool() {
+  for (int i = 0, n = slabs_.size(); i < n; ++i) {
+    delete [] slabs_[i];
+  }
+}
+
+void* SlabPool::Allocate(SlabPool* pool, size_t size) {
+  if ((pool != NULL) && (size <= kMaxPooledSize)) {
+    return pool->AllocateFromSlab(size);
+  }
+  Header* header = static_cast<Header*>(
+      ::operator new(sizeof(Header) + size));
+  header->pool = pool;
+  header->size_class = kHeapSizeClass;
+  if (pool != NULL) {
+    ++pool->num_allocations_;
+    ++pool->num_system_allocations_;
+  }
+  return header + 1;
+}
+
+void* SlabPool::AllocateFromSlab(size_t size) {
+  ++num_allocations_;
+  uint32 size_class = (size + kGranularity - 1) / kGranularity;
+  FreeBlock* block = free_lists_[size_class];
+  if (block != NULL) {
+    free_lists_[size_class] = block->next;
+    return block;
+  }
+  size_t block_size = sizeof(Header) + size_class * kGranularity;
+  if (next_ + block_size > end_) {
+    // Whatever is left of the current slab is too small, and is abandoned.
+    next_ = new char[kSlabSize];
+    end_ = next_ + kSlabSize;
+    slabs_.push_back(next_);
+    ++num_system_allocations_;
+  }
+  Header* header = reinterpret_cast<Header*>(next_);
+  next_ += block_size;
+  header->pool = this;
+  header->size_class = size_class;
+  return header + 1;
+}
+
+void SlabPool::Free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  Header* header = static_cast<Header*>(ptr) - 1;
+  if (header->size_class == kHeapSizeClass) {
+    ::operator delete(header);
+    return;
+  }
+  SlabPool* pool = header->pool;
+  DCHECK_LT(header->size_class, static_cast<uint32>(kNumSizeClasses));
+  FreeBlock* block = static_cast<FreeBlock*>(ptr);
+  block->next = pool->free_lists_[header->size_class];
+  pool->free_lists_[header->size_class] = block;
+}
+
+}  // namespace net_instaweb
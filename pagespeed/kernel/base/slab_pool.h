@@ -0,0 +1,118 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_BASE_SLAB_POOL_H_
+#define PAGESPEED_KERNEL_BASE_SLAB_POOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// A SlabPool recycles small blocks of memory. Blocks are carved out of 8k
+// slabs and, once freed, kept on a free list per size class for the next
+// allocation of that size, so a long-lived pool that sees the same mix of
+// allocations over and over (e.g. one per HtmlParse, reused across
+// documents) stops calling the system allocator after the first few uses.
+// Slabs are only returned to the system when the pool is destroyed, which
+// must not happen before every block allocated from it has been freed.
+//
+// Each block is preceded by a small header naming the pool it came from, so
+// it can be freed without knowing its pool or size. That makes it simple to
+// mix pooled objects with ones on the heap; see SlabPoolAllocated.
+//
+// This class is not thread-safe.
+class SlabPool {
+ public:
+  // Requests larger than this are passed through to the heap.
+  static const size_t kMaxPooledSize = 256;
+
+  SlabPool();
+  ~SlabPool();
+
+  // Returns size bytes, aligned as for malloc, from pool, or from the heap
+  // if pool is NULL.
+  static void* Allocate(SlabPool* pool, size_t size);
+
+  // Releases a block returned by Allocate(). NULL is ignored.
+  static void Free(void* ptr);
+
+  // Number of blocks handed out by this pool.
+  int64 num_allocations() const { return num_allocations_; }
+
+  // Number of those that needed a call to the system allocator, i.e. new
+  // slabs and blocks too large to pool.
+  int64 num_system_allocations() const { return num_system_allocations_; }
+
+  // Bytes held in slabs, whether in use or free.
+  size_t slab_bytes() const { return slabs_.size() * kSlabSize; }
+
+ private:
+  static const size_t kSlabSize = 8192;
+  static const size_t kGranularity = 16;
+  static const int kNumSizeClasses = kMaxPooledSize / kGranularity + 1;
+  static const uint32 kHeapSizeClass = 0xffffffff;
+
+  // Precedes every block. Kept at 16 bytes so blocks are 16-byte aligned.
+  struct Header {
+    SlabPool* pool;
+    uint32 size_class;
+    uint32 padding;
+  };
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  void* AllocateFromSlab(size_t size);
+
+  FreeBlock* free_lists_[kNumSizeClasses];
+  std::vector<char*> slabs_;
+  char* next_;  // First unused byte in the newest slab.
+  char* end_;   // End of the newest slab.
+  int64 num_allocations_;
+  int64 num_system_allocations_;
+
+  DISALLOW_COPY_AND_ASSIGN(SlabPool);
+};
+
+// Base class for objects that may live in a SlabPool: new (pool) T(...)
+// allocates from pool (or the heap if pool is NULL), plain new T(...)
+// allocates from the heap, and delete works for both.
+class SlabPoolAllocated {
+ public:
+  static void* operator new(size_t size, SlabPool* pool) {
+    return SlabPool::Allocate(pool, size);
+  }
+  static void* operator new(size_t size) {
+    return SlabPool::Allocate(NULL, size);
+  }
+  static void operator delete(void* ptr) { SlabPool::Free(ptr); }
+  // Only called if a constructor throws.
+  static void operator delete(void* ptr, SlabPool* pool) {
+    SlabPool::Free(ptr);
+  }
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_SLAB_POOL_H_
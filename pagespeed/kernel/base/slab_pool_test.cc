@@ -0,0 +1,142 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Unit-test the slab pool.
+
+#include "pagespeed/kernel/base/slab_pool.h"
+
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class Pooled : public SlabPoolAllocated {
+ public:
+  explicit Pooled(int* destroyed) : destroyed_(destroyed) {}
+  virtual ~Pooled() { ++*destroyed_; }
+
+ private:
+  int* destroyed_;
+  char payload_[40];
+};
+
+class SlabPoolTest : public testing::Test {
+ protected:
+  SlabPool pool_;
+};
+
+TEST_F(SlabPoolTest, BlocksAreDistinctAndAligned) {
+  std::set<char*> blocks;
+  std::vector<char*> ordered;
+  for (int i = 0; i < 1000; ++i) {
+    size_t size = 1 + (i % SlabPool::kMaxPooledSize);
+    char* block = static_cast<char*>(SlabPool::Allocate(&pool_, size));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(block) % 8);
+    memset(block, i, size);
+    EXPECT_TRUE(blocks.insert(block).second);
+    ordered.push_back(block);
+  }
+  // Nothing overlapped: each block still holds what we wrote.
+  for (int i = 0; i < 1000; ++i) {
+    size_t size = 1 + (i % SlabPool::kMaxPooledSize);
+    for (size_t j = 0; j < size; ++j) {
+      ASSERT_EQ(static_cast<char>(i), ordered[i][j]);
+    }
+    SlabPool::Free(ordered[i]);
+  }
+  EXPECT_EQ(1000, pool_.num_allocations());
+}
+
+TEST_F(SlabPoolTest, RecyclesFreedBlocks) {
+  void* a = SlabPool::Allocate(&pool_, 24);
+  void* b = SlabPool::Allocate(&pool_, 100);
+  EXPECT_EQ(1, pool_.num_system_allocations());
+  SlabPool::Free(a);
+  SlabPool::Free(b);
+
+  // Same size classes come back from the free lists.
+  EXPECT_EQ(b, SlabPool::Allocate(&pool_, 97));
+  EXPECT_EQ(a, SlabPool::Allocate(&pool_, 17));
+  EXPECT_EQ(4, pool_.num_allocations());
+  EXPECT_EQ(1, pool_.num_system_allocations());
+  SlabPool::Free(a);
+  SlabPool::Free(b);
+}
+
+TEST_F(SlabPoolTest, SteadyStateNeedsNoSystemAllocations) {
+  std::vector<void*> blocks;
+  int64 first_round_system_allocations = 0;
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 2000; ++i) {
+      blocks.push_back(SlabPool::Allocate(&pool_, 8 + (i % 64)));
+    }
+    for (int i = 0, n = blocks.size(); i < n; ++i) {
+      SlabPool::Free(blocks[i]);
+    }
+    blocks.clear();
+    if (round == 0) {
+      first_round_system_allocations = pool_.num_system_allocations();
+    }
+  }
+  EXPECT_LT(0, first_round_system_allocations);
+  EXPECT_EQ(first_round_system_allocations, pool_.num_system_allocations());
+  EXPECT_EQ(20000, pool_.num_allocations());
+}
+
+TEST_F(SlabPoolTest, LargeAndUnpooledBlocksUseHeap) {
+  void* large = SlabPool::Allocate(&pool_, SlabPool::kMaxPooledSize + 1);
+  EXPECT_EQ(1, pool_.num_allocations());
+  EXPECT_EQ(1, pool_.num_system_allocations());
+  EXPECT_EQ(0, pool_.slab_bytes());
+  SlabPool::Free(large);
+
+  void* unpooled = SlabPool::Allocate(NULL, 16);
+  EXPECT_EQ(1, pool_.num_allocations());
+  SlabPool::Free(unpooled);
+  SlabPool::Free(NULL);
+}
+
+TEST_F(SlabPoolTest, SlabPoolAllocated) {
+  int destroyed = 0;
+  Pooled* pooled = new (&pool_) Pooled(&destroyed);
+  Pooled* heap = new Pooled(&destroyed);
+  Pooled* null_pool = new (static_cast<SlabPool*>(NULL)) Pooled(&destroyed);
+  EXPECT_EQ(1, pool_.num_allocations());
+  delete pooled;
+  delete heap;
+  delete null_pool;
+  EXPECT_EQ(3, destroyed);
+
+  // The pooled object's memory is reused.
+  Pooled* again = new (&pool_) Pooled(&destroyed);
+  EXPECT_EQ(pooled, again);
+  delete again;
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
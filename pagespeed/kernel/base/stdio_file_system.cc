@@ -150,6 +150,14 @@ class StdioInputFile : public FileSystem::InputFile {
     return ret;
   }
 
+  bool Seek(int64 offset, MessageHandler* message_handler) override {
+    if (fseeko(file_helper_.file_, offset, SEEK_SET) != 0) {
+      file_helper_.ReportError(message_handler, "seeking file");
+      return false;
+    }
+    return true;
+  }
+
   bool Close(MessageHandler* message_handler) override {
     return file_helper_.Close(message_handler);
   }
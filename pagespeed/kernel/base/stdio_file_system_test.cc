@@ -123,6 +123,10 @@ TEST_F(StdioFileSystemTest, TestAppend) {
   TestAppend();
 }
 
+TEST_F(StdioFileSystemTest, TestSeek) {
+  TestSeek();
+}
+
 // Write a temp file, rename it, then read it.
 TEST_F(StdioFileSystemTest, TestRename) {
   TestRename();
@@ -0,0 +1,136 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
+
+#include <algorithm>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+namespace {
+
+const char kAdmissionsRejected[] = "_admissions_rejected";
+
+// Must be a power of two; stripes are picked from the top bits of the hash,
+// leaving the low bits to the sketch.
+const int kNumStripes = 16;
+const int kStripeShift = 60;
+
+}  // namespace
+
+namespace net_instaweb {
+
+class AdmissionFilterCache::Stripe {
+ public:
+  Stripe(int64 expected_entries, ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        sketch_(expected_entries) {
+  }
+
+  void Increment(uint64 hash) {
+    ScopedMutex lock(mutex_.get());
+    sketch_.Increment(hash);
+  }
+
+  int Estimate(uint64 hash) {
+    ScopedMutex lock(mutex_.get());
+    return sketch_.Estimate(hash);
+  }
+
+ private:
+  scoped_ptr<AbstractMutex> mutex_;
+  FrequencySketch sketch_;
+
+  DISALLOW_COPY_AND_ASSIGN(Stripe);
+};
+
+AdmissionFilterCache::AdmissionFilterCache(StringPiece prefix,
+                                           CacheInterface* cache,
+                                           int64 expected_entries,
+                                           ThreadSystem* thread_system,
+                                           Statistics* statistics)
+    : cache_(cache),
+      min_frequency_(kDefaultMinFrequency),
+      delete_on_reject_(true),
+      admissions_rejected_(statistics->GetVariable(
+          StrCat(prefix, kAdmissionsRejected))) {
+  int64 entries_per_stripe = std::max(
+      expected_entries / kNumStripes, static_cast<int64>(1));
+  for (int i = 0; i < kNumStripes; ++i) {
+    stripes_.push_back(new Stripe(entries_per_stripe, thread_system));
+  }
+}
+
+AdmissionFilterCache::~AdmissionFilterCache() {
+  STLDeleteElements(&stripes_);
+}
+
+void AdmissionFilterCache::InitStats(StringPiece prefix,
+                                     Statistics* statistics) {
+  statistics->AddVariable(StrCat(prefix, kAdmissionsRejected));
+}
+
+GoogleString AdmissionFilterCache::FormatName(StringPiece cache) {
+  return StrCat("AdmissionFilter(", cache, ")");
+}
+
+void AdmissionFilterCache::RecordAccess(const GoogleString& key) {
+  uint64 hash = FrequencySketch::Hash(key);
+  stripes_[hash >> kStripeShift]->Increment(hash);
+}
+
+bool AdmissionFilterCache::ShouldAdmit(const GoogleString& key) {
+  uint64 hash = FrequencySketch::Hash(key);
+  return stripes_[hash >> kStripeShift]->Estimate(hash) >= min_frequency_;
+}
+
+void AdmissionFilterCache::Get(const GoogleString& key, Callback* callback) {
+  RecordAccess(key);
+  cache_->Get(key, callback);
+}
+
+void AdmissionFilterCache::MultiGet(MultiGetRequest* request) {
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    RecordAccess((*request)[i].key);
+  }
+  cache_->MultiGet(request);
+}
+
+void AdmissionFilterCache::Put(const GoogleString& key,
+                               const SharedString& value) {
+  if (ShouldAdmit(key)) {
+    cache_->Put(key, value);
+  } else {
+    admissions_rejected_->Add(1);
+    if (delete_on_reject_) {
+      cache_->Delete(key);
+    }
+  }
+}
+
+void AdmissionFilterCache::Delete(const GoogleString& key) {
+  cache_->Delete(key);
+}
+
+}  // namespace net_instaweb
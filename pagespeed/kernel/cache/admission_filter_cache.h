@@ -0,0 +1,112 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_ADMISSION_FILTER_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_ADMISSION_FILTER_CACHE_H_
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class Statistics;
+class ThreadSystem;
+class Variable;
+
+// Wrapper around a CacheInterface, typically a small L1 such as an LRUCache
+// or SharedMemCache, that only admits Puts for keys that have been looked up
+// recently and repeatedly.  Without it, a crawler sweeping through thousands
+// of URLs that are requested exactly once evicts the hot working set from
+// the L1, even though none of the new entries will ever be hit.
+//
+// Every Get and MultiGet key is recorded in a FrequencySketch.  A Put is
+// passed through only if the key's estimated frequency is at least
+// min_frequency(); otherwise it is counted in the <prefix>_admissions_rejected
+// statistic and, if delete_on_reject(), the key is deleted from the
+// underlying cache, so that a rejected update can't leave a stale value
+// behind.  With the default min_frequency of 2, an entry is admitted the
+// second time it is missed.
+//
+// The sketch is split into lock stripes by key hash, so this wrapper does
+// not reintroduce a single point of contention in front of a sharded cache.
+// Note that the sketch is process-local: when wrapping a SharedMemCache,
+// each process makes its own admission decisions.  Such a wrapper must be
+// built with set_delete_on_reject(false), or one process would evict
+// entries that another process admitted and is still hitting.
+class AdmissionFilterCache : public CacheInterface {
+ public:
+  static const int kDefaultMinFrequency = 2;
+
+  // expected_entries sizes the frequency sketch, and should approximate the
+  // number of entries the underlying cache holds when full.  Does not take
+  // ownership of cache, thread_system, or statistics.
+  AdmissionFilterCache(StringPiece prefix,
+                       CacheInterface* cache,
+                       int64 expected_entries,
+                       ThreadSystem* thread_system,
+                       Statistics* statistics);
+  virtual ~AdmissionFilterCache();
+
+  // This must be called once for every unique cache prefix.
+  static void InitStats(StringPiece prefix, Statistics* statistics);
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void MultiGet(MultiGetRequest* request);
+  virtual void Put(const GoogleString& key, const SharedString& value);
+  virtual void Delete(const GoogleString& key);
+  virtual CacheInterface* Backend() { return cache_; }
+  virtual bool IsBlocking() const { return cache_->IsBlocking(); }
+  virtual bool IsHealthy() const { return cache_->IsHealthy(); }
+  virtual void ShutDown() { cache_->ShutDown(); }
+
+  static GoogleString FormatName(StringPiece cache);
+  virtual GoogleString Name() const { return FormatName(cache_->Name()); }
+
+  int min_frequency() const { return min_frequency_; }
+  void set_min_frequency(int x) { min_frequency_ = x; }
+
+  // Whether a rejected Put deletes the key from the underlying cache (the
+  // default), or is simply dropped.
+  bool delete_on_reject() const { return delete_on_reject_; }
+  void set_delete_on_reject(bool x) { delete_on_reject_ = x; }
+
+ private:
+  class Stripe;
+  typedef std::vector<Stripe*> StripeVector;
+
+  void RecordAccess(const GoogleString& key);
+  bool ShouldAdmit(const GoogleString& key);
+
+  CacheInterface* cache_;
+  StripeVector stripes_;
+  int min_frequency_;
+  bool delete_on_reject_;
+  Variable* admissions_rejected_;
+
+  DISALLOW_COPY_AND_ASSIGN(AdmissionFilterCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_ADMISSION_FILTER_CACHE_H_
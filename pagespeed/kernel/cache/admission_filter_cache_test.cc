@@ -0,0 +1,186 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the admission-filtering cache wrapper.
+
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kPrefix[] = "test";
+const char kRejected[] = "test_admissions_rejected";
+
+// Room for about ten of the entries used below.
+const size_t kMaxSize = 100;
+const int64 kExpectedEntries = 1000;
+
+class AdmissionFilterCacheTest : public CacheTestBase {
+ protected:
+  AdmissionFilterCacheTest()
+      : lru_cache_(kMaxSize),
+        thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()) {
+    AdmissionFilterCache::InitStats(kPrefix, &stats_);
+    cache_.reset(new AdmissionFilterCache(kPrefix, &lru_cache_,
+                                          kExpectedEntries,
+                                          thread_system_.get(), &stats_));
+  }
+
+  virtual CacheInterface* Cache() { return cache_.get(); }
+  virtual void PostOpCleanup() { lru_cache_.SanityCheck(); }
+
+  // Looks up key, and on a miss Puts a value for it, the way a cache-aside
+  // client (or WriteThroughCache filling its L1) would.  Returns whether
+  // the lookup hit.
+  bool GetOrPut(CacheInterface* cache, const GoogleString& key) {
+    Callback* callback = InitiateGet(cache, key);
+    callback->Wait();
+    if (callback->state() == CacheInterface::kAvailable) {
+      return true;
+    }
+    CheckPut(cache, key, "value");
+    return false;
+  }
+
+  int Rejected() { return stats_.GetVariable(kRejected)->Get(); }
+
+  LRUCache lru_cache_;
+  scoped_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  scoped_ptr<AdmissionFilterCache> cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AdmissionFilterCacheTest);
+};
+
+TEST_F(AdmissionFilterCacheTest, AdmittedOnSecondMiss) {
+  CheckNotFound("Name");
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, Rejected());
+  CheckNotFound("Name");
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, Rejected());
+  CheckGet("Name", "Value");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(AdmissionFilterCacheTest, UnseenKeyRejected) {
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, Rejected());
+  CheckNotFound(&lru_cache_, "Name");
+}
+
+TEST_F(AdmissionFilterCacheTest, MinFrequency) {
+  cache_->set_min_frequency(0);
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(0, Rejected());
+}
+
+TEST_F(AdmissionFilterCacheTest, RejectedPutDropsStaleValue) {
+  // If an update to an entry is rejected, the old value must not be left
+  // behind for the next lookup to find.
+  CheckPut(&lru_cache_, "Name", "Old");
+  CheckPut("Name", "New");
+  EXPECT_EQ(1, Rejected());
+  CheckNotFound(&lru_cache_, "Name");
+}
+
+TEST_F(AdmissionFilterCacheTest, RejectedPutKeepsSharedValue) {
+  // When the underlying cache is shared with other processes, the value may
+  // be one that another process admitted, so it is left alone.
+  cache_->set_delete_on_reject(false);
+  CheckPut(&lru_cache_, "Name", "Other");
+  CheckPut("Name", "New");
+  EXPECT_EQ(1, Rejected());
+  CheckGet(&lru_cache_, "Name", "Other");
+}
+
+TEST_F(AdmissionFilterCacheTest, MultiGetRecordsAccesses) {
+  for (int i = 0; i < 2; ++i) {
+    Callback* n0 = AddCallback();
+    Callback* n1 = AddCallback();
+    Callback* n2 = AddCallback();
+    IssueMultiGet(n0, "n0", n1, "n1", n2, "n2");
+    WaitAndCheckNotFound(n0);
+    WaitAndCheckNotFound(n1);
+    WaitAndCheckNotFound(n2);
+  }
+  PopulateCache(3);
+  EXPECT_EQ(0, Rejected());
+  TestMultiGet();
+}
+
+TEST_F(AdmissionFilterCacheTest, ScanResistance) {
+  // A small hot set, accessed a few times so it becomes resident.
+  StringVector hot;
+  for (int i = 0; i < 5; ++i) {
+    hot.push_back(StrCat("hot", IntegerToString(i)));
+  }
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int i = 0, n = hot.size(); i < n; ++i) {
+      GetOrPut(cache_.get(), hot[i]);
+    }
+  }
+
+  // A crawler sweeps through many keys exactly once.
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_FALSE(GetOrPut(cache_.get(), StrCat("scan", IntegerToString(i))));
+  }
+  EXPECT_EQ(105, Rejected());  // 5 first hot misses, then the whole scan.
+
+  // The hot set survived.
+  for (int i = 0, n = hot.size(); i < n; ++i) {
+    EXPECT_TRUE(GetOrPut(cache_.get(), hot[i])) << hot[i];
+  }
+
+  // Whereas without admission control, the scan flushes it out.
+  lru_cache_.Clear();
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int i = 0, n = hot.size(); i < n; ++i) {
+      GetOrPut(&lru_cache_, hot[i]);
+    }
+  }
+  for (int i = 0; i < 100; ++i) {
+    GetOrPut(&lru_cache_, StrCat("scan", IntegerToString(i)));
+  }
+  for (int i = 0, n = hot.size(); i < n; ++i) {
+    EXPECT_FALSE(GetOrPut(&lru_cache_, hot[i])) << hot[i];
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -51,13 +51,21 @@ const char kCompressedCacheCompressedSize[] =
     "compressed_cache_compressed_size";
 const char kCompressedCacheCorruptPayloads[] =
     "compressed_cache_corrupt_payloads";
+const char kCompressedCacheDictionaryMismatches[] =
+    "compressed_cache_dictionary_mismatches";
 
 class CompressedCallback : public CacheInterface::Callback {
  public:
+  // dictionary must outlive the callback.
   CompressedCallback(CacheInterface::Callback* callback,
-                     Variable* corrupt_payloads)
+                     StringPiece dictionary, uint32 dictionary_id,
+                     Variable* corrupt_payloads,
+                     Variable* dictionary_mismatches)
       : callback_(callback),
+        dictionary_(dictionary),
+        dictionary_id_(dictionary_id),
         corrupt_payloads_(corrupt_payloads),
+        dictionary_mismatches_(dictionary_mismatches),
         validate_candidate_called_(false) {
   }
 
@@ -71,18 +79,29 @@ class CompressedCallback : public CacheInterface::Callback {
       GoogleString uncompressed;
       StringWriter writer(&uncompressed);
       StringPiece compressed = value().Value();
-      if (strings::EndsWith(compressed,
-                            StringPiece(kTrailer, STATIC_STRLEN(kTrailer))) &&
-          GzipInflater::Inflate(
-              compressed.substr(0, compressed.size() - STATIC_STRLEN(kTrailer)),
-              GzipInflater::kDeflate, &writer)) {
-        SharedString uncompressed_shared;
-        uncompressed_shared.SwapWithString(&uncompressed);
-        callback_->set_value(uncompressed_shared);
-        ret = true;
-      } else {
+      uint32 id;
+      if (!strings::EndsWith(compressed,
+                             StringPiece(kTrailer, STATIC_STRLEN(kTrailer)))) {
         state = CacheInterface::kNotFound;
         corrupt_payloads_->Add(1);
+      } else {
+        compressed.remove_suffix(STATIC_STRLEN(kTrailer));
+        if (GzipInflater::GetDictionaryId(compressed, &id) &&
+            (dictionary_.empty() || id != dictionary_id_)) {
+          // Written with another dictionary, e.g. by a server that has
+          // not been reconfigured yet.  Not corrupt, but we can't read it.
+          state = CacheInterface::kNotFound;
+          dictionary_mismatches_->Add(1);
+        } else if (GzipInflater::InflateWithDictionary(compressed, dictionary_,
+                                                       &writer)) {
+          SharedString uncompressed_shared;
+          uncompressed_shared.SwapWithString(&uncompressed);
+          callback_->set_value(uncompressed_shared);
+          ret = true;
+        } else {
+          state = CacheInterface::kNotFound;
+          corrupt_payloads_->Add(1);
+        }
       }
     }
     ret &= callback_->DelegatedValidateCandidate(key, state);
@@ -96,25 +115,36 @@ class CompressedCallback : public CacheInterface::Callback {
   }
 
   Callback* callback_;
+  StringPiece dictionary_;
+  uint32 dictionary_id_;
   Variable* corrupt_payloads_;
+  Variable* dictionary_mismatches_;
   bool validate_candidate_called_;
 };
 
 }  // namespace
 
 CompressedCache::CompressedCache(CacheInterface* cache, Statistics* stats)
-    : cache_(cache) {
+    : cache_(cache),
+      dictionary_id_(0) {
 #if INCLUDE_HISTOGRAMS
   compressed_cache_savings_ = stats->GetHistogram(kCompressedCacheSavings);
 #endif
   corrupt_payloads_ = stats->GetVariable(kCompressedCacheCorruptPayloads);
   original_size_ = stats->GetVariable(kCompressedCacheOriginalSize);
   compressed_size_ = stats->GetVariable(kCompressedCacheCompressedSize);
+  dictionary_mismatches_ =
+      stats->GetVariable(kCompressedCacheDictionaryMismatches);
 }
 
 CompressedCache::~CompressedCache() {
 }
 
+void CompressedCache::set_dictionary(const SharedString& dictionary) {
+  dictionary_ = dictionary;
+  dictionary_id_ = GzipInflater::DictionaryId(dictionary_.Value());
+}
+
 GoogleString CompressedCache::FormatName(StringPiece name) {
   return StrCat("Compressed(", name, ")");
 }
@@ -126,10 +156,26 @@ void CompressedCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kCompressedCacheCorruptPayloads);
   statistics->AddVariable(kCompressedCacheOriginalSize);
   statistics->AddVariable(kCompressedCacheCompressedSize);
+  statistics->AddVariable(kCompressedCacheDictionaryMismatches);
+}
+
+bool CompressedCache::UncompressPayload(StringPiece payload,
+                                        StringPiece dictionary,
+                                        GoogleString* value) {
+  if (!strings::EndsWith(payload,
+                         StringPiece(kTrailer, STATIC_STRLEN(kTrailer)))) {
+    return false;
+  }
+  payload.remove_suffix(STATIC_STRLEN(kTrailer));
+  value->clear();
+  StringWriter writer(value);
+  return GzipInflater::InflateWithDictionary(payload, dictionary, &writer);
 }
 
 void CompressedCache::Get(const GoogleString& key, Callback* callback) {
-  CompressedCallback* cb = new CompressedCallback(callback, corrupt_payloads_);
+  CompressedCallback* cb = new CompressedCallback(
+      callback, dictionary_.Value(), dictionary_id_, corrupt_payloads_,
+      dictionary_mismatches_);
   cache_->Get(key, cb);
 }
 
@@ -139,7 +185,11 @@ void CompressedCache::Put(const GoogleString& key, const SharedString& value) {
   buf.reserve(old_size + STATIC_STRLEN(kTrailer));
   StringWriter writer(&buf);
   original_size_->Add(old_size);
-  if (GzipInflater::Deflate(value.Value(), GzipInflater::kDeflate, &writer)) {
+  bool deflated = dictionary_.empty()
+      ? GzipInflater::Deflate(value.Value(), GzipInflater::kDeflate, &writer)
+      : GzipInflater::DeflateWithDictionary(value.Value(),
+                                            dictionary_.Value(), &writer);
+  if (deflated) {
     buf.append(kTrailer, STATIC_STRLEN(kTrailer));
 #if INCLUDE_HISTOGRAMS
     compressed_cache_savings_->Add(
@@ -174,4 +224,8 @@ int64 CompressedCache::CompressedSize() const {
   return compressed_size_->Get();
 }
 
+int64 CompressedCache::DictionaryMismatches() const {
+  return dictionary_mismatches_->Get();
+}
+
 }  // namespace net_instaweb
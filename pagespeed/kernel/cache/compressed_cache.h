@@ -34,14 +34,37 @@ class Statistics;
 class Variable;
 
 // Compressed cache adapter.
+//
+// By default each value is deflated on its own.  Small entries such as
+// rewrite metadata and property pages compress poorly that way, but share a
+// lot of structure with each other, so a dictionary trained on a sample of
+// them (see compression_dictionary_builder.h) can be supplied with
+// set_dictionary.  Values are then deflated against that dictionary, and
+// the zlib stream header records which dictionary was used.  Values written
+// without a dictionary remain readable; values written with a different
+// dictionary are reported as misses.
 class CompressedCache : public CacheInterface {
  public:
   // Does not takes ownership of cache or stats.
   CompressedCache(CacheInterface* cache, Statistics* stats);
   virtual ~CompressedCache();
 
+  // Compresses new values against dictionary.  Must be called before the
+  // cache is used.  zlib only looks at the last 32k of the dictionary.  The
+  // dictionary is shared, not copied, so every CompressedCache configured
+  // with the same one holds a single copy of it.
+  void set_dictionary(const SharedString& dictionary);
+  const SharedString& dictionary() const { return dictionary_; }
+
   static void InitStats(Statistics* stats);
 
+  // Recovers the original value from a payload a CompressedCache wrote to its
+  // backend, given the dictionary it used (if any).  Returns false if payload
+  // is not in that format.  Used to gather dictionary training samples from a
+  // dump of a compressed cache.
+  static bool UncompressPayload(StringPiece payload, StringPiece dictionary,
+                                GoogleString* value);
+
   virtual void Get(const GoogleString& key, Callback* callback);
   virtual void Put(const GoogleString& key, const SharedString& value);
   virtual void Delete(const GoogleString& key);
@@ -64,12 +87,19 @@ class CompressedCache : public CacheInterface {
   // started.
   int64 CompressedSize() const;
 
+  // Total number of times we did a fetch from the underlying cache and
+  // the payload had been compressed against a dictionary other than ours.
+  int64 DictionaryMismatches() const;
+
  private:
   CacheInterface* cache_;
+  SharedString dictionary_;
+  uint32 dictionary_id_;
   Histogram* compressed_cache_savings_;
   Variable* corrupt_payloads_;
   Variable* original_size_;
   Variable* compressed_size_;
+  Variable* dictionary_mismatches_;
 
   DISALLOW_COPY_AND_ASSIGN(CompressedCache);
 };
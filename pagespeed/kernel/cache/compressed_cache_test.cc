@@ -183,4 +183,58 @@ TEST_F(CompressedCacheTest, RemoveOneByteFromMiddle) {
   EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
 }
 
+TEST_F(CompressedCacheTest, Dictionary) {
+  const char kDictionary[] =
+      "<link rel=\"stylesheet\" href=\"http://example.com/styles/";
+  const char kValue[] =
+      "<link rel=\"stylesheet\" href=\"http://example.com/styles/a.css\">";
+  CheckPut("plain", kValue);
+  compressed_cache_->set_dictionary(SharedString(kDictionary));
+  CheckPut("dict", kValue);
+  CheckGet("dict", kValue);
+  EXPECT_GT(GetRawValue("plain").size(), GetRawValue("dict").size());
+
+  // Values written before the dictionary was configured are still readable.
+  CheckGet("plain", kValue);
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+  EXPECT_EQ(0, compressed_cache_->DictionaryMismatches());
+
+  GoogleString value;
+  EXPECT_TRUE(CompressedCache::UncompressPayload(GetRawValue("dict"),
+                                                 kDictionary, &value));
+  EXPECT_STREQ(kValue, value);
+  EXPECT_FALSE(CompressedCache::UncompressPayload("garbage", kDictionary,
+                                                  &value));
+}
+
+TEST_F(CompressedCacheTest, DictionaryMismatch) {
+  compressed_cache_->set_dictionary(SharedString("first dictionary"));
+  CheckPut("key", "first value");
+
+  // Another cache with a different dictionary sees a miss, as does one with
+  // no dictionary, but neither considers the payload corrupt.
+  CompressedCache other(lru_cache_.get(), &stats_);
+  other.set_dictionary(SharedString("second dictionary"));
+  CheckNotFound(&other, "key");
+  CompressedCache plain(lru_cache_.get(), &stats_);
+  CheckNotFound(&plain, "key");
+  EXPECT_EQ(2, compressed_cache_->DictionaryMismatches());
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+
+  CheckGet("key", "first value");
+}
+
+TEST_F(CompressedCacheTest, DictionaryIsShared) {
+  SharedString dictionary("shared dictionary");
+  compressed_cache_->set_dictionary(dictionary);
+  CompressedCache other(lru_cache_.get(), &stats_);
+  other.set_dictionary(dictionary);
+  EXPECT_EQ(dictionary.data(), compressed_cache_->dictionary().data());
+  EXPECT_EQ(dictionary.data(), other.dictionary().data());
+
+  CheckPut("key", "value");
+  CheckGet(&other, "key", "value");
+  EXPECT_EQ(0, compressed_cache_->DictionaryMismatches());
+}
+
 }  // namespace net_instaweb
@@ -0,0 +1,189 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/compression_dictionary_builder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Substrings are compared 8 bytes at a time, which is about the shortest
+// match deflate gains much from, and conveniently fits a uint64.
+const int kGramSize = 8;
+
+// Dictionary content is picked in units of this many bytes.  Candidate
+// segments start every kSegmentSize / 2 bytes, so they overlap.
+const int kSegmentSize = 64;
+
+const int64 kDefaultMaxSampleBytes = 16 << 20;
+
+typedef std::unordered_map<uint64, int> GramCounts;
+
+inline uint64 GramAt(const char* p) {
+  uint64 gram;
+  memcpy(&gram, p, sizeof(gram));
+  return gram;
+}
+
+struct Candidate {
+  Candidate(int64 score_in, int sample_in, int offset_in, int size_in)
+      : score(score_in), sample(sample_in), offset(offset_in),
+        size(size_in) {}
+
+  bool operator<(const Candidate& other) const {
+    return score < other.score;
+  }
+
+  int64 score;
+  int sample;
+  int offset;
+  int size;
+};
+
+// Sums the counts of the distinct grams in segment.  Grams seen in only one
+// sample, or already covered by the dictionary, have a count of 1 or 0 and
+// contribute nothing.
+int64 ScoreSegment(StringPiece segment, const GramCounts& counts) {
+  std::vector<uint64> grams;
+  int last = static_cast<int>(segment.size()) - kGramSize;
+  for (int i = 0; i <= last; ++i) {
+    grams.push_back(GramAt(segment.data() + i));
+  }
+  std::sort(grams.begin(), grams.end());
+  grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  int64 score = 0;
+  for (int i = 0, n = grams.size(); i < n; ++i) {
+    GramCounts::const_iterator p = counts.find(grams[i]);
+    if (p != counts.end() && p->second > 1) {
+      score += p->second;
+    }
+  }
+  return score;
+}
+
+}  // namespace
+
+const size_t CompressionDictionaryBuilder::kMaxDictionarySize;
+
+CompressionDictionaryBuilder::CompressionDictionaryBuilder()
+    : sample_bytes_(0),
+      max_sample_bytes_(kDefaultMaxSampleBytes) {
+}
+
+CompressionDictionaryBuilder::~CompressionDictionaryBuilder() {
+}
+
+bool CompressionDictionaryBuilder::AddSample(StringPiece sample) {
+  if (sample_bytes_ + static_cast<int64>(sample.size()) > max_sample_bytes_) {
+    return false;
+  }
+  if (sample.size() >= static_cast<size_t>(kGramSize)) {
+    samples_.push_back(sample.as_string());
+    sample_bytes_ += sample.size();
+  }
+  return true;
+}
+
+void CompressionDictionaryBuilder::Build(size_t max_size,
+                                         GoogleString* dictionary) const {
+  dictionary->clear();
+  max_size = std::min(max_size, kMaxDictionarySize);
+
+  // Count how many samples each gram occurs in.
+  GramCounts counts;
+  for (int s = 0, num_samples = samples_.size(); s < num_samples; ++s) {
+    const GoogleString& sample = samples_[s];
+    std::vector<uint64> grams;
+    int last = static_cast<int>(sample.size()) - kGramSize;
+    for (int i = 0; i <= last; ++i) {
+      grams.push_back(GramAt(sample.data() + i));
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    for (int i = 0, n = grams.size(); i < n; ++i) {
+      ++counts[grams[i]];
+    }
+  }
+
+  std::priority_queue<Candidate> candidates;
+  for (int s = 0, num_samples = samples_.size(); s < num_samples; ++s) {
+    const GoogleString& sample = samples_[s];
+    int last = static_cast<int>(sample.size()) - kGramSize;
+    for (int offset = 0; offset <= last; offset += kSegmentSize / 2) {
+      int size = std::min(kSegmentSize,
+                          static_cast<int>(sample.size()) - offset);
+      int64 score =
+          ScoreSegment(StringPiece(sample.data() + offset, size), counts);
+      if (score > 0) {
+        candidates.push(Candidate(score, s, offset, size));
+      }
+    }
+  }
+
+  // Greedily pick the best segment.  Picking a segment can only lower the
+  // scores of the others, so a candidate whose re-computed score still beats
+  // every queued (possibly stale, hence optimistic) score is the best one.
+  std::vector<StringPiece> picked;
+  size_t total_size = 0;
+  while (!candidates.empty() && (total_size < max_size)) {
+    Candidate best = candidates.top();
+    candidates.pop();
+    StringPiece segment(samples_[best.sample].data() + best.offset, best.size);
+    int64 score = ScoreSegment(segment, counts);
+    if (score == 0) {
+      continue;
+    }
+    if (!candidates.empty() && score < candidates.top().score) {
+      best.score = score;
+      candidates.push(best);
+      continue;
+    }
+    if (total_size + segment.size() > max_size) {
+      segment = segment.substr(0, max_size - total_size);
+    }
+    picked.push_back(segment);
+    total_size += segment.size();
+    int last = static_cast<int>(segment.size()) - kGramSize;
+    for (int i = 0; i <= last; ++i) {
+      GramCounts::iterator p = counts.find(GramAt(segment.data() + i));
+      if (p != counts.end()) {
+        p->second = 0;
+      }
+    }
+  }
+
+  // Best segments last, closest to the data being compressed.
+  dictionary->reserve(total_size);
+  for (int i = picked.size() - 1; i >= 0; --i) {
+    picked[i].AppendToString(dictionary);
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,76 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_COMPRESSION_DICTIONARY_BUILDER_H_
+#define PAGESPEED_KERNEL_CACHE_COMPRESSION_DICTIONARY_BUILDER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Builds a preset dictionary for CompressedCache from sample cache values.
+//
+// Every 8-byte substring of the samples is scored by how many samples it
+// occurs in.  The samples are cut into fixed-size segments, and segments are
+// picked greedily by the total score of the substrings they contain that no
+// segment picked earlier already covers.  Substrings that occur in a single
+// sample are worthless, since deflate finds those in the value itself.
+//
+// zlib encodes nearby matches more cheaply and only looks at the last 32k of
+// a dictionary, so the best segments are placed at the end.
+class CompressionDictionaryBuilder {
+ public:
+  // The most that zlib can make use of.
+  static const size_t kMaxDictionarySize = 32768;
+
+  CompressionDictionaryBuilder();
+  ~CompressionDictionaryBuilder();
+
+  // Adds a sample.  Once max_sample_bytes() worth of samples have been
+  // added, further samples are ignored and false is returned.
+  bool AddSample(StringPiece sample);
+
+  // Fills dictionary with at most max_size bytes (capped at
+  // kMaxDictionarySize).  The dictionary is empty if no substring occurs in
+  // more than one sample.
+  void Build(size_t max_size, GoogleString* dictionary) const;
+
+  int num_samples() const { return samples_.size(); }
+  int64 sample_bytes() const { return sample_bytes_; }
+
+  int64 max_sample_bytes() const { return max_sample_bytes_; }
+  void set_max_sample_bytes(int64 x) { max_sample_bytes_ = x; }
+
+ private:
+  StringVector samples_;
+  int64 sample_bytes_;
+  int64 max_sample_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressionDictionaryBuilder);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_COMPRESSION_DICTIONARY_BUILDER_H_
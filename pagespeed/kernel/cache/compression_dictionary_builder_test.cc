@@ -0,0 +1,108 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/compression_dictionary_builder.h"
+
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/simple_random.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kCommonPrefix[] =
+    "{\"input\":[{\"url\":\"http://www.example.com/static/";
+const char kCommonSuffix[] = "\",\"last_modified_time_ms\":1400000000000}]}";
+
+class CompressionDictionaryBuilderTest : public testing::Test {
+ protected:
+  CompressionDictionaryBuilderTest() : random_(new NullMutex) {}
+
+  // A value shaped like rewrite metadata: common boilerplate around a random
+  // part.
+  GoogleString MakeSample() {
+    return StrCat(kCommonPrefix, random_.GenerateHighEntropyString(20),
+                  kCommonSuffix);
+  }
+
+  int DeflatedSize(StringPiece value, StringPiece dictionary) {
+    GoogleString deflated;
+    StringWriter writer(&deflated);
+    EXPECT_TRUE(GzipInflater::DeflateWithDictionary(value, dictionary,
+                                                    &writer));
+    return deflated.size();
+  }
+
+  SimpleRandom random_;
+  CompressionDictionaryBuilder builder_;
+};
+
+TEST_F(CompressionDictionaryBuilderTest, LearnsCommonSubstrings) {
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_TRUE(builder_.AddSample(MakeSample()));
+  }
+  EXPECT_EQ(50, builder_.num_samples());
+  GoogleString dictionary;
+  builder_.Build(CompressionDictionaryBuilder::kMaxDictionarySize,
+                 &dictionary);
+  EXPECT_FALSE(dictionary.empty());
+  EXPECT_NE(GoogleString::npos, dictionary.find("http://www.example.com/"));
+  EXPECT_NE(GoogleString::npos, dictionary.find("last_modified_time_ms"));
+
+  GoogleString value = MakeSample();
+  EXPECT_GT(DeflatedSize(value, ""), DeflatedSize(value, dictionary));
+}
+
+TEST_F(CompressionDictionaryBuilderTest, RespectsMaxSize) {
+  for (int i = 0; i < 50; ++i) {
+    builder_.AddSample(MakeSample());
+  }
+  GoogleString dictionary;
+  builder_.Build(20, &dictionary);
+  EXPECT_EQ(20u, dictionary.size());
+}
+
+TEST_F(CompressionDictionaryBuilderTest, NothingShared) {
+  for (int i = 0; i < 10; ++i) {
+    builder_.AddSample(random_.GenerateHighEntropyString(100));
+  }
+  GoogleString dictionary("junk");
+  builder_.Build(CompressionDictionaryBuilder::kMaxDictionarySize,
+                 &dictionary);
+  EXPECT_TRUE(dictionary.empty());
+}
+
+TEST_F(CompressionDictionaryBuilderTest, MaxSampleBytes) {
+  builder_.set_max_sample_bytes(250);
+  EXPECT_TRUE(builder_.AddSample(GoogleString(100, 'a')));
+  EXPECT_TRUE(builder_.AddSample(GoogleString(100, 'b')));
+  EXPECT_FALSE(builder_.AddSample(GoogleString(100, 'c')));
+  EXPECT_EQ(2, builder_.num_samples());
+  EXPECT_EQ(200, builder_.sample_bytes());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,160 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include <algorithm>
+
+#include "pagespeed/kernel/base/string_hash.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Sketches smaller than this many words have too few counters for the
+// row hashes to be meaningfully independent.
+const int64 kMinTableWords = 64;
+
+// Matches TinyLFU's recommended window: age the counts after ten accesses
+// per expected entry.
+const int64 kSampleSizeMultiplier = 10;
+
+const uint64 kHalfCounterMask = 0x7777777777777777ULL;
+
+// Finalizer from MurmurHash3, so that HashString's poorly mixed high bits
+// can be used for the row indices.
+uint64 Mix64(uint64 h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Rounds x up to a power of two.
+uint64 CeilingPowerOfTwo(uint64 x) {
+  uint64 result = 1;
+  while (result < x) {
+    result <<= 1;
+  }
+  return result;
+}
+
+}  // namespace
+
+const int FrequencySketch::kMaxFrequency;
+
+FrequencySketch::FrequencySketch(int64 expected_entries)
+    : additions_(0),
+      num_resets_(0) {
+  expected_entries = std::max(expected_entries, static_cast<int64>(1));
+  uint64 words = CeilingPowerOfTwo(
+      std::max(expected_entries, kMinTableWords));
+  table_.resize(words, 0);
+  doorkeeper_.resize(words, 0);
+  counter_mask_ = words * 16 - 1;
+  doorkeeper_mask_ = words * 64 - 1;
+  sample_size_ = kSampleSizeMultiplier * expected_entries;
+}
+
+FrequencySketch::~FrequencySketch() {
+}
+
+uint64 FrequencySketch::Hash(StringPiece key) {
+  return Mix64(HashString<CasePreserve, uint64>(key.data(), key.size()));
+}
+
+// Derives the per-row indices from one hash by double hashing
+// (Kirsch & Mitzenmacher), rather than hashing the key kDepth times.
+int FrequencySketch::CounterIndex(uint64 hash, int row) const {
+  uint64 h1 = hash;
+  uint64 h2 = (hash >> 32) | 1;
+  return static_cast<int>((h1 + row * h2) & counter_mask_);
+}
+
+int FrequencySketch::Counter(int index) const {
+  return static_cast<int>((table_[index >> 4] >> ((index & 15) * 4)) & 0xf);
+}
+
+bool FrequencySketch::DoorkeeperContains(uint64 hash) const {
+  uint64 a = hash & doorkeeper_mask_;
+  uint64 b = (hash >> 24) & doorkeeper_mask_;
+  return (((doorkeeper_[a >> 6] >> (a & 63)) & 1) != 0) &&
+      (((doorkeeper_[b >> 6] >> (b & 63)) & 1) != 0);
+}
+
+bool FrequencySketch::DoorkeeperAdd(uint64 hash) {
+  bool present = DoorkeeperContains(hash);
+  uint64 a = hash & doorkeeper_mask_;
+  uint64 b = (hash >> 24) & doorkeeper_mask_;
+  doorkeeper_[a >> 6] |= static_cast<uint64>(1) << (a & 63);
+  doorkeeper_[b >> 6] |= static_cast<uint64>(1) << (b & 63);
+  return present;
+}
+
+void FrequencySketch::Increment(uint64 hash) {
+  if (DoorkeeperAdd(hash)) {
+    int index[kDepth];
+    int min_count = 15;
+    for (int row = 0; row < kDepth; ++row) {
+      index[row] = CounterIndex(hash, row);
+      min_count = std::min(min_count, Counter(index[row]));
+    }
+    // Conservative update: only the counters that determine the estimate
+    // are bumped, which reduces the overestimate from collisions.
+    if (min_count < 15) {
+      for (int row = 0; row < kDepth; ++row) {
+        if (Counter(index[row]) == min_count) {
+          table_[index[row] >> 4] +=
+              static_cast<uint64>(1) << ((index[row] & 15) * 4);
+        }
+      }
+    }
+  }
+  if (++additions_ >= sample_size_) {
+    Reset();
+  }
+}
+
+int FrequencySketch::Estimate(uint64 hash) const {
+  int min_count = 15;
+  for (int row = 0; row < kDepth; ++row) {
+    min_count = std::min(min_count, Counter(CounterIndex(hash, row)));
+  }
+  // The doorkeeper holds the access that was not counted in the table.
+  return DoorkeeperContains(hash) ? min_count + 1 : min_count;
+}
+
+void FrequencySketch::Clear() {
+  std::fill(table_.begin(), table_.end(), 0);
+  std::fill(doorkeeper_.begin(), doorkeeper_.end(), 0);
+  additions_ = 0;
+}
+
+void FrequencySketch::Reset() {
+  for (int i = 0, n = table_.size(); i < n; ++i) {
+    table_[i] = (table_[i] >> 1) & kHalfCounterMask;
+  }
+  std::fill(doorkeeper_.begin(), doorkeeper_.end(), 0);
+  additions_ /= 2;
+  ++num_resets_;
+}
+
+}  // namespace net_instaweb
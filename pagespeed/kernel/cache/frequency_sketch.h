@@ -0,0 +1,97 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+#define PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Approximate, bounded-memory access-frequency counter for cache keys, in
+// the style of the TinyLFU admission policy (Einziger & Friedman).  It
+// combines:
+//   - a Count-Min sketch of 4-bit saturating counters, 4 per key, updated
+//     conservatively (only the smallest counters are bumped);
+//   - a "doorkeeper" Bloom filter that absorbs the first access to each key,
+//     so that one-hit wonders never reach the Count-Min counters;
+//   - periodic aging: after sample_size() accesses all counters are halved
+//     and the doorkeeper is cleared, so that the sketch tracks recent
+//     popularity rather than all-time popularity.
+//
+// Keys are given as 64-bit hashes (see Hash()), so callers that need the
+// hash for something else, e.g. picking a lock stripe, only compute it once.
+//
+// This class is not thread-safe.
+class FrequencySketch {
+ public:
+  // The largest value Estimate() returns.
+  static const int kMaxFrequency = 16;
+
+  // Sizes the sketch for roughly expected_entries distinct live keys.  The
+  // sketch uses about 16 bytes per expected entry.
+  explicit FrequencySketch(int64 expected_entries);
+  ~FrequencySketch();
+
+  static uint64 Hash(StringPiece key);
+
+  // Records one access to the key with the given hash.
+  void Increment(uint64 hash);
+
+  // Returns the approximate number of accesses recorded for the key since
+  // it was last aged out, in the range [0, kMaxFrequency].  Never
+  // underestimates, except through aging.
+  int Estimate(uint64 hash) const;
+
+  // Forgets all recorded accesses.
+  void Clear();
+
+  // The number of accesses after which all counts are halved.
+  int64 sample_size() const { return sample_size_; }
+  // The number of times counts have been halved.
+  int64 num_resets() const { return num_resets_; }
+
+ private:
+  static const int kDepth = 4;
+
+  int CounterIndex(uint64 hash, int row) const;
+  int Counter(int index) const;
+  bool DoorkeeperContains(uint64 hash) const;
+  // Returns true if the hash was already present.
+  bool DoorkeeperAdd(uint64 hash);
+  void Reset();
+
+  // Each word packs sixteen 4-bit counters.
+  std::vector<uint64> table_;
+  std::vector<uint64> doorkeeper_;
+  uint64 counter_mask_;
+  uint64 doorkeeper_mask_;
+  int64 sample_size_;
+  int64 additions_;
+  int64 num_resets_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrequencySketch);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
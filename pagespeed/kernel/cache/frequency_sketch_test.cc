@@ -0,0 +1,111 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the frequency sketch.
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kExpectedEntries = 1000;
+
+class FrequencySketchTest : public testing::Test {
+ protected:
+  FrequencySketchTest() : sketch_(kExpectedEntries) {}
+
+  void Access(StringPiece key, int times) {
+    for (int i = 0; i < times; ++i) {
+      sketch_.Increment(FrequencySketch::Hash(key));
+    }
+  }
+
+  int Estimate(StringPiece key) {
+    return sketch_.Estimate(FrequencySketch::Hash(key));
+  }
+
+  FrequencySketch sketch_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FrequencySketchTest);
+};
+
+TEST_F(FrequencySketchTest, CountsAccesses) {
+  EXPECT_EQ(0, Estimate("a"));
+  Access("a", 1);
+  EXPECT_EQ(1, Estimate("a"));
+  Access("a", 4);
+  EXPECT_EQ(5, Estimate("a"));
+  EXPECT_EQ(0, Estimate("b"));
+}
+
+TEST_F(FrequencySketchTest, Saturates) {
+  Access("a", 100);
+  EXPECT_EQ(FrequencySketch::kMaxFrequency, Estimate("a"));
+}
+
+TEST_F(FrequencySketchTest, Clear) {
+  Access("a", 3);
+  sketch_.Clear();
+  EXPECT_EQ(0, Estimate("a"));
+}
+
+TEST_F(FrequencySketchTest, NeverUnderestimates) {
+  // Fill the sketch to its expected population, but not past the aging
+  // threshold, and check that collisions only ever inflate the estimates.
+  for (int i = 0; i < kExpectedEntries; ++i) {
+    Access(StrCat("key", IntegerToString(i)), 1 + i % 5);
+  }
+  ASSERT_EQ(0, sketch_.num_resets());
+  int exact = 0;
+  for (int i = 0; i < kExpectedEntries; ++i) {
+    int estimate = Estimate(StrCat("key", IntegerToString(i)));
+    EXPECT_LE(1 + i % 5, estimate);
+    if (estimate == 1 + i % 5) {
+      ++exact;
+    }
+  }
+  // Conservative update keeps nearly all of the estimates exact.
+  EXPECT_LT(kExpectedEntries * 9 / 10, exact);
+}
+
+TEST_F(FrequencySketchTest, Aging) {
+  Access("hot", 8);
+  EXPECT_EQ(8, Estimate("hot"));
+
+  // Push enough one-off accesses through to trigger a reset, which halves
+  // the counts and forgets the doorkeeper bit.
+  int64 one_offs = sketch_.sample_size();
+  for (int64 i = 0; i < one_offs; ++i) {
+    Access(StrCat("cold", Integer64ToString(i)), 1);
+  }
+  EXPECT_EQ(1, sketch_.num_resets());
+  EXPECT_EQ(3, Estimate("hot"));  // 7 counted in the table, halved.
+  EXPECT_EQ(0, Estimate("cold0"));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
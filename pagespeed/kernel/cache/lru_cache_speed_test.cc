@@ -30,6 +30,12 @@
 // LRUFailedGets         16068878   16000000        100
 // LRUEvictions         143558421  143200000        100
 //
+// The contention benchmarks run a 15:1 mix of Gets and Puts from N threads
+// against a single cache shared by all of them, comparing the mutex-wrapped
+// LRUCache used historically with ShardedLRUCache.  The range argument is the
+// number of threads; each thread does a fixed amount of work so the total
+// grows with N, and ideally the time would stay flat.
+//
 // Disclaimer: comparing runs over time and across different machines
 // can be misleading.  When contemplating an algorithm change, always do
 // interleaved runs with the old & new algorithm.
@@ -43,9 +49,15 @@
 #include "pagespeed/kernel/base/benchmark.h"
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+#include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_random.h"
 
 namespace {
@@ -53,6 +65,9 @@ namespace {
 const int kNumKeys = 100000;
 const int kKeySize = 50;
 const int kPayloadSize = 100;
+const int kContentionOpsPerThread = 100000;
+const int kContentionPutFrequency = 16;  // One op in 16 is a Put.
+const int kNumShards = 64;
 
 class EmptyCallback : public net_instaweb::CacheInterface::Callback {
  public:
@@ -190,6 +205,96 @@ static void LRUEvictions(int iters) {
   CHECK_LT(0, static_cast<int>(payload.lru_cache()->num_evictions()));
 }
 
+// Hammers a shared cache with a mix of Gets and Puts over a common key set.
+// Each thread starts at a different point in the key set and strides through
+// it differently, so threads touch the same keys but not in lock-step.
+class ContentionThread : public net_instaweb::ThreadSystem::Thread {
+ public:
+  ContentionThread(net_instaweb::ThreadSystem* thread_system,
+                   net_instaweb::CacheInterface* cache,
+                   const net_instaweb::StringVector* keys,
+                   const std::vector<net_instaweb::SharedString>* values,
+                   int index)
+      : Thread(thread_system, "contention",
+               net_instaweb::ThreadSystem::kJoinable),
+        cache_(cache),
+        keys_(keys),
+        values_(values),
+        offset_(index * 7919),
+        stride_(2 * index + 1) {
+  }
+
+ protected:
+  virtual void Run() {
+    int num_keys = keys_->size();
+    for (int i = 0; i < kContentionOpsPerThread; ++i) {
+      int k = (offset_ + i * stride_) % num_keys;
+      if ((i % kContentionPutFrequency) == 0) {
+        cache_->Put((*keys_)[k], (*values_)[k]);
+      } else {
+        cache_->Get((*keys_)[k], &callback_);
+      }
+    }
+  }
+
+ private:
+  net_instaweb::CacheInterface* cache_;
+  const net_instaweb::StringVector* keys_;
+  const std::vector<net_instaweb::SharedString>* values_;
+  int offset_;
+  int stride_;
+  EmptyCallback callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentionThread);
+};
+
+static void RunContention(int iters, int num_threads,
+                          net_instaweb::CacheInterface* cache,
+                          net_instaweb::ThreadSystem* thread_system) {
+  StopBenchmarkTiming();
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  GoogleString value_prefix = random.GenerateHighEntropyString(kPayloadSize);
+  net_instaweb::StringVector keys(kNumKeys);
+  std::vector<net_instaweb::SharedString> values(kNumKeys);
+  for (int k = 0; k < kNumKeys; ++k) {
+    keys[k] = net_instaweb::StrCat("key", net_instaweb::IntegerToString(k));
+    values[k].Assign(net_instaweb::StrCat(value_prefix,
+                                          net_instaweb::IntegerToString(k)));
+    cache->Put(keys[k], values[k]);
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    std::vector<ContentionThread*> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.push_back(
+          new ContentionThread(thread_system, cache, &keys, &values, t));
+      CHECK(threads.back()->Start());
+    }
+    for (int t = 0; t < num_threads; ++t) {
+      threads[t]->Join();
+      delete threads[t];
+    }
+  }
+}
+
+static void LRUContendedThreadsafe(int iters, int num_threads) {
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::LRUCache lru_cache(2 * (kKeySize + kPayloadSize) * kNumKeys);
+  net_instaweb::ThreadsafeCache cache(&lru_cache, thread_system->NewMutex());
+  RunContention(iters, num_threads, &cache, thread_system.get());
+}
+
+static void LRUContendedSharded(int iters, int num_threads) {
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::ShardedLRUCache cache(
+      kNumShards, 2 * (kKeySize + kPayloadSize) * kNumKeys,
+      thread_system.get());
+  RunContention(iters, num_threads, &cache, thread_system.get());
+}
+
 }  // namespace
 
 BENCHMARK(LRUPuts);
@@ -198,3 +303,5 @@ BENCHMARK(LRUReplaceNewValue);
 BENCHMARK(LRUGets);
 BENCHMARK(LRUFailedGets);
 BENCHMARK(LRUEvictions);
+BENCHMARK_RANGE(LRUContendedThreadsafe, 1, 64);
+BENCHMARK_RANGE(LRUContendedSharded, 1, 64);
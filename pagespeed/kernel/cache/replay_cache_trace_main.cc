@@ -0,0 +1,187 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_message_handler.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_thread_system.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/stdio_file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/gflags.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+// Replays a recorded trace of cache keys against an LRUCache, with and
+// without an AdmissionFilterCache in front of it, and reports the hit rate
+// of each.  Each lookup that misses is followed by a Put, as WriteThroughCache
+// does when filling its L1 from the L2.
+//
+// The trace has one lookup per line: the key, optionally followed by
+// whitespace and the size of the value in bytes (--value_bytes is used
+// otherwise).  Blank lines and lines starting with '#' are ignored.  For
+// example, a trace of URL requests can be pulled out of an access log with
+//   awk '{print $7, $10}' access.log > trace
+
+namespace net_instaweb {
+
+DEFINE_int64(cache_kb, 1024, "Size of the LRU cache in kilobytes.");
+
+DEFINE_int32(value_bytes, 1024, "Size of the value stored for keys whose "
+             "trace line doesn't give one.");
+
+DEFINE_int32(min_frequency, AdmissionFilterCache::kDefaultMinFrequency,
+             "Number of recent lookups a key needs before it is admitted.");
+
+namespace {
+
+struct TraceEntry {
+  GoogleString key;
+  int size;
+};
+
+class Replayer {
+ public:
+  explicit Replayer(CacheInterface* cache) : cache_(cache), hits_(0) {}
+
+  void Lookup(const TraceEntry& entry) {
+    CacheInterface::SynchronousCallback callback;
+    cache_->Get(entry.key, &callback);
+    if (callback.state() == CacheInterface::kAvailable) {
+      ++hits_;
+    } else {
+      cache_->Put(entry.key, SharedString(GoogleString(entry.size, 'x')));
+    }
+  }
+
+  int64 hits() const { return hits_; }
+
+ private:
+  CacheInterface* cache_;
+  int64 hits_;
+
+  DISALLOW_COPY_AND_ASSIGN(Replayer);
+};
+
+bool ParseTrace(StringPiece contents, std::vector<TraceEntry>* trace,
+                MessageHandler* handler) {
+  StringPieceVector lines;
+  SplitStringPieceToVector(contents, "\n", &lines, true);
+  for (int i = 0, n = lines.size(); i < n; ++i) {
+    StringPiece line = lines[i];
+    TrimWhitespace(&line);
+    if (line.empty() || line.starts_with("#")) {
+      continue;
+    }
+    StringPieceVector fields;
+    SplitStringPieceToVector(line, " \t", &fields, true);
+    TraceEntry entry;
+    fields[0].CopyToString(&entry.key);
+    entry.size = FLAGS_value_bytes;
+    if (fields.size() > 1 &&
+        (!StringToInt(fields[1].as_string(), &entry.size) ||
+         entry.size < 0)) {
+      handler->Message(kError, "Bad value size on trace line %d: %s", i + 1,
+                       fields[1].as_string().c_str());
+      return false;
+    }
+    trace->push_back(entry);
+  }
+  return true;
+}
+
+bool ReplayCacheTraceMain(int argc, char** argv) {
+  FileMessageHandler handler(stderr);
+  StdioFileSystem file_system;
+  if (argc != 2) {
+    handler.Message(kError,
+                    "Usage: \n"
+                    "  replay_cache_trace [--cache_kb=N] [--value_bytes=N] "
+                    "[--min_frequency=N] trace_file\n");
+    return false;
+  }
+  GoogleString contents;
+  if (!file_system.ReadFile(argv[1], &contents, &handler)) {
+    return false;
+  }
+  std::vector<TraceEntry> trace;
+  if (!ParseTrace(contents, &trace, &handler)) {
+    return false;
+  }
+  if (trace.empty()) {
+    handler.Message(kError, "No lookups in %s", argv[1]);
+    return false;
+  }
+
+  // Size the sketch for the number of average-sized entries that fit.
+  int64 total_bytes = 0;
+  for (int i = 0, n = trace.size(); i < n; ++i) {
+    total_bytes += trace[i].key.size() + trace[i].size;
+  }
+  int64 average_bytes = std::max(total_bytes / static_cast<int64>(trace.size()),
+                                 static_cast<int64>(1));
+  int64 expected_entries = FLAGS_cache_kb * 1024 / average_bytes;
+
+  NullThreadSystem thread_system;
+  SimpleStats stats(&thread_system);
+  AdmissionFilterCache::InitStats("replay", &stats);
+  LRUCache plain_lru(FLAGS_cache_kb * 1024);
+  LRUCache filtered_lru(FLAGS_cache_kb * 1024);
+  AdmissionFilterCache filter("replay", &filtered_lru, expected_entries,
+                              &thread_system, &stats);
+  filter.set_min_frequency(FLAGS_min_frequency);
+
+  Replayer plain(&plain_lru);
+  Replayer filtered(&filter);
+  for (int i = 0, n = trace.size(); i < n; ++i) {
+    plain.Lookup(trace[i]);
+    filtered.Lookup(trace[i]);
+  }
+
+  double lookups = trace.size();
+  fprintf(stdout, "lookups:                %d\n",
+          static_cast<int>(trace.size()));
+  fprintf(stdout, "LRU hit rate:           %.2f%%\n",
+          100.0 * plain.hits() / lookups);
+  fprintf(stdout, "LRU+admission hit rate: %.2f%%\n",
+          100.0 * filtered.hits() / lookups);
+  fprintf(stdout, "admissions rejected:    %s\n",
+          Integer64ToString(
+              stats.GetVariable("replay_admissions_rejected")->Get()).c_str());
+  return true;
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
+
+int main(int argc, char** argv) {
+  net_instaweb::ParseGflags(argv[0], &argc, &argv);
+  return net_instaweb::ReplayCacheTraceMain(argc, argv) ? EXIT_SUCCESS
+                                                        : EXIT_FAILURE;
+}
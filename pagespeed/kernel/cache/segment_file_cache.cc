@@ -0,0 +1,781 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/cache/segment_file_cache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/slow_worker.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// On-disk record layout, in host byte order:
+//   uint32 magic
+//   uint32 key size
+//   uint32 value size
+//   uint32 flags
+//   int64  write timestamp, in microseconds
+//   key bytes
+//   value bytes
+// The timestamp orders records for the same key written by different
+// processes into different segments.
+const uint32 kRecordMagic = 0x50535346;  // "PSSF"
+const uint32 kFlagDeleted = 1;
+const size_t kHeaderSize = 4 * sizeof(uint32) + sizeof(int64);
+
+const char kSegmentPrefix[] = "seg-";
+const char kSegmentSuffix[] = ".seg";
+const char kCleanLockName[] = "!clean!lock!";
+
+// Once a cleanup starts, it gets the cache down to this fraction of the
+// target, as FileCache does.
+const int64 kCleanTargetNumerator = 3;
+const int64 kCleanTargetDenominator = 4;
+
+// Sealed segments whose live records take up less than this fraction of the
+// file are compacted rather than being left to age out.
+const double kCompactionLiveFraction = 0.5;
+
+// Sweep the index once this many entries refer to forgotten segments, and
+// they make up at least half the index.
+const int64 kMinDeadEntriesToSweep = 1024;
+
+uint32 ReadUint32(const char* p) {
+  uint32 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+void AppendUint32(uint32 value, GoogleString* buf) {
+  buf->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Returns the creation time encoded in a segment filename, or 0 if the name
+// isn't one of ours.
+int64 SegmentCreationMs(StringPiece filename) {
+  stringpiece_ssize_type slash = filename.rfind('/');
+  if (slash != StringPiece::npos) {
+    filename.remove_prefix(slash + 1);
+  }
+  if (!filename.starts_with(kSegmentPrefix) ||
+      !filename.ends_with(kSegmentSuffix)) {
+    return 0;
+  }
+  filename.remove_prefix(STATIC_STRLEN(kSegmentPrefix));
+  stringpiece_ssize_type dash = filename.find('-');
+  int64 created_us;
+  if (dash == StringPiece::npos ||
+      !StringToInt64(filename.substr(0, dash), &created_us)) {
+    return 0;
+  }
+  return created_us / Timer::kMsUs;
+}
+
+GoogleString WithTrailingSlash(const GoogleString& path) {
+  GoogleString result(path);
+  EnsureEndsInSlash(&result);
+  return result;
+}
+
+}  // namespace
+
+struct SegmentFileCache::Segment {
+  Segment(int32 id_in, const GoogleString& filename_in, int64 created_ms_in)
+      : id(id_in), filename(filename_in), created_ms(created_ms_in),
+        size_bytes(0), live_bytes(0), live_entries(0), corrupt(false) {}
+
+  const int32 id;
+  const GoogleString filename;
+  const int64 created_ms;
+  // Bytes of the file we have indexed (or, for our active segment, written).
+  int64 size_bytes;
+  // Bytes and count of records that are the newest copy of their key.
+  int64 live_bytes;
+  int64 live_entries;
+  // Set if we hit a malformed record; we don't index past it.
+  bool corrupt;
+};
+
+struct SegmentFileCache::Record {
+  StringPiece key;
+  StringPiece value;
+  int64 timestamp_us;
+  bool is_delete;
+  size_t size;
+};
+
+const char SegmentFileCache::kCleanups[] = "segment_file_cache_cleanups";
+const char SegmentFileCache::kCompactedSegments[] =
+    "segment_file_cache_compacted_segments";
+const char SegmentFileCache::kEvictedSegments[] =
+    "segment_file_cache_evicted_segments";
+const char SegmentFileCache::kBytesFreedInCleanup[] =
+    "segment_file_cache_bytes_freed_in_cleanup";
+const char SegmentFileCache::kCorruptRecords[] =
+    "segment_file_cache_corrupt_records";
+const char SegmentFileCache::kWriteErrors[] = "segment_file_cache_write_errors";
+
+const int64 SegmentFileCache::kIndexRefreshIntervalMs = Timer::kSecondMs;
+const int64 SegmentFileCache::kSegmentWriteWindowMs = 5 * Timer::kMinuteMs;
+const int64 SegmentFileCache::kLockTimeoutMs = 5 * Timer::kMinuteMs;
+
+SegmentFileCache::SegmentFileCache(const GoogleString& path,
+                                   FileSystem* file_system,
+                                   ThreadSystem* thread_system,
+                                   SlowWorker* worker, CachePolicy* policy,
+                                   Statistics* stats, MessageHandler* handler)
+    : path_(WithTrailingSlash(path)),
+      file_system_(file_system),
+      worker_(worker),
+      message_handler_(handler),
+      cache_policy_(policy),
+      instance_tag_(StringPrintf(
+          "%d.%x", static_cast<int>(getpid()),
+          HashString<CasePreserve, uint32>(PointerToString(this).data(),
+                                           PointerToString(this).size()))),
+      clean_lock_path_(StrCat(path_, kCleanLockName)),
+      mutex_(thread_system->NewMutex()),
+      total_bytes_(0),
+      dead_entries_(0),
+      next_segment_id_(0),
+      segments_started_(0),
+      next_refresh_ms_(0),
+      refreshing_(false),
+      active_file_(NULL),
+      active_segment_(NULL),
+      shut_down_(false),
+      cleanups_(stats->GetVariable(kCleanups)),
+      compacted_segments_(stats->GetVariable(kCompactedSegments)),
+      evicted_segments_(stats->GetVariable(kEvictedSegments)),
+      bytes_freed_in_cleanup_(stats->GetVariable(kBytesFreedInCleanup)),
+      corrupt_records_(stats->GetVariable(kCorruptRecords)),
+      write_errors_(stats->GetVariable(kWriteErrors)) {
+  file_system_->RecursivelyMakeDir(path, message_handler_);
+}
+
+SegmentFileCache::~SegmentFileCache() {
+  ScopedMutex lock(mutex_.get());
+  CloseActiveSegmentLocked();
+  for (SegmentIdMap::iterator p = segments_by_id_.begin(),
+           e = segments_by_id_.end(); p != e; ++p) {
+    delete p->second;
+  }
+}
+
+void SegmentFileCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kCleanups);
+  statistics->AddVariable(kCompactedSegments);
+  statistics->AddVariable(kEvictedSegments);
+  statistics->AddVariable(kBytesFreedInCleanup);
+  statistics->AddVariable(kCorruptRecords);
+  statistics->AddVariable(kWriteErrors);
+}
+
+uint64 SegmentFileCache::HashKey(const GoogleString& key) {
+  // Two differently-seeded 32-bit hashes; HashString alone mixes poorly in
+  // its high bits for short keys.
+  uint32 low = HashString<CasePreserve, uint32>(key.data(), key.size());
+  uint32 high = JoinHash(low, key.size());
+  return (static_cast<uint64>(high) << 32) | low;
+}
+
+void SegmentFileCache::EncodeRecord(const GoogleString& key,
+                                    const SharedString* value,
+                                    int64 timestamp_us, GoogleString* buf) {
+  size_t value_size = (value == NULL) ? 0 : value->size();
+  buf->clear();
+  buf->reserve(kHeaderSize + key.size() + value_size);
+  AppendUint32(kRecordMagic, buf);
+  AppendUint32(key.size(), buf);
+  AppendUint32(value_size, buf);
+  AppendUint32((value == NULL) ? kFlagDeleted : 0, buf);
+  buf->append(reinterpret_cast<const char*>(&timestamp_us),
+              sizeof(timestamp_us));
+  buf->append(key);
+  if (value != NULL) {
+    buf->append(value->data(), value_size);
+  }
+}
+
+bool SegmentFileCache::DecodeRecord(StringPiece data, Record* record) {
+  if (data.size() < kHeaderSize || ReadUint32(data.data()) != kRecordMagic) {
+    return false;
+  }
+  const char* p = data.data();
+  size_t key_size = ReadUint32(p + 4);
+  size_t value_size = ReadUint32(p + 8);
+  uint32 flags = ReadUint32(p + 12);
+  if (data.size() - kHeaderSize < key_size ||
+      data.size() - kHeaderSize - key_size < value_size) {
+    return false;
+  }
+  memcpy(&record->timestamp_us, p + 16, sizeof(record->timestamp_us));
+  record->key = data.substr(kHeaderSize, key_size);
+  record->value = data.substr(kHeaderSize + key_size, value_size);
+  record->is_delete = (flags & kFlagDeleted) != 0;
+  record->size = kHeaderSize + key_size + value_size;
+  return true;
+}
+
+bool SegmentFileCache::IsHealthy() const {
+  ScopedMutex lock(mutex_.get());
+  return !shut_down_;
+}
+
+void SegmentFileCache::ShutDown() {
+  ScopedMutex lock(mutex_.get());
+  shut_down_ = true;
+  CloseActiveSegmentLocked();
+}
+
+void SegmentFileCache::Get(const GoogleString& key, Callback* callback) {
+  uint64 hash = HashKey(key);
+  bool found = false;
+  Location location;
+  GoogleString filename;
+  bool refresh_due;
+  {
+    ScopedMutex lock(mutex_.get());
+    refresh_due = (!shut_down_ && !refreshing_ &&
+                   cache_policy_->timer->NowMs() >= next_refresh_ms_);
+  }
+  if (refresh_due) {
+    // Pick up whatever other processes have written or deleted.
+    Refresh();
+  }
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!shut_down_) {
+      Index::iterator iter = index_.find(hash);
+      if (iter != index_.end() && iter->second.size != 0) {
+        location = iter->second;
+        SegmentIdMap::iterator segment = segments_by_id_.find(
+            location.segment_id);
+        if (segment == segments_by_id_.end()) {
+          // The segment was evicted; drop the stale entry.
+          index_.erase(iter);
+          --dead_entries_;
+        } else {
+          filename = segment->second->filename;
+          found = true;
+        }
+      }
+    }
+  }
+
+  // The read is done without the lock.  If the segment is deleted underneath
+  // us by a cleaner in another process, we just report a miss.
+  GoogleString buf;
+  if (found && ReadRecord(filename, location, key, &buf)) {
+    SharedString value;
+    value.SwapWithString(&buf);
+    value.RemovePrefix(kHeaderSize + key.size());
+    callback->set_value(value);
+  } else {
+    found = false;
+  }
+  ValidateAndReportResult(key, found ? kAvailable : kNotFound, callback);
+}
+
+bool SegmentFileCache::ReadRecord(const GoogleString& filename,
+                                  const Location& location,
+                                  const GoogleString& key,
+                                  GoogleString* buf) {
+  NullMessageHandler null_handler;
+  FileSystem::InputFile* file =
+      file_system_->OpenInputFile(filename.c_str(), &null_handler);
+  if (file == NULL) {
+    return false;
+  }
+  bool ok = file->Seek(location.offset, &null_handler);
+  if (ok) {
+    buf->resize(location.size);
+    int pos = 0;
+    while (ok && pos < static_cast<int>(location.size)) {
+      int n = file->Read(&(*buf)[pos], location.size - pos, &null_handler);
+      ok = (n > 0);
+      pos += n;
+    }
+  }
+  file_system_->Close(file, &null_handler);
+
+  Record record;
+  if (ok && (!DecodeRecord(*buf, &record) || record.size != location.size ||
+             record.is_delete)) {
+    corrupt_records_->Add(1);
+    ok = false;
+  }
+  return ok && (record.key == key);
+}
+
+void SegmentFileCache::Put(const GoogleString& key,
+                           const SharedString& value) {
+  int64 timestamp_us = cache_policy_->timer->NowUs();
+  GoogleString record;
+  EncodeRecord(key, &value, timestamp_us, &record);
+  if (static_cast<int64>(record.size()) > cache_policy_->segment_size_bytes) {
+    return;
+  }
+  bool started_segment;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      return;
+    }
+    started_segment = AppendLocked(HashKey(key), record, timestamp_us, false);
+  }
+  if (started_segment) {
+    CleanIfNeeded();
+  }
+}
+
+void SegmentFileCache::Delete(const GoogleString& key) {
+  GoogleString record;
+  int64 timestamp_us = cache_policy_->timer->NowUs();
+  EncodeRecord(key, NULL, timestamp_us, &record);
+  ScopedMutex lock(mutex_.get());
+  if (shut_down_) {
+    return;
+  }
+  // The tombstone is only needed so other processes see the deletion.
+  AppendLocked(HashKey(key), record, timestamp_us, true);
+}
+
+bool SegmentFileCache::AppendLocked(uint64 hash, const GoogleString& record,
+                                    int64 timestamp_us, bool is_delete) {
+  bool started_segment = false;
+  const int64 now_ms = timestamp_us / Timer::kMsUs;
+  if (active_file_ == NULL ||
+      (active_segment_->size_bytes + static_cast<int64>(record.size()) >
+       cache_policy_->segment_size_bytes) ||
+      now_ms - active_segment_->created_ms >= kSegmentWriteWindowMs) {
+    CloseActiveSegmentLocked();
+    if (!StartSegmentLocked()) {
+      write_errors_->Add(1);
+      return false;
+    }
+    started_segment = true;
+  }
+
+  if (!active_file_->Write(record, message_handler_) ||
+      !active_file_->Flush(message_handler_)) {
+    // We no longer know where the end of the file is, so abandon it.
+    write_errors_->Add(1);
+    active_segment_->corrupt = true;
+    CloseActiveSegmentLocked();
+    return started_segment;
+  }
+
+  Location location;
+  location.segment_id = active_segment_->id;
+  location.offset = active_segment_->size_bytes;
+  location.size = is_delete ? 0 : record.size();
+  location.timestamp_us = timestamp_us;
+  active_segment_->size_bytes += record.size();
+  total_bytes_ += record.size();
+  IndexLocked(hash, location);
+  return started_segment;
+}
+
+bool SegmentFileCache::StartSegmentLocked() {
+  const int64 now_us = cache_policy_->timer->NowUs();
+  GoogleString filename = StrCat(
+      path_, kSegmentPrefix, Integer64ToString(now_us), "-",
+      StrCat(instance_tag_, ".", IntegerToString(segments_started_++)),
+      kSegmentSuffix);
+  active_file_ = file_system_->OpenOutputFile(filename.c_str(),
+                                              message_handler_);
+  if (active_file_ == NULL) {
+    return false;
+  }
+  active_segment_ = AddSegmentLocked(filename);
+  return true;
+}
+
+void SegmentFileCache::CloseActiveSegmentLocked() {
+  if (active_file_ != NULL) {
+    file_system_->Close(active_file_, message_handler_);
+    active_file_ = NULL;
+  }
+  active_segment_ = NULL;
+}
+
+SegmentFileCache::Segment* SegmentFileCache::AddSegmentLocked(
+    const GoogleString& filename) {
+  Segment* segment = new Segment(next_segment_id_++, filename,
+                                 SegmentCreationMs(filename));
+  segments_by_id_[segment->id] = segment;
+  segments_by_name_[filename] = segment;
+  return segment;
+}
+
+void SegmentFileCache::ForgetSegmentLocked(Segment* segment) {
+  DCHECK(segment != active_segment_);
+  segments_by_id_.erase(segment->id);
+  segments_by_name_.erase(segment->filename);
+  total_bytes_ -= segment->size_bytes;
+  dead_entries_ += segment->live_entries;
+  delete segment;
+  MaybeSweepIndexLocked();
+}
+
+void SegmentFileCache::MaybeSweepIndexLocked() {
+  if (dead_entries_ < kMinDeadEntriesToSweep ||
+      dead_entries_ * 2 < static_cast<int64>(index_.size())) {
+    return;
+  }
+  for (Index::iterator iter = index_.begin(); iter != index_.end(); ) {
+    if (segments_by_id_.find(iter->second.segment_id) ==
+        segments_by_id_.end()) {
+      iter = index_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  dead_entries_ = 0;
+}
+
+void SegmentFileCache::IndexLocked(uint64 hash, const Location& location) {
+  Index::iterator iter = index_.find(hash);
+  if (iter != index_.end()) {
+    if (iter->second.timestamp_us > location.timestamp_us) {
+      return;  // We already know about a newer write or delete.
+    }
+    UnindexLocked(iter);
+  }
+  index_[hash] = location;
+  Segment* segment = segments_by_id_[location.segment_id];
+  segment->live_bytes += location.size;
+  ++segment->live_entries;
+}
+
+void SegmentFileCache::UnindexLocked(Index::iterator iter) {
+  SegmentIdMap::iterator segment = segments_by_id_.find(
+      iter->second.segment_id);
+  if (segment == segments_by_id_.end()) {
+    --dead_entries_;
+  } else {
+    segment->second->live_bytes -= iter->second.size;
+    --segment->second->live_entries;
+  }
+  index_.erase(iter);
+}
+
+void SegmentFileCache::Refresh() {
+  int32 first_unlisted_id;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (refreshing_ || shut_down_) {
+      return;
+    }
+    refreshing_ = true;
+    next_refresh_ms_ = cache_policy_->timer->NowMs() + kIndexRefreshIntervalMs;
+    // Segments we start from here on won't be in the listing.
+    first_unlisted_id = next_segment_id_;
+  }
+
+  StringVector files;
+  std::vector<int64> file_sizes;
+  NullMessageHandler null_handler;
+  bool listed = file_system_->ListContents(path_, &files, &null_handler);
+  if (listed) {
+    std::sort(files.begin(), files.end());
+    files.erase(std::remove_if(files.begin(), files.end(),
+                               [](const GoogleString& filename) {
+                                 return SegmentCreationMs(filename) == 0;
+                               }),
+                files.end());
+    file_sizes.resize(files.size(), 0);
+    for (int i = 0, n = files.size(); i < n; ++i) {
+      // A file deleted since the listing just looks empty until next time.
+      file_system_->Size(files[i], &file_sizes[i], &null_handler);
+    }
+  }
+
+  // Data to read from each segment, as (filename, (start, end)).
+  typedef std::pair<GoogleString, std::pair<int64, int64> > PendingScan;
+  std::vector<PendingScan> scans;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (listed) {
+      // Forget segments that other processes have deleted.  If one of them
+      // is our active segment, a cleaner evicted it under size pressure, so
+      // stop appending to it.
+      std::vector<Segment*> missing;
+      for (SegmentNameMap::iterator p = segments_by_name_.begin(),
+               e = segments_by_name_.end(); p != e; ++p) {
+        if (p->second->id < first_unlisted_id &&
+            !std::binary_search(files.begin(), files.end(), p->first)) {
+          missing.push_back(p->second);
+        }
+      }
+      for (int i = 0, n = missing.size(); i < n; ++i) {
+        if (missing[i] == active_segment_) {
+          CloseActiveSegmentLocked();
+        }
+        ForgetSegmentLocked(missing[i]);
+      }
+
+      for (int i = 0, n = files.size(); i < n; ++i) {
+        const GoogleString& filename = files[i];
+        SegmentNameMap::iterator p = segments_by_name_.find(filename);
+        Segment* segment = (p == segments_by_name_.end())
+            ? AddSegmentLocked(filename) : p->second;
+        if (segment != active_segment_ && !segment->corrupt &&
+            file_sizes[i] > segment->size_bytes) {
+          scans.push_back(PendingScan(
+              filename, std::make_pair(segment->size_bytes, file_sizes[i])));
+        }
+      }
+    }
+  }
+
+  for (int i = 0, n = scans.size(); i < n; ++i) {
+    const GoogleString& filename = scans[i].first;
+    const int64 start = scans[i].second.first;
+    GoogleString buf;
+    ReadSegmentData(filename, start, scans[i].second.second, &buf);
+    ScopedMutex lock(mutex_.get());
+    // The segment may have been removed, or scanned by a cleaner, while we
+    // were reading it.
+    SegmentNameMap::iterator p = segments_by_name_.find(filename);
+    if (p != segments_by_name_.end() && !p->second->corrupt &&
+        p->second->size_bytes == start) {
+      IndexSegmentDataLocked(p->second, buf);
+    }
+  }
+
+  ScopedMutex lock(mutex_.get());
+  refreshing_ = false;
+}
+
+void SegmentFileCache::ReadSegmentData(const GoogleString& filename,
+                                       int64 start, int64 end,
+                                       GoogleString* buf) {
+  buf->clear();
+  NullMessageHandler null_handler;
+  FileSystem::InputFile* file =
+      file_system_->OpenInputFile(filename.c_str(), &null_handler);
+  if (file == NULL) {
+    return;
+  }
+  if (file->Seek(start, &null_handler)) {
+    buf->resize(end - start);
+    int64 pos = 0;
+    while (pos < static_cast<int64>(buf->size())) {
+      int n = file->Read(&(*buf)[pos], buf->size() - pos, &null_handler);
+      if (n <= 0) {
+        break;
+      }
+      pos += n;
+    }
+    buf->resize(pos);
+  }
+  file_system_->Close(file, &null_handler);
+}
+
+void SegmentFileCache::IndexSegmentDataLocked(Segment* segment,
+                                              StringPiece data) {
+  Record record;
+  while (!data.empty()) {
+    if (!DecodeRecord(data, &record)) {
+      // Either another process is part-way through writing this record, and
+      // we'll pick it up next time, or the file is damaged.
+      if (data.size() >= kHeaderSize &&
+          ReadUint32(data.data()) != kRecordMagic) {
+        corrupt_records_->Add(1);
+        segment->corrupt = true;
+      }
+      break;
+    }
+    Location location;
+    location.segment_id = segment->id;
+    location.offset = segment->size_bytes;
+    location.size = record.is_delete ? 0 : record.size;
+    location.timestamp_us = record.timestamp_us;
+    IndexLocked(HashKey(record.key.as_string()), location);
+    segment->size_bytes += record.size;
+    total_bytes_ += record.size;
+    data.remove_prefix(record.size);
+  }
+}
+
+void SegmentFileCache::CleanIfNeeded() {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (total_bytes_ <= cache_policy_->target_size_bytes) {
+      return;
+    }
+  }
+  if (worker_ != NULL) {
+    worker_->RunIfNotBusy(
+        MakeFunction(this, &SegmentFileCache::CleanWithLocking));
+  } else {
+    CleanWithLocking();
+  }
+}
+
+void SegmentFileCache::CleanWithLocking() {
+  if (file_system_->TryLockWithTimeout(clean_lock_path_, kLockTimeoutMs,
+                                       cache_policy_->timer,
+                                       message_handler_).is_true()) {
+    Clean(cache_policy_->target_size_bytes);
+    file_system_->Unlock(clean_lock_path_, message_handler_);
+  }
+}
+
+void SegmentFileCache::Clean(int64 target_size_bytes) {
+  typedef std::pair<int64, GoogleString> CreationAndName;
+  std::vector<CreationAndName> evictable;
+  std::vector<GoogleString> sparse;
+  int64 total_bytes;
+  Refresh();
+  {
+    ScopedMutex lock(mutex_.get());
+    total_bytes = total_bytes_;
+    if (total_bytes <= target_size_bytes) {
+      return;
+    }
+    const int64 now_ms = cache_policy_->timer->NowMs();
+    for (SegmentIdMap::iterator p = segments_by_id_.begin(),
+             e = segments_by_id_.end(); p != e; ++p) {
+      Segment* segment = p->second;
+      if (segment == active_segment_) {
+        continue;
+      }
+      evictable.push_back(CreationAndName(segment->created_ms,
+                                          segment->filename));
+      // Compacting a segment someone may still be appending to would lose
+      // their later records, so only sealed ones are compacted.
+      if (now_ms - segment->created_ms >= 2 * kSegmentWriteWindowMs &&
+          segment->live_bytes <
+          segment->size_bytes * kCompactionLiveFraction) {
+        sparse.push_back(segment->filename);
+      }
+    }
+  }
+  if (evictable.empty()) {
+    return;  // All we have is our active segment.
+  }
+  message_handler_->Message(
+      kInfo, "Segment file cache size is %s; beginning cleanup.",
+      Integer64ToString(total_bytes).c_str());
+  cleanups_->Add(1);
+
+  for (int i = 0, n = sparse.size(); i < n; ++i) {
+    CompactSegment(sparse[i]);
+  }
+
+  // Then drop whole segments, oldest first.  Segments that may still be
+  // being written are the youngest, so they only go if the cache can't get
+  // under target without them.
+  int64 clean_target_bytes =
+      target_size_bytes * kCleanTargetNumerator / kCleanTargetDenominator;
+  std::sort(evictable.begin(), evictable.end());
+  int64 bytes_freed = 0;
+  for (int i = 0, n = evictable.size(); i < n; ++i) {
+    {
+      ScopedMutex lock(mutex_.get());
+      if (total_bytes_ <= clean_target_bytes) {
+        break;
+      }
+      if (segments_by_name_.find(evictable[i].second) ==
+          segments_by_name_.end()) {
+        continue;  // Already compacted away.
+      }
+    }
+    bytes_freed += RemoveSegment(evictable[i].second);
+    evicted_segments_->Add(1);
+  }
+  bytes_freed_in_cleanup_->Add(bytes_freed);
+  message_handler_->Message(
+      kInfo, "Segment file cache cleanup complete; evicted %s bytes",
+      Integer64ToString(bytes_freed).c_str());
+}
+
+void SegmentFileCache::CompactSegment(const GoogleString& filename) {
+  GoogleString buf;
+  NullMessageHandler null_handler;
+  if (!file_system_->ReadFile(filename.c_str(), &buf, &null_handler)) {
+    return;
+  }
+  StringPiece data(buf);
+  int64 offset = 0;
+  Record record;
+  {
+    ScopedMutex lock(mutex_.get());
+    SegmentNameMap::iterator p = segments_by_name_.find(filename);
+    if (p == segments_by_name_.end() || shut_down_) {
+      return;
+    }
+    const int32 id = p->second->id;
+    while (DecodeRecord(data, &record)) {
+      uint64 hash = HashKey(record.key.as_string());
+      Index::iterator iter = index_.find(hash);
+      if (iter != index_.end() && iter->second.segment_id == id &&
+          iter->second.offset == offset) {
+        // Still the newest record for this key, so carry it forward with its
+        // original timestamp.
+        GoogleString copy(data.data(), record.size);
+        AppendLocked(hash, copy, record.timestamp_us, record.is_delete);
+      }
+      offset += record.size;
+      data.remove_prefix(record.size);
+    }
+  }
+  RemoveSegment(filename);
+  compacted_segments_->Add(1);
+}
+
+int64 SegmentFileCache::RemoveSegment(const GoogleString& filename) {
+  NullMessageHandler null_handler;
+  file_system_->RemoveFile(filename.c_str(), &null_handler);
+  ScopedMutex lock(mutex_.get());
+  SegmentNameMap::iterator p = segments_by_name_.find(filename);
+  if (p == segments_by_name_.end()) {
+    return 0;
+  }
+  int64 size = p->second->size_bytes;
+  ForgetSegmentLocked(p->second);
+  return size;
+}
+
+}  // namespace net_instaweb
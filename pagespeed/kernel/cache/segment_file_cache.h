@@ -0,0 +1,256 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_SEGMENT_FILE_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_SEGMENT_FILE_CACHE_H_
+
+#include <map>
+#include <unordered_map>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+class SlowWorker;
+class Statistics;
+class ThreadSystem;
+class Timer;
+class Variable;
+
+// A disk cache that appends entries to a small number of large segment files,
+// rather than writing one file per key as FileCache does.  Each process keeps
+// an in-memory index from a 64-bit hash of the key to the location of the
+// newest record for that key.  Records carry their key, so a hash collision
+// just looks like a miss.
+//
+// Several processes can share a cache directory.  Each one appends only to
+// its own active segment, and picks up records written by the others by
+// periodically re-scanning the directory for new segments and new data at
+// the end of segments it has already indexed.  So a Put in one process
+// becomes visible to the others within kIndexRefreshIntervalMs.  The re-scan
+// is done by whichever Get finds it due, but the directory listing and file
+// reads happen without holding the index lock, so other lookups go ahead
+// meanwhile.
+//
+// Space is reclaimed a whole segment at a time: when the total size of the
+// segments exceeds target_size_bytes, one process (holding a lock file) first
+// compacts sealed segments that are mostly garbage, by copying their live
+// records to its active segment, and then deletes the oldest segments other
+// than its own active one until the cache is under 3/4 of the target.  There
+// is never a directory walk over the individual entries.
+class SegmentFileCache : public CacheInterface {
+ public:
+  struct CachePolicy {
+    CachePolicy(Timer* timer, int64 segment_size_bytes,
+                int64 target_size_bytes)
+        : timer(timer), segment_size_bytes(segment_size_bytes),
+          target_size_bytes(target_size_bytes) {}
+    const Timer* timer;
+    // A process starts a new segment once its active one reaches this size.
+    // Records larger than this are not stored.
+    int64 segment_size_bytes;
+    int64 target_size_bytes;
+   private:
+    DISALLOW_COPY_AND_ASSIGN(CachePolicy);
+  };
+
+  // Takes ownership of policy.  Segment files are kept directly in path.
+  SegmentFileCache(const GoogleString& path, FileSystem* file_system,
+                   ThreadSystem* thread_system, SlowWorker* worker,
+                   CachePolicy* policy, Statistics* stats,
+                   MessageHandler* handler);
+  virtual ~SegmentFileCache();
+
+  static void InitStats(Statistics* statistics);
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, const SharedString& value);
+  virtual void Delete(const GoogleString& key);
+  void set_worker(SlowWorker* worker) { worker_ = worker; }
+  SlowWorker* worker() { return worker_; }
+
+  static GoogleString FormatName() { return "SegmentFileCache"; }
+  virtual GoogleString Name() const { return FormatName(); }
+
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const;
+  virtual void ShutDown();
+
+  const CachePolicy* cache_policy() const { return cache_policy_.get(); }
+  CachePolicy* mutable_cache_policy() { return cache_policy_.get(); }
+  const GoogleString& path() const { return path_; }
+
+  // Variable names.
+  // Number of times we cleaned because the segments exceeded the target size.
+  static const char kCleanups[];
+  // Segments rewritten to drop their garbage.
+  static const char kCompactedSegments[];
+  // Segments deleted, live records and all, to get under the target size.
+  static const char kEvictedSegments[];
+  static const char kBytesFreedInCleanup[];
+  // Records found to be truncated or corrupt while indexing or reading.
+  static const char kCorruptRecords[];
+  static const char kWriteErrors[];
+
+  // How often a process re-scans the directory for data written by others.
+  static const int64 kIndexRefreshIntervalMs;
+
+  // A process never appends to a segment created more than this long ago, and
+  // the cleaner only compacts segments older than twice this.  Younger
+  // segments are still evicted, oldest first, if the cache can't otherwise
+  // get under its target size; a process that was still appending to one
+  // notices at its next refresh and starts a new segment.
+  static const int64 kSegmentWriteWindowMs;
+
+ private:
+  struct Location {
+    int32 segment_id;
+    // Size of the record, which is limited by the 32-bit sizes in its header.
+    uint32 size;
+    int64 offset;
+    int64 timestamp_us;
+  };
+  struct Segment;
+  struct Record;
+  typedef std::unordered_map<uint64, Location> Index;
+  typedef std::map<int32, Segment*> SegmentIdMap;
+  typedef std::map<GoogleString, Segment*> SegmentNameMap;
+
+  friend class SegmentFileCacheTest;
+
+  static uint64 HashKey(const GoogleString& key);
+
+  // Serializes a record header plus key and value (which may be NULL for a
+  // deletion) into *buf.
+  static void EncodeRecord(const GoogleString& key, const SharedString* value,
+                           int64 timestamp_us, GoogleString* buf);
+
+  // Parses the record at the front of data, returning false if data does not
+  // hold a complete, well-formed record.
+  static bool DecodeRecord(StringPiece data, Record* record);
+
+  // Appends an encoded record to the active segment, starting a new one first
+  // if necessary, and indexes it.  Returns true if a new segment was started.
+  bool AppendLocked(uint64 hash, const GoogleString& record, int64 timestamp_us,
+                    bool is_delete) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool StartSegmentLocked() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void CloseActiveSegmentLocked() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Records that the newest copy of hash lives at location, unless the index
+  // already has a newer one.  Deletions are indexed as zero-size locations, so
+  // that an older record for the key found later does not resurrect it.
+  void IndexLocked(uint64 hash, const Location& location)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UnindexLocked(Index::iterator iter) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Looks for new segments and for new records at the end of known ones, and
+  // forgets segments that have been deleted.  The disk is only touched with
+  // mutex_ released, and only one thread refreshes at a time; the others
+  // carry on with the index as it stands.
+  void Refresh() LOCKS_EXCLUDED(mutex_);
+
+  // Indexes the records in data, which was read from segment starting at its
+  // current size_bytes.
+  void IndexSegmentDataLocked(Segment* segment, StringPiece data)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Segment* AddSegmentLocked(const GoogleString& filename)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ForgetSegmentLocked(Segment* segment) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Index entries pointing at forgotten segments are dropped lazily; this
+  // sweeps them all once they make up a large fraction of the index.
+  void MaybeSweepIndexLocked() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Reads the whole record at location from filename into *buf, returning
+  // true if it is intact and has the expected key.
+  bool ReadRecord(const GoogleString& filename, const Location& location,
+                  const GoogleString& key, GoogleString* buf);
+
+  // Reads filename from offset start up to (at most) end into *buf.
+  void ReadSegmentData(const GoogleString& filename, int64 start, int64 end,
+                       GoogleString* buf);
+
+  // Kicks off a cleanup on worker_ (or inline, if there is no worker) if the
+  // cache has grown past its target size.
+  void CleanIfNeeded() LOCKS_EXCLUDED(mutex_);
+  void CleanWithLocking() LOCKS_EXCLUDED(mutex_);
+
+  // Compacts and evicts segments until the cache fits within
+  // target_size_bytes.  Must be called with the clean lock file held.
+  void Clean(int64 target_size_bytes) LOCKS_EXCLUDED(mutex_);
+
+  // Copies the records from the named segment that are still live in our
+  // index to the active segment, then deletes it.
+  void CompactSegment(const GoogleString& filename) LOCKS_EXCLUDED(mutex_);
+
+  // Deletes the named segment and forgets about it.  Returns the number of
+  // bytes freed.
+  int64 RemoveSegment(const GoogleString& filename) LOCKS_EXCLUDED(mutex_);
+
+  const GoogleString path_;
+  FileSystem* file_system_;
+  SlowWorker* worker_;
+  MessageHandler* message_handler_;
+  const scoped_ptr<CachePolicy> cache_policy_;
+  // Distinguishes our segment filenames from those of other processes.
+  const GoogleString instance_tag_;
+  const GoogleString clean_lock_path_;
+
+  scoped_ptr<AbstractMutex> mutex_;
+  Index index_ GUARDED_BY(mutex_);
+  SegmentIdMap segments_by_id_ GUARDED_BY(mutex_);
+  SegmentNameMap segments_by_name_ GUARDED_BY(mutex_);
+  int64 total_bytes_ GUARDED_BY(mutex_);
+  // Number of index entries that refer to forgotten segments.
+  int64 dead_entries_ GUARDED_BY(mutex_);
+  int32 next_segment_id_ GUARDED_BY(mutex_);
+  int32 segments_started_ GUARDED_BY(mutex_);
+  int64 next_refresh_ms_ GUARDED_BY(mutex_);
+  bool refreshing_ GUARDED_BY(mutex_);
+  FileSystem::OutputFile* active_file_ GUARDED_BY(mutex_);
+  Segment* active_segment_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+
+  Variable* cleanups_;
+  Variable* compacted_segments_;
+  Variable* evicted_segments_;
+  Variable* bytes_freed_in_cleanup_;
+  Variable* corrupt_records_;
+  Variable* write_errors_;
+
+  // How long a cleaner may go without bumping the clean lock before another
+  // process may take it over.
+  static const int64 kLockTimeoutMs;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentFileCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_SEGMENT_FILE_CACHE_H_
@@ -0,0 +1,387 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Unit-test the segment file cache.
+#include "pagespeed/kernel/cache/segment_file_cache.h"
+
+#include <unistd.h>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mem_file_system.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/thread/slow_worker.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace net_instaweb {
+
+class SegmentFileCacheTest : public CacheTestBase {
+ protected:
+  SegmentFileCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        worker_("cleaner", thread_system_.get()),
+        mock_timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        file_system_(thread_system_.get(), &mock_timer_),
+        kSegmentSize(100),
+        kTargetSize(1000),
+        stats_(thread_system_.get()) {
+    SegmentFileCache::InitStats(&stats_);
+    cache_.reset(NewCache());
+    cleanups_ = stats_.GetVariable(SegmentFileCache::kCleanups);
+    compacted_segments_ = stats_.GetVariable(
+        SegmentFileCache::kCompactedSegments);
+    evicted_segments_ = stats_.GetVariable(SegmentFileCache::kEvictedSegments);
+    corrupt_records_ = stats_.GetVariable(SegmentFileCache::kCorruptRecords);
+  }
+
+  // Each cache instance stands in for a separate process sharing the
+  // directory.
+  SegmentFileCache* NewCache() {
+    return new SegmentFileCache(
+        GTestTempDir(), &file_system_, thread_system_.get(), NULL,
+        new SegmentFileCache::CachePolicy(&mock_timer_, kSegmentSize,
+                                          kTargetSize),
+        &stats_, &message_handler_);
+  }
+
+  virtual void SetUp() {
+    worker_.Start();
+  }
+
+  virtual CacheInterface* Cache() { return cache_.get(); }
+  virtual void PostOpCleanup() { }
+
+  void Clean(SegmentFileCache* cache, int64 target_size_bytes) {
+    // Cache expects to be locked when cleaning.
+    EXPECT_TRUE(file_system_.TryLock(
+        cache->clean_lock_path_, &message_handler_).is_true());
+    cache->Clean(target_size_bytes);
+    EXPECT_TRUE(file_system_.Unlock(
+        cache->clean_lock_path_, &message_handler_));
+  }
+
+  int NumSegmentFiles() {
+    StringVector files;
+    EXPECT_TRUE(file_system_.ListContents(GTestTempDir(), &files,
+                                          &message_handler_));
+    int num_segments = 0;
+    for (int i = 0, n = files.size(); i < n; ++i) {
+      if (StringPiece(files[i]).ends_with(".seg")) {
+        ++num_segments;
+      }
+    }
+    return num_segments;
+  }
+
+  void EncodeRecord(const GoogleString& key, const GoogleString& value,
+                    GoogleString* record) {
+    SharedString shared_value(value);
+    SegmentFileCache::EncodeRecord(key, &shared_value, mock_timer_.NowUs(),
+                                   record);
+  }
+
+  int64 TotalBytes(SegmentFileCache* cache) {
+    ScopedMutex lock(cache->mutex_.get());
+    return cache->total_bytes_;
+  }
+
+  // Lets other caches see what was written, and lets segments written before
+  // now be cleaned.
+  void AdvancePastWriteWindow() {
+    mock_timer_.AdvanceMs(2 * SegmentFileCache::kSegmentWriteWindowMs + 1);
+  }
+
+  void WaitForWorker(SlowWorker* worker) {
+    while (worker->IsBusy()) {
+      usleep(10);
+    }
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  SlowWorker worker_;
+  MockTimer mock_timer_;
+  MemFileSystem file_system_;
+  const int64 kSegmentSize;
+  const int64 kTargetSize;
+  SimpleStats stats_;
+  scoped_ptr<SegmentFileCache> cache_;
+  GoogleMessageHandler message_handler_;
+  Variable* cleanups_;
+  Variable* compacted_segments_;
+  Variable* evicted_segments_;
+  Variable* corrupt_records_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SegmentFileCacheTest);
+};
+
+// Simple flow of putting in an item, getting it, deleting it.
+TEST_F(SegmentFileCacheTest, PutGetDelete) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+
+  cache_->Delete("Name");
+  CheckNotFound("Name");
+  CheckPut("Name", "Resurrected");
+  CheckGet("Name", "Resurrected");
+}
+
+TEST_F(SegmentFileCacheTest, EmptyValue) {
+  CheckPut("Name", "");
+  CheckGet("Name", "");
+}
+
+TEST_F(SegmentFileCacheTest, OversizedValueNotStored) {
+  CheckPut("Name", GoogleString(kSegmentSize, 'x'));
+  CheckNotFound("Name");
+  EXPECT_EQ(0, NumSegmentFiles());
+}
+
+TEST_F(SegmentFileCacheTest, ManyKeysShareASegment) {
+  CheckPut("a", "1");
+  CheckPut("b", "2");
+  CheckPut("c", "3");
+  EXPECT_EQ(1, NumSegmentFiles());
+  CheckGet("a", "1");
+  CheckGet("b", "2");
+  CheckGet("c", "3");
+}
+
+TEST_F(SegmentFileCacheTest, RollsOverFullSegments) {
+  // Each record is 24 bytes of header plus key and value, so only two of
+  // these 39-byte records fit in a 100-byte segment.
+  for (int i = 0; i < 10; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)), "0123456789");
+  }
+  EXPECT_EQ(5, NumSegmentFiles());
+  for (int i = 0; i < 10; ++i) {
+    CheckGet(StrCat("Name", IntegerToString(i)), "0123456789");
+  }
+}
+
+TEST_F(SegmentFileCacheTest, RollsOverOldSegments) {
+  CheckPut("a", "1");
+  mock_timer_.AdvanceMs(SegmentFileCache::kSegmentWriteWindowMs);
+  CheckPut("b", "2");
+  EXPECT_EQ(2, NumSegmentFiles());
+}
+
+TEST_F(SegmentFileCacheTest, SharedBetweenInstances) {
+  scoped_ptr<SegmentFileCache> other(NewCache());
+  CheckPut("Name", "Value");
+  CheckGet(other.get(), "Name", "Value");
+
+  // other has refreshed its index too recently to see this yet.
+  CheckPut("Name2", "Value2");
+  CheckNotFound(other.get(), "Name2");
+  mock_timer_.AdvanceMs(SegmentFileCache::kIndexRefreshIntervalMs);
+  CheckGet(other.get(), "Name2", "Value2");
+
+  // Overwrites and deletions propagate the same way, and the newest write
+  // wins no matter which segment it landed in.
+  mock_timer_.AdvanceMs(1);
+  CheckPut(other.get(), "Name", "NewValue");
+  mock_timer_.AdvanceMs(1);
+  cache_->Delete("Name2");
+  mock_timer_.AdvanceMs(SegmentFileCache::kIndexRefreshIntervalMs);
+  CheckGet("Name", "NewValue");
+  CheckGet(other.get(), "Name", "NewValue");
+  CheckNotFound("Name2");
+  CheckNotFound(other.get(), "Name2");
+
+  // A fresh instance sees the same thing, regardless of the order in which
+  // it scans the segments.
+  scoped_ptr<SegmentFileCache> third(NewCache());
+  CheckGet(third.get(), "Name", "NewValue");
+  CheckNotFound(third.get(), "Name2");
+}
+
+TEST_F(SegmentFileCacheTest, PartialRecordIsPickedUpLater) {
+  scoped_ptr<SegmentFileCache> other(NewCache());
+  CheckPut("Name", "Value");
+
+  // Simulate another process being part-way through an append.
+  GoogleString filename = StrCat(GTestTempDir(), "/seg-",
+                                 Integer64ToString(mock_timer_.NowUs()),
+                                 "-other.0.seg");
+  GoogleString record;
+  EncodeRecord("Partial", "Partial", &record);
+  ASSERT_TRUE(file_system_.WriteFile(filename.c_str(),
+                                     record.substr(0, record.size() - 3),
+                                     &message_handler_));
+  CheckNotFound(other.get(), "Partial");
+  CheckGet(other.get(), "Name", "Value");
+
+  ASSERT_TRUE(file_system_.WriteFile(filename.c_str(), record,
+                                     &message_handler_));
+  mock_timer_.AdvanceMs(SegmentFileCache::kIndexRefreshIntervalMs);
+  CheckGet(other.get(), "Partial", "Partial");
+  EXPECT_EQ(0, corrupt_records_->Get());
+}
+
+TEST_F(SegmentFileCacheTest, CorruptSegment) {
+  GoogleString filename = StrCat(GTestTempDir(), "/seg-",
+                                 Integer64ToString(mock_timer_.NowUs()),
+                                 "-other.0.seg");
+  ASSERT_TRUE(file_system_.WriteFile(
+      filename.c_str(), "this is not a segment file at all",
+      &message_handler_));
+  CheckNotFound("Name");
+  EXPECT_EQ(1, corrupt_records_->Get());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+}
+
+TEST_F(SegmentFileCacheTest, MissingSegmentIsAMiss) {
+  CheckPut("Name", "Value");
+  scoped_ptr<SegmentFileCache> other(NewCache());
+  CheckGet(other.get(), "Name", "Value");
+
+  // Another process removes the segment; we notice on the failed read before
+  // our next refresh, and on the refresh after that.
+  cache_->ShutDown();
+  StringVector files;
+  ASSERT_TRUE(file_system_.ListContents(GTestTempDir(), &files,
+                                        &message_handler_));
+  for (int i = 0, n = files.size(); i < n; ++i) {
+    file_system_.RemoveFile(files[i].c_str(), &message_handler_);
+  }
+  CheckNotFound(other.get(), "Name");
+  mock_timer_.AdvanceMs(SegmentFileCache::kIndexRefreshIntervalMs);
+  CheckNotFound(other.get(), "Name");
+}
+
+TEST_F(SegmentFileCacheTest, CleanEvictsOldestSegments) {
+  // Fill four segments, with two 39-byte records each.
+  for (int i = 0; i < 8; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)), "0123456789");
+    mock_timer_.AdvanceMs(1);
+  }
+  EXPECT_EQ(4, NumSegmentFiles());
+  EXPECT_EQ(8 * 39, TotalBytes(cache_.get()));
+
+  // Cleaning to 220 bytes leaves at most 165, so the two oldest segments go.
+  AdvancePastWriteWindow();
+  Clean(cache_.get(), 220);
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(2, evicted_segments_->Get());
+  EXPECT_EQ(0, compacted_segments_->Get());
+  EXPECT_EQ(2, NumSegmentFiles());
+  for (int i = 0; i < 4; ++i) {
+    CheckNotFound(StrCat("Name", IntegerToString(i)).c_str());
+  }
+  for (int i = 4; i < 8; ++i) {
+    CheckGet(StrCat("Name", IntegerToString(i)), "0123456789");
+  }
+}
+
+TEST_F(SegmentFileCacheTest, CleanEvictsYoungSegments) {
+  // Segments too young to be compacted are still evicted, oldest first, when
+  // the cache is over its target.
+  for (int i = 0; i < 8; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)), "0123456789");
+    mock_timer_.AdvanceMs(1);
+  }
+  CheckPut("k", "1");
+  CheckPut("k", "2");
+  EXPECT_EQ(5, NumSegmentFiles());
+
+  Clean(cache_.get(), 220);
+  EXPECT_EQ(1, cleanups_->Get());
+  EXPECT_EQ(3, evicted_segments_->Get());
+  EXPECT_EQ(0, compacted_segments_->Get());
+  EXPECT_EQ(2, NumSegmentFiles());
+  for (int i = 0; i < 6; ++i) {
+    CheckNotFound(StrCat("Name", IntegerToString(i)).c_str());
+  }
+  CheckGet("Name6", "0123456789");
+  CheckGet("Name7", "0123456789");
+  CheckGet("k", "2");
+
+  // Our active segment is never evicted, even if that leaves us over target.
+  Clean(cache_.get(), 1);
+  EXPECT_EQ(4, evicted_segments_->Get());
+  EXPECT_EQ(1, NumSegmentFiles());
+  CheckGet("k", "2");
+}
+
+TEST_F(SegmentFileCacheTest, CleanCompactsSparseSegments) {
+  // Three 26-byte records fill the first segment, and two of them are then
+  // overwritten in the second.
+  CheckPut("k", "1");
+  CheckPut("d", "1");
+  CheckPut("e", "1");
+  mock_timer_.AdvanceMs(1);
+  CheckPut("d", "2");
+  CheckPut("e", "2");
+  EXPECT_EQ(2, NumSegmentFiles());
+  EXPECT_EQ(5 * 26, TotalBytes(cache_.get()));
+
+  // Compacting the first segment carries "k" forward into the active one,
+  // which gets us under target without evicting anything.
+  AdvancePastWriteWindow();
+  Clean(cache_.get(), 5 * 26 - 1);
+  EXPECT_EQ(1, compacted_segments_->Get());
+  EXPECT_EQ(0, evicted_segments_->Get());
+  EXPECT_EQ(1, NumSegmentFiles());
+  EXPECT_EQ(3 * 26, TotalBytes(cache_.get()));
+  CheckGet("k", "1");
+  CheckGet("d", "2");
+  CheckGet("e", "2");
+
+  // Another instance agrees.
+  scoped_ptr<SegmentFileCache> other(NewCache());
+  CheckGet(other.get(), "k", "1");
+  CheckGet(other.get(), "d", "2");
+}
+
+TEST_F(SegmentFileCacheTest, CleanTriggeredByPut) {
+  cache_->set_worker(&worker_);
+  for (int i = 0; i < 30; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)), "0123456789");
+    AdvancePastWriteWindow();
+    WaitForWorker(&worker_);
+  }
+  EXPECT_LT(0, cleanups_->Get());
+  EXPECT_GE(kTargetSize, TotalBytes(cache_.get()));
+  CheckGet("Name29", "0123456789");
+}
+
+TEST_F(SegmentFileCacheTest, ShutDown) {
+  CheckPut("Name", "Value");
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+}
+
+}  // namespace net_instaweb
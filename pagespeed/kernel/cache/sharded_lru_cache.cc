@@ -0,0 +1,191 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+// One independently-locked slice of the cache.  Shards are allocated
+// separately and padded so that the mutex and the LRU bookkeeping of one
+// shard never share a cache line with those of another, which would
+// otherwise reintroduce contention through false sharing.
+class ShardedLRUCache::Shard {
+ public:
+  Shard(size_t max_bytes, SharedStringHelper* helper, AbstractMutex* mutex)
+      : mutex_(mutex),
+        base_(max_bytes, helper) {
+  }
+
+  AbstractMutex* mutex() const { return mutex_.get(); }
+  Base* base() { return &base_; }
+
+ private:
+  scoped_ptr<AbstractMutex> mutex_;
+  Base base_;
+  char padding_[ShardedLRUCache::kCacheLineSize];
+
+  DISALLOW_COPY_AND_ASSIGN(Shard);
+};
+
+ShardedLRUCache::ShardedLRUCache(int num_shards, size_t max_bytes,
+                                 ThreadSystem* thread_system) {
+  CHECK_LE(1, num_shards);
+  size_t bytes_per_shard = max_bytes / num_shards;
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.push_back(new Shard(bytes_per_shard, &value_helper_,
+                                thread_system->NewMutex()));
+  }
+}
+
+ShardedLRUCache::~ShardedLRUCache() {
+  STLDeleteElements(&shards_);
+}
+
+GoogleString ShardedLRUCache::FormatName(int num_shards) {
+  return StrCat("ShardedLRUCache(", IntegerToString(num_shards), ")");
+}
+
+int ShardedLRUCache::ShardIndex(const GoogleString& key) const {
+  // LRUCacheBase's hash-map buckets are selected by the low bits of
+  // CasePreserveStringHash, so picking shards from those same bits would
+  // leave most buckets in every shard empty.  Run the hash through a
+  // finalizer (from MurmurHash3) so that the shard index is derived from
+  // well-mixed bits instead.
+  uint32 hash = HashString<CasePreserve, uint32>(key.data(), key.size());
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return static_cast<int>(hash % shards_.size());
+}
+
+void ShardedLRUCache::Get(const GoogleString& key, Callback* callback) {
+  KeyState key_state = kNotFound;
+  if (!is_shut_down_.value()) {
+    Shard* shard = ShardFor(key);
+    ScopedMutex lock(shard->mutex());
+    SharedString* value = shard->base()->GetFreshen(key);
+    if (value != NULL) {
+      key_state = kAvailable;
+      // This only bumps a reference count; the bytes are shared.
+      callback->set_value(*value);
+    }
+  }
+  // Unlike ThreadsafeCache, we validate and report with the shard unlocked,
+  // so a slow validator or callback cannot stall other threads.
+  ValidateAndReportResult(key, key_state, callback);
+}
+
+void ShardedLRUCache::Put(const GoogleString& key,
+                          const SharedString& new_value) {
+  if (is_shut_down_.value()) {
+    return;
+  }
+  Shard* shard = ShardFor(key);
+  ScopedMutex lock(shard->mutex());
+  shard->base()->Put(key, new_value);
+}
+
+void ShardedLRUCache::Delete(const GoogleString& key) {
+  if (is_shut_down_.value()) {
+    return;
+  }
+  Shard* shard = ShardFor(key);
+  ScopedMutex lock(shard->mutex());
+  shard->base()->Delete(key);
+}
+
+bool ShardedLRUCache::IsHealthy() const {
+  return !is_shut_down_.value();
+}
+
+void ShardedLRUCache::ShutDown() {
+  is_shut_down_.set_value(true);
+}
+
+void ShardedLRUCache::DeleteWithPrefixForTesting(StringPiece prefix) {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    ScopedMutex lock(shards_[i]->mutex());
+    shards_[i]->base()->DeleteWithPrefixForTesting(prefix);
+  }
+}
+
+void ShardedLRUCache::SanityCheck() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    ScopedMutex lock(shards_[i]->mutex());
+    shards_[i]->base()->SanityCheck();
+  }
+}
+
+void ShardedLRUCache::Clear() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    ScopedMutex lock(shards_[i]->mutex());
+    shards_[i]->base()->Clear();
+  }
+}
+
+void ShardedLRUCache::ClearStats() {
+  for (int i = 0, n = shards_.size(); i < n; ++i) {
+    ScopedMutex lock(shards_[i]->mutex());
+    shards_[i]->base()->ClearStats();
+  }
+}
+
+// Defines an accessor that sums the given LRUCacheBase statistic over all
+// shards.
+#define SHARDED_LRU_CACHE_SUM(method)                          \
+  size_t ShardedLRUCache::method() const {                     \
+    size_t sum = 0;                                            \
+    for (int i = 0, n = shards_.size(); i < n; ++i) {          \
+      ScopedMutex lock(shards_[i]->mutex());                   \
+      sum += shards_[i]->base()->method();                     \
+    }                                                          \
+    return sum;                                                \
+  }
+
+SHARDED_LRU_CACHE_SUM(size_bytes)
+SHARDED_LRU_CACHE_SUM(max_bytes_in_cache)
+SHARDED_LRU_CACHE_SUM(num_elements)
+SHARDED_LRU_CACHE_SUM(num_evictions)
+SHARDED_LRU_CACHE_SUM(num_hits)
+SHARDED_LRU_CACHE_SUM(num_misses)
+SHARDED_LRU_CACHE_SUM(num_inserts)
+SHARDED_LRU_CACHE_SUM(num_identical_reinserts)
+SHARDED_LRU_CACHE_SUM(num_deletes)
+
+#undef SHARDED_LRU_CACHE_SUM
+
+}  // namespace net_instaweb
@@ -0,0 +1,143 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/lru_cache_base.h"
+
+namespace net_instaweb {
+
+class ThreadSystem;
+
+// Thread-safe in-memory LRU cache that splits its key-space across a
+// fixed number of independently locked shards, each holding its own
+// LRUCacheBase.  This is a drop-in replacement for wrapping an LRUCache in a
+// ThreadsafeCache: that combination serializes every Get on every thread on
+// a single mutex, which becomes a contention point on machines with many
+// cores.  Here, threads only contend when they hit the same shard.
+//
+// Unlike ThreadsafeCache, the shard lock is not held while the callback's
+// validator runs, nor while Done() is called.
+//
+// Each shard gets an equal share of max_bytes, and LRU ordering is only
+// maintained within a shard, so eviction is approximately (not strictly) LRU
+// across the whole cache.  An entry larger than a shard's share of the
+// budget will not be stored.
+class ShardedLRUCache : public CacheInterface {
+ public:
+  // Assumes a 64-byte cache line; shards are padded so that two shards'
+  // mutexes and hot counters never share a line.
+  static const int kCacheLineSize = 64;
+
+  // num_shards must be at least 1.  Does not take ownership of thread_system,
+  // which is used only to create the per-shard mutexes.
+  ShardedLRUCache(int num_shards, size_t max_bytes,
+                  ThreadSystem* thread_system);
+  virtual ~ShardedLRUCache();
+
+  virtual void Get(const GoogleString& key, Callback* callback);
+  virtual void Put(const GoogleString& key, const SharedString& new_value);
+  virtual void Delete(const GoogleString& key);
+
+  static GoogleString FormatName(int num_shards);
+  virtual GoogleString Name() const { return FormatName(num_shards()); }
+  virtual bool IsBlocking() const { return true; }
+  virtual bool IsHealthy() const;
+  virtual void ShutDown();
+
+  int num_shards() const { return static_cast<int>(shards_.size()); }
+
+  // The following accessors aggregate over all shards, locking each in turn,
+  // so they are not atomic snapshots of the cache as a whole.
+  size_t size_bytes() const;
+  size_t max_bytes_in_cache() const;
+  size_t num_elements() const;
+  size_t num_evictions() const;
+  size_t num_hits() const;
+  size_t num_misses() const;
+  size_t num_inserts() const;
+  size_t num_identical_reinserts() const;
+  size_t num_deletes() const;
+
+  // Sanity check the cache data structures of every shard.
+  void SanityCheck();
+
+  // Clear the entire cache.  Used primarily for testing.  Note that this
+  // will not clear the stats.
+  void Clear();
+
+  // Clear the stats -- note that this will not clear the content.
+  void ClearStats();
+
+  // Deletes all objects whose key starts with prefix.
+  // Not part of cache interface. Exported for testing only.
+  void DeleteWithPrefixForTesting(StringPiece prefix);
+
+  // Exposed for testing: the shard index a key maps to.
+  int ShardIndexForTesting(const GoogleString& key) const {
+    return ShardIndex(key);
+  }
+
+ private:
+  struct SharedStringHelper {
+    size_t size(const SharedString& ss) const {
+      return ss.size();
+    }
+    bool Equal(const SharedString& a, const SharedString& b) const {
+      return a.Value() == b.Value();
+    }
+    void EvictNotify(const SharedString& a) {}
+    bool ShouldReplace(const SharedString& old_value,
+                       const SharedString& new_value) const {
+      return true;
+    }
+  };
+  typedef LRUCacheBase<SharedString, SharedStringHelper> Base;
+
+  class Shard;
+  typedef std::vector<Shard*> ShardVector;
+
+  int ShardIndex(const GoogleString& key) const;
+  Shard* ShardFor(const GoogleString& key) const {
+    return shards_[ShardIndex(key)];
+  }
+
+  ShardVector shards_;
+  SharedStringHelper value_helper_;
+  AtomicBool is_shut_down_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
@@ -0,0 +1,224 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Unit-test the sharded LRU cache.
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_spammer.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace {
+const int kNumShards = 4;
+const size_t kMaxSize = 100 * kNumShards;
+const int kNumThreads = 4;
+const int kNumIters = 10000;
+const int kNumInserts = 10;
+}
+
+namespace net_instaweb {
+
+class ShardedLRUCacheTest : public CacheTestBase {
+ protected:
+  ShardedLRUCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        cache_(kNumShards, kMaxSize, thread_system_.get()) {
+  }
+
+  virtual CacheInterface* Cache() { return &cache_; }
+  virtual void PostOpCleanup() { cache_.SanityCheck(); }
+
+  // Finds num_keys distinct keys of the form "prefix%d" that all map to
+  // the same shard.
+  void KeysInOneShard(const char* prefix, int num_keys, StringVector* keys) {
+    int shard = -1;
+    for (int i = 0; static_cast<int>(keys->size()) < num_keys; ++i) {
+      GoogleString key = StrCat(prefix, IntegerToString(i));
+      int index = cache_.ShardIndexForTesting(key);
+      if (shard == -1) {
+        shard = index;
+      }
+      if (index == shard) {
+        keys->push_back(key);
+      }
+    }
+  }
+
+  void SpamHelper(bool expecting_evictions, bool do_deletes,
+                  const char* value_pattern) {
+    CacheSpammer::RunTests(kNumThreads, kNumIters, kNumInserts,
+                           expecting_evictions, do_deletes, value_pattern,
+                           &cache_, thread_system_.get());
+    cache_.SanityCheck();
+  }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  ShardedLRUCache cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCacheTest);
+};
+
+TEST_F(ShardedLRUCacheTest, PutGetDelete) {
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_elements());
+  EXPECT_EQ(kMaxSize, cache_.max_bytes_in_cache());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(static_cast<size_t>(9), cache_.size_bytes());  // "Name" + "Value"
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_elements());
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  EXPECT_EQ(static_cast<size_t>(12),
+            cache_.size_bytes());  // "Name" + "NewValue"
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_elements());
+
+  cache_.Delete("Name");
+  cache_.SanityCheck();
+  CheckNotFound("Name");
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_elements());
+  EXPECT_EQ(static_cast<size_t>(2), cache_.num_hits());
+  EXPECT_EQ(static_cast<size_t>(2), cache_.num_misses());
+}
+
+TEST_F(ShardedLRUCacheTest, KeysSpreadAcrossShards) {
+  bool used[kNumShards] = {false};
+  for (int i = 0; i < 100; ++i) {
+    int index = cache_.ShardIndexForTesting(StrCat("key", IntegerToString(i)));
+    ASSERT_LE(0, index);
+    ASSERT_GT(kNumShards, index);
+    used[index] = true;
+  }
+  for (int i = 0; i < kNumShards; ++i) {
+    EXPECT_TRUE(used[i]) << "shard " << i << " never used";
+  }
+}
+
+TEST_F(ShardedLRUCacheTest, DeleteWithPrefix) {
+  CheckPut("N1", "Value1");
+  CheckPut("N2", "Value2");
+  CheckPut("M3", "Value3");
+  CheckPut("M4", "Value4");
+  EXPECT_EQ(static_cast<size_t>(32), cache_.size_bytes());
+
+  cache_.DeleteWithPrefixForTesting("N");
+  EXPECT_EQ(static_cast<size_t>(16), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(2), cache_.num_elements());
+  CheckNotFound("N1");
+  CheckNotFound("N2");
+  CheckGet("M3", "Value3");
+  CheckGet("M4", "Value4");
+}
+
+// LRU ordering is maintained per shard, so exercise eviction on a set of
+// keys that all land in the same shard, whose budget is kMaxSize/kNumShards.
+TEST_F(ShardedLRUCacheTest, LeastRecentlyUsedWithinShard) {
+  StringVector keys;
+  KeysInOneShard("nm", 12, &keys);
+
+  // Each key is "nm" plus 1 or 2 digits; use a value padding every entry to
+  // exactly 10 bytes, so the 100-byte shard holds exactly 10 of them.
+  for (int i = 0; i < 10; ++i) {
+    CheckPut(keys[i], GoogleString(10 - keys[i].size(), 'v'));
+  }
+  EXPECT_EQ(static_cast<size_t>(100), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_evictions());
+
+  // Freshen keys[0], then insert keys[10]; keys[1] is now the oldest.
+  CheckGet(keys[0], GoogleString(10 - keys[0].size(), 'v'));
+  CheckPut(keys[10], GoogleString(10 - keys[10].size(), 'v'));
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_evictions());
+  CheckNotFound(keys[1].c_str());
+  CheckGet(keys[0], GoogleString(10 - keys[0].size(), 'v'));
+  CheckGet(keys[10], GoogleString(10 - keys[10].size(), 'v'));
+}
+
+TEST_F(ShardedLRUCacheTest, TooBigForShard) {
+  // The value fits in the whole-cache budget but not in one shard's share.
+  CheckPut("big", GoogleString(kMaxSize / 2, 'x'));
+  CheckNotFound("big");
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+}
+
+TEST_F(ShardedLRUCacheTest, BasicInvalid) {
+  // Check that we honor callback veto on validity.
+  CheckPut("nameA", "valueA");
+  CheckPut("nameB", "valueB");
+  CheckGet("nameA", "valueA");
+  CheckGet("nameB", "valueB");
+  set_invalid_value("valueA");
+  CheckNotFound("nameA");
+  CheckGet("nameB", "valueB");
+}
+
+TEST_F(ShardedLRUCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(ShardedLRUCacheTest, ShutDown) {
+  CheckPut("nameA", "valueA");
+  EXPECT_TRUE(cache_.IsHealthy());
+  cache_.ShutDown();
+  EXPECT_FALSE(cache_.IsHealthy());
+  CheckNotFound("nameA");
+  CheckPut("nameB", "valueB");
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_elements());
+}
+
+TEST_F(ShardedLRUCacheTest, ClearAndClearStats) {
+  CheckPut("nameA", "valueA");
+  CheckGet("nameA", "valueA");
+  cache_.Clear();
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_hits());
+  cache_.ClearStats();
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_hits());
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheNoEvictionsOrDeletions) {
+  SpamHelper(false, false, "valu");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletions) {
+  SpamHelper(false, true, "valu");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithEvictions) {
+  // Use a big enough value pattern that the 10 inserts cannot all fit.
+  SpamHelper(true, false, "value-value-value-value-value-value-value");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletionsAndEvictions) {
+  SpamHelper(true, true, "value-value-value-value-value-value-value");
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,154 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_message_handler.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/stdio_file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/compressed_cache.h"
+#include "pagespeed/kernel/cache/compression_dictionary_builder.h"
+#include "pagespeed/kernel/util/gflags.h"
+
+// Trains a preset dictionary for CompressedCache from a dump of cache values,
+// one value per file, such as a file cache directory.  Directories named on
+// the command line are walked recursively.  Values that were written by a
+// CompressedCache are uncompressed first (pass --old_dictionary if they were
+// compressed against a dictionary).  The dictionary is written to --output,
+// or to stdout.
+
+namespace net_instaweb {
+
+DEFINE_string(output, "", "File to write the dictionary to.  Defaults to "
+              "standard output.");
+
+DEFINE_string(old_dictionary, "", "Dictionary that values in the dump were "
+              "compressed with, if any.");
+
+DEFINE_int32(dictionary_size, 16384,
+             "Maximum size of the dictionary in bytes.  zlib cannot use more "
+             "than 32768.  Larger dictionaries cost more CPU on every cache "
+             "write.");
+
+DEFINE_int64(max_sample_bytes, 16 << 20, "Stop reading values after this "
+             "many bytes.  Training memory use is a small multiple of this.");
+
+namespace {
+
+class Trainer {
+ public:
+  Trainer(FileSystem* file_system, MessageHandler* handler)
+      : file_system_(file_system), handler_(handler) {
+    builder_.set_max_sample_bytes(FLAGS_max_sample_bytes);
+  }
+
+  bool LoadOldDictionary() {
+    return FLAGS_old_dictionary.empty() ||
+        file_system_->ReadFile(FLAGS_old_dictionary.c_str(), &old_dictionary_,
+                               handler_);
+  }
+
+  // Returns false once the sample budget is used up.
+  bool AddPath(const GoogleString& path) {
+    if (file_system_->IsDir(path.c_str(), handler_).is_true()) {
+      StringVector files;
+      if (!file_system_->ListContents(path, &files, handler_)) {
+        return true;
+      }
+      for (int i = 0, n = files.size(); i < n; ++i) {
+        if (!AddPath(files[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+    GoogleString contents, value;
+    if (!file_system_->ReadFile(path.c_str(), &contents, handler_)) {
+      return true;
+    }
+    if (CompressedCache::UncompressPayload(contents, old_dictionary_,
+                                           &value)) {
+      return builder_.AddSample(value);
+    }
+    return builder_.AddSample(contents);
+  }
+
+  void Build(GoogleString* dictionary) {
+    builder_.Build(FLAGS_dictionary_size, dictionary);
+  }
+
+  const CompressionDictionaryBuilder& builder() const { return builder_; }
+
+ private:
+  FileSystem* file_system_;
+  MessageHandler* handler_;
+  GoogleString old_dictionary_;
+  CompressionDictionaryBuilder builder_;
+
+  DISALLOW_COPY_AND_ASSIGN(Trainer);
+};
+
+bool TrainCacheDictionaryMain(int argc, char** argv) {
+  FileMessageHandler handler(stderr);
+  StdioFileSystem file_system;
+  if (argc < 2) {
+    handler.Message(kError,
+                    "Usage: \n"
+                    "  train_cache_dictionary [--output=dict] "
+                    "[--old_dictionary=old_dict] [--dictionary_size=N] "
+                    "file_cache_dir...\n");
+    return false;
+  }
+  Trainer trainer(&file_system, &handler);
+  if (!trainer.LoadOldDictionary()) {
+    return false;
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (!trainer.AddPath(argv[i])) {
+      handler.Message(kInfo, "Read %s bytes of samples, ignoring the rest",
+                      Integer64ToString(FLAGS_max_sample_bytes).c_str());
+      break;
+    }
+  }
+  GoogleString dictionary;
+  trainer.Build(&dictionary);
+  handler.Message(kInfo, "Built a %d byte dictionary from %d samples",
+                  static_cast<int>(dictionary.size()),
+                  trainer.builder().num_samples());
+  if (FLAGS_output.empty()) {
+    return file_system.Stdout()->Write(dictionary, &handler);
+  }
+  return file_system.WriteFile(FLAGS_output.c_str(), dictionary, &handler);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
+
+int main(int argc, char** argv) {
+  net_instaweb::ParseGflags(argv[0], &argc, &argv);
+  return net_instaweb::TrainCacheDictionaryMain(argc, argv) ? EXIT_SUCCESS
+                                                            : EXIT_FAILURE;
+}
@@ -24,6 +24,7 @@
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/slab_pool.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_event.h"
@@ -33,9 +34,10 @@
 namespace net_instaweb {
 
 HtmlElement::HtmlElement(HtmlElement* parent, const HtmlName& name,
-    const HtmlEventListIterator& begin, const HtmlEventListIterator& end)
+    const HtmlEventListIterator& begin, const HtmlEventListIterator& end,
+    SlabPool* pool)
     : HtmlNode(parent),
-      data_(new Data(name, begin, end)) {
+      data_(new (pool) Data(name, begin, end, pool)) {
 }
 
 HtmlElement::~HtmlElement() {
@@ -43,14 +45,16 @@ HtmlElement::~HtmlElement() {
 
 HtmlElement::Data::Data(const HtmlName& name,
                         const HtmlEventListIterator& begin,
-                        const HtmlEventListIterator& end)
+                        const HtmlEventListIterator& end,
+                        SlabPool* pool)
     : begin_line_number_(0),
       live_(1),
       end_line_number_(0),
       style_(AUTO_CLOSE),
       name_(name),
       begin_(begin),
-      end_(end) {
+      end_(end),
+      pool_(pool) {
 }
 
 HtmlElement::Data::~Data() {
@@ -65,11 +69,13 @@ void HtmlElement::MarkAsDead(const HtmlEventListIterator& end) {
 }
 
 void HtmlElement::SynthesizeEvents(const HtmlEventListIterator& iter,
-                                   HtmlEventList* queue) {
+                                   HtmlEventList* queue, SlabPool* pool) {
   // We use -1 as a bogus line number, since these events are synthetic.
-  HtmlEvent* start_tag = new HtmlStartElementEvent(this, Data::kMaxLineNumber);
+  HtmlEvent* start_tag =
+      new (pool) HtmlStartElementEvent(this, Data::kMaxLineNumber);
   set_begin(queue->insert(iter, start_tag));
-  HtmlEvent* end_tag = new HtmlEndElementEvent(this, Data::kMaxLineNumber);
+  HtmlEvent* end_tag =
+      new (pool) HtmlEndElementEvent(this, Data::kMaxLineNumber);
   set_end(queue->insert(iter, end_tag));
 }
 
@@ -170,13 +176,13 @@ void HtmlElement::DebugPrint() const {
 }
 
 void HtmlElement::AddAttribute(const Attribute& src_attr) {
-  Attribute* attr = new Attribute(src_attr.name(),
-                                  src_attr.escaped_value(),
-                                  src_attr.quote_style());
+  Attribute* attr = new (data_->pool_) Attribute(
+      src_attr.name(), src_attr.escaped_value(), src_attr.quote_style(),
+      data_->pool_);
   if (src_attr.decoded_value_computed_) {
     attr->decoded_value_computed_ = true;
     attr->decoding_error_ = src_attr.decoding_error_;
-    Attribute::CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
+    attr->CopyValue(src_attr.decoded_value_, &attr->decoded_value_);
   }
   data_->attributes_.Append(attr);
 }
@@ -185,46 +191,57 @@ void HtmlElement::AddAttribute(const HtmlName& name,
                                const StringPiece& decoded_value,
                                QuoteStyle quote_style) {
   GoogleString buf;
-  Attribute* attr = new Attribute(name,
-                                  HtmlKeywords::Escape(decoded_value, &buf),
-                                  quote_style);
+  Attribute* attr = new (data_->pool_) Attribute(
+      name, HtmlKeywords::Escape(decoded_value, &buf), quote_style,
+      data_->pool_);
   attr->decoded_value_computed_ = true;
   attr->decoding_error_ = false;
-  Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  attr->CopyValue(decoded_value, &attr->decoded_value_);
   data_->attributes_.Append(attr);
 }
 
 void HtmlElement::AddEscapedAttribute(const HtmlName& name,
                                       const StringPiece& escaped_value,
                                       QuoteStyle quote_style) {
-  Attribute* attr = new Attribute(name, escaped_value, quote_style);
+  Attribute* attr = new (data_->pool_) Attribute(name, escaped_value,
+                                                 quote_style, data_->pool_);
   data_->attributes_.Append(attr);
 }
 
 void HtmlElement::Attribute::CopyValue(const StringPiece& src,
-                                       scoped_array<char>* dst) {
-  if (src.data() == NULL) {
-    // This case indicates attribute without value <tag attr>, as opposed
+                                       char** dst) const {
+  // Copy before freeing the old value, in case src points into it.
+  char* buf = NULL;
+  if (src.data() != NULL) {
+    // A NULL src indicates attribute without value <tag attr>, as opposed
     // to data()=="", which implies an empty value <tag attr=>.
-    dst->reset();
-  } else {
-    char* buf = new char[src.size() + 1];
+    buf = static_cast<char*>(SlabPool::Allocate(pool_, src.size() + 1));
     memcpy(buf, src.data(), src.size());
     buf[src.size()] = '\0';
-    dst->reset(buf);
   }
+  SlabPool::Free(*dst);
+  *dst = buf;
 }
 
 HtmlElement::Attribute::Attribute(const HtmlName& name,
                                   const StringPiece& escaped_value,
-                                  QuoteStyle quote_style)
-    : name_(name),
+                                  QuoteStyle quote_style,
+                                  SlabPool* pool)
+    : pool_(pool),
+      name_(name),
       quote_style_(quote_style),
       decoding_error_(false),
-      decoded_value_computed_(false) {
+      decoded_value_computed_(false),
+      escaped_value_(NULL),
+      decoded_value_(NULL) {
   CopyValue(escaped_value, &escaped_value_);
 }
 
+HtmlElement::Attribute::~Attribute() {
+  SlabPool::Free(escaped_value_);
+  SlabPool::Free(decoded_value_);
+}
+
 // Modify value of attribute (eg to rewrite dest of src or href).
 // As with the constructor, copies the string in, so caller retains
 // ownership of value.
@@ -233,7 +250,7 @@ void HtmlElement::Attribute::SetValue(const StringPiece& decoded_value) {
   // Note that we execute the lines in this order in case value
   // is a substring of value_.  This copies the value just prior
   // to deallocation of the old value_.
-  const char* escaped_chars = escaped_value_.get();
+  const char* escaped_chars = escaped_value_;
   DCHECK(decoded_value.data() + decoded_value.size() < escaped_chars ||
          escaped_chars + strlen(escaped_chars) < decoded_value.data())
       << "Setting unescaped value from substring of escaped value.";
@@ -246,14 +263,15 @@ void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
   // Note that we execute the lines in this order in case value
   // is a substring of value_.  This copies the value just prior
   // to deallocation of the old value_.
-  const char* value_chars = decoded_value_.get();
+  const char* value_chars = decoded_value_;
   if (value_chars != NULL) {
     DCHECK(value_chars + strlen(value_chars) < escaped_value.data() ||
            escaped_value.data() + escaped_value.size() < value_chars)
         << "Setting escaped value from substring of unescaped value.";
   }
 
-  decoded_value_.reset();
+  SlabPool::Free(decoded_value_);
+  decoded_value_ = NULL;
   decoding_error_ = false;
   decoded_value_computed_ = false;
 
@@ -275,7 +293,7 @@ const char* HtmlElement::Attribute::quote_str() const {
 void HtmlElement::Attribute::ComputeDecodedValue() const {
   GoogleString buf;
   StringPiece unescaped_value = HtmlKeywords::Unescape(
-      escaped_value_.get(), &buf, &decoding_error_);
+      escaped_value_, &buf, &decoding_error_);
   CopyValue(unescaped_value, &decoded_value_);
   decoded_value_computed_ = true;
 }
@@ -24,6 +24,7 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/inline_slist.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/slab_pool.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_name.h"
@@ -65,8 +66,11 @@ class HtmlElement : public HtmlNode {
     DOUBLE_QUOTE
   };
 
-  class Attribute : public InlineSListElement<Attribute> {
+  class Attribute : public InlineSListElement<Attribute>,
+                    public SlabPoolAllocated {
    public:
+    ~Attribute();
+
     // A large quantity of HTML in the wild has attributes that are
     // improperly escaped.  Browsers are generally tolerant of this.
     // But we want to avoid corrupting pages we do not understand.
@@ -90,7 +94,7 @@ class HtmlElement : public HtmlNode {
 
     // Returns the value in its original directly from the HTML source.
     // This may have HTML escapes in it, such as "&amp;".
-    const char* escaped_value() const { return escaped_value_.get(); }
+    const char* escaped_value() const { return escaped_value_; }
 
     // The result of DecodedValueOrNull() is still owned by this, and
     // will be invalidated by a subsequent call to SetValue().
@@ -121,7 +125,7 @@ class HtmlElement : public HtmlNode {
       if (!decoded_value_computed_) {
         ComputeDecodedValue();
       }
-      return decoded_value_.get();
+      return decoded_value_;
     }
 
     void set_decoding_error(bool x) { decoding_error_ = x; }
@@ -173,12 +177,16 @@ class HtmlElement : public HtmlNode {
    private:
     void ComputeDecodedValue() const;
 
-    // This should only be called from AddAttribute
+    // This should only be called from AddAttribute.  The attribute and its
+    // values are allocated from pool, which may be NULL to use the heap.
     Attribute(const HtmlName& name, const StringPiece& escaped_value,
-              QuoteStyle quote_style);
+              QuoteStyle quote_style, SlabPool* pool);
+
+    // Replaces *dst with a NUL-terminated copy of src allocated from pool_,
+    // or with NULL if src.data() is NULL.
+    inline void CopyValue(const StringPiece& src, char** dst) const;
 
-    static inline void CopyValue(const StringPiece& src,
-                                 scoped_array<char>* dst);
+    SlabPool* pool_;
 
     HtmlName name_;
     QuoteStyle quote_style_ : 8;
@@ -193,7 +201,7 @@ class HtmlElement : public HtmlNode {
     // Note that it is acceptable to have 8-bit characters in escape
     // sequences (typically iso8859).  However we will not be able to
     // decode such attributes.
-    scoped_array<char> escaped_value_;
+    char* escaped_value_;
 
     // An 8-bit representation of the escaped_value.  Escape sequences
     // that contain character-codes >= 256 are not decoded, and will
@@ -211,7 +219,7 @@ class HtmlElement : public HtmlNode {
     // Note that we do not decode non-ASCII characters but we can
     // represent them in escaped_value_.  We can get 8-bit characters
     // into decoded_value_ via &#129; etc.
-    mutable scoped_array<char> decoded_value_;
+    mutable char* decoded_value_;
 
     DISALLOW_COPY_AND_ASSIGN(Attribute);
   };
@@ -349,7 +357,7 @@ class HtmlElement : public HtmlNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
   virtual HtmlEventListIterator begin() const { return data_->begin_; }
   virtual HtmlEventListIterator end() const { return data_->end_; }
@@ -357,10 +365,12 @@ class HtmlElement : public HtmlNode {
  private:
   // All of the data associated with an HtmlElement is indirected through this
   // class, so we can delete it on Flush after a CloseElement event.
-  struct Data {
+  // It is allocated from the HtmlParse's SlabPool, as are the attributes.
+  struct Data : public SlabPoolAllocated {
     Data(const HtmlName& name,
          const HtmlEventListIterator& begin,
-         const HtmlEventListIterator& end);
+         const HtmlEventListIterator& end,
+         SlabPool* pool);
     ~Data();
 
     // Max value for the line numbers below.  Since they are 24-bits,
@@ -387,6 +397,7 @@ class HtmlElement : public HtmlNode {
     AttributeList attributes_;
     HtmlEventListIterator begin_;
     HtmlEventListIterator end_;
+    SlabPool* pool_;  // Where attributes are allocated; may be NULL.
   };
 
   // Begin/end event iterators are used by HtmlParse to keep track
@@ -401,7 +412,8 @@ class HtmlElement : public HtmlNode {
   // construct via HtmlParse::NewElement
   HtmlElement(HtmlElement* parent, const HtmlName& name,
               const HtmlEventListIterator& begin,
-              const HtmlEventListIterator& end);
+              const HtmlEventListIterator& end,
+              SlabPool* pool);
 
   // HtmlElement data is held in HtmlElement::Data*, which is freed
   // when a CloseElement is Flushed.  The pointers themselves are
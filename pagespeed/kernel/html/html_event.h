@@ -22,6 +22,7 @@
 #define PAGESPEED_KERNEL_HTML_HTML_EVENT_H_
 
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/slab_pool.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_element.h"
@@ -30,7 +31,9 @@
 
 namespace net_instaweb {
 
-class HtmlEvent {
+// Events are allocated from their HtmlParse's SlabPool, with
+// new (pool) HtmlFooEvent(...), so that they can be recycled.
+class HtmlEvent : public SlabPoolAllocated {
  public:
   explicit HtmlEvent(int line_number) : line_number_(line_number) {
   }
@@ -26,6 +26,10 @@
 #include <cstddef>  // for size_t
 #include <cstdio>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "base/logging.h"
 #include "strings/stringpiece_utils.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -148,6 +152,44 @@ bool IsInSet(const HtmlName::Keyword* keywords, int num,
 #define IS_IN_SET(keywords, keyword) \
     IsInSet(keywords, arraysize(keywords), keyword)
 
+// Returns the first byte in [begin, end) that is either a or b, or end if
+// there is none, and adds the number of newlines before it to *newlines.
+// This is how the lexer gets through runs of bytes that cannot change its
+// state, so where SSE2 is available it looks at 16 bytes at a time.
+const char* ScanUntil(const char* begin, const char* end, char a, char b,
+                      int* newlines) {
+  const char* p = begin;
+#if defined(__SSE2__)
+  const __m128i match_a = _mm_set1_epi8(a);
+  const __m128i match_b = _mm_set1_epi8(b);
+  const __m128i match_newline = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned found = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(bytes, match_a),
+                     _mm_cmpeq_epi8(bytes, match_b)));
+    unsigned newline_bits =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, match_newline));
+    if (found != 0) {
+      int pos = __builtin_ctz(found);
+      *newlines += __builtin_popcount(newline_bits & ((1u << pos) - 1));
+      return p + pos;
+    }
+    *newlines += __builtin_popcount(newline_bits);
+  }
+#endif
+  for (; p < end; ++p) {
+    char c = *p;
+    if (c == a || c == b) {
+      break;
+    }
+    if (c == '\n') {
+      ++*newlines;
+    }
+  }
+  return p;
+}
+
 }  // namespace
 
 // TODO(jmarantz): support multi-byte encodings
@@ -641,7 +683,7 @@ void HtmlLexer::EvalScriptTag(char c) {
 // Emits raw uninterpreted characters.
 void HtmlLexer::EmitLiteral() {
   if (!literal_.empty()) {
-    html_parse_->AddEvent(new HtmlCharactersEvent(
+    html_parse_->AddEvent(new (&html_parse_->slab_pool_) HtmlCharactersEvent(
         html_parse_->NewCharactersNode(Parent(), literal_), tag_start_line_));
     literal_.clear();
   }
@@ -658,10 +700,12 @@ void HtmlLexer::EmitComment() {
       (token_.find("[endif]") != GoogleString::npos)) {
     HtmlIEDirectiveNode* node =
         html_parse_->NewIEDirectiveNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlIEDirectiveEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (&html_parse_->slab_pool_) HtmlIEDirectiveEvent(
+        node, tag_start_line_));
   } else {
     HtmlCommentNode* node = html_parse_->NewCommentNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlCommentEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (&html_parse_->slab_pool_) HtmlCommentEvent(
+        node, tag_start_line_));
   }
   token_.clear();
   state_ = START;
@@ -669,7 +713,7 @@ void HtmlLexer::EmitComment() {
 
 void HtmlLexer::EmitCdata() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlCdataEvent(
+  html_parse_->AddEvent(new (&html_parse_->slab_pool_) HtmlCdataEvent(
       html_parse_->NewCdataNode(Parent(), token_), tag_start_line_));
   token_.clear();
   state_ = START;
@@ -754,6 +798,33 @@ HtmlElement* HtmlLexer::Parent() const {
   return element_stack_.back();
 }
 
+bool HtmlLexer::TakeOpenStyleText(GoogleString* text, int* line_number) {
+  HtmlElement* parent = Parent();
+  if ((state_ != LITERAL_TAG) || (parent == NULL) ||
+      (parent->keyword() != HtmlName::kStyle)) {
+    return false;
+  }
+
+  // Hold back the longest suffix of literal_ that could still grow into
+  // literal_close_, e.g. "</sty" when the close is "</style>".
+  size_t keep = std::min(literal_.size(), literal_close_.size() - 1);
+  for (; keep > 0; --keep) {
+    if (StringCaseEqual(
+            StringPiece(literal_.data() + literal_.size() - keep, keep),
+            StringPiece(literal_close_.data(), keep))) {
+      break;
+    }
+  }
+  size_t release = literal_.size() - keep;
+  if (release == 0) {
+    return false;
+  }
+  text->assign(literal_, 0, release);
+  literal_.erase(0, release);
+  *line_number = tag_start_line_;
+  return true;
+}
+
 void HtmlLexer::MakeElement() {
   DCHECK(!discard_until_start_state_for_error_recovery_);
   if (element_ == NULL) {
@@ -1017,7 +1088,7 @@ void HtmlLexer::EmitTagClose(HtmlElement::Style style) {
 
 void HtmlLexer::EmitDirective() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlDirectiveEvent(
+  html_parse_->AddEvent(new (&html_parse_->slab_pool_) HtmlDirectiveEvent(
       html_parse_->NewDirectiveNode(Parent(), token_), line_));
   // Update the doctype; note that if this is not a doctype directive, Parse()
   // will return false and not alter doctype_.
@@ -1039,6 +1110,10 @@ void HtmlLexer::Parse(const char* text, int size) {
       // Return without doing anything if skip_parsing_ is true.
       return;
     }
+    i += SkipInertRun(text + i, size - i);
+    if (i == size) {
+      break;
+    }
     char c = text[i];
     if (c == '\n') {
       ++line_;
@@ -1088,6 +1163,44 @@ void HtmlLexer::Parse(const char* text, int size) {
   }
 }
 
+int HtmlLexer::SkipInertRun(const char* text, int size) {
+  // Each of these states only acts on one or two bytes, and otherwise just
+  // accumulates what it sees.
+  char a, b;
+  GoogleString* token = NULL;
+  switch (state_) {
+    case START:           a = b = '<';                         break;
+    case COMMENT_BODY:    a = b = '-';  token = &token_;       break;
+    case CDATA_BODY:      a = b = ']';  token = &token_;       break;
+    case TAG_ATTR_VALDQ:  a = b = '"';  token = &attr_value_;  break;
+    case TAG_ATTR_VALSQ:  a = b = '\''; token = &attr_value_;  break;
+    case LITERAL_TAG:     a = b = '>';                         break;
+    case SCRIPT_TAG: {
+      // EvalScriptTag acts on '-', and on whitespace, '/' or '>' following
+      // "</script", "<script" or "--". So once the last few bytes seen hold
+      // no '<' or '-', everything up to the next one is inert.
+      const size_t kTail = STATIC_STRLEN("</script");
+      size_t tail_start = literal_.size() > kTail ? literal_.size() - kTail : 0;
+      if (literal_.find_first_of("<-", tail_start) != GoogleString::npos) {
+        return 0;
+      }
+      a = '<';
+      b = '-';
+      break;
+    }
+    default:
+      return 0;
+  }
+
+  const char* end = ScanUntil(text, text + size, a, b, &line_);
+  int run = end - text;
+  literal_.append(text, run);
+  if (token != NULL) {
+    token->append(text, run);
+  }
+  return run;
+}
+
 // The HTML-input sloppiness in these three methods is applied independent
 // of whether we think the document is XHTML, either via doctype or
 // mime-type.  The internet is full of lies.  See Issue 252:
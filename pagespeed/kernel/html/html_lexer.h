@@ -86,6 +86,13 @@ class HtmlLexer {
   // NULL if the stack is empty.
   HtmlElement* Parent() const;
 
+  // If the lexer is partway through the contents of a <style> element, moves
+  // the text buffered so far into *text, sets *line_number to the line it
+  // started on, and returns true.  Any trailing bytes that might begin the
+  // closing tag are kept back so the close is still recognized.  Returns
+  // false, leaving the outputs untouched, otherwise.
+  bool TakeOpenStyleText(GoogleString* text, int* line_number);
+
   // Return the current assumed doctype of the document (based on the content
   // type and any HTML directives encountered so far).
   const DocType& doctype() const { return doctype_; }
@@ -131,6 +138,12 @@ class HtmlLexer {
   inline void EvalDirective(char c);
   inline void EvalBogusComment(char c);
 
+  // Consumes the longest prefix of text that cannot change state_ in the
+  // current state, appending it wherever the Eval method for the state would,
+  // and returns its length. Lets Parse skip over character data, comments,
+  // attribute values and literal tag bodies in bulk.
+  int SkipInertRun(const char* text, int size);
+
   // Makes an element based on token_, which will be parsed as the tag
   // name.
   void MakeElement();
@@ -35,6 +35,7 @@ namespace net_instaweb {
 
 class HtmlElement;
 class HtmlEvent;
+class SlabPool;
 
 typedef std::list<HtmlEvent*> HtmlEventList;
 typedef HtmlEventList::iterator HtmlEventListIterator;
@@ -76,8 +77,9 @@ class HtmlNode {
   // the queue just before the given iterator; also, update this node object as
   // necessary so that begin() and end() will return iterators pointing to
   // the new event(s).  The line number for each event should probably be -1.
+  // The events are allocated from pool.
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue) = 0;
+                                HtmlEventList* queue, SlabPool* pool) = 0;
 
   // Return an iterator pointing to the first event associated with this node.
   virtual HtmlEventListIterator begin() const = 0;
@@ -153,7 +155,7 @@ class HtmlCdataNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
  private:
   HtmlCdataNode(HtmlElement* parent,
@@ -179,7 +181,7 @@ class HtmlCharactersNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
  private:
   HtmlCharactersNode(HtmlElement* parent,
@@ -199,7 +201,7 @@ class HtmlCommentNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
  private:
   HtmlCommentNode(HtmlElement* parent,
@@ -219,7 +221,7 @@ class HtmlIEDirectiveNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
  private:
   HtmlIEDirectiveNode(HtmlElement* parent,
@@ -239,7 +241,7 @@ class HtmlDirectiveNode : public HtmlLeafNode {
 
  protected:
   virtual void SynthesizeEvents(const HtmlEventListIterator& iter,
-                                HtmlEventList* queue);
+                                HtmlEventList* queue, SlabPool* pool);
 
  private:
   HtmlDirectiveNode(HtmlElement* parent,
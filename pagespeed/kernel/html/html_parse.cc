@@ -63,6 +63,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       log_rewrite_timing_(false),
       running_filters_(false),
       buffer_events_(false),
+      split_style_at_flush_(false),
       parse_start_time_us_(0),
       timer_(NULL),
       current_filter_(NULL),
@@ -223,7 +224,8 @@ HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
   }
 #endif
   HtmlElement* element =
-      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end());
+      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end(),
+                                &slab_pool_);
   if (IsOptionallyClosedTag(name.keyword())) {
     // When we programmatically insert HTML nodes we should default to
     // including an explicit close-tag if they are optionally closed
@@ -235,7 +237,7 @@ HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
 
 void HtmlParse::AddElement(HtmlElement* element, int line_number) {
   HtmlStartElementEvent* event =
-      new HtmlStartElementEvent(element, line_number);
+      new (&slab_pool_) HtmlStartElementEvent(element, line_number);
   AddEvent(event);
   element->set_begin(Last());
   element->set_begin_line_number(line_number);
@@ -279,7 +281,7 @@ bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
       parse_start_time_us_ = timer_->NowUs();
       InfoHere("HtmlParse::StartParse");
     }
-    AddEvent(new HtmlStartDocumentEvent(line_number_));
+    AddEvent(new (&slab_pool_) HtmlStartDocumentEvent(line_number_));
     lexer_->StartParse(id, content_type);
   }
   return url_valid_;
@@ -310,7 +312,7 @@ void HtmlParse::BeginFinishParse() {
     lexer_->FinishParse();
     DCHECK(delayed_start_literal_.get() == NULL);
     delayed_start_literal_.reset();
-    AddEvent(new HtmlEndDocumentEvent(line_number_));
+    AddEvent(new (&slab_pool_) HtmlEndDocumentEvent(line_number_));
   }
 }
 
@@ -419,6 +421,25 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   current_filter_ = NULL;
 }
 
+void HtmlParse::SplitOpenStyle() {
+  GoogleString text;
+  int line_number;
+  if (!split_style_at_flush_ || buffer_events_ ||
+      !lexer_->TakeOpenStyleText(&text, &line_number)) {
+    return;
+  }
+  HtmlElement* style = lexer_->Parent();
+  if (delayed_start_literal_.get() != NULL) {
+    // DelayLiteralTag held the <style> back from an earlier flush window.
+    // Release it now, ahead of the first text we have for it.
+    DCHECK_EQ(style, delayed_start_literal_->GetElementIfStartEvent());
+    queue_.push_back(delayed_start_literal_.release());
+    style->set_begin(Last());
+  }
+  AddEvent(new (&slab_pool_) HtmlCharactersEvent(
+      NewCharactersNode(style, text), line_number));
+}
+
 void HtmlParse::NextEvent() {
   if (skip_increment_) {
     skip_increment_ = false;
@@ -554,6 +575,7 @@ void HtmlParse::Flush() {
   // will propagate to filters before the behavior of the filter has been
   // determined (Enabled/CanModifyUrls), so we call that here.
   DetermineFiltersBehavior();
+  SplitOpenStyle();
 
   for (FilterVector::iterator it = event_listeners_.begin();
       it != event_listeners_.end(); ++it) {
@@ -680,7 +702,7 @@ void HtmlParse::InsertNodeBeforeEvent(const HtmlEventListIterator& event,
                                       HtmlNode* new_node) {
   need_sanity_check_ = true;
   need_coalesce_characters_ = true;
-  new_node->SynthesizeEvents(event, &queue_);
+  new_node->SynthesizeEvents(event, &queue_, &slab_pool_);
 }
 
 void HtmlParse::InsertNodeAfterEvent(const HtmlEventListIterator& event,
@@ -1198,7 +1220,7 @@ void HtmlParse::CloseElement(
   }
 
   HtmlEndElementEvent* end_event =
-      new HtmlEndElementEvent(element, line_number);
+      new (&slab_pool_) HtmlEndElementEvent(element, line_number);
   if (element->style() != HtmlElement::INVISIBLE) {
     element->set_style(style);
   }
@@ -1290,8 +1312,8 @@ bool HtmlParse::InsertComment(StringPiece unescaped) {
     if (parent != NULL && IsLiteralTag(parent->keyword())) {
       return false;
     }
-    AddEvent(
-        new HtmlCommentEvent(NewCommentNode(lexer_->Parent(), escaped), 0));
+    AddEvent(new (&slab_pool_) HtmlCommentEvent(
+        NewCommentNode(lexer_->Parent(), escaped), 0));
   }
   return true;
 }
@@ -33,6 +33,7 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/printf_format.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/slab_pool.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/symbol_table.h"
@@ -441,12 +442,23 @@ class HtmlParse {
   // Run a filter on the current queue of parse nodes.
   void ApplyFilter(HtmlFilter* filter);
 
+  // If split_style_at_flush() is set and the lexer is inside a <style>
+  // element, adds the text lexed so far to the queue as a Characters node.
+  // Call this at the start of a flush, before running any filter.
+  void SplitOpenStyle();
+
   // Provide timer to helping to report timing of each filter.  You must also
   // set_log_rewrite_timing(true) to turn on this reporting.
   void set_timer(Timer* timer) { timer_ = timer; }
   Timer* timer() const { return timer_; }
   void set_log_rewrite_timing(bool x) { log_rewrite_timing_ = x; }
 
+  // Events, element data and attributes are allocated from this pool, which
+  // lives as long as the HtmlParse, so that a parser (e.g. a RewriteDriver
+  // in a RewriteDriverPool) reused for many documents recycles their memory
+  // rather than going back to the heap.  Exposed for its statistics.
+  const SlabPool& slab_pool() const { return slab_pool_; }
+
   // Adds a filter to be called during parsing as new events are added.
   // Takes ownership of the HtmlFilter passed in.
   void add_event_listener(HtmlFilter* listener);
@@ -467,6 +479,15 @@ class HtmlParse {
   // Returns whether we have exceeded the size limit.
   bool size_limit_exceeded() const;
 
+  // Normally a <style> element that is still open at a flush is held back,
+  // start tag and all, until its close tag arrives, so that filters see its
+  // contents as a single Characters node.  When this is set, each flush
+  // instead releases the style text received so far as a Characters node of
+  // its own, so a filter may see one such node per flush window until the
+  // element closes.  Only set this if every filter is prepared for that.
+  void set_split_style_at_flush(bool x) { split_style_at_flush_ = x; }
+  bool split_style_at_flush() const { return split_style_at_flush_; }
+
   // For debugging purposes. If this vector is supplied, DetermineEnabledFilters
   // will populate it with the list of Filters that were disabled, plus the
   // associated reason, if supplied by the Filter. Caller retains ownership
@@ -635,6 +656,8 @@ class HtmlParse {
   // right before calling the Filters.
   void DelayLiteralTag();
 
+  // Declared first so it is destroyed after everything allocated from it.
+  SlabPool slab_pool_;
   FilterVector event_listeners_;
   SymbolTableSensitive string_table_;
   FilterList filters_;
@@ -659,6 +682,7 @@ class HtmlParse {
   bool log_rewrite_timing_;  // Should we time the speed of parsing?
   bool running_filters_;
   bool buffer_events_;
+  bool split_style_at_flush_;
   int64 parse_start_time_us_;
   scoped_ptr<HtmlEvent> delayed_start_literal_;
   Timer* timer_;
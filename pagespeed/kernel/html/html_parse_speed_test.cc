@@ -43,6 +43,7 @@
 #include "pagespeed/kernel/base/google_message_handler.h"
 #include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/null_writer.h"
+#include "pagespeed/kernel/base/slab_pool.h"
 #include "pagespeed/kernel/base/stdio_file_system.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -94,6 +95,18 @@ const StringPiece GetHtmlText() {
   return *sHtmlText;
 }
 
+// Logs how many events, element data and attributes the parser allocated per
+// document, and how few of those allocations reached the system allocator
+// once its SlabPool had warmed up.
+void ReportAllocations(const char* name, const HtmlParse& parser, int iters) {
+  const SlabPool& pool = parser.slab_pool();
+  LOG(INFO) << name << ": " << (pool.num_allocations() / iters)
+            << " pooled allocations per document; "
+            << pool.num_system_allocations()
+            << " system allocations over " << iters << " documents ("
+            << pool.slab_bytes() << " bytes of slabs)";
+}
+
 static void BM_ParseAndSerializeNewParserEachIter(int iters) {
   StopBenchmarkTiming();
   StringPiece text = GetHtmlText();
@@ -136,6 +149,8 @@ static void BM_ParseAndSerializeReuseParser(int iters) {
     parser.ParseText(text);
     parser.FinishParse();
   }
+  StopBenchmarkTiming();
+  ReportAllocations("ReuseParser", parser, iters);
 }
 BENCHMARK(BM_ParseAndSerializeReuseParser);
 
@@ -165,9 +180,86 @@ static void BM_ParseAndSerializeReuseParserX50(int iters) {
     parser.ParseText(text);
     parser.FinishParse();
   }
+  StopBenchmarkTiming();
+  ReportAllocations("ReuseParserX50", parser, iters);
 }
 BENCHMARK(BM_ParseAndSerializeReuseParserX50);
 
+// The remaining benchmarks use synthetic documents, so they run even
+// without the testdata directory.  Each is dominated by long runs the lexer
+// can skip over in bulk: prose, script/style bodies, and attribute values.
+void ParseAndSerializeSynthetic(const char* name, int iters,
+                                const GoogleString& text) {
+  NullWriter writer;
+  NullMessageHandler handler;
+  HtmlParse parser(&handler);
+  HtmlWriterFilter writer_filter(&parser);
+  parser.AddFilter(&writer_filter);
+  writer_filter.set_writer(&writer);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < iters; ++i) {
+    parser.StartParse("http://example.com/benchmark");
+    parser.ParseText(text);
+    parser.FinishParse();
+  }
+  StopBenchmarkTiming();
+  ReportAllocations(name, parser, iters);
+}
+
+static void BM_ParseAndSerializeTextHeavy(int iters) {
+  StopBenchmarkTiming();
+  GoogleString text = "<html><body>\n";
+  for (int i = 0; i < 2000; ++i) {
+    StrAppend(&text, "<p>Lorem ipsum dolor sit amet, consectetur adipiscing "
+              "elit, sed do eiusmod tempor incididunt ut labore et dolore "
+              "magna aliqua.\nUt enim ad minim veniam, quis nostrud "
+              "exercitation ullamco laboris nisi ut aliquip ex ea commodo "
+              "consequat.</p>\n");
+  }
+  StrAppend(&text, "</body></html>\n");
+  ParseAndSerializeSynthetic("TextHeavy", iters, text);
+}
+BENCHMARK(BM_ParseAndSerializeTextHeavy);
+
+static void BM_ParseAndSerializeScriptHeavy(int iters) {
+  StopBenchmarkTiming();
+  GoogleString text = "<html><head>\n";
+  for (int i = 0; i < 200; ++i) {
+    StrAppend(&text, "<style>\n");
+    for (int j = 0; j < 20; ++j) {
+      StrAppend(&text, ".c", IntegerToString(j), " > .d { margin: 0 auto; "
+                "padding: 4px 8px; color: #333; font: 12px/1.5 sans-serif; }\n");
+    }
+    StrAppend(&text, "</style>\n<script>\n");
+    for (int j = 0; j < 20; ++j) {
+      StrAppend(&text, "  var v", IntegerToString(j), " = (function(a, b) "
+                "{ return a.concat(b).join(\",\"); })([1, 2, 3], [4, 5]);\n");
+    }
+    StrAppend(&text, "</script>\n");
+  }
+  StrAppend(&text, "</head><body></body></html>\n");
+  ParseAndSerializeSynthetic("ScriptHeavy", iters, text);
+}
+BENCHMARK(BM_ParseAndSerializeScriptHeavy);
+
+static void BM_ParseAndSerializeAttributeHeavy(int iters) {
+  StopBenchmarkTiming();
+  GoogleString data_uri = "data:image/png;base64,";
+  for (int i = 0; i < 64; ++i) {
+    StrAppend(&data_uri, "iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlE");
+  }
+  GoogleString text = "<html><body>\n";
+  for (int i = 0; i < 500; ++i) {
+    StrAppend(&text, "<img src=\"", data_uri, "\" srcset='/img/a-320.jpg "
+              "320w, /img/a-640.jpg 640w, /img/a-1280.jpg 1280w, "
+              "/img/a-2560.jpg 2560w' alt=\"A fairly descriptive alt text\">\n");
+  }
+  StrAppend(&text, "</body></html>\n");
+  ParseAndSerializeSynthetic("AttributeHeavy", iters, text);
+}
+BENCHMARK(BM_ParseAndSerializeAttributeHeavy);
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -1086,6 +1086,40 @@ TEST_F(HtmlAnnotationTest, FlushDoesNotBreakStyleTag) {
                annotation());
 }
 
+TEST_F(HtmlAnnotationTest, SplitStyleTagAtFlush) {
+  SetupWriter();
+  annotation_.set_annotate_flush(true);
+  html_parse_.set_split_style_at_flush(true);
+  html_parse_.StartParse("http://test.com/split_flush.html");
+  html_parse_.ParseText("<style>");
+  html_parse_.Flush();
+  html_parse_.ParseText(".blue {color: ");
+  html_parse_.Flush();
+  html_parse_.ParseText("blue;}</St");  // Possible start of the close is kept.
+  html_parse_.Flush();
+  html_parse_.ParseText("yle><script>a=b;");  // Scripts are still held back.
+  html_parse_.Flush();
+  html_parse_.ParseText("</script><style>x</style>");
+  html_parse_.FinishParse();
+  EXPECT_STREQ("[F] +style '.blue {color: '[F] 'blue;}'[F] -style(e)[F]"
+               " +script 'a=b;' -script(e) +style 'x' -style(e)[F]",
+               annotation());
+  EXPECT_STREQ("<style>.blue {color: blue;}</style>"
+               "<script>a=b;</script><style>x</style>",
+               output_buffer_);
+}
+
+TEST_F(HtmlAnnotationTest, SplitStyleTagAtFlushKeepsCloseLookalike) {
+  annotation_.set_annotate_flush(true);
+  html_parse_.set_split_style_at_flush(true);
+  html_parse_.StartParse("http://test.com/split_flush.html");
+  html_parse_.ParseText("<style>a</b</");
+  html_parse_.Flush();
+  html_parse_.ParseText("x</style>");
+  html_parse_.FinishParse();
+  EXPECT_STREQ("+style 'a</b'[F] '</x' -style(e)[F]", annotation());
+}
+
 TEST_F(HtmlAnnotationTest, UnclosedScriptOnly) {
   SetupWriter();
   annotation_.set_annotate_flush(true);
@@ -1127,6 +1161,66 @@ TEST_F(HtmlAnnotationTest, NulInAttrName) {
   html_parse_.FinishParse();
 }
 
+namespace {
+
+// Records the line each element starts on.
+class LineRecordingFilter : public EmptyHtmlFilter {
+ public:
+  virtual void StartElement(HtmlElement* element) {
+    StrAppend(&lines_, element->name_str(), "@",
+              IntegerToString(element->begin_line_number()), " ");
+  }
+
+  virtual const char* Name() const { return "LineRecordingFilter"; }
+
+  const GoogleString& lines() const { return lines_; }
+  void Clear() { lines_.clear(); }
+
+ private:
+  GoogleString lines_;
+};
+
+}  // namespace
+
+TEST_F(HtmlAnnotationTest, LongRunsLexSameAsBytewise) {
+  // The lexer skips over long stretches of text, attribute values, comments,
+  // CDATA and literal tag bodies in bulk. Make sure that doing so gets the
+  // same results as seeing one byte at a time.
+  const GoogleString filler = "0123456789 abcdefghijklmnopqrstuvwxyz\n";
+  const GoogleString html = StrCat(
+      StrCat("text ", filler, filler,
+             "<div title=\"", filler, "x\" alt='", filler, "'>"),
+      StrCat("a - b <!--", filler, "-", filler, "-- -->"),
+      StrCat("<![CDATA[", filler, "]", filler, "]]>"),
+      StrCat("<style>", filler, "a>b{}", filler, "</style>"),
+      StrCat("<script>", filler, "if (a<b && c--) {}", filler,
+             StrCat("<!--", filler, "<script>", filler, "</script>", filler),
+             StrCat("-->", filler, "</script>")),
+      StrCat("<p>", filler, "</div>"));
+
+  SetupWriter();
+  LineRecordingFilter lines;
+  html_parse_.AddFilter(&lines);
+  html_parse_.StartParse("http://test.com/long_runs.html");
+  html_parse_.ParseText(html);
+  html_parse_.FinishParse();
+  EXPECT_EQ(html, output_buffer_);
+  EXPECT_EQ("div@3 style@9 script@11 p@17 ", lines.lines());
+  GoogleString whole_annotation = annotation();
+
+  ResetAnnotation();
+  lines.Clear();
+  output_buffer_.clear();
+  html_parse_.StartParse("http://test.com/long_runs_bytewise.html");
+  for (int i = 0, n = html.size(); i < n; ++i) {
+    html_parse_.ParseText(html.substr(i, 1));
+  }
+  html_parse_.FinishParse();
+  EXPECT_EQ(html, output_buffer_);
+  EXPECT_EQ("div@3 style@9 script@11 p@17 ", lines.lines());
+  EXPECT_EQ(whole_annotation, annotation());
+}
+
 TEST_F(HtmlParseTest, MakeName) {
   EXPECT_EQ(0, HtmlTestingPeer::symbol_table_size(&html_parse_));
 
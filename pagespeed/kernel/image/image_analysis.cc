@@ -23,6 +23,10 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PHOTO_METRIC_SSE2
+#endif
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -51,6 +55,15 @@ const float kHistogramThreshold = 0.01;
 // or a completely opaque alpha channel.
 const float kPhotoMetricThreshold = 16;
 
+// Side of the square blocks which IsPhotoSampled() samples.
+const int kPhotoSampleBlockSize = 16;
+
+// IsPhotoSampled() may stop early once the metric is this many times larger,
+// or smaller, than kPhotoMetricThreshold, over at least
+// kMinSamplesForEarlyDecision samples.
+const float kEarlyDecisionMargin = 2.0f;
+const int kMinSamplesForEarlyDecision = 1 << 15;
+
 template <class T>
 inline T AbsDif(T v1, T v2) {
   return (v1 >= v2 ? v1 - v2 : v2 - v1);
@@ -257,6 +270,288 @@ bool IsPhoto(ScanlineReaderInterface* reader, MessageHandler* handler) {
   return metric >= kPhotoMetricThreshold;
 }
 
+namespace {
+
+// Computes the Sobel gradient of row 'row' for x0 <= x < x1, in exactly the
+// way ComputeGradientFromLuminance() does, and writes it to out[x - x0].
+// 'above' and 'below' are the neighboring rows; all three hold luminance
+// which has not been normalized yet. Requires 1 <= x0 and x1 < width.
+void GradientSpan(const int16_t* above, const int16_t* row,
+                  const int16_t* below, int x0, int x1, float norm_factor,
+                  uint8_t* out) {
+  int x = x0;
+#ifdef PHOTO_METRIC_SSE2
+  // The differences fit in 16 bits, so _mm_madd_epi16 on interleaved
+  // (dif_x, dif_y) pairs yields dif_x^2 + dif_y^2 as exact 32-bit integers.
+  // The square root and scaling are done in single precision, as in the
+  // scalar code, so the results are identical.
+  const __m128 norm = _mm_set1_ps(norm_factor);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 max_value = _mm_set1_ps(255.0f);
+  for (; x + 8 <= x1; x += 8) {
+    const __m128i a_l =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+    const __m128i a_c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+    const __m128i a_r =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x + 1));
+    const __m128i c_l =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+    const __m128i c_r =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+    const __m128i b_l =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x - 1));
+    const __m128i b_c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+    const __m128i b_r =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x + 1));
+
+    const __m128i dif_y = _mm_sub_epi16(
+        _mm_add_epi16(_mm_add_epi16(a_l, a_r), _mm_slli_epi16(a_c, 1)),
+        _mm_add_epi16(_mm_add_epi16(b_l, b_r), _mm_slli_epi16(b_c, 1)));
+    const __m128i dif_x = _mm_sub_epi16(
+        _mm_add_epi16(_mm_add_epi16(a_l, b_l), _mm_slli_epi16(c_l, 1)),
+        _mm_add_epi16(_mm_add_epi16(a_r, b_r), _mm_slli_epi16(c_r, 1)));
+
+    const __m128i pairs_lo = _mm_unpacklo_epi16(dif_x, dif_y);
+    const __m128i pairs_hi = _mm_unpackhi_epi16(dif_x, dif_y);
+    __m128 dif_lo = _mm_cvtepi32_ps(_mm_madd_epi16(pairs_lo, pairs_lo));
+    __m128 dif_hi = _mm_cvtepi32_ps(_mm_madd_epi16(pairs_hi, pairs_hi));
+    dif_lo = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(dif_lo), norm), half);
+    dif_hi = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(dif_hi), norm), half);
+    dif_lo = _mm_min_ps(dif_lo, max_value);
+    dif_hi = _mm_min_ps(dif_hi, max_value);
+
+    const __m128i gradient = _mm_packs_epi32(_mm_cvttps_epi32(dif_lo),
+                                             _mm_cvttps_epi32(dif_hi));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x - x0),
+                     _mm_packus_epi16(gradient, gradient));
+  }
+#endif
+  for (; x < x1; ++x) {
+    int32_t dif_y =
+        static_cast<int32_t>(above[x - 1]) +
+        (static_cast<int32_t>(above[x]) << 1) +
+        static_cast<int32_t>(above[x + 1]) -
+        static_cast<int32_t>(below[x - 1]) -
+        (static_cast<int32_t>(below[x]) << 1) -
+        static_cast<int32_t>(below[x + 1]);
+    int32_t dif_x =
+        static_cast<int32_t>(above[x - 1]) +
+        (static_cast<int32_t>(row[x - 1]) << 1) +
+        static_cast<int32_t>(below[x - 1]) -
+        static_cast<int32_t>(above[x + 1]) -
+        (static_cast<int32_t>(row[x + 1]) << 1) -
+        static_cast<int32_t>(below[x + 1]);
+    float dif2 = static_cast<float>(dif_x * dif_x + dif_y * dif_y);
+    float dif = std::sqrt(dif2) * norm_factor + 0.5f;
+    out[x - x0] = static_cast<uint8_t>(std::min(255.0f, dif));
+  }
+}
+
+// Accumulates the gradient histogram of an image fed to it one row at a time.
+// See IsPhotoSampled() for the sampling scheme.
+class PhotoMetricSampler {
+ public:
+  PhotoMetricSampler(int width, int height, int num_channels,
+                     int max_samples)
+      : width_(width),
+        height_(height),
+        num_channels_(num_channels),
+        step_(1),
+        norm_factor_(num_channels == 1 ? 1.0f : 1.0f / 3.0f),
+        row_index_(0),
+        num_samples_(0),
+        is_decided_(false),
+        is_photo_(false),
+        gradient_(new uint8_t[width]) {
+    norm_factor_ *= 0.25;  // Remove the magnification factor of Sobel filter.
+    const int64 num_interior_pixels =
+        static_cast<int64>(width - 2) * (height - 2);
+    if (max_samples > 0 && num_interior_pixels > max_samples) {
+      step_ = static_cast<int>(std::ceil(std::sqrt(
+          static_cast<double>(num_interior_pixels) / max_samples)));
+    }
+    for (int i = 0; i < 3; ++i) {
+      luminance_[i].reset(new int16_t[width]);
+    }
+    memset(hist_, 0, sizeof(hist_));
+  }
+
+  // Feeds the next row of the image. Returns false once the rest of the
+  // image no longer matters.
+  bool AddRow(const uint8_t* scanline) {
+    const int y = row_index_++;
+    if (IsLuminanceNeeded(y)) {
+      ComputeLuminance(scanline, luminance_[y % 3].get());
+    }
+    // Row 'y' completes the neighborhood of interior row 'y - 1'.
+    const int interior_y = y - 1;
+    if (interior_y >= 1 && IsSampledBand(Band(interior_y))) {
+      AddGradientRow(interior_y);
+      if (step_ > 1 && IsLastRowOfBand(interior_y)) {
+        MaybeDecideEarly(y + 1);
+      }
+    }
+    return !is_decided_;
+  }
+
+  bool IsPhoto() {
+    if (is_decided_) {
+      return is_photo_;
+    }
+    return Metric() >= kPhotoMetricThreshold;
+  }
+
+ private:
+  int Band(int interior_y) const {
+    return (interior_y - 1) / kPhotoSampleBlockSize;
+  }
+
+  bool IsSampledBand(int band) const {
+    return band % step_ == 0;
+  }
+
+  bool IsInteriorSampledRow(int y) const {
+    return y >= 1 && y < height_ - 1 && IsSampledBand(Band(y));
+  }
+
+  bool IsLuminanceNeeded(int y) const {
+    return IsInteriorSampledRow(y - 1) || IsInteriorSampledRow(y) ||
+        IsInteriorSampledRow(y + 1);
+  }
+
+  bool IsLastRowOfBand(int interior_y) const {
+    return interior_y == height_ - 2 ||
+        (interior_y % kPhotoSampleBlockSize) == 0;
+  }
+
+  // Luminance is the sum of R, G, and B, which fits in 16 bits.
+  void ComputeLuminance(const uint8_t* scanline, int16_t* luminance) {
+    if (num_channels_ == 1) {
+      for (int x = 0; x < width_; ++x) {
+        luminance[x] = scanline[x];
+      }
+    } else {
+      for (int x = 0; x < width_; ++x, scanline += num_channels_) {
+        luminance[x] = static_cast<int16_t>(scanline[0]) + scanline[1] +
+            scanline[2];
+      }
+    }
+  }
+
+  void AddGradientRow(int interior_y) {
+    const int16_t* above = luminance_[(interior_y - 1) % 3].get();
+    const int16_t* row = luminance_[interior_y % 3].get();
+    const int16_t* below = luminance_[(interior_y + 1) % 3].get();
+    if (step_ == 1) {
+      AddGradientSpan(above, row, below, 1, width_ - 1);
+      return;
+    }
+    // Stagger the sampled columns from band to band, so that together the
+    // blocks form a diagonal grid rather than columns.
+    const int stagger = (Band(interior_y) / step_) % step_;
+    const int first_block = (step_ - stagger) % step_;
+    for (int block = first_block;
+         1 + block * kPhotoSampleBlockSize < width_ - 1;
+         block += step_) {
+      const int x0 = 1 + block * kPhotoSampleBlockSize;
+      const int x1 = std::min(x0 + kPhotoSampleBlockSize, width_ - 1);
+      AddGradientSpan(above, row, below, x0, x1);
+    }
+  }
+
+  void AddGradientSpan(const int16_t* above, const int16_t* row,
+                       const int16_t* below, int x0, int x1) {
+    uint8_t* gradient = gradient_.get();
+    GradientSpan(above, row, below, x0, x1, norm_factor_, gradient);
+    const int count = x1 - x0;
+    // Spread consecutive pixels over separate tables so that runs of equal
+    // values, which are common in graphics, do not serialize on one counter.
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+      ++hist_[0][gradient[i]];
+      ++hist_[1][gradient[i + 1]];
+      ++hist_[2][gradient[i + 2]];
+      ++hist_[3][gradient[i + 3]];
+    }
+    for (; i < count; ++i) {
+      ++hist_[0][gradient[i]];
+    }
+    num_samples_ += count;
+  }
+
+  float Metric() const {
+    float hist[kNumColorHistogramBins];
+    for (int i = 0; i < kNumColorHistogramBins; ++i) {
+      hist[i] = static_cast<float>(hist_[0][i] + hist_[1][i] + hist_[2][i] +
+                                   hist_[3][i]);
+    }
+    return WidestPeakWidth(hist, kHistogramThreshold);
+  }
+
+  void MaybeDecideEarly(int num_rows_read) {
+    if (2 * num_rows_read < height_ ||
+        num_samples_ < kMinSamplesForEarlyDecision) {
+      return;
+    }
+    const float metric = Metric();
+    if (metric >= kPhotoMetricThreshold * kEarlyDecisionMargin) {
+      is_decided_ = true;
+      is_photo_ = true;
+    } else if (metric * kEarlyDecisionMargin < kPhotoMetricThreshold) {
+      is_decided_ = true;
+      is_photo_ = false;
+    }
+  }
+
+  const int width_;
+  const int height_;
+  const int num_channels_;
+  // One in 'step_' bands is sampled, and one in 'step_' blocks of each.
+  int step_;
+  float norm_factor_;
+  int row_index_;
+  int64 num_samples_;
+  bool is_decided_;
+  bool is_photo_;
+  // Luminance of the last three rows, indexed by row modulo 3.
+  net_instaweb::scoped_array<int16_t> luminance_[3];
+  net_instaweb::scoped_array<uint8_t> gradient_;
+  uint32_t hist_[4][kNumColorHistogramBins];
+
+  DISALLOW_COPY_AND_ASSIGN(PhotoMetricSampler);
+};
+
+}  // namespace
+
+bool IsPhotoSampled(ScanlineReaderInterface* reader, int max_samples,
+                    MessageHandler* handler) {
+  // Same policy as IsPhoto().
+  if (reader->GetPixelFormat() == UNSUPPORTED ||
+      reader->GetPixelFormat() == RGBA_8888 ||
+      reader->GetImageWidth() < 3 || reader->GetImageHeight() < 3) {
+    return false;
+  }
+
+  const int width = reader->GetImageWidth();
+  const int height = reader->GetImageHeight();
+  const int num_channels =
+      GetNumChannelsFromPixelFormat(reader->GetPixelFormat(), handler);
+  PhotoMetricSampler sampler(width, height, num_channels, max_samples);
+  for (int y = 0; y < height; ++y) {
+    uint8_t* scanline = NULL;
+    if (!reader->HasMoreScanLines() ||
+        !reader->ReadNextScanline(reinterpret_cast<void**>(&scanline))) {
+      return false;
+    }
+    if (!sampler.AddRow(scanline)) {
+      break;
+    }
+  }
+  return sampler.IsPhoto();
+}
+
 bool AnalyzeImage(ImageFormat image_type,
                   const void* image_buffer,
                   size_t buffer_length,
@@ -372,9 +667,10 @@ bool AnalyzeImage(ImageFormat image_type,
         // be photos, in order to save computations.
         *is_photo = true;
       } else {
-        // IsPhoto will read all scanlines of the image, so optimizer cannot be
-        // used anymore.
-        *is_photo = IsPhoto(optimizer.get(), handler);
+        // IsPhotoSampled may read any number of scanlines of the image, so
+        // optimizer cannot be used anymore.
+        *is_photo = IsPhotoSampled(optimizer.get(), kPhotoSampleCount,
+                                   handler);
         optimizer.reset();
       }
     }
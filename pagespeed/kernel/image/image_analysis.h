@@ -82,6 +82,20 @@ float WidestPeakWidth(const float* hist, float threshold);
 // to be processed.
 bool IsPhoto(ScanlineReaderInterface* reader, MessageHandler* handler);
 
+// Default sample budget for IsPhotoSampled().
+const int kPhotoSampleCount = 1 << 18;
+
+// Returns the same decision as IsPhoto() without buffering the image. Rows
+// are consumed as they are read, keeping only the three rows the Sobel
+// operator needs. If the image has more than 'max_samples' interior pixels,
+// the gradient is only computed over a staggered grid of blocks holding about
+// 'max_samples' pixels, and reading stops once at least half of the image has
+// been seen and the metric is more than a factor of two away from the
+// threshold. Images with at most 'max_samples' interior pixels, or any image
+// when 'max_samples' is 0, are classified exactly as IsPhoto() does.
+bool IsPhotoSampled(ScanlineReaderInterface* reader, int max_samples,
+                    MessageHandler* handler);
+
 // Return key information of the image. For the information which you do not
 // need, set the arguments to NULL so they will not be computed.
 //
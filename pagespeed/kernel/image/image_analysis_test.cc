@@ -42,6 +42,7 @@ using net_instaweb::MessageHandler;
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
 using pagespeed::image_compression::GRAY_8;
+using pagespeed::image_compression::CreateScanlineReader;
 using pagespeed::image_compression::Histogram;
 using pagespeed::image_compression::ImageFormat;
 using pagespeed::image_compression::IMAGE_GIF;
@@ -51,13 +52,18 @@ using pagespeed::image_compression::IMAGE_UNKNOWN;
 using pagespeed::image_compression::kGifTestDir;
 using pagespeed::image_compression::kJpegTestDir;
 using pagespeed::image_compression::kNumColorHistogramBins;
+using pagespeed::image_compression::kPhotoSampleCount;
 using pagespeed::image_compression::kPngSuiteTestDir;
+using pagespeed::image_compression::kPngTestDir;
+using pagespeed::image_compression::kValidGifImageCount;
+using pagespeed::image_compression::kValidGifImages;
 using pagespeed::image_compression::PixelFormat;
 using pagespeed::image_compression::ReadImage;
 using pagespeed::image_compression::ReadTestFile;
 using pagespeed::image_compression::RGB_888;
 using pagespeed::image_compression::RGBA_8888;
 using pagespeed::image_compression::ScanlineReaderInterface;
+using pagespeed::image_compression::ScanlineStatus;
 using pagespeed::image_compression::SynthesizeImage;
 
 struct ImageInfo {
@@ -104,6 +110,68 @@ const ImageInfo kPngImages[] = {
 };
 const size_t kPngImageCount = arraysize(kPngImages);
 
+// Images, besides the ones above, on which IsPhotoSampled() is compared
+// against IsPhoto().
+const char* kMorePngImages[] = {
+  "gray_alpha",
+  "large",
+  "pagespeed-128",
+  "pagespeed-33x34",
+  "rgb_alpha",
+  "this_is_a_test",
+};
+
+// Serves an image held in memory, and counts the rows read.
+class BufferScanlineReader : public ScanlineReaderInterface {
+ public:
+  BufferScanlineReader(const uint8_t* image, int width, int height,
+                       int bytes_per_line, PixelFormat pixel_format)
+      : image_(image),
+        width_(width),
+        height_(height),
+        bytes_per_line_(bytes_per_line),
+        pixel_format_(pixel_format),
+        row_(0) {
+  }
+
+  virtual bool Reset() {
+    row_ = 0;
+    return true;
+  }
+  virtual size_t GetBytesPerScanline() { return bytes_per_line_; }
+  virtual bool HasMoreScanLines() { return row_ < height_; }
+  virtual ScanlineStatus InitializeWithStatus(const void* image_buffer,
+                                              size_t buffer_length) {
+    row_ = 0;
+    return ScanlineStatus(
+        pagespeed::image_compression::SCANLINE_STATUS_SUCCESS);
+  }
+  virtual ScanlineStatus ReadNextScanlineWithStatus(
+      void** out_scanline_bytes) {
+    *out_scanline_bytes =
+        const_cast<uint8_t*>(image_ + row_ * bytes_per_line_);
+    ++row_;
+    return ScanlineStatus(
+        pagespeed::image_compression::SCANLINE_STATUS_SUCCESS);
+  }
+  virtual size_t GetImageHeight() { return height_; }
+  virtual size_t GetImageWidth() { return width_; }
+  virtual PixelFormat GetPixelFormat() { return pixel_format_; }
+  virtual bool IsProgressive() { return false; }
+
+  int rows_read() const { return row_; }
+
+ private:
+  const uint8_t* image_;
+  const int width_;
+  const int height_;
+  const int bytes_per_line_;
+  const PixelFormat pixel_format_;
+  int row_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferScanlineReader);
+};
+
 class ImageAnalysisTest : public testing::Test {
  public:
   ImageAnalysisTest() :
@@ -184,6 +252,32 @@ class ImageAnalysisTest : public testing::Test {
     }
   }
 
+  // Checks that IsPhotoSampled() makes the same decision as IsPhoto() on
+  // the image, for several sample budgets.
+  void ExpectSampledMatchesExhaustive(ImageFormat image_format,
+                                      const char* dir, const char* file_name,
+                                      const char* ext) {
+    const int kMaxSamples[] = {0, kPhotoSampleCount, 4096};
+
+    GoogleString image_string;
+    ASSERT_TRUE(ReadTestFile(dir, file_name, ext, &image_string));
+    net_instaweb::scoped_ptr<ScanlineReaderInterface> reader(
+        CreateScanlineReader(image_format, image_string.data(),
+                             image_string.length(), &message_handler_));
+    ASSERT_TRUE(reader.get() != NULL) << file_name;
+    const bool is_photo = IsPhoto(reader.get(), &message_handler_);
+
+    for (size_t i = 0; i < arraysize(kMaxSamples); ++i) {
+      reader.reset(CreateScanlineReader(image_format, image_string.data(),
+                                        image_string.length(),
+                                        &message_handler_));
+      ASSERT_TRUE(reader.get() != NULL) << file_name;
+      EXPECT_EQ(is_photo, IsPhotoSampled(reader.get(), kMaxSamples[i],
+                                         &message_handler_))
+          << file_name << " with " << kMaxSamples[i] << " samples";
+    }
+  }
+
  protected:
   MockMessageHandler message_handler_;
   float expected_hist_[kNumColorHistogramBins];
@@ -374,4 +468,59 @@ TEST_F(ImageAnalysisTest, KeyInformation) {
                        kPngImageCount);
 }
 
+TEST_F(ImageAnalysisTest, SampledMatchesExhaustive) {
+  for (size_t i = 0; i < kJpegImageCount; ++i) {
+    ExpectSampledMatchesExhaustive(IMAGE_JPEG, kJpegTestDir,
+                                   kJpegImages[i].file_name, "jpg");
+  }
+  for (size_t i = 0; i < kGifImageCount; ++i) {
+    if (!kGifImages[i].is_animated) {
+      ExpectSampledMatchesExhaustive(IMAGE_GIF, kGifTestDir,
+                                     kGifImages[i].file_name, "gif");
+    }
+  }
+  for (size_t i = 0; i < kValidGifImageCount; ++i) {
+    ExpectSampledMatchesExhaustive(IMAGE_PNG, kPngSuiteTestDir,
+                                   kValidGifImages[i].filename, "png");
+  }
+  for (size_t i = 0; i < arraysize(kMorePngImages); ++i) {
+    ExpectSampledMatchesExhaustive(IMAGE_PNG, kPngTestDir, kMorePngImages[i],
+                                   "png");
+  }
+}
+
+TEST_F(ImageAnalysisTest, SampledStopsEarly) {
+  const int kWidth = 1024;
+  const int kHeight = 1024;
+  net_instaweb::scoped_array<uint8_t> image(new uint8_t[kWidth * kHeight]);
+
+  // Noise looks like a photo.
+  uint32_t seed = 1;
+  for (int i = 0; i < kWidth * kHeight; ++i) {
+    seed = seed * 1103515245 + 12345;
+    image[i] = static_cast<uint8_t>(seed >> 24);
+  }
+  BufferScanlineReader noise(image.get(), kWidth, kHeight, kWidth, GRAY_8);
+  EXPECT_TRUE(IsPhoto(&noise, &message_handler_));
+  noise.Reset();
+  EXPECT_TRUE(IsPhotoSampled(&noise, kPhotoSampleCount, &message_handler_));
+  EXPECT_LT(noise.rows_read(), kHeight);
+
+  // Flat stripes look like graphics.
+  for (int y = 0; y < kHeight; ++y) {
+    memset(image.get() + y * kWidth, (y / 37) * 20, kWidth);
+  }
+  BufferScanlineReader stripes(image.get(), kWidth, kHeight, kWidth, GRAY_8);
+  EXPECT_FALSE(IsPhoto(&stripes, &message_handler_));
+  stripes.Reset();
+  EXPECT_FALSE(IsPhotoSampled(&stripes, kPhotoSampleCount,
+                              &message_handler_));
+  EXPECT_LT(stripes.rows_read(), kHeight);
+
+  // Without a sample budget, the whole image is read.
+  stripes.Reset();
+  EXPECT_FALSE(IsPhotoSampled(&stripes, 0, &message_handler_));
+  EXPECT_EQ(kHeight, stripes.rows_read());
+}
+
 }  // namespace
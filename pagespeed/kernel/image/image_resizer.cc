@@ -21,12 +21,23 @@
 #include "pagespeed/kernel/image/image_resizer.h"
 
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 
+// The SSE2 and AVX2 kernels are compiled with per-function target attributes
+// and chosen at run time, so the rest of the file does not need any special
+// compiler flags.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RESIZER_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 namespace pagespeed {
 
 namespace {
@@ -308,6 +319,463 @@ void ResizeRowAreaRGBA(const ResizeTableEntry* table, int pixels_per_row,
   }
 }
 
+// The vertical resizer works on whole rows of 'size' elements at a time:
+// AppendFirstRow, AppendMiddleRow and AppendLastRow accumulate weighted input
+// rows into 'buffer', and ComputeOutput scales the accumulated row into
+// bytes. The input rows are floats if the horizontal resizer ran, and bytes
+// otherwise. Loop unrolling is used to speed up computation.
+template<class BufferType>
+void AppendFirstRow(const BufferType* in_data, float weight, int size,
+                    float* buffer) {
+  const int size_4 = (size & ~3);
+  int index = 0;
+  for (; index < size_4; index += 4) {
+    buffer[index] = weight * in_data[index];
+    buffer[index + 1] = weight * in_data[index + 1];
+    buffer[index + 2] = weight * in_data[index + 2];
+    buffer[index + 3] = weight * in_data[index + 3];
+  }
+  for (; index < size; ++index) {
+    buffer[index] = weight * in_data[index];
+  }
+}
+
+template<class BufferType>
+void AppendMiddleRow(const BufferType* in_data, int size, float* buffer) {
+  const int size_4 = (size & ~3);
+  int index = 0;
+  for (; index < size_4; index += 4) {
+    buffer[index] += in_data[index];
+    buffer[index + 1] += in_data[index + 1];
+    buffer[index + 2] += in_data[index + 2];
+    buffer[index + 3] += in_data[index + 3];
+  }
+  for (; index < size; ++index) {
+    buffer[index] += in_data[index];
+  }
+}
+
+template<class BufferType>
+void AppendLastRow(const BufferType* in_data, float weight, int size,
+                   float* buffer) {
+  const int size_4 = (size & ~3);
+  int index = 0;
+  for (; index < size_4; index += 4) {
+    buffer[index] += weight * in_data[index];
+    buffer[index + 1] += weight * in_data[index + 1];
+    buffer[index + 2] += weight * in_data[index + 2];
+    buffer[index + 3] += weight * in_data[index + 3];
+  }
+  for (; index < size; ++index) {
+    buffer[index] += weight * in_data[index];
+  }
+}
+
+void ComputeOutput(const float* in_data, float half_grid_area,
+                   float inv_grid_area, int size, uint8_t* out_data) {
+  const int size_4 = (size & ~3);
+  int index = 0;
+  for (; index < size_4; index += 4) {
+    out_data[index] = static_cast<uint8_t>((
+        in_data[index] + half_grid_area) * inv_grid_area);
+    out_data[index + 1] = static_cast<uint8_t>((
+        in_data[index + 1] + half_grid_area) * inv_grid_area);
+    out_data[index + 2] = static_cast<uint8_t>((
+        in_data[index + 2] + half_grid_area) * inv_grid_area);
+    out_data[index + 3] = static_cast<uint8_t>((
+        in_data[index + 3] + half_grid_area) * inv_grid_area);
+  }
+  for (; index < size; ++index) {
+    out_data[index] = static_cast<uint8_t>((
+        in_data[index] + half_grid_area) * inv_grid_area);
+  }
+}
+
+#ifdef RESIZER_X86_KERNELS
+
+// The vector kernels do the same single-precision multiplies and adds as
+// the scalar ones above, in the same order for each element, so they give
+// bit-identical results. The one exception is ResizeRowAreaGraySse2; see
+// there.
+
+TARGET_SSE2 inline __m128 LoadFloatsSse2(const float* data) {
+  return _mm_loadu_ps(data);
+}
+
+TARGET_SSE2 inline __m128 LoadFloatsSse2(const uint8_t* data) {
+  int32_t bytes;
+  memcpy(&bytes, data, sizeof(bytes));
+  __m128i zero = _mm_setzero_si128();
+  __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// Loads the 3 bytes of an RGB pixel into the low lanes, without touching
+// memory past them. The top lane is zero.
+TARGET_SSE2 inline __m128 LoadRgbPixelSse2(const uint8_t* data) {
+  int32_t bytes = data[0] | (data[1] << 8) | (data[2] << 16);
+  __m128i zero = _mm_setzero_si128();
+  __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// Middle runs shorter than this are accumulated one byte at a time.
+const int kMinGrayRunToSum = 16;
+
+// Sums 'size' bytes using SAD against zero, 16 bytes at a time.
+TARGET_SSE2 uint32_t SumBytesSse2(const uint8_t* data, int size) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  int index = 0;
+  for (; index + 16 <= size; index += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, zero));
+  }
+  uint32_t sum = _mm_cvtsi128_si32(sums) +
+      _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+  for (; index < size; ++index) {
+    sum += data[index];
+  }
+  return sum;
+}
+
+// A gray pixel has a single channel, so there are no lanes to spread it
+// over. Instead, long runs of fully covered input pixels, which dominate
+// when shrinking a lot, are summed as integers and added to the float
+// accumulator at once. That rounds once rather than per pixel, so the
+// result can differ from ResizeRowAreaGray in the last bits, and the output
+// very rarely by one. Shorter runs are added exactly as the scalar code
+// does; summing those as integers is no faster and changes more outputs.
+TARGET_SSE2 void ResizeRowAreaGraySse2(const ResizeTableEntry* table,
+                                       int pixels_per_row,
+                                       const uint8_t* in_data,
+                                       float* out_data) {
+  for (int out_idx = 0; out_idx < pixels_per_row; ++out_idx) {
+    const ResizeTableEntry& table_entry = table[out_idx];
+    float acc1 = in_data[table_entry.first_index] * table_entry.first_weight;
+    const int run = table_entry.last_index - table_entry.first_index - 1;
+    if (run >= kMinGrayRunToSum) {
+      acc1 += static_cast<float>(
+          SumBytesSse2(in_data + table_entry.first_index + 1, run));
+    } else {
+      for (int in_idx = table_entry.first_index + 1;
+           in_idx < table_entry.last_index;
+           ++in_idx) {
+        acc1 += in_data[in_idx];
+      }
+    }
+    acc1 += in_data[table_entry.last_index] * table_entry.last_weight;
+    out_data[out_idx] = acc1;
+  }
+}
+
+// The RGB and RGBA kernels keep the channels of a pixel in the lanes of one
+// vector.
+TARGET_SSE2 void ResizeRowAreaRGBSse2(const ResizeTableEntry* table,
+                                      int pixels_per_row,
+                                      const uint8_t* in_data,
+                                      float* out_data) {
+  for (int x = 0; x < pixels_per_row; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index;
+    __m128 acc = _mm_mul_ps(LoadRgbPixelSse2(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight));
+    // Every fully covered pixel is followed by at least the last pixel, so
+    // it can be loaded 4 bytes at a time. The top lane then picks up a byte
+    // of the following pixel, which is never stored.
+    for (in_idx += 3; in_idx < table_entry.last_index; in_idx += 3) {
+      acc = _mm_add_ps(acc, LoadFloatsSse2(in_data + in_idx));
+    }
+    acc = _mm_add_ps(acc,
+                     _mm_mul_ps(LoadRgbPixelSse2(in_data +
+                                                 table_entry.last_index),
+                                _mm_set1_ps(table_entry.last_weight)));
+    float channels[4];
+    _mm_storeu_ps(channels, acc);
+    out_data[3 * x] = channels[0];
+    out_data[3 * x + 1] = channels[1];
+    out_data[3 * x + 2] = channels[2];
+  }
+}
+
+TARGET_SSE2 void ResizeRowAreaRGBASse2(const ResizeTableEntry* table,
+                                       int pixels_per_row,
+                                       const uint8_t* in_data,
+                                       float* out_data) {
+  for (int x = 0; x < pixels_per_row; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index;
+    __m128 acc = _mm_mul_ps(LoadFloatsSse2(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight));
+    for (in_idx += 4; in_idx < table_entry.last_index; in_idx += 4) {
+      acc = _mm_add_ps(acc, LoadFloatsSse2(in_data + in_idx));
+    }
+    acc = _mm_add_ps(acc,
+                     _mm_mul_ps(LoadFloatsSse2(in_data +
+                                               table_entry.last_index),
+                                _mm_set1_ps(table_entry.last_weight)));
+    _mm_storeu_ps(out_data + 4 * x, acc);
+  }
+}
+
+template<class BufferType>
+TARGET_SSE2 void AppendFirstRowSse2(const BufferType* in_data, float weight,
+                                    int size, float* buffer) {
+  const __m128 weights = _mm_set1_ps(weight);
+  int index = 0;
+  for (; index + 4 <= size; index += 4) {
+    _mm_storeu_ps(buffer + index,
+                  _mm_mul_ps(weights, LoadFloatsSse2(in_data + index)));
+  }
+  for (; index < size; ++index) {
+    buffer[index] = weight * in_data[index];
+  }
+}
+
+template<class BufferType>
+TARGET_SSE2 void AppendMiddleRowSse2(const BufferType* in_data, int size,
+                                     float* buffer) {
+  int index = 0;
+  for (; index + 4 <= size; index += 4) {
+    _mm_storeu_ps(buffer + index,
+                  _mm_add_ps(_mm_loadu_ps(buffer + index),
+                             LoadFloatsSse2(in_data + index)));
+  }
+  for (; index < size; ++index) {
+    buffer[index] += in_data[index];
+  }
+}
+
+template<class BufferType>
+TARGET_SSE2 void AppendLastRowSse2(const BufferType* in_data, float weight,
+                                   int size, float* buffer) {
+  const __m128 weights = _mm_set1_ps(weight);
+  int index = 0;
+  for (; index + 4 <= size; index += 4) {
+    _mm_storeu_ps(buffer + index,
+                  _mm_add_ps(_mm_loadu_ps(buffer + index),
+                             _mm_mul_ps(weights,
+                                        LoadFloatsSse2(in_data + index))));
+  }
+  for (; index < size; ++index) {
+    buffer[index] += weight * in_data[index];
+  }
+}
+
+// Converting with truncation and then packing with saturation matches
+// static_cast<uint8_t>, since the scaled values lie in [0, 256).
+TARGET_SSE2 void ComputeOutputSse2(const float* in_data, float half_grid_area,
+                                   float inv_grid_area, int size,
+                                   uint8_t* out_data) {
+  const __m128 half = _mm_set1_ps(half_grid_area);
+  const __m128 inv = _mm_set1_ps(inv_grid_area);
+  int index = 0;
+  for (; index + 8 <= size; index += 8) {
+    __m128i lo = _mm_cvttps_epi32(
+        _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in_data + index), half), inv));
+    __m128i hi = _mm_cvttps_epi32(
+        _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in_data + index + 4), half), inv));
+    __m128i words = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out_data + index),
+                     _mm_packus_epi16(words, words));
+  }
+  for (; index < size; ++index) {
+    out_data[index] = static_cast<uint8_t>((
+        in_data[index] + half_grid_area) * inv_grid_area);
+  }
+}
+
+TARGET_AVX2 inline __m256 LoadFloatsAvx2(const float* data) {
+  return _mm256_loadu_ps(data);
+}
+
+TARGET_AVX2 inline __m256 LoadFloatsAvx2(const uint8_t* data) {
+  __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+template<class BufferType>
+TARGET_AVX2 void AppendFirstRowAvx2(const BufferType* in_data, float weight,
+                                    int size, float* buffer) {
+  const __m256 weights = _mm256_set1_ps(weight);
+  int index = 0;
+  for (; index + 8 <= size; index += 8) {
+    _mm256_storeu_ps(buffer + index,
+                     _mm256_mul_ps(weights, LoadFloatsAvx2(in_data + index)));
+  }
+  for (; index < size; ++index) {
+    buffer[index] = weight * in_data[index];
+  }
+}
+
+template<class BufferType>
+TARGET_AVX2 void AppendMiddleRowAvx2(const BufferType* in_data, int size,
+                                     float* buffer) {
+  int index = 0;
+  for (; index + 8 <= size; index += 8) {
+    _mm256_storeu_ps(buffer + index,
+                     _mm256_add_ps(_mm256_loadu_ps(buffer + index),
+                                   LoadFloatsAvx2(in_data + index)));
+  }
+  for (; index < size; ++index) {
+    buffer[index] += in_data[index];
+  }
+}
+
+template<class BufferType>
+TARGET_AVX2 void AppendLastRowAvx2(const BufferType* in_data, float weight,
+                                   int size, float* buffer) {
+  const __m256 weights = _mm256_set1_ps(weight);
+  int index = 0;
+  for (; index + 8 <= size; index += 8) {
+    _mm256_storeu_ps(
+        buffer + index,
+        _mm256_add_ps(_mm256_loadu_ps(buffer + index),
+                      _mm256_mul_ps(weights, LoadFloatsAvx2(in_data + index))));
+  }
+  for (; index < size; ++index) {
+    buffer[index] += weight * in_data[index];
+  }
+}
+
+TARGET_AVX2 void ComputeOutputAvx2(const float* in_data, float half_grid_area,
+                                   float inv_grid_area, int size,
+                                   uint8_t* out_data) {
+  const __m256 half = _mm256_set1_ps(half_grid_area);
+  const __m256 inv = _mm256_set1_ps(inv_grid_area);
+  int index = 0;
+  for (; index + 8 <= size; index += 8) {
+    __m256i ints = _mm256_cvttps_epi32(_mm256_mul_ps(
+        _mm256_add_ps(_mm256_loadu_ps(in_data + index), half), inv));
+    __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(ints),
+                                    _mm256_extracti128_si256(ints, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out_data + index),
+                     _mm_packus_epi16(words, words));
+  }
+  for (; index < size; ++index) {
+    out_data[index] = static_cast<uint8_t>((
+        in_data[index] + half_grid_area) * inv_grid_area);
+  }
+}
+
+#endif  // RESIZER_X86_KERNELS
+
+typedef void (*ResizeRowFunction)(const ResizeTableEntry* table,
+                                  int pixels_per_row,
+                                  const uint8_t* in_data,
+                                  float* out_data);
+typedef void (*ComputeOutputFunction)(const float* in_data,
+                                      float half_grid_area,
+                                      float inv_grid_area,
+                                      int size,
+                                      uint8_t* out_data);
+
+template<class BufferType>
+struct ColumnKernels {
+  void (*append_first_row)(const BufferType* in_data, float weight, int size,
+                           float* buffer);
+  void (*append_middle_row)(const BufferType* in_data, int size,
+                            float* buffer);
+  void (*append_last_row)(const BufferType* in_data, float weight, int size,
+                          float* buffer);
+};
+
+// One implementation of all of the inner loops of the resizer.
+struct ResizeKernels {
+  ResizeRowFunction resize_row_gray;
+  ResizeRowFunction resize_row_rgb;
+  ResizeRowFunction resize_row_rgba;
+  ColumnKernels<float> float_columns;
+  ColumnKernels<uint8_t> byte_columns;
+  ComputeOutputFunction compute_output;
+};
+
+const ResizeKernels kScalarKernels = {
+  &ResizeRowAreaGray,
+  &ResizeRowAreaRGB,
+  &ResizeRowAreaRGBA,
+  { &AppendFirstRow<float>, &AppendMiddleRow<float>, &AppendLastRow<float> },
+  { &AppendFirstRow<uint8_t>, &AppendMiddleRow<uint8_t>,
+    &AppendLastRow<uint8_t> },
+  &ComputeOutput,
+};
+
+#ifdef RESIZER_X86_KERNELS
+const ResizeKernels kSse2Kernels = {
+  &ResizeRowAreaGraySse2,
+  &ResizeRowAreaRGBSse2,
+  &ResizeRowAreaRGBASse2,
+  { &AppendFirstRowSse2<float>, &AppendMiddleRowSse2<float>,
+    &AppendLastRowSse2<float> },
+  { &AppendFirstRowSse2<uint8_t>, &AppendMiddleRowSse2<uint8_t>,
+    &AppendLastRowSse2<uint8_t> },
+  &ComputeOutputSse2,
+};
+
+// AVX2 only widens the vertical pass; the horizontal one works a pixel at a
+// time, which fits in SSE2 registers already.
+const ResizeKernels kAvx2Kernels = {
+  &ResizeRowAreaGraySse2,
+  &ResizeRowAreaRGBSse2,
+  &ResizeRowAreaRGBASse2,
+  { &AppendFirstRowAvx2<float>, &AppendMiddleRowAvx2<float>,
+    &AppendLastRowAvx2<float> },
+  { &AppendFirstRowAvx2<uint8_t>, &AppendMiddleRowAvx2<uint8_t>,
+    &AppendLastRowAvx2<uint8_t> },
+  &ComputeOutputAvx2,
+};
+#endif  // RESIZER_X86_KERNELS
+
+// Returns the kernels for 'kernel_set', or NULL if the CPU cannot run them.
+const ResizeKernels* SelectResizeKernels(
+    image_compression::ScanlineResizer::KernelSet kernel_set) {
+  typedef image_compression::ScanlineResizer ScanlineResizer;
+#ifdef RESIZER_X86_KERNELS
+  __builtin_cpu_init();
+  const bool has_sse2 = __builtin_cpu_supports("sse2");
+  const bool has_avx2 = __builtin_cpu_supports("avx2");
+  switch (kernel_set) {
+    case ScanlineResizer::kKernelsBest:
+      if (has_avx2) {
+        return &kAvx2Kernels;
+      }
+      if (has_sse2) {
+        return &kSse2Kernels;
+      }
+      break;
+    case ScanlineResizer::kKernelsScalar:
+      break;
+    case ScanlineResizer::kKernelsSse2:
+      return has_sse2 ? &kSse2Kernels : NULL;
+    case ScanlineResizer::kKernelsAvx2:
+      return has_avx2 ? &kAvx2Kernels : NULL;
+  }
+#else
+  if (kernel_set == ScanlineResizer::kKernelsSse2 ||
+      kernel_set == ScanlineResizer::kKernelsAvx2) {
+    return NULL;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+template<class BufferType>
+const ColumnKernels<BufferType>& GetColumnKernels(
+    const ResizeKernels& kernels);
+
+template<>
+const ColumnKernels<float>& GetColumnKernels<float>(
+    const ResizeKernels& kernels) {
+  return kernels.float_columns;
+}
+
+template<>
+const ColumnKernels<uint8_t>& GetColumnKernels<uint8_t>(
+    const ResizeKernels& kernels) {
+  return kernels.byte_columns;
+}
+
 }  // namespace
 
 namespace image_compression {
@@ -373,8 +841,8 @@ class ResizeCol {
 // Base class for the horizontal resizer using the "area" method.
 class ResizeRowArea : public ResizeRow {
  public:
-  explicit ResizeRowArea(int num_channels)
-      : num_channels_(num_channels), output_buffer_(NULL) {}
+  ResizeRowArea(int num_channels, const ResizeKernels* kernels)
+      : num_channels_(num_channels), kernels_(kernels), output_buffer_(NULL) {}
 
   virtual bool Initialize(int in_size, int out_size, double ratio,
                           float* output_buffer, MessageHandler* handler);
@@ -382,6 +850,7 @@ class ResizeRowArea : public ResizeRow {
 
  protected:
   const int num_channels_;
+  const ResizeKernels* kernels_;  // Not owned
   int pixels_per_row_;
   float* output_buffer_;  // Not owned
   net_instaweb::scoped_array<ResizeTableEntry> table_;
@@ -414,13 +883,16 @@ const void* ResizeRowArea::Resize(const uint8_t* in_data) {
 
   switch (num_channels_) {
     case 1:  // GRAY_8
-      ResizeRowAreaGray(table_.get(), pixels_per_row_, in_data, output_buffer_);
+      kernels_->resize_row_gray(table_.get(), pixels_per_row_, in_data,
+                                output_buffer_);
       break;
     case 3:  // RGB_888
-      ResizeRowAreaRGB(table_.get(), pixels_per_row_, in_data, output_buffer_);
+      kernels_->resize_row_rgb(table_.get(), pixels_per_row_, in_data,
+                               output_buffer_);
       break;
     case 4:  // RGBA_8888
-      ResizeRowAreaRGBA(table_.get(), pixels_per_row_, in_data, output_buffer_);
+      kernels_->resize_row_rgba(table_.get(), pixels_per_row_, in_data,
+                                output_buffer_);
       break;
   }
 
@@ -431,7 +903,10 @@ const void* ResizeRowArea::Resize(const uint8_t* in_data) {
 template<class BufferType>
 class ResizeColArea : public ResizeCol {
  public:
-  ResizeColArea() : output_buffer_(NULL) {}
+  explicit ResizeColArea(const ResizeKernels* kernels)
+      : kernels_(kernels),
+        columns_(GetColumnKernels<BufferType>(*kernels)),
+        output_buffer_(NULL) {}
 
   virtual bool Initialize(int in_size,
                           int out_size,
@@ -456,18 +931,28 @@ class ResizeColArea : public ResizeCol {
   }
 
  private:
-  void AppendFirstRow(const BufferType* in_data, float weight);
-  void AppendMiddleRow(const BufferType* in_data);
-  void AppendLastRow(const BufferType* in_data, float weight);
-  void ComputeOutput(const float* in_data, uint8_t* out_data);
+  void AppendFirstRow(const BufferType* in_data, float weight) {
+    columns_.append_first_row(in_data, weight, elements_per_row_,
+                              buffer_.get());
+  }
+  void AppendMiddleRow(const BufferType* in_data) {
+    columns_.append_middle_row(in_data, elements_per_row_, buffer_.get());
+  }
+  void AppendLastRow(const BufferType* in_data, float weight) {
+    columns_.append_last_row(in_data, weight, elements_per_row_,
+                             buffer_.get());
+  }
+  void ComputeOutput(const float* in_data, uint8_t* out_data) {
+    kernels_->compute_output(in_data, half_grid_area_, inv_grid_area_,
+                             elements_per_row_, out_data);
+  }
 
+  const ResizeKernels* kernels_;  // Not owned
+  const ColumnKernels<BufferType>& columns_;
   net_instaweb::scoped_array<ResizeTableEntry> table_;
   net_instaweb::scoped_array<float> buffer_;
   uint8_t* output_buffer_;  // Not owned
   int elements_per_row_;
-  // elements_per_row_4_ is the largest multiple of 4 which is smaller than
-  // elements_per_row_.
-  int elements_per_row_4_;
   int in_row_;
   int out_row_;
   int num_out_rows_;
@@ -508,82 +993,9 @@ bool ResizeColArea<BufferType>::Initialize(
   num_out_rows_ = out_size;
   need_more_scanlines_ = true;
   elements_per_row_ = elements_per_output_row;
-  // elements_per_row_4_ is the largest multiplier of 4 which is smaller than
-  // elements_per_row_.
-  elements_per_row_4_ = (elements_per_output_row & ~3);
   return true;
 }
 
-// To speed up computation, loop unrolling is used in AppendFirstRow()
-// AppendMiddleRow(), AppendLastRow(), and ComputeOutput().
-template<class BufferType>
-void ResizeColArea<BufferType>::AppendFirstRow(
-    const BufferType* in_data, float weight) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] = weight * in_data[index];
-    buffer_[index + 1] = weight * in_data[index + 1];
-    buffer_[index + 2] = weight * in_data[index + 2];
-    buffer_[index + 3] = weight * in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] = weight * in_data[index];
-  }
-}
-
-template<class BufferType>
-void ResizeColArea<BufferType>::AppendMiddleRow(
-    const BufferType* in_data) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] += in_data[index];
-    buffer_[index + 1] += in_data[index + 1];
-    buffer_[index + 2] += in_data[index + 2];
-    buffer_[index + 3] += in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] += in_data[index];
-  }
-}
-
-template<class BufferType>
-void ResizeColArea<BufferType>::AppendLastRow(
-    const BufferType* in_data, float weight) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] += weight * in_data[index];
-    buffer_[index + 1] += weight * in_data[index + 1];
-    buffer_[index + 2] += weight * in_data[index + 2];
-    buffer_[index + 3] += weight * in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] += weight * in_data[index];
-  }
-}
-
-template<class BufferType>
-void ResizeColArea<BufferType>::ComputeOutput(const float* in_data,
-                                              uint8_t* out_data) {
-  int index = 0;
-  // Make local copies of the data in order to speed up computation.
-  const float half_grid_area = half_grid_area_;
-  const float inv_grid_area = inv_grid_area_;
-  for (; index < elements_per_row_4_; index += 4) {
-    out_data[index] = static_cast<uint8_t>((
-        in_data[index] + half_grid_area) * inv_grid_area);
-    out_data[index + 1] = static_cast<uint8_t>((
-        in_data[index + 1] + half_grid_area) * inv_grid_area);
-    out_data[index + 2] = static_cast<uint8_t>((
-        in_data[index + 2] + half_grid_area) * inv_grid_area);
-    out_data[index + 3] = static_cast<uint8_t>((
-        in_data[index + 3] + half_grid_area) * inv_grid_area);
-  }
-  for (; index < elements_per_row_; ++index) {
-    out_data[index] = static_cast<uint8_t>((
-        in_data[index] + half_grid_area) * inv_grid_area);
-  }
-}
-
 // Resize the image vertically and output a row.
 template<class BufferType>
 const uint8_t* ResizeColArea<BufferType>::Resize(const void* in_data_ptr) {
@@ -641,10 +1053,11 @@ template<class BufferType>
 bool InstantiateResizers(pagespeed::image_compression::PixelFormat pixel_format,
                          net_instaweb::scoped_ptr<ResizeRow>* resizer_x,
                          net_instaweb::scoped_ptr<ResizeCol>* resizer_y,
+                         const ResizeKernels* kernels,
                          MessageHandler* handler) {
   const int num_channels = GetNumChannelsFromPixelFormat(pixel_format, handler);
-  resizer_x->reset(new ResizeRowArea(num_channels));
-  resizer_y->reset(new ResizeColArea<BufferType>());
+  resizer_x->reset(new ResizeRowArea(num_channels, kernels));
+  resizer_y->reset(new ResizeColArea<BufferType>(kernels));
   return (resizer_x->get() != NULL && resizer_y->get() != NULL);
 }
 
@@ -654,12 +1067,21 @@ ScanlineResizer::ScanlineResizer(MessageHandler* handler)
     height_(0),
     elements_per_row_(0),
     bytes_per_buffer_row_(0),
+    kernel_set_(kKernelsBest),
     message_handler_(handler) {
 }
 
 ScanlineResizer::~ScanlineResizer() {
 }
 
+bool ScanlineResizer::SetKernelsForTesting(KernelSet kernel_set) {
+  if (SelectResizeKernels(kernel_set) == NULL) {
+    return false;
+  }
+  kernel_set_ = kernel_set;
+  return true;
+}
+
 // Reset the scanline reader to its initial state.
 bool ScanlineResizer::Reset() {
   reader_ = NULL;
@@ -794,11 +1216,12 @@ bool ScanlineResizer::Initialize(ScanlineReaderInterface* reader,
 
   const bool need_resize_x = (ratio_x != 1.0);
   const bool need_resize_y = (ratio_y != 1.0);
+  const ResizeKernels* kernels = SelectResizeKernels(kernel_set_);
   float* resizer_x_buffer = NULL;
   uint8_t* resizer_y_buffer = NULL;
   if (need_resize_x) {
     InstantiateResizers<float>(pixel_format, &resizer_x_, &resizer_y_,
-                               message_handler_);
+                               kernels, message_handler_);
     buffer_.reset(new float[elements_per_row_]);
     resizer_x_buffer = buffer_.get();
     output_.reset(new uint8_t[elements_per_row_]);
@@ -808,7 +1231,7 @@ bool ScanlineResizer::Initialize(ScanlineReaderInterface* reader,
     }
   } else {
     InstantiateResizers<uint8_t>(pixel_format, &resizer_x_, &resizer_y_,
-                                 message_handler_);
+                                 kernels, message_handler_);
     if (need_resize_y) {
       output_.reset(new uint8_t[elements_per_row_]);
       resizer_y_buffer = output_.get();
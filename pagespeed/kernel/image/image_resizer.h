@@ -101,6 +101,20 @@ class ScanlineResizer : public ScanlineReaderInterface {
   virtual ScanlineStatus InitializeWithStatus(const void* image_buffer,
                                               size_t buffer_length);
 
+  // Implementations of the inner loops of the resizer.
+  enum KernelSet {
+    kKernelsBest,    // The fastest one the CPU supports. The default.
+    kKernelsScalar,
+    kKernelsSse2,
+    kKernelsAvx2,
+  };
+
+  // Forces one implementation of the inner loops, from the next call to
+  // Initialize() on, so that each can be compared with the scalar code.
+  // Returns false and keeps the current choice if this build or CPU cannot
+  // run the requested one.
+  bool SetKernelsForTesting(KernelSet kernel_set);
+
   static const size_t kPreserveAspectRatio = 0;
 
  private:
@@ -118,6 +132,7 @@ class ScanlineResizer : public ScanlineReaderInterface {
   // Buffer for storing the intermediate results.
   net_instaweb::scoped_array<float> buffer_;
   int bytes_per_buffer_row_;
+  KernelSet kernel_set_;
   MessageHandler* message_handler_;
 
   DISALLOW_COPY_AND_ASSIGN(ScanlineResizer);
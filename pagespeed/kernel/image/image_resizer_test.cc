@@ -18,6 +18,8 @@
  */
 
 
+#include <cstdlib>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
@@ -357,6 +359,92 @@ TEST_F(ScanlineResizerTest, ResizeFractionalRatio) {
   EXPECT_EQ(new_height, num_rows);
 }
 
+// Resizes 'image' to each of 'widths' with 'kernel_set' and with the scalar
+// kernels, and checks that the outputs agree. Only GRAY_8 is allowed to
+// differ, by at most one, since the vector kernels sum long runs of pixels as
+// integers.
+void ExpectKernelsMatchScalar(const GoogleString& image,
+                              const size_t* widths,
+                              size_t num_widths,
+                              ScanlineResizer::KernelSet kernel_set,
+                              MessageHandler* handler) {
+  PngScanlineReaderRaw scalar_reader(handler);
+  PngScanlineReaderRaw simd_reader(handler);
+  ScanlineResizer scalar_resizer(handler);
+  ScanlineResizer simd_resizer(handler);
+  ASSERT_TRUE(scalar_resizer.SetKernelsForTesting(
+      ScanlineResizer::kKernelsScalar));
+  ASSERT_TRUE(simd_resizer.SetKernelsForTesting(kernel_set));
+  for (size_t index_width = 0; index_width < num_widths; ++index_width) {
+    const size_t width = widths[index_width];
+    ASSERT_TRUE(scalar_reader.Initialize(image.data(), image.length()));
+    ASSERT_TRUE(simd_reader.Initialize(image.data(), image.length()));
+    ASSERT_TRUE(scalar_resizer.Initialize(&scalar_reader, width,
+                                          kPreserveAspectRatio));
+    ASSERT_TRUE(simd_resizer.Initialize(&simd_reader, width,
+                                        kPreserveAspectRatio));
+    ASSERT_EQ(scalar_resizer.GetImageHeight(), simd_resizer.GetImageHeight());
+    const int max_diff = (scalar_resizer.GetPixelFormat() == GRAY_8) ? 1 : 0;
+
+    while (scalar_resizer.HasMoreScanLines()) {
+      uint8* scalar_scanline = NULL;
+      uint8* simd_scanline = NULL;
+      ASSERT_TRUE(scalar_resizer.ReadNextScanline(
+          reinterpret_cast<void**>(&scalar_scanline)));
+      ASSERT_TRUE(simd_resizer.ReadNextScanline(
+          reinterpret_cast<void**>(&simd_scanline)));
+      for (size_t i = 0; i < scalar_resizer.GetBytesPerScanline(); ++i) {
+        ASSERT_GE(max_diff, abs(static_cast<int>(scalar_scanline[i]) -
+                                static_cast<int>(simd_scanline[i])))
+            << "kernels " << kernel_set << ", width " << width
+            << ", byte " << i;
+      }
+    }
+    ASSERT_FALSE(simd_resizer.HasMoreScanLines());
+  }
+}
+
+// Each set of vector kernels produces the same output as the scalar ones,
+// for every pixel format and for integer and non-integer ratios. Sets the
+// CPU cannot run are skipped.
+TEST_F(ScanlineResizerTest, KernelsMatchScalar) {
+  const ScanlineResizer::KernelSet kKernelSets[] = {
+    ScanlineResizer::kKernelsSse2,
+    ScanlineResizer::kKernelsAvx2,
+  };
+  const size_t kWidths32[] = {1, 2, 3, 5, 7, 9, 13, 16, 21, 31, 32};
+  const size_t kWidths128[] = {3, 17, 40, 63, 64, 100, 127};
+  // Shrinking the large GRAY_8 image exercises the long runs.
+  const size_t kWidths4096[] = {7, 64, 100, 255, 1000};
+
+  for (size_t index_set = 0; index_set < arraysize(kKernelSets); ++index_set) {
+    const ScanlineResizer::KernelSet kernel_set = kKernelSets[index_set];
+    ScanlineResizer probe(&message_handler_);
+    if (!probe.SetKernelsForTesting(kernel_set)) {
+      continue;
+    }
+
+    for (size_t index_image = 0; index_image < kValidImageCount;
+         ++index_image) {
+      ASSERT_TRUE(ReadTestFile(kPngSuiteTestDir, kValidImages[index_image],
+                               "png", &input_image_));
+      ExpectKernelsMatchScalar(input_image_, kWidths32, arraysize(kWidths32),
+                               kernel_set, &message_handler_);
+    }
+
+    ASSERT_TRUE(ReadTestFile(kPngTestDir, kImagePagespeed, "png",
+                             &input_image_));
+    ExpectKernelsMatchScalar(input_image_, kWidths128, arraysize(kWidths128),
+                             kernel_set, &message_handler_);
+
+    ASSERT_TRUE(ReadTestFile(kPngTestDir, kLarge4096x2048, "png",
+                             &input_image_));
+    ExpectKernelsMatchScalar(input_image_, kWidths4096,
+                             arraysize(kWidths4096), kernel_set,
+                             &message_handler_);
+  }
+}
+
 TEST_F(ScanlineResizerTest, LargeImage) {
   ASSERT_TRUE(ReadTestFile(kPngTestDir, kLarge4096x2048, "png", &input_image_));
   ResizeAndValidateImage(kLarge4096x2048, input_image_);
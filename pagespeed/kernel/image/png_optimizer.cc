@@ -20,11 +20,23 @@
 
 #include "pagespeed/kernel/image/png_optimizer.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
 
 #ifdef __native_client__
 // For some reason that is not yet clear, invoking png_longjmp on
@@ -46,7 +58,10 @@ extern "C" {
 #include "third_party/optipng/src/opngreduc/opngreduc.h"
 }
 
+using net_instaweb::AtomicInt32;
 using net_instaweb::MessageHandler;
+using net_instaweb::QueuedWorkerPool;
+using net_instaweb::ThreadSystem;
 using pagespeed::image_compression::PngCompressParams;
 
 namespace {
@@ -125,6 +140,145 @@ void WritePngToString(png_structp write_ptr,
   buffer.append(reinterpret_cast<char*>(data), length);
 }
 
+// Output for a candidate encode that is abandoned once it grows past the
+// smallest candidate output seen so far, as it can no longer win.
+struct SizeLimitedPngOutput {
+  GoogleString* buffer;
+  const AtomicInt32* size_limit;
+};
+
+void WritePngToSizeLimitedString(png_structp write_ptr,
+                                 png_bytep data,
+                                 png_size_t length) {
+  SizeLimitedPngOutput* output =
+      reinterpret_cast<SizeLimitedPngOutput*>(png_get_io_ptr(write_ptr));
+  output->buffer->append(reinterpret_cast<char*>(data), length);
+  if (output->buffer->size() >
+      static_cast<size_t>(output->size_limit->value())) {
+    png_error(write_ptr, "Candidate is larger than the best so far.");
+  }
+}
+
+// Images with less pixel data than this are cheap enough to encode with
+// every candidate, so PredictUsefulFilters keeps them all.
+const size_t kMinBytesToPredict = 64 * 1024;
+
+// PredictUsefulFilters deflates bands of this many consecutive rows, spread
+// over the image, up to about kMaxSampleBytes in all.
+const png_uint_32 kSampleBandRows = 8;
+const size_t kMaxSampleBytes = 128 * 1024;
+
+// Magnitude of a filtered byte read as a signed value.
+inline int FilteredByteCost(int value) {
+  value &= 0xff;
+  return value < 128 ? value : 256 - value;
+}
+
+inline int PaethPredictor(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return (pb <= pc) ? b : c;
+}
+
+// Appends 'row' to 'out' the way libpng writes it with PNG_ALL_FILTERS: as
+// a filter type byte followed by the row under whichever filter gives the
+// smallest sum of absolute values.
+void AppendAdaptivelyFilteredRow(const unsigned char* row,
+                                 const unsigned char* prior,
+                                 size_t row_bytes, size_t bpp,
+                                 GoogleString* out) {
+  static const int kNumFilters = 5;  // None, Sub, Up, Average, Paeth.
+  GoogleString filtered[kNumFilters];
+  uint64 cost[kNumFilters] = { 0 };
+  for (int f = 0; f < kNumFilters; ++f) {
+    filtered[f].resize(row_bytes);
+  }
+  for (size_t i = 0; i < row_bytes; ++i) {
+    int a = (i >= bpp) ? row[i - bpp] : 0;
+    int b = (prior != NULL) ? prior[i] : 0;
+    int c = (i >= bpp && prior != NULL) ? prior[i - bpp] : 0;
+    int x = row[i];
+    int value[kNumFilters] = {
+      x, x - a, x - b, x - (a + b) / 2, x - PaethPredictor(a, b, c)
+    };
+    for (int f = 0; f < kNumFilters; ++f) {
+      filtered[f][i] = static_cast<char>(value[f]);
+      cost[f] += FilteredByteCost(value[f]);
+    }
+  }
+  int best = 0;
+  for (int f = 1; f < kNumFilters; ++f) {
+    if (cost[f] < cost[best]) {
+      best = f;
+    }
+  }
+  out->push_back(static_cast<char>(best));
+  out->append(filtered[best]);
+}
+
+uLong DeflatedSize(const GoogleString& data) {
+  uLongf size = compressBound(data.size());
+  GoogleString buffer(size, '\0');
+  if (compress2(reinterpret_cast<Bytef*>(&buffer[0]), &size,
+                reinterpret_cast<const Bytef*>(data.data()), data.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return data.size();
+  }
+  return size;
+}
+
+// Guesses whether the unfiltered (PNG_FILTER_NONE) and the adaptively
+// filtered (PNG_ALL_FILTERS) candidates are worth a full encode, by
+// deflating bands of rows both ways at the default level. A choice is only
+// ruled out if its sample comes out more than 10% larger, so at least one of
+// the outputs is always true.
+void PredictUsefulFilters(png_structp png_ptr, png_infop info_ptr,
+                          bool* try_unfiltered, bool* try_filtered) {
+  *try_unfiltered = true;
+  *try_filtered = true;
+
+  png_bytepp rows = png_get_rows(png_ptr, info_ptr);
+  png_uint_32 height = png_get_image_height(png_ptr, info_ptr);
+  size_t row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+  if (rows == NULL || row_bytes == 0 ||
+      row_bytes * height < kMinBytesToPredict) {
+    return;
+  }
+  int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+  size_t bpp = std::max(1, png_get_channels(png_ptr, info_ptr) * bit_depth / 8);
+
+  size_t band_bytes = kSampleBandRows * (row_bytes + 1);
+  png_uint_32 num_bands = std::max<png_uint_32>(
+      1, std::min<png_uint_32>(height / kSampleBandRows,
+                               kMaxSampleBytes / band_bytes));
+  png_uint_32 band_stride = height / num_bands;
+
+  GoogleString unfiltered, filtered;
+  for (png_uint_32 band = 0; band < num_bands; ++band) {
+    png_uint_32 first = band * band_stride;
+    png_uint_32 last = std::min(height, first + kSampleBandRows);
+    for (png_uint_32 y = first; y < last; ++y) {
+      unfiltered.push_back(PNG_FILTER_VALUE_NONE);
+      unfiltered.append(reinterpret_cast<const char*>(rows[y]), row_bytes);
+      AppendAdaptivelyFilteredRow(rows[y], (y > 0) ? rows[y - 1] : NULL,
+                                  row_bytes, bpp, &filtered);
+    }
+  }
+
+  uLong unfiltered_size = DeflatedSize(unfiltered);
+  uLong filtered_size = DeflatedSize(filtered);
+  if (10 * unfiltered_size > 11 * filtered_size) {
+    *try_unfiltered = false;
+  } else if (10 * filtered_size > 11 * unfiltered_size) {
+    *try_filtered = false;
+  }
+}
+
 void PngErrorFn(png_structp png_ptr, png_const_charp msg) {
   PS_DLOG_INFO(static_cast<MessageHandler*>(png_get_error_ptr(png_ptr)), \
                "libpng error: %s", msg);
@@ -260,10 +414,157 @@ PngReaderInterface::PngReaderInterface() {
 PngReaderInterface::~PngReaderInterface() {
 }
 
+// The candidates of one CreateBestOptimizedPngInParallel call. Whichever
+// thread claims a candidate first encodes it. This is reference counted
+// because a pool task whose candidate the calling thread took back may only
+// run after the call has returned.
+class PngOptimizer::ParallelSearch
+    : public net_instaweb::RefCounted<ParallelSearch> {
+ public:
+  ParallelSearch(PngOptimizer* optimizer, ThreadSystem* thread_system)
+      : optimizer_(optimizer),
+        mutex_(thread_system->NewMutex()),
+        done_(mutex_->NewCondvar()),
+        num_done_(0),
+        best_size_(kint32max) {
+  }
+
+  ~ParallelSearch() {
+    STLDeleteElements(&candidates_);
+  }
+
+  // Adds a candidate encoding 'source' with 'params'. Must be called before
+  // any task is handed to a worker.
+  void AddCandidate(const ScopedPngStruct& source,
+                    const PngCompressParams* params,
+                    MessageHandler* handler) {
+    Candidate* candidate = new Candidate;
+    candidate->params = params;
+    candidate->write.reset(
+        new ScopedPngStruct(ScopedPngStruct::WRITE, handler));
+    // libpng does not let write structs be reused or shared across threads,
+    // so each candidate gets its own copy, made here on the calling thread.
+    if (!CopyPngStructs(source, candidate->write.get())) {
+      candidate->write.reset();
+      candidate->claimed = true;
+      ++num_done_;
+    }
+    candidates_.push_back(candidate);
+  }
+
+  int num_candidates() const { return candidates_.size(); }
+
+  // Encodes candidate 'index' unless another thread has claimed it.
+  void MaybeEncode(int index) {
+    Candidate* candidate = candidates_[index];
+    {
+      net_instaweb::ScopedMutex lock(mutex_.get());
+      if (candidate->claimed) {
+        return;
+      }
+      candidate->claimed = true;
+    }
+    bool success = optimizer_->CreateOptimizedPngWithParams(
+        candidate->write.get(), *candidate->params, &best_size_,
+        &candidate->output);
+    candidate->write.reset();
+
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    candidate->success = success;
+    if (success &&
+        candidate->output.size() < static_cast<size_t>(best_size_.value())) {
+      best_size_.set_value(candidate->output.size());
+    }
+    ++num_done_;
+    done_->Signal();
+  }
+
+  void WaitForCompletion() {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    while (num_done_ < num_candidates()) {
+      done_->Wait();
+    }
+  }
+
+  // Moves the smallest output into 'out', preferring earlier candidates on
+  // ties so the result does not depend on scheduling. Returns false if no
+  // candidate succeeded.
+  bool TakeBest(GoogleString* out) {
+    Candidate* best = NULL;
+    for (int i = 0, n = num_candidates(); i < n; ++i) {
+      Candidate* candidate = candidates_[i];
+      if (candidate->success &&
+          (best == NULL || candidate->output.size() < best->output.size())) {
+        best = candidate;
+      }
+    }
+    if (best == NULL) {
+      return false;
+    }
+    out->swap(best->output);
+    return true;
+  }
+
+ private:
+  struct Candidate {
+    Candidate() : params(NULL), claimed(false), success(false) {}
+
+    const PngCompressParams* params;
+    net_instaweb::scoped_ptr<ScopedPngStruct> write;
+    GoogleString output;
+    bool claimed;
+    bool success;
+  };
+
+  PngOptimizer* optimizer_;
+  net_instaweb::scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  net_instaweb::scoped_ptr<ThreadSystem::Condvar> done_;
+  std::vector<Candidate*> candidates_;
+  int num_done_;
+  AtomicInt32 best_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelSearch);
+};
+
+// Offers one candidate of a ParallelSearch to a worker pool. Each task runs
+// in a sequence of its own, which it frees when done.
+class PngOptimizer::ParallelSearchTask : public net_instaweb::Function {
+ public:
+  ParallelSearchTask(ParallelSearch* search, int index,
+                     QueuedWorkerPool* workers,
+                     QueuedWorkerPool::Sequence* sequence)
+      : search_(search),
+        index_(index),
+        workers_(workers),
+        sequence_(sequence) {
+  }
+
+ protected:
+  void Run() override {
+    search_->MaybeEncode(index_);
+    workers_->FreeSequence(sequence_);
+  }
+
+  // The pool is shutting down, and will clean up the sequence itself. The
+  // calling thread encodes the candidate instead.
+  void Cancel() override {}
+
+ private:
+  net_instaweb::RefCountedPtr<ParallelSearch> search_;
+  int index_;
+  QueuedWorkerPool* workers_;
+  QueuedWorkerPool::Sequence* sequence_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelSearchTask);
+};
+
 PngOptimizer::PngOptimizer(MessageHandler* handler)
     : read_(ScopedPngStruct::READ, handler),
       write_(ScopedPngStruct::WRITE, handler),
       best_compression_(false),
+      parallel_search_(false),
+      workers_(NULL),
+      thread_system_(NULL),
       message_handler_(handler) {
 }
 
@@ -311,12 +612,15 @@ bool PngOptimizer::CreateOptimizedPng(const PngReaderInterface& reader,
   // (e.g. RGB->palette, etc).
   opng_reduce_image(write_.png_ptr(), write_.info_ptr(), OPNG_REDUCE_ALL);
 
-  if (best_compression_) {
+  if (parallel_search_) {
+    return CreateBestOptimizedPngInParallel(kPngCompressionParams, kParamCount,
+                                            out);
+  } else if (best_compression_) {
     return CreateBestOptimizedPngForParams(kPngCompressionParams, kParamCount,
                                            out);
   } else {
     PngCompressParams params(PNG_FILTER_NONE, Z_DEFAULT_STRATEGY, false);
-    return CreateOptimizedPngWithParams(&write_, params, out);
+    return CreateOptimizedPngWithParams(&write_, params, NULL, out);
   }
 }
 
@@ -324,16 +628,21 @@ bool PngOptimizer::CreateBestOptimizedPngForParams(
     const PngCompressParams* param_list, size_t param_list_size,
     GoogleString* out) {
   bool success = false;
+  // Candidates that cannot beat the best so far are abandoned part way. They
+  // would not have been picked, so this only saves time.
+  AtomicInt32 best_size(kint32max);
   for (size_t idx = 0; idx < param_list_size; ++idx) {
     ScopedPngStruct write(ScopedPngStruct::WRITE, message_handler_);
     GoogleString temp_output;
     // libpng doesn't allow for reuse of the write structs, so we must copy on
     // each iteration of the loop.
     CopyPngStructs(write_, &write);
-    if (CreateOptimizedPngWithParams(&write, param_list[idx], &temp_output)) {
+    if (CreateOptimizedPngWithParams(&write, param_list[idx], &best_size,
+                                     &temp_output)) {
       // If this gives better compression update the output.
       if (out->empty() || out->size() > temp_output.size()) {
         out->swap(temp_output);
+        best_size.set_value(out->size());
       }
       success |= true;
     }
@@ -341,8 +650,44 @@ bool PngOptimizer::CreateBestOptimizedPngForParams(
   return success;
 }
 
+bool PngOptimizer::CreateBestOptimizedPngInParallel(
+    const PngCompressParams* param_list, size_t param_list_size,
+    GoogleString* out) {
+  bool try_unfiltered, try_filtered;
+  PredictUsefulFilters(write_.png_ptr(), write_.info_ptr(),
+                       &try_unfiltered, &try_filtered);
+
+  net_instaweb::RefCountedPtr<ParallelSearch> search(
+      new ParallelSearch(this, thread_system_));
+  for (size_t idx = 0; idx < param_list_size; ++idx) {
+    bool unfiltered = (param_list[idx].filter_level == PNG_FILTER_NONE);
+    if (unfiltered ? try_unfiltered : try_filtered) {
+      search->AddCandidate(write_, &param_list[idx], message_handler_);
+    }
+  }
+
+  // The first candidate is left for the calling thread.
+  int num_candidates = search->num_candidates();
+  if (workers_ != NULL) {
+    for (int i = 1; i < num_candidates; ++i) {
+      QueuedWorkerPool::Sequence* sequence = workers_->NewSequence();
+      if (sequence == NULL) {
+        break;  // Shutting down.
+      }
+      sequence->Add(
+          new ParallelSearchTask(search.get(), i, workers_, sequence));
+    }
+  }
+  for (int i = 0; i < num_candidates; ++i) {
+    search->MaybeEncode(i);
+  }
+  search->WaitForCompletion();
+  return search->TakeBest(out);
+}
+
 bool PngOptimizer::CreateOptimizedPngWithParams(ScopedPngStruct* write,
     const PngCompressParams& params,
+    const AtomicInt32* size_limit,
     GoogleString *out) {
   int compression_level =
       best_compression_ ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION;
@@ -351,7 +696,7 @@ bool PngOptimizer::CreateOptimizedPngWithParams(ScopedPngStruct* write,
   png_set_compression_strategy(write->png_ptr(), params.compression_strategy);
   png_set_filter(write->png_ptr(), PNG_FILTER_TYPE_BASE, params.filter_level);
   png_set_compression_window_bits(write->png_ptr(), 15);
-  if (!WritePng(write, out)) {
+  if (!WritePng(write, size_limit, out)) {
     return false;
   }
   return true;
@@ -374,6 +719,18 @@ bool PngOptimizer::OptimizePngBestCompression(const PngReaderInterface& reader,
   return o.CreateOptimizedPng(reader, in, out, handler);
 }
 
+bool PngOptimizer::OptimizePngBestCompressionInParallel(
+    const PngReaderInterface& reader,
+    const GoogleString& in,
+    GoogleString* out,
+    QueuedWorkerPool* workers,
+    ThreadSystem* thread_system,
+    MessageHandler* handler) {
+  PngOptimizer o(handler);
+  o.EnableParallelSearch(workers, thread_system);
+  return o.CreateOptimizedPng(reader, in, out, handler);
+}
+
 PngReader::PngReader(MessageHandler* handler)
   : message_handler_(handler) {
 }
@@ -501,11 +858,19 @@ bool PngReader::GetAttributes(const GoogleString& body,
   return true;
 }
 
-bool PngOptimizer::WritePng(ScopedPngStruct* write, GoogleString* buffer) {
+bool PngOptimizer::WritePng(ScopedPngStruct* write,
+                            const AtomicInt32* size_limit,
+                            GoogleString* buffer) {
+  SizeLimitedPngOutput limited_output = { buffer, size_limit };
   if (setjmp(png_jmpbuf(write->png_ptr()))) {
     return false;
   }
-  png_set_write_fn(write->png_ptr(), buffer, &WritePngToString, &PngFlush);
+  if (size_limit != NULL) {
+    png_set_write_fn(write->png_ptr(), &limited_output,
+                     &WritePngToSizeLimitedString, &PngFlush);
+  } else {
+    png_set_write_fn(write->png_ptr(), buffer, &WritePngToString, &PngFlush);
+  }
   png_write_png(
       write->png_ptr(), write->info_ptr(), PNG_TRANSFORM_IDENTITY, NULL);
 
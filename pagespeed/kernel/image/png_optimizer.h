@@ -44,7 +44,10 @@ extern "C" {
 #include "third_party/optipng/src/opngreduc/opngreduc.h"
 
 namespace net_instaweb {
+class AtomicInt32;
 class MessageHandler;
+class QueuedWorkerPool;
+class ThreadSystem;
 }
 
 namespace pagespeed {
@@ -239,9 +242,30 @@ class PngOptimizer {
                                          GoogleString* out,
                                          MessageHandler* handler);
 
+  // Like OptimizePngBestCompression, but meant for large images. Candidate
+  // parameter sets that a look at the filtered scanlines predicts cannot
+  // win are skipped, and the rest are encoded concurrently on 'workers'.
+  // The calling thread encodes candidates too, and takes back any that the
+  // pool has not started yet, so a busy pool only costs parallelism. If
+  // 'workers' is NULL all candidates are encoded on the calling thread.
+  //
+  // The output can be larger than OptimizePngBestCompression's when a
+  // skipped candidate would have won, but it does not depend on how the
+  // encodes were scheduled.
+  static bool OptimizePngBestCompressionInParallel(
+      const PngReaderInterface& reader,
+      const GoogleString& in,
+      GoogleString* out,
+      net_instaweb::QueuedWorkerPool* workers,
+      net_instaweb::ThreadSystem* thread_system,
+      MessageHandler* handler);
+
   static bool CopyPngStructs(const ScopedPngStruct& from, ScopedPngStruct* to);
 
  private:
+  class ParallelSearch;
+  class ParallelSearchTask;
+
   explicit PngOptimizer(MessageHandler* handler);
   ~PngOptimizer();
 
@@ -257,17 +281,40 @@ class PngOptimizer {
   // smaller files.
   void EnableBestCompression() { best_compression_ = true; }
 
-  bool WritePng(ScopedPngStruct* write, GoogleString* buffer);
+  // Encodes best-compression candidates in parallel rather than one after
+  // another; see OptimizePngBestCompressionInParallel.
+  void EnableParallelSearch(net_instaweb::QueuedWorkerPool* workers,
+                            net_instaweb::ThreadSystem* thread_system) {
+    best_compression_ = true;
+    parallel_search_ = true;
+    workers_ = workers;
+    thread_system_ = thread_system;
+  }
+
+  bool WritePng(ScopedPngStruct* write,
+                const net_instaweb::AtomicInt32* size_limit,
+                GoogleString* buffer);
   bool CopyReadToWrite();
   bool CreateBestOptimizedPngForParams(const PngCompressParams* param_list,
                                        size_t param_list_size,
                                        GoogleString* out);
+  bool CreateBestOptimizedPngInParallel(const PngCompressParams* param_list,
+                                        size_t param_list_size,
+                                        GoogleString* out);
+
+  // Encodes 'write' with 'params' into 'out'. If 'size_limit' is non-NULL
+  // the encode is abandoned, returning false, as soon as its output grows
+  // past size_limit->value().
   bool CreateOptimizedPngWithParams(ScopedPngStruct* write,
                                     const PngCompressParams& params,
+                                    const net_instaweb::AtomicInt32* size_limit,
                                     GoogleString* out);
   ScopedPngStruct read_;
   ScopedPngStruct write_;
   bool best_compression_;
+  bool parallel_search_;
+  net_instaweb::QueuedWorkerPool* workers_;
+  net_instaweb::ThreadSystem* thread_system_;
   MessageHandler* message_handler_;
 
   DISALLOW_COPY_AND_ASSIGN(PngOptimizer);
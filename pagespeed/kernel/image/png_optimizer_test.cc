@@ -25,12 +25,16 @@
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/gif_reader.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 #include "pagespeed/kernel/image/test_utils.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/platform.h"
 
 extern "C" {
 #ifdef USE_SYSTEM_LIBPNG
@@ -50,6 +54,9 @@ namespace {
 
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
+using net_instaweb::Platform;
+using net_instaweb::QueuedWorkerPool;
+using net_instaweb::ThreadSystem;
 using pagespeed::image_compression::kGifTestDir;
 using pagespeed::image_compression::kPngSuiteTestDir;
 using pagespeed::image_compression::kPngSuiteGifTestDir;
@@ -714,6 +721,55 @@ TEST_F(PngOptimizerTest, LargerPng) {
   EXPECT_EQ(0, color_type);
 }
 
+TEST_F(PngOptimizerTest, ParallelSearch) {
+  net_instaweb::scoped_ptr<ThreadSystem> thread_system(
+      Platform::CreateThreadSystem());
+  QueuedWorkerPool workers(3, "png_search", thread_system.get());
+  reader_.reset(new PngReader(&message_handler_));
+  GoogleString in_rgba;
+  for (size_t i = 0; i < kValidImageCount; i++) {
+    const char* filename = kValidImages[i].filename;
+    GoogleString in, serial_out, parallel_out;
+    ReadTestFile(kPngSuiteTestDir, filename, "png", &in);
+    ASSERT_TRUE(PngOptimizer::OptimizePngBestCompression(
+        *reader_, in, &serial_out, &message_handler_)) << filename;
+    ASSERT_TRUE(PngOptimizer::OptimizePngBestCompressionInParallel(
+        *reader_, in, &parallel_out, &workers, thread_system.get(),
+        &message_handler_)) << filename;
+
+    // These images are too small for any candidate to be skipped, so the
+    // parallel search must pick exactly what the serial one does.
+    EXPECT_EQ(serial_out, parallel_out) << filename;
+    AssertPngEq(in, parallel_out, filename, in_rgba);
+  }
+  workers.ShutDown();
+}
+
+TEST_F(PngOptimizerTest, ParallelSearchLargerPng) {
+  net_instaweb::scoped_ptr<ThreadSystem> thread_system(
+      Platform::CreateThreadSystem());
+  QueuedWorkerPool workers(3, "png_search", thread_system.get());
+  reader_.reset(new PngReader(&message_handler_));
+  GoogleString in, serial_out, unpooled_out, parallel_out, in_rgba;
+  // Large enough that PredictUsefulFilters samples it.
+  ReadTestFile(kPngTestDir, "this_is_a_test", "png", &in);
+  ASSERT_TRUE(PngOptimizer::OptimizePngBestCompression(
+      *reader_, in, &serial_out, &message_handler_));
+  ASSERT_TRUE(PngOptimizer::OptimizePngBestCompressionInParallel(
+      *reader_, in, &unpooled_out, NULL, thread_system.get(),
+      &message_handler_));
+  ASSERT_TRUE(PngOptimizer::OptimizePngBestCompressionInParallel(
+      *reader_, in, &parallel_out, &workers, thread_system.get(),
+      &message_handler_));
+  // Skipping candidates can only lose ground on the exhaustive serial
+  // search, and the pool must not change which candidate wins.
+  EXPECT_LE(serial_out.size(), parallel_out.size());
+  EXPECT_EQ(unpooled_out, parallel_out);
+  EXPECT_GT(in.size(), parallel_out.size());
+  AssertPngEq(in, parallel_out, "this_is_a_test", in_rgba);
+  workers.ShutDown();
+}
+
 TEST_F(PngOptimizerTest, InvalidPngs) {
   reader_.reset(new PngReader(&message_handler_));
   for (size_t i = 0; i < kInvalidFileCount; i++) {
@@ -20,11 +20,14 @@
 
 #include "pagespeed/kernel/js/js_minify.h"
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "strings/stringpiece_utils.h"
 #include "pagespeed/kernel/base/source_map.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
 #include "pagespeed/kernel/js/js_keywords.h"
 #include "pagespeed/kernel/js/js_tokenizer.h"
 
@@ -600,6 +603,28 @@ bool ShouldRecordStep(
   return true;
 }
 
+// The tokenizer decides some tokens by looking a little past their end: at
+// the next token after a linebreak (e.g. "in" vs. "instanceof"), for "<!--"
+// and "-->", and at the rest of a multi-byte UTF-8 character.  A streamed
+// token is only kept if at least this much unconsumed input follows it.
+const int kStreamingLookahead = 16;
+
+// How much input JsStreamingMinifier consumes between saving its state, when
+// it is not near the end of the input it has.
+const int kStreamingCheckpointInterval = 1024;
+
+// Returns the piece of 'new_input' at the same offset as 'piece' is in
+// 'old_input', or 'piece' itself if that lies outside 'old_input'.
+StringPiece MovePiece(StringPiece piece, StringPiece old_input,
+                      StringPiece new_input) {
+  if (piece.empty() || piece.data() < old_input.data() ||
+      piece.data() + piece.size() > old_input.data() + old_input.size()) {
+    return piece;
+  }
+  return StringPiece(new_input.data() + (piece.data() - old_input.data()),
+                     piece.size());
+}
+
 }  // namespace
 
 JsMinifyingTokenizer::JsMinifyingTokenizer(
@@ -620,6 +645,58 @@ JsMinifyingTokenizer::JsMinifyingTokenizer(
 
 JsMinifyingTokenizer::~JsMinifyingTokenizer() {}
 
+JsMinifyingTokenizer::State::State()
+    : whitespace_(kNoWhitespace), prev_type_(JsKeywords::kEndOfInput),
+      next_type_(JsKeywords::kEndOfInput), num_mappings_(0) {}
+
+JsMinifyingTokenizer::State::~State() {}
+
+void JsMinifyingTokenizer::SaveState(State* state) const {
+  tokenizer_.SaveState(&state->tokenizer_state_);
+  state->whitespace_ = whitespace_;
+  state->prev_type_ = prev_type_;
+  state->prev_token_ = prev_token_;
+  state->next_type_ = next_type_;
+  state->next_token_ = next_token_;
+  state->num_mappings_ = (mappings_ == NULL ? 0 : mappings_->size());
+  state->current_position_ = current_position_;
+  state->next_position_ = next_position_;
+}
+
+void JsMinifyingTokenizer::RestoreState(const State& state) {
+  tokenizer_.RestoreState(state.tokenizer_state_);
+  whitespace_ = state.whitespace_;
+  prev_type_ = state.prev_type_;
+  prev_token_ = state.prev_token_;
+  next_type_ = state.next_type_;
+  next_token_ = state.next_token_;
+  if (mappings_ != NULL) {
+    mappings_->resize(state.num_mappings_);
+  }
+  current_position_ = state.current_position_;
+  next_position_ = state.next_position_;
+}
+
+StringPiece JsMinifyingTokenizer::RetainedInput() const {
+  const StringPiece retained = tokenizer_.RetainedInput();
+  const char* begin = retained.data();
+  // prev_token_ is a constant rather than input after semicolon insertion.
+  if (prev_type_ != JsKeywords::kSemiInsert && !prev_token_.empty()) {
+    begin = std::min(begin, prev_token_.data());
+  }
+  if (!next_token_.empty()) {
+    begin = std::min(begin, next_token_.data());
+  }
+  return StringPiece(begin, retained.data() + retained.size() - begin);
+}
+
+void JsMinifyingTokenizer::ResumeWithInput(StringPiece old_input,
+                                           StringPiece new_input) {
+  tokenizer_.ResumeWithInput(old_input, new_input);
+  prev_token_ = MovePiece(prev_token_, old_input, new_input);
+  next_token_ = MovePiece(next_token_, old_input, new_input);
+}
+
 JsKeywords::Type JsMinifyingTokenizer::NextToken(StringPiece* token_out) {
   net_instaweb::source_map::Mapping token_out_position;
   const JsKeywords::Type type = NextTokenHelper(token_out, &token_out_position);
@@ -774,6 +851,96 @@ bool MinifyUtf8JsWithSourceMap(
   }
 }
 
+JsStreamingMinifier::JsStreamingMinifier(
+    const JsTokenizerPatterns* patterns,
+    net_instaweb::source_map::MappingVector* mappings)
+    : tokenizer_(patterns, StringPiece(), mappings),
+      retry_size_(0),
+      finished_(false) {}
+
+JsStreamingMinifier::~JsStreamingMinifier() {}
+
+bool JsStreamingMinifier::Add(StringPiece input, net_instaweb::Writer* writer,
+                              net_instaweb::MessageHandler* handler) {
+  DCHECK(!finished_);
+  if (input.empty()) {
+    return true;
+  }
+  if (buffer_.size() + input.size() <= buffer_.capacity()) {
+    // Appending won't move the buffer, so the tokenizer's input is simply
+    // extended.
+    const StringPiece old_buffer(buffer_);
+    input.AppendToString(&buffer_);
+    tokenizer_.ResumeWithInput(old_buffer, buffer_);
+  } else {
+    // Move the input the tokenizer still needs, and the new input, to a
+    // bigger buffer, dropping the rest.  Leaving room to grow means the
+    // retained input is not copied again on every call.
+    const StringPiece retained =
+        buffer_.empty() ? StringPiece() : tokenizer_.RetainedInput();
+    GoogleString new_buffer;
+    new_buffer.reserve(2 * (retained.size() + input.size()));
+    retained.AppendToString(&new_buffer);
+    input.AppendToString(&new_buffer);
+    tokenizer_.ResumeWithInput(retained, new_buffer);
+    buffer_.swap(new_buffer);
+  }
+  return Minify(false, writer, handler);
+}
+
+bool JsStreamingMinifier::Finish(net_instaweb::Writer* writer,
+                                 net_instaweb::MessageHandler* handler) {
+  DCHECK(!finished_);
+  finished_ = true;
+  return Minify(true, writer, handler) && !has_error();
+}
+
+bool JsStreamingMinifier::Minify(bool at_end, net_instaweb::Writer* writer,
+                                 net_instaweb::MessageHandler* handler) {
+  if (!at_end &&
+      static_cast<int>(tokenizer_.unconsumed_input().size()) < retry_size_) {
+    return true;
+  }
+  output_.clear();
+  // Saving the state before every token is measurably slow, so far from the
+  // end of the input only save it every so often; if we have to back up from
+  // there, the tokens since are simply minified again.
+  int saved_input_size = -1;
+  size_t saved_output_size = 0;
+  while (true) {
+    const int input_size = tokenizer_.unconsumed_input().size();
+    if (!at_end &&
+        (saved_input_size < 0 || input_size < kStreamingCheckpointInterval ||
+         saved_input_size - input_size >= kStreamingCheckpointInterval)) {
+      tokenizer_.SaveState(&state_);
+      saved_input_size = input_size;
+      saved_output_size = output_.size();
+    }
+    StringPiece token;
+    const JsKeywords::Type type = tokenizer_.NextToken(&token);
+    if (!at_end && static_cast<int>(tokenizer_.unconsumed_input().size()) <
+                       kStreamingLookahead) {
+      // Too close to the end of the input seen so far to be sure of this
+      // token (which covers reaching the end, and errors, which consume
+      // the rest of the input).  Back up and wait for more input.
+      tokenizer_.RestoreState(state_);
+      output_.resize(saved_output_size);
+      retry_size_ = std::max(2 * saved_input_size, kStreamingLookahead);
+      break;
+    }
+    if (type == JsKeywords::kEndOfInput) {
+      DCHECK(token.empty());
+      break;
+    }
+    token.AppendToString(&output_);
+    if (type == JsKeywords::kError) {
+      DCHECK(tokenizer_.has_error());
+      break;
+    }
+  }
+  return output_.empty() || writer->Write(output_, handler);
+}
+
 bool MinifyJs(const StringPiece& input, GoogleString* out) {
   return legacy::MinifyJs(input, out);
 }
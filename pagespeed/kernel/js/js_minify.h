@@ -28,6 +28,11 @@
 #include "pagespeed/kernel/js/js_keywords.h"
 #include "pagespeed/kernel/js/js_tokenizer.h"
 
+namespace net_instaweb {
+class MessageHandler;
+class Writer;
+}  // namespace net_instaweb
+
 namespace pagespeed {
 
 namespace js {
@@ -67,6 +72,16 @@ class JsMinifyingTokenizer {
   // will return JsKeywords::kEndOfInput with an empty token string.
   bool has_error() const { return tokenizer_.has_error(); }
 
+  // Support for input that arrives in pieces; these work like the methods of
+  // the same names in JsTokenizer.  Restoring a State also drops any source
+  // mappings recorded since it was saved.
+  class State;
+  void SaveState(State* state) const;
+  void RestoreState(const State& state);
+  StringPiece unconsumed_input() const { return tokenizer_.unconsumed_input(); }
+  StringPiece RetainedInput() const;
+  void ResumeWithInput(StringPiece old_input, StringPiece new_input);
+
  private:
   JsKeywords::Type NextTokenHelper(
       StringPiece* token_out,
@@ -89,6 +104,81 @@ class JsMinifyingTokenizer {
   DISALLOW_COPY_AND_ASSIGN(JsMinifyingTokenizer);
 };
 
+class JsMinifyingTokenizer::State {
+ public:
+  State();
+  ~State();
+
+ private:
+  friend class JsMinifyingTokenizer;
+
+  JsTokenizer::State tokenizer_state_;
+  JsWhitespace whitespace_;
+  JsKeywords::Type prev_type_;
+  StringPiece prev_token_;
+  JsKeywords::Type next_type_;
+  StringPiece next_token_;
+  int num_mappings_;
+  net_instaweb::source_map::Mapping current_position_;
+  net_instaweb::source_map::Mapping next_position_;
+
+  DISALLOW_COPY_AND_ASSIGN(State);
+};
+
+// Minifies JavaScript that arrives in pieces, such as an inline script split
+// across flush windows or a large file read in chunks, writing the output as
+// it goes.  The output (and the source map, if requested) is identical to
+// what MinifyUtf8JsWithSourceMap() produces for the concatenated input.
+//
+// Only a few bytes past the last complete token are held back, plus any
+// token that is not complete yet.  The exception is a syntax error: since
+// everything from the error onward is passed through unmodified, and
+// whether there is an error may depend on input not seen yet, input from
+// the first suspicious token onward is held until Finish().
+class JsStreamingMinifier {
+ public:
+  // 'mappings' may be NULL if no source map is wanted; otherwise it must
+  // outlive this object, and mappings are appended to it as output is
+  // written.
+  JsStreamingMinifier(const JsTokenizerPatterns* patterns,
+                      net_instaweb::source_map::MappingVector* mappings);
+  ~JsStreamingMinifier();
+
+  // Adds the next piece of input, and writes out whatever part of the
+  // minified output is now certain.  Returns false if the writer fails.
+  bool Add(StringPiece input, net_instaweb::Writer* writer,
+           net_instaweb::MessageHandler* handler);
+
+  // Writes out the rest of the output once all input has been added.  Like
+  // MinifyUtf8Js(), returns false if a syntax error prevented complete
+  // minification (has_error() is then true), or if the writer fails.  No
+  // input may be added afterwards.
+  bool Finish(net_instaweb::Writer* writer,
+              net_instaweb::MessageHandler* handler);
+
+  bool has_error() const { return tokenizer_.has_error(); }
+
+ private:
+  // Minifies as far as is safe (or to the end if 'at_end') and writes the
+  // output.
+  bool Minify(bool at_end, net_instaweb::Writer* writer,
+              net_instaweb::MessageHandler* handler);
+
+  JsMinifyingTokenizer tokenizer_;
+  // The input still referred to by tokenizer_, and the input not yet
+  // tokenized.
+  GoogleString buffer_;
+  // Don't try tokenizing again until there is this much unconsumed input.
+  // Doubling it each time a long token is found to be incomplete keeps the
+  // total work linear, however the token is split up.
+  int retry_size_;
+  GoogleString output_;
+  JsMinifyingTokenizer::State state_;
+  bool finished_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsStreamingMinifier);
+};
+
 // Minifies the given UTF8-encoded JavaScript code; returns true if the code
 // parsed successfully, or false if a syntax error prevented complete
 // minification.  Even if this function returns false, the output string will
@@ -23,9 +23,12 @@
 
 #include "pagespeed/kernel/base/google_message_handler.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/source_map.h"
 #include "pagespeed/kernel/base/stdio_file_system.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/js/js_keywords.h"
 
 namespace {
@@ -91,6 +94,29 @@ const char* kAfterCompilationNew =
 
 const char kTestRootDir[] = "/pagespeed/kernel/js/testdata/third_party/";
 
+// Chunk sizes for feeding input to JsStreamingMinifier.  These include sizes
+// on either side of the minifier's lookahead, and a size larger than most
+// test inputs.
+const int kChunkSizes[] = {1, 2, 3, 7, 15, 16, 17, 64, 1000};
+
+// Simple method for serializing Mappings so that they can be compared against
+// gold versions.
+GoogleString MappingsToString(
+    const net_instaweb::source_map::MappingVector& mappings) {
+  GoogleString result("{");
+  for (int i = 0, n = mappings.size(); i < n; ++i) {
+    StrAppend(&result, "(",
+              net_instaweb::IntegerToString(mappings[i].gen_line), ", ",
+              net_instaweb::IntegerToString(mappings[i].gen_col),  ", ");
+    StrAppend(&result,
+              net_instaweb::IntegerToString(mappings[i].src_file), ", ",
+              net_instaweb::IntegerToString(mappings[i].src_line), ", ",
+              net_instaweb::IntegerToString(mappings[i].src_col),  "), ");
+  }
+  result += "}";
+  return result;
+}
+
 class JsMinifyTest : public testing::Test {
  protected:
   void CheckOldMinification(StringPiece before, StringPiece after) {
@@ -107,6 +133,41 @@ class JsMinifyTest : public testing::Test {
     GoogleString output;
     EXPECT_TRUE(pagespeed::js::MinifyUtf8Js(&patterns_, before, &output));
     EXPECT_EQ(after, output);
+    CheckStreamingMinification(before);
+  }
+
+  // Feeds 'input' to a JsStreamingMinifier in pieces of 'chunk_size' bytes,
+  // and returns what Finish() returned.
+  bool StreamingMinify(StringPiece input, int chunk_size, GoogleString* output,
+                       net_instaweb::source_map::MappingVector* mappings) {
+    net_instaweb::NullMessageHandler handler;
+    net_instaweb::StringWriter writer(output);
+    pagespeed::js::JsStreamingMinifier minifier(&patterns_, mappings);
+    for (size_t pos = 0; pos < input.size(); pos += chunk_size) {
+      EXPECT_TRUE(minifier.Add(input.substr(pos, chunk_size), &writer,
+                               &handler));
+    }
+    return minifier.Finish(&writer, &handler);
+  }
+
+  // Checks that streaming 'input' in pieces of any size gives the same
+  // result, output and source map as minifying it all at once.
+  void CheckStreamingMinification(StringPiece input) {
+    GoogleString expected_output;
+    net_instaweb::source_map::MappingVector expected_mappings;
+    const bool expected_result = pagespeed::js::MinifyUtf8JsWithSourceMap(
+        &patterns_, input, &expected_output, &expected_mappings);
+    for (size_t i = 0; i < arraysize(kChunkSizes); ++i) {
+      GoogleString output;
+      net_instaweb::source_map::MappingVector mappings;
+      EXPECT_EQ(expected_result,
+                StreamingMinify(input, kChunkSizes[i], &output, &mappings))
+          << "chunk size " << kChunkSizes[i];
+      EXPECT_EQ(expected_output, output) << "chunk size " << kChunkSizes[i];
+      EXPECT_EQ(MappingsToString(expected_mappings),
+                MappingsToString(mappings))
+          << "chunk size " << kChunkSizes[i];
+    }
   }
 
   void CheckMinification(StringPiece before, StringPiece after) {
@@ -126,6 +187,7 @@ class JsMinifyTest : public testing::Test {
   void CheckNewError(StringPiece input) {
     GoogleString output;
     EXPECT_FALSE(pagespeed::js::MinifyUtf8Js(&patterns_, input, &output));
+    CheckStreamingMinification(input);
   }
 
   void CheckError(StringPiece input) {
@@ -154,6 +216,7 @@ class JsMinifyTest : public testing::Test {
     GoogleString actual;
     EXPECT_TRUE(pagespeed::js::MinifyUtf8Js(&patterns_, original, &actual));
     EXPECT_STREQ(expected, actual);
+    CheckStreamingMinification(original);
   }
 
   pagespeed::js::JsTokenizerPatterns patterns_;
@@ -579,24 +642,6 @@ TEST_F(JsMinifyTest, MinifyPrototype) {
   CheckFileMinification("prototype.original", "prototype.minified");
 }
 
-// Simple method for serializing Mappings so that they can be compared against
-// gold versions.
-GoogleString MappingsToString(
-    const net_instaweb::source_map::MappingVector& mappings) {
-  GoogleString result("{");
-  for (int i = 0, n = mappings.size(); i < n; ++i) {
-    StrAppend(&result, "(",
-              net_instaweb::IntegerToString(mappings[i].gen_line), ", ",
-              net_instaweb::IntegerToString(mappings[i].gen_col),  ", ");
-    StrAppend(&result,
-              net_instaweb::IntegerToString(mappings[i].src_file), ", ",
-              net_instaweb::IntegerToString(mappings[i].src_line), ", ",
-              net_instaweb::IntegerToString(mappings[i].src_col),  "), ");
-  }
-  result += "}";
-  return result;
-}
-
 TEST_F(JsMinifyTest, SourceMapsSimple) {
   const char js_before[] =
       "/* Simple hello world program. */\n"
@@ -705,4 +750,42 @@ TEST_F(JsMinifyTest, SourceMapsComplex) {
   EXPECT_EQ(expected_map, MappingsToString(mappings));
 }
 
+TEST_F(JsMinifyTest, StreamingSourceMaps) {
+  CheckStreamingMinification(kBeforeCompilation);
+}
+
+// Decisions that depend on what follows a token must wait for enough input.
+TEST_F(JsMinifyTest, StreamingSplitsTokens) {
+  CheckStreamingMinification("var x = a\ninstanceof b;\nvar y = a\ninner();");
+  CheckStreamingMinification("x = 1 <!-- y\n-->z\nfoo();");
+  CheckStreamingMinification("var s = '\xE2\x80\xA8 abc'; return /re/g");
+  CheckStreamingMinification("a = b\n++c\nd = 1.5e10 + 0x1F.toString()");
+}
+
+// Output is written as the input comes in, rather than all at the end.
+TEST_F(JsMinifyTest, StreamingWritesIncrementally) {
+  net_instaweb::NullMessageHandler handler;
+  GoogleString output;
+  net_instaweb::StringWriter writer(&output);
+  pagespeed::js::JsStreamingMinifier minifier(&patterns_, NULL);
+  const StringPiece input(kBeforeCompilation);
+  for (size_t pos = 0; pos < input.size(); pos += 10) {
+    ASSERT_TRUE(minifier.Add(input.substr(pos, 10), &writer, &handler));
+  }
+  // All but the last few tokens are out already.
+  const StringPiece expected(kAfterCompilationNew);
+  EXPECT_TRUE(expected.starts_with(output));
+  EXPECT_GT(20u, expected.size() - output.size());
+  EXPECT_TRUE(minifier.Finish(&writer, &handler));
+  EXPECT_EQ(expected, output);
+}
+
+// A long string literal arriving a byte at a time.
+TEST_F(JsMinifyTest, StreamingLongToken) {
+  GoogleString input = "var s = '";
+  input.append(100000, 'x');
+  input.append("';\nalert(s);\n");
+  CheckStreamingMinification(input);
+}
+
 }  // namespace
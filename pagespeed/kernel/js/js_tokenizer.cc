@@ -313,6 +313,11 @@ JsTokenizer::JsTokenizer(const JsTokenizerPatterns* patterns,
 
 JsTokenizer::~JsTokenizer() {}
 
+JsTokenizer::State::State()
+    : json_step_(kJsonStart), start_of_line_(true), error_(false) {}
+
+JsTokenizer::State::~State() {}
+
 JsKeywords::Type JsTokenizer::NextToken(StringPiece* token_out) {
   // Empty out the lookahead queue before we scan any further.
   if (!lookahead_queue_.empty()) {
@@ -413,6 +418,54 @@ JsKeywords::Type JsTokenizer::NextToken(StringPiece* token_out) {
   }
 }
 
+void JsTokenizer::SaveState(State* state) const {
+  state->parse_stack_ = parse_stack_;
+  state->lookahead_queue_ = lookahead_queue_;
+  state->input_ = input_;
+  state->json_step_ = json_step_;
+  state->start_of_line_ = start_of_line_;
+  state->error_ = error_;
+}
+
+void JsTokenizer::RestoreState(const State& state) {
+  parse_stack_ = state.parse_stack_;
+  lookahead_queue_ = state.lookahead_queue_;
+  input_ = state.input_;
+  json_step_ = state.json_step_;
+  start_of_line_ = state.start_of_line_;
+  error_ = state.error_;
+}
+
+StringPiece JsTokenizer::RetainedInput() const {
+  if (lookahead_queue_.empty()) {
+    return input_;
+  }
+  const char* begin = lookahead_queue_.front().second.data();
+  return StringPiece(begin, input_.data() + input_.size() - begin);
+}
+
+void JsTokenizer::ResumeWithInput(StringPiece old_input,
+                                  StringPiece new_input) {
+  DCHECK_LE(old_input.size(), new_input.size());
+  for (std::deque<std::pair<JsKeywords::Type, StringPiece> >::iterator iter =
+           lookahead_queue_.begin(); iter != lookahead_queue_.end(); ++iter) {
+    StringPiece* token = &iter->second;
+    DCHECK(token->data() >= old_input.data() &&
+           token->data() + token->size() <= old_input.data() + old_input.size());
+    *token = StringPiece(new_input.data() + (token->data() - old_input.data()),
+                         token->size());
+  }
+  // The unconsumed input may be empty and point anywhere if the tokenizer
+  // has never had any input.
+  int offset = old_input.size();
+  if (!input_.empty()) {
+    DCHECK(input_.data() >= old_input.data() &&
+           input_.data() + input_.size() == old_input.data() + old_input.size());
+    offset = input_.data() - old_input.data();
+  }
+  input_ = new_input.substr(offset);
+}
+
 GoogleString JsTokenizer::ParseStackForTest() const {
   GoogleString output;
   for (std::vector<ParseState>::const_iterator iter = parse_stack_.begin();
@@ -1020,14 +1073,24 @@ JsKeywords::Type JsTokenizer::ConsumeString(StringPiece* token_out) {
   DCHECK(!input_.empty());
   DCHECK(input_[0] == '"' || input_[0] == '\'');
   Re2StringPiece unconsumed = StringPieceToRe2(input_);
-  if (!RE2::Consume(&unconsumed, patterns_->string_literal_pattern) ||
-      input_[input_.size() - unconsumed.size() - 1] != input_[0]) {
+  if (!RE2::Consume(&unconsumed, patterns_->string_literal_pattern)) {
+    return Error(token_out);
+  }
+  const int size = input_.size() - unconsumed.size();
+  // If the string is unterminated, the regex can still match by treating the
+  // backslash of an escaped quote as an ordinary character; so make sure the
+  // closing quote isn't preceded by an odd number of backslashes.
+  int num_backslashes = 0;
+  while (num_backslashes < size - 2 &&
+         input_[size - 2 - num_backslashes] == '\\') {
+    ++num_backslashes;
+  }
+  if (input_[size - 1] != input_[0] || num_backslashes % 2 != 0) {
     // EOF or an unescaped linebreak in the string will cause an error.
     return Error(token_out);
   }
   PushExpression();
-  return Emit(JsKeywords::kStringLiteral, input_.size() - unconsumed.size(),
-              token_out);
+  return Emit(JsKeywords::kStringLiteral, size, token_out);
 }
 
 bool JsTokenizer::TryConsumeWhitespace(
@@ -87,6 +87,29 @@ class JsTokenizer {
   // Return a string representing the current parse stack, for testing only.
   GoogleString ParseStackForTest() const;
 
+  // The remaining methods support tokenizing input that arrives in pieces
+  // (see JsStreamingMinifier in js_minify.h).  A caller that does not yet
+  // have the whole input saves the tokenizer's state before each token, and
+  // restores it to take back a token that might continue, or be tokenized
+  // differently, once more input arrives.
+  class State;
+  void SaveState(State* state) const;
+  void RestoreState(const State& state);
+
+  // Returns the input that has not been consumed yet.  Note that tokens in
+  // the lookahead queue have been consumed, but not yet returned.
+  StringPiece unconsumed_input() const { return input_; }
+
+  // Returns the suffix of the input that the tokenizer still refers to: the
+  // unconsumed input, plus any tokens waiting in the lookahead queue.
+  StringPiece RetainedInput() const;
+
+  // Switches to reading 'new_input', which must begin with a copy of
+  // 'old_input', the RetainedInput() (or a longer suffix of the current
+  // input), and may continue with input the tokenizer has not seen before.
+  // Any saved State is invalidated.
+  void ResumeWithInput(StringPiece old_input, StringPiece new_input);
+
  private:
   // An entry in the parse stack.  This does not fully capture the grammar of
   // JavaScript -- far from it -- rather, it is just barely nuanced enough to
@@ -190,6 +213,25 @@ class JsTokenizer {
   DISALLOW_COPY_AND_ASSIGN(JsTokenizer);
 };
 
+// A snapshot of everything in a JsTokenizer that NextToken() can change.
+class JsTokenizer::State {
+ public:
+  State();
+  ~State();
+
+ private:
+  friend class JsTokenizer;
+
+  std::vector<ParseState> parse_stack_;
+  std::deque<std::pair<JsKeywords::Type, StringPiece> > lookahead_queue_;
+  StringPiece input_;
+  JsonStep json_step_;
+  bool start_of_line_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(State);
+};
+
 // Structure to store RE2 patterns that can be shared by instances of
 // JsTokenizer.  These patterns are slightly expensive to compile, so we'd
 // rather not create one for every JsTokenizer instance, but unfortunately C++
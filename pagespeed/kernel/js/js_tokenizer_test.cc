@@ -1415,6 +1415,13 @@ TEST_F(JsTokenizerTest, UnclosedStringLiteral) {
   ExpectError("'quux;");
 }
 
+TEST_F(JsTokenizerTest, UnclosedStringLiteralEndingInEscapedQuote) {
+  BeginTokenizing("bar='quux\\'");
+  ExpectToken(JsKeywords::kIdentifier, "bar");
+  ExpectToken(JsKeywords::kOperator,   "=");
+  ExpectError("'quux\\'");
+}
+
 TEST_F(JsTokenizerTest, UnmatchedCloseParen) {
   BeginTokenizing("bar='quux');");
   ExpectToken(JsKeywords::kIdentifier, "bar");
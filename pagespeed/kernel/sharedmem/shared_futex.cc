@@ -0,0 +1,83 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/sharedmem/shared_futex.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <climits>
+
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+#ifdef __linux__
+
+// Note that we deliberately don't use the FUTEX_PRIVATE_FLAG variants, as
+// those only match waiters within a single process.
+
+bool SharedFutex::Supported() {
+  return true;
+}
+
+void SharedFutex::Wait(volatile Word* word, Word expected, int64 timeout_us) {
+  if (timeout_us <= 0) {
+    return;
+  }
+  timespec timeout;
+  timeout.tv_sec = timeout_us / Timer::kSecondUs;
+  timeout.tv_nsec = (timeout_us % Timer::kSecondUs) * 1000;
+  if (timeout.tv_sec > INT_MAX) {
+    timeout.tv_sec = INT_MAX;
+  }
+  // The kernel compares *word against expected atomically with queueing us,
+  // so a WakeAll() after a change to *word can't be missed.  EINTR, EAGAIN
+  // and ETIMEDOUT all just mean the caller should look again.
+  syscall(SYS_futex, const_cast<Word*>(word), FUTEX_WAIT, expected, &timeout,
+          NULL, 0);
+}
+
+void SharedFutex::WakeAll(volatile Word* word) {
+  syscall(SYS_futex, const_cast<Word*>(word), FUTEX_WAKE, INT_MAX, NULL, NULL,
+          0);
+}
+
+#else
+
+bool SharedFutex::Supported() {
+  return false;
+}
+
+void SharedFutex::Wait(volatile Word* word, Word expected, int64 timeout_us) {
+}
+
+void SharedFutex::WakeAll(volatile Word* word) {
+}
+
+#endif
+
+}  // namespace net_instaweb
@@ -0,0 +1,54 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_FUTEX_H_
+#define PAGESPEED_KERNEL_SHAREDMEM_SHARED_FUTEX_H_
+
+#include "pagespeed/kernel/base/atomicops.h"
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Sleep/wake primitives on a 32-bit word that may live in a shared memory
+// segment, so a thread in one process can sleep until a thread in another
+// changes the word.  This is futex(2) on Linux.  Elsewhere Supported()
+// returns false, Wait() returns immediately and WakeAll() does nothing, so
+// callers need to fall back to polling.
+class SharedFutex {
+ public:
+  typedef base::subtle::Atomic32 Word;
+
+  static bool Supported();
+
+  // Sleeps for up to timeout_us as long as *word == expected.  Returns
+  // immediately if *word != expected on entry; may also return spuriously,
+  // so callers must re-check whatever condition they are waiting for.
+  static void Wait(volatile Word* word, Word expected, int64 timeout_us);
+
+  // Wakes all threads, in any process, sleeping in Wait() on word.
+  static void WakeAll(volatile Word* word);
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(SharedFutex);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_SHAREDMEM_SHARED_FUTEX_H_
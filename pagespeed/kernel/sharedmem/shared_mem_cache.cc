@@ -116,12 +116,60 @@
 //
 // For now, writers wait in sleep loop, while readers simply fail/miss.
 //
+// version is a sequence number for lock-free readers; see below.
+//
+// ----------------------------------------------------------------------------
+// Optimistic reads
+// ----------------------------------------------------------------------------
+//
+// Where 64-bit atomics are available, Get does not take the sector lock in
+// the common case. Instead, writers bump an entry's version to an odd value
+// (with the lock held) before changing its key, size or list of blocks, or
+// handing any of its blocks to another entry, and bump it back to even once
+// done. A reader samples the version, and if it is even, compares the key and
+// copies the payload with no lock held, then checks that the version has not
+// changed. If it has, the reader may have seen a torn entry, so it retries,
+// and after a few attempts falls back to the locked path. Readers on this path
+// do not bump open_count, so writers never wait for them.
+//
+// To avoid writing to the sector on every hit, lock-free hits only move the
+// entry to the front of the LRU (and refresh its timestamp) if it was last
+// touched over kTouchIntervalMs ago, and only if the sector lock can be had
+// without waiting. The LRU order and timestamps used for replacement are
+// therefore approximate for hot entries.
+//
+// ----------------------------------------------------------------------------
+// Incremental checkpoints
+// ----------------------------------------------------------------------------
+//
+// With set_incremental_checkpoints(true), a checkpoint copies the whole sector
+// (minus the mutex) with the lock held, and then, on the file cache's worker
+// thread, cuts the copy into kImageChunkBytes chunks. Each chunk is hashed, and
+// only chunks whose hash differs from the previous checkpoint's are written to
+// the file cache, under keys that include the generation of the checkpoint
+// writing them. All-zero chunks are not written at all. The manifest, which
+// lists the generation and hash of every chunk, is written last, and chunks
+// only it referenced are deleted after that. Since the file cache replaces
+// files atomically, a crash at any point leaves the previous manifest and all
+// of its chunks in place.
+//
+// At startup the image is reassembled, checked against the hashes, checked for
+// structural consistency, and copied back into the sector. Entries that were
+// being written when the image was taken are freed, and reader counts and
+// versions are reset, since the processes they belonged to are gone. This
+// replaces re-inserting every entry, as restoring a regular snapshot does.
+//
+// Checkpoints of one sector may be started by any process, so the sector
+// header records whether one is being written out. That mark expires after
+// kImageCheckpointLeaseMs in case the process writing it died.
+//
 // TODO(morlovich): Evaluate using chaining and one more layer of indirection
 // instead, as it should hopefully produce much better utilization and avoid
 // conflict misses entirely.
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 
+#include <algorithm>
 #include <cstddef>                     // for size_t
 #include <cstring>
 #include <map>
@@ -131,6 +179,7 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/base64_util.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
@@ -166,6 +215,69 @@ namespace {
 // format.
 const int kSnapshotVersion = 1;
 
+// Likewise for the layout of sectors, which incremental checkpoints copy
+// verbatim.
+const int kImageVersion = 1;
+
+// Granularity at which incremental checkpoints detect changes.
+const size_t kImageChunkBytes = 64 * 1024;
+
+// Generation recorded for chunks that are all zeros and so are not stored.
+const int64 kZeroChunkGeneration = -1;
+
+// How long an incremental checkpoint may take before another process assumes
+// the one writing it is gone and starts over.
+const int64 kImageCheckpointLeaseMs = 10 * Timer::kMinuteMs;
+
+// How many times a lock-free Get retries after racing a writer before taking
+// the sector lock.
+const int kOptimisticReadAttempts = 2;
+
+// Lock-free hits re-link an entry into the LRU at most this often.
+const int64 kTouchIntervalMs = 100;
+
+inline volatile base::subtle::Atomic32* VersionPtr(CacheEntry* entry) {
+  return reinterpret_cast<volatile base::subtle::Atomic32*>(&entry->version);
+}
+
+// Versions are allowed to wrap around.
+inline int32 NextVersion(const CacheEntry* entry) {
+  return static_cast<int32>(static_cast<uint32>(entry->version) + 1);
+}
+
+// Seqlock write side: bracket any change to an entry's key, size or blocks.
+// Must be called with the sector lock held.
+void BeginEntryWrite(CacheEntry* entry) {
+  DCHECK_EQ(0, entry->version & 1);
+  base::subtle::NoBarrier_Store(VersionPtr(entry), NextVersion(entry));
+  base::subtle::MemoryBarrier();
+}
+
+void EndEntryWrite(CacheEntry* entry) {
+  DCHECK_EQ(1, entry->version & 1);
+  base::subtle::Release_Store(VersionPtr(entry), NextVersion(entry));
+}
+
+#ifdef ARCH_CPU_64_BITS
+// Get statistics are bumped by lock-free readers, so all updates to them use
+// atomic increments.
+inline void IncrementStat(int64* stat) {
+  base::subtle::NoBarrier_AtomicIncrement(
+      reinterpret_cast<volatile base::subtle::Atomic64*>(stat), 1);
+}
+
+inline int64 LoadTimestamp(const CacheEntry* entry) {
+  return base::subtle::NoBarrier_Load(
+      reinterpret_cast<volatile const base::subtle::Atomic64*>(
+          &entry->last_use_timestamp_ms));
+}
+#else
+// Without 64-bit atomics every Get takes the sector lock.
+inline void IncrementStat(int64* stat) {
+  ++*stat;
+}
+#endif  // ARCH_CPU_64_BITS
+
 bool IsAllNil(const StringPiece& raw_hash) {
   bool all_nil = true;
   for (size_t c = 0; c < raw_hash.length(); ++c) {
@@ -213,6 +325,7 @@ SharedMemCache<kBlockSize>::SharedMemCache(
       entries_per_sector_(entries_per_sector),
       blocks_per_sector_(blocks_per_sector),
       checkpoint_interval_sec_(-1),
+      incremental_checkpoints_(false),
       handler_(handler),
       snapshot_path_(""),
       file_cache_(NULL) {
@@ -585,9 +698,217 @@ GoogleString SharedMemCache<kBlockSize>::SnapshotCacheKey(
                        IntegerToString(sector_num)));
 }
 
+template<size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::ImageManifestCacheKey(
+    int sector_num) const {
+  // The size of the mutex and of the entries is part of the layout too.
+  return StrCat("shm_metadata_cache/image/",
+                filename_, "/",
+                IntegerToString(kImageVersion), "/",
+                StrCat(IntegerToString(kBlockSize), "/",
+                       IntegerToString(entries_per_sector_), "/",
+                       IntegerToString(blocks_per_sector_), "/",
+                       IntegerToString(num_sectors_), "/",
+                       IntegerToString(segment_->SharedMutexSize()), "/",
+                       IntegerToString(sector_num)));
+}
+
+template<size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::ImageChunkCacheKey(
+    int sector_num, int chunk, int64 generation) const {
+  return StrCat(ImageManifestCacheKey(sector_num), "/",
+                IntegerToString(chunk), "/",
+                Integer64ToString(generation));
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::CopySectorImage(
+    int sector_num, int64 last_checkpoint_ms, GoogleString* image) {
+  CHECK_LE(0, sector_num);
+  CHECK_LT(sector_num, num_sectors_);
+
+  Sector<kBlockSize>* sector = sectors_[sector_num];
+  SectorStats* stats = sector->sector_stats();
+  ScopedMutex lock(sector->mutex());
+  DCHECK(!(last_checkpoint_ms > stats->last_checkpoint_ms));
+  if (last_checkpoint_ms < stats->last_checkpoint_ms) {
+    // Another thread already checkpointed this sector; do nothing.
+    return false;
+  }
+
+  int64 now_ms = timer_->NowMs();
+  if (sector->checkpoint_in_progress() &&
+      (now_ms - stats->last_checkpoint_ms < kImageCheckpointLeaseMs)) {
+    return false;
+  }
+
+  stats->last_checkpoint_ms = now_ms;
+  sector->set_checkpoint_in_progress(true);
+  sector->CopyToImage(image);
+  return true;
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::FinishSectorImage(int sector_num) {
+  Sector<kBlockSize>* sector = sectors_[sector_num];
+  ScopedMutex lock(sector->mutex());
+  sector->set_checkpoint_in_progress(false);
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::ReadImageManifest(
+    int sector_num, SharedMemCacheImageManifest* out) {
+  CacheInterface::SynchronousCallback callback;
+  file_cache_->Get(ImageManifestCacheKey(sector_num), &callback);
+  CHECK(callback.called());
+  if (callback.state() != CacheInterface::kAvailable) {
+    return false;
+  }
+  StringPiece marshaled = callback.value().Value();
+  ArrayInputStream input(marshaled.data(), marshaled.size());
+  return out->ParseFromZeroCopyStream(&input);
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::WriteOutImageFromWorkerThread(
+    int sector_num, int64 last_checkpoint_ms) {
+  GoogleString image;
+  if (!CopySectorImage(sector_num, last_checkpoint_ms, &image)) {
+    return;  // Another thread got to it first.  Nothing needs doing.
+  }
+
+  CHECK(file_cache_ != NULL);
+  int num_chunks = (image.size() + kImageChunkBytes - 1) / kImageChunkBytes;
+  SharedMemCacheImageManifest previous;
+  if (!ReadImageManifest(sector_num, &previous) ||
+      previous.image_size() != static_cast<int64>(image.size()) ||
+      previous.chunk_size() != num_chunks) {
+    previous.Clear();
+  }
+
+  // Chunk keys must not collide with the previous manifest's even if the
+  // clock did not advance.
+  SharedMemCacheImageManifest manifest;
+  int64 generation =
+      std::max<int64>(timer_->NowMs(), previous.generation() + 1);
+  manifest.set_generation(generation);
+  manifest.set_image_size(image.size());
+  for (int c = 0; c < num_chunks; ++c) {
+    StringPiece chunk = StringPiece(image).substr(c * kImageChunkBytes,
+                                                  kImageChunkBytes);
+    SharedMemCacheImageChunk* chunk_info = manifest.add_chunk();
+    if (IsAllNil(chunk)) {
+      chunk_info->set_generation(kZeroChunkGeneration);
+      chunk_info->set_checksum("");
+      continue;
+    }
+    GoogleString checksum = hasher_->RawHash(chunk);
+    if (c < previous.chunk_size() &&
+        previous.chunk(c).generation() != kZeroChunkGeneration &&
+        previous.chunk(c).checksum() == checksum) {
+      chunk_info->set_generation(previous.chunk(c).generation());
+    } else {
+      chunk_info->set_generation(generation);
+      file_cache_->Put(ImageChunkCacheKey(sector_num, c, generation),
+                       SharedString(chunk));
+    }
+    chunk_info->set_checksum(checksum);
+  }
+
+  GoogleString manifest_s;
+  {
+    StringOutputStream sstream(&manifest_s);  // finalizes in destructor
+    manifest.SerializeToZeroCopyStream(&sstream);
+  }
+  file_cache_->Put(ImageManifestCacheKey(sector_num),
+                   SharedString(manifest_s));
+
+  // Only now that the new manifest is in place can the chunks it no longer
+  // refers to go.
+  for (int c = 0; c < previous.chunk_size(); ++c) {
+    int64 old_generation = previous.chunk(c).generation();
+    if (old_generation != kZeroChunkGeneration &&
+        old_generation != manifest.chunk(c).generation()) {
+      file_cache_->Delete(ImageChunkCacheKey(sector_num, c, old_generation));
+    }
+  }
+  FinishSectorImage(sector_num);
+}
+
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::RestoreSectorImage(int sector_num) {
+  SharedMemCacheImageManifest manifest;
+  if (!ReadImageManifest(sector_num, &manifest)) {
+    return false;
+  }
+
+  Sector<kBlockSize>* sector = sectors_[sector_num];
+  size_t image_size = sector->ImageSize();
+  int num_chunks = (image_size + kImageChunkBytes - 1) / kImageChunkBytes;
+  bool ok = (manifest.image_size() == static_cast<int64>(image_size) &&
+             manifest.chunk_size() == num_chunks);
+
+  GoogleString image;
+  if (ok) {
+    image.assign(image_size, '\0');
+  }
+  for (int c = 0; ok && c < num_chunks; ++c) {
+    const SharedMemCacheImageChunk& chunk_info = manifest.chunk(c);
+    if (chunk_info.generation() == kZeroChunkGeneration) {
+      continue;
+    }
+    size_t offset = c * kImageChunkBytes;
+    size_t chunk_size = std::min(kImageChunkBytes, image_size - offset);
+    CacheInterface::SynchronousCallback callback;
+    file_cache_->Get(
+        ImageChunkCacheKey(sector_num, c, chunk_info.generation()), &callback);
+    CHECK(callback.called());
+    StringPiece chunk = callback.value().Value();
+    ok = (callback.state() == CacheInterface::kAvailable &&
+          chunk.size() == chunk_size &&
+          hasher_->RawHash(chunk) == chunk_info.checksum());
+    if (ok) {
+      std::memcpy(&image[offset], chunk.data(), chunk_size);
+    }
+  }
+
+  if (ok) {
+    ScopedMutex lock(sector->mutex());
+    ok = sector->RestoreFromImage(image);
+    if (ok) {
+      // Nobody is reading or writing any entry any more. Entries that were
+      // being written may have partial payloads, so they have to go.
+      for (EntryNum e = 0; e < entries_per_sector_; ++e) {
+        CacheEntry* entry = sector->EntryAt(e);
+        entry->open_count = 0;
+        entry->version = 0;
+        if (entry->creating) {
+          BlockVector blocks;
+          sector->BlockListForEntry(entry, &blocks);
+          sector->ReturnBlocksToFreeList(blocks);
+          entry->creating = false;
+          MarkEntryFree(sector, e);
+        }
+      }
+    }
+  }
+
+  if (!ok) {
+    handler_->Message(
+        kWarning, "SharedMemCache: discarding damaged checkpoint of sector %d "
+        "of %s", sector_num, filename_.c_str());
+    file_cache_->Delete(ImageManifestCacheKey(sector_num));
+  }
+  return ok;
+}
+
 template<size_t kBlockSize>
 void SharedMemCache<kBlockSize>::WriteOutSnapshotFromWorkerThread(
     int sector_num, int64 last_checkpoint_ms) {
+  if (incremental_checkpoints_) {
+    WriteOutImageFromWorkerThread(sector_num, last_checkpoint_ms);
+    return;
+  }
   SharedMemCacheDump snapshot;
   bool updated = AddSectorToSnapshot(sector_num, last_checkpoint_ms, &snapshot);
   if (!updated) {
@@ -619,6 +940,9 @@ void SharedMemCache<kBlockSize>::RestoreFromDisk() {
   // on the file cache being a synchronous cache.
   CHECK(file_cache_->IsBlocking());
   for (int sector_num = 0; sector_num < num_sectors_; ++sector_num) {
+    if (incremental_checkpoints_ && RestoreSectorImage(sector_num)) {
+      continue;
+    }
     CacheInterface::SynchronousCallback callback;
     file_cache_->Get(SnapshotCacheKey(sector_num), &callback);
     CHECK(callback.called());
@@ -658,6 +982,7 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
       sector->ReturnBlocksToFreeList(blocks);
       entry->creating = false;
       MarkEntryFree(sector, entry_num);
+      EndEntryWrite(entry);
       return;
     }
   }
@@ -696,6 +1021,7 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(
 
   // We're done, clear creating bit.
   entry->creating = false;
+  EndEntryWrite(entry);
 }
 
 template<size_t kBlockSize>
@@ -706,16 +1032,31 @@ void SharedMemCache<kBlockSize>::Get(const GoogleString& key,
   ExtractPosition(raw_hash, &pos);
   CacheInterface::KeyState key_state = kNotFound;
   Sector<kBlockSize>* sector = sectors_[pos.sector];
+  SectorStats* stats = sector->sector_stats();
+
+#ifdef ARCH_CPU_64_BITS
+  if (TryGetWithoutLock(raw_hash, pos, sector, callback, &key_state)) {
+    IncrementStat(&stats->num_get);
+    if (key_state == kAvailable) {
+      IncrementStat(&stats->num_get_hit);
+    }
+    ValidateAndReportResult(key, key_state, callback);
+    return;
+  }
+#endif  // ARCH_CPU_64_BITS
+
   {
     ScopedMutex lock(sector->mutex());
-    SectorStats* stats = sector->sector_stats();
-    ++stats->num_get;
+    IncrementStat(&stats->num_get);
+#ifdef ARCH_CPU_64_BITS
+    ++stats->num_get_locked;
+#endif  // ARCH_CPU_64_BITS
 
     for (int p = 0; p < kAssociativity; ++p) {
       EntryNum cand_key = pos.keys[p];
       CacheEntry* cand = sector->EntryAt(cand_key);
       if (KeyMatch(cand, raw_hash)) {
-        ++stats->num_get_hit;
+        IncrementStat(&stats->num_get_hit);
         key_state = GetFromEntry(key, sector, cand_key, callback);
         break;
       }
@@ -725,6 +1066,86 @@ void SharedMemCache<kBlockSize>::Get(const GoogleString& key,
   ValidateAndReportResult(key, key_state, callback);
 }
 
+#ifdef ARCH_CPU_64_BITS
+template<size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::TryGetWithoutLock(
+    const GoogleString& raw_hash, const Position& pos,
+    Sector<kBlockSize>* sector, Callback* callback,
+    CacheInterface::KeyState* key_state) {
+  for (int attempt = 0; attempt < kOptimisticReadAttempts; ++attempt) {
+    bool raced = false;
+    for (int p = 0; p < kAssociativity; ++p) {
+      EntryNum cand_key = pos.keys[p];
+      CacheEntry* cand = sector->EntryAt(cand_key);
+      int32 version = base::subtle::Acquire_Load(VersionPtr(cand));
+      if ((version & 1) != 0) {
+        // Being written. If it is our key, the locked path would consider it
+        // a miss as well, so just move on.
+        continue;
+      }
+      if (!KeyMatch(cand, raw_hash)) {
+        continue;
+      }
+
+      size_t byte_size = static_cast<size_t>(cand->byte_size);
+      BlockNum first_block = cand->first_block;
+      BlockVector blocks;
+      SharedString value;
+      if (byte_size <= MaxValueSize() &&
+          sector->BlockListForEntryUnlocked(first_block, byte_size, &blocks)) {
+        value.Extend(byte_size);
+        size_t total_blocks = blocks.size();
+        int offset = 0;
+        for (size_t b = 0; b < total_blocks; ++b) {
+          int bytes = sector->BytesInPortion(byte_size, b, total_blocks);
+          value.WriteAt(offset, sector->BlockBytes(blocks[b]), bytes);
+          offset += bytes;
+        }
+      }
+
+      // Make sure all the reads above are done before re-checking the version.
+      base::subtle::MemoryBarrier();
+      if (base::subtle::NoBarrier_Load(VersionPtr(cand)) != version ||
+          blocks.size() != sector->DataBlocksForSize(byte_size)) {
+        raced = true;
+        break;
+      }
+
+      callback->set_value(value);
+      *key_state = kAvailable;
+      MaybeTouchEntry(sector, cand_key, version);
+      return true;
+    }
+    if (!raced) {
+      *key_state = kNotFound;
+      return true;
+    }
+  }
+  return false;
+}
+
+template<size_t kBlockSize>
+void SharedMemCache<kBlockSize>::MaybeTouchEntry(Sector<kBlockSize>* sector,
+                                                 EntryNum entry_num,
+                                                 int32 version) {
+  CacheEntry* entry = sector->EntryAt(entry_num);
+  int64 now_ms = timer_->NowMs();
+  if (now_ms - LoadTimestamp(entry) < kTouchIntervalMs) {
+    return;
+  }
+  // If another process holds the lock, skip the touch rather than wait; some
+  // later hit will do it.
+  if (!sector->mutex()->TryLock()) {
+    return;
+  }
+  // The entry may have been replaced since we read it.
+  if (entry->version == version) {
+    TouchEntry(sector, now_ms, entry_num);
+  }
+  sector->mutex()->Unlock();
+}
+#endif  // ARCH_CPU_64_BITS
+
 // Expects sector->mutex() held on entry, leaves it held on exit.
 template<size_t kBlockSize>
 CacheInterface::KeyState SharedMemCache<kBlockSize>::GetFromEntry(
@@ -803,6 +1224,7 @@ void SharedMemCache<kBlockSize>::DeleteEntry(Sector<kBlockSize>* sector,
   sector->ReturnBlocksToFreeList(blocks);
   entry->creating = false;
   MarkEntryFree(sector, entry_num);
+  EndEntryWrite(entry);
 }
 
 template<size_t kBlockSize>
@@ -877,8 +1299,12 @@ bool SharedMemCache<kBlockSize>::TryAllocateBlocks(
   while ((entry_num != kInvalidEntry) && (got < goal)) {
     CacheEntry* entry = sector->EntryAt(entry_num);
     if (Writeable(entry)) {
+      // The blocks are about to be reused, so lock-free readers of this entry
+      // must notice.
+      BeginEntryWrite(entry);
       got += sector->BlockListForEntry(entry, blocks);
       MarkEntryFree(sector, entry_num);
+      EndEntryWrite(entry);
       entry_num = sector->OldestEntryNum();
     } else {
       entry_num = entry->lru_prev;
@@ -983,6 +1409,7 @@ void SharedMemCache<kBlockSize>::EnsureReadyForWriting(
   // as if there were, we would have given up ourselves).
   //
   entry->creating = true;
+  BeginEntryWrite(entry);
 
   // Now just wait for previous readers to leave.
   while (entry->open_count > 0) {
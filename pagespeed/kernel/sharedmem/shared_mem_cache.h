@@ -41,6 +41,7 @@ class AbstractSharedMemSegment;
 class Hasher;
 class MessageHandler;
 class SharedMemCacheDump;
+class SharedMemCacheImageManifest;
 class Timer;
 
 // Abstract interface for a cache.
@@ -151,6 +152,14 @@ class SharedMemCache : public CacheInterface {
   void RegisterSnapshotFileCache(FileCache* potential_file_cache,
                                  int checkpoint_interval_sec);
 
+  // Switches checkpointing to incremental images: rather than dumping the live
+  // entries of a sector, a checkpoint copies the sector's memory as is, and
+  // writes out only the chunks of it that changed since the previous
+  // checkpoint. Restoring copies the image straight back into shared memory.
+  // Must be called before Initialize(). If no usable image is found for a
+  // sector, a snapshot written in the regular format is restored instead.
+  void set_incremental_checkpoints(bool x) { incremental_checkpoints_ = x; }
+
   StringPiece snapshot_path() const { return snapshot_path_; }
   FileCache* file_cache() const { return file_cache_; }
 
@@ -181,6 +190,22 @@ class SharedMemCache : public CacheInterface {
   void PutRawHash(const GoogleString& raw_hash, int64 last_use_timestamp_ms,
                   const SharedString& value, bool checkpoint_ok);
 
+  // Tries to serve a get without taking the sector lock, as described at the
+  // top of shared_mem_cache.cc. Returns false if it kept racing writers, in
+  // which case the caller should retry with the lock held. Otherwise sets
+  // *key_state, and on a hit the callback's value. Only used where 64-bit
+  // atomics are available.
+  bool TryGetWithoutLock(const GoogleString& raw_hash, const Position& pos,
+                         SharedMemCacheData::Sector<kBlockSize>* sector,
+                         Callback* callback,
+                         CacheInterface::KeyState* key_state);
+
+  // After a lock-free hit on entry_num, which had the given version, marks it
+  // as recently used if it has not been for a while and the sector lock is
+  // free.
+  void MaybeTouchEntry(SharedMemCacheData::Sector<kBlockSize>* sector,
+                       SharedMemCacheData::EntryNum entry_num, int32 version);
+
   // Finish a get, with the entry matching and sector lock held.  Releases lock
   // while performing the read, but takes it again before returning.
   CacheInterface::KeyState GetFromEntry(
@@ -259,6 +284,36 @@ class SharedMemCache : public CacheInterface {
   void WriteOutSnapshotFromWorkerThread(int sector_num,
                                         int64 last_checkpoint_ms);
 
+  // WriteOutSnapshotFromWorkerThread's counterpart for incremental
+  // checkpoints. Only writes chunks whose checksum differs from the previous
+  // manifest's, and writes the new manifest after all of its chunks, so that
+  // the manifest on disk always describes a complete image.
+  void WriteOutImageFromWorkerThread(int sector_num, int64 last_checkpoint_ms);
+
+  // Copies the sector into *image, and marks a checkpoint of it as being in
+  // progress. Like AddSectorToSnapshot, gives up and returns false if another
+  // thread got to the sector first, and also does so if another checkpoint is
+  // still being written out.
+  bool CopySectorImage(int sector_num, int64 last_checkpoint_ms,
+                       GoogleString* image);
+
+  // Clears the in-progress mark set by CopySectorImage.
+  void FinishSectorImage(int sector_num);
+
+  // Tries to restore the sector from its incremental checkpoint, and returns
+  // whether it did. A damaged checkpoint is deleted so the next one is
+  // written out in full.
+  bool RestoreSectorImage(int sector_num);
+
+  bool ReadImageManifest(int sector_num, SharedMemCacheImageManifest* out);
+
+  // Keys to store the manifest of the sector's image and its chunks under.
+  // Like SnapshotCacheKey, these include everything that affects the layout
+  // of a sector.
+  GoogleString ImageManifestCacheKey(int sector_num) const;
+  GoogleString ImageChunkCacheKey(int sector_num, int chunk,
+                                  int64 generation) const;
+
   // Key to store the snapshot of this sector under.  If two SharedMemCaches
   // have the same cache key it's safe to restore a snapshot dumped from one
   // into the other.
@@ -272,6 +327,7 @@ class SharedMemCache : public CacheInterface {
   int entries_per_sector_;
   int blocks_per_sector_;
   int checkpoint_interval_sec_;
+  bool incremental_checkpoints_;
   MessageHandler* handler_;
   GoogleString snapshot_path_;
   FileCache* file_cache_;
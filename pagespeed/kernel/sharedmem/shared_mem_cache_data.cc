@@ -23,9 +23,12 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
+#include <cstring>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string_util.h"
 
@@ -51,7 +54,7 @@ struct Sector<kBlockSize>::MemLayout {
     // Check out alignment assumptions -- everything must be of a size
     // that's multiple of 8. The exact sizes don't matter too much, but
     // we check it anyway to avoid surprises.
-    CHECK_EQ(104u, sizeof(SectorHeader));
+    CHECK_EQ(112u, sizeof(SectorHeader));
     CHECK_EQ(48u, sizeof(CacheEntry));
 
     header_bytes = AlignTo(8, sizeof(SectorHeader) + mutex_size);
@@ -77,6 +80,8 @@ Sector<kBlockSize>::Sector(AbstractSharedMemSegment* segment,
       segment_(segment),
       sector_offset_(sector_offset) {
   MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks);
+  header_bytes_ = layout.header_bytes;
+  image_size_ = layout.metadata_bytes + data_blocks * kBlockSize;
   char* base = const_cast<char*>(segment->Base()) + sector_offset;
   sector_header_ = reinterpret_cast<SectorHeader*>(base);
   block_successors_ = reinterpret_cast<BlockNum*>(base + layout.header_bytes);
@@ -109,6 +114,8 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
     return false;
   }
 
+  sector_header_->checkpoint_in_progress = 0;
+
   // Initialize the LRU and the cache entry.
   sector_header_->lru_list_front = kInvalidEntry;
   sector_header_->lru_list_rear = kInvalidEntry;
@@ -244,6 +251,137 @@ int Sector<kBlockSize>::BlockListForEntry(CacheEntry* entry,
   return data_blocks;
 }
 
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::BlockListForEntryUnlocked(BlockNum first_block,
+                                                   size_t byte_size,
+                                                   BlockVector* out_blocks) {
+  size_t data_blocks = DataBlocksForSize(byte_size);
+  if (data_blocks > data_blocks_) {
+    return false;
+  }
+
+  volatile base::subtle::Atomic32* successors =
+      reinterpret_cast<volatile base::subtle::Atomic32*>(block_successors_);
+  BlockNum block = first_block;
+  for (size_t d = 0; d < data_blocks; ++d) {
+    if (block < 0 || block >= static_cast<BlockNum>(data_blocks_)) {
+      return false;
+    }
+    out_blocks->push_back(block);
+    block = base::subtle::NoBarrier_Load(successors + block);
+  }
+  return true;
+}
+
+template<size_t kBlockSize>
+void Sector<kBlockSize>::CopyToImage(GoogleString* image) {
+  const char* base = reinterpret_cast<const char*>(sector_header_);
+  image->assign(base, image_size_);
+}
+
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::RestoreFromImage(StringPiece image) {
+  if (!ValidateImage(image)) {
+    return false;
+  }
+
+  SectorStats stats;
+  const SectorHeader* image_header =
+      reinterpret_cast<const SectorHeader*>(image.data());
+  stats.used_entries = image_header->stats.used_entries;
+  stats.used_blocks = image_header->stats.used_blocks;
+  stats.last_checkpoint_ms = image_header->stats.last_checkpoint_ms;
+
+  // Everything but the mutex, which sits between the header proper and
+  // header_bytes_.
+  char* base = reinterpret_cast<char*>(sector_header_);
+  std::memcpy(base, image.data(), sizeof(SectorHeader));
+  std::memcpy(base + header_bytes_, image.data() + header_bytes_,
+              image_size_ - header_bytes_);
+  sector_header_->checkpoint_in_progress = 0;
+  sector_header_->stats = stats;
+  return true;
+}
+
+template<size_t kBlockSize>
+bool Sector<kBlockSize>::ValidateImage(StringPiece image) const {
+  if (image.size() != image_size_) {
+    return false;
+  }
+
+  // The image comes from a heap-allocated buffer, so it's at least as aligned
+  // as the segment's layout needs.
+  const char* base = image.data();
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(base) % 8);
+  const SectorHeader* header = reinterpret_cast<const SectorHeader*>(base);
+  const BlockNum* successors =
+      reinterpret_cast<const BlockNum*>(base + header_bytes_);
+  const CacheEntry* entries = reinterpret_cast<const CacheEntry*>(
+      base + (directory_base_ - reinterpret_cast<char*>(sector_header_)));
+  const BlockNum num_blocks = static_cast<BlockNum>(data_blocks_);
+  const EntryNum num_entries = static_cast<EntryNum>(cache_entries_);
+
+  for (BlockNum b = 0; b < num_blocks; ++b) {
+    if (successors[b] < kInvalidBlock || successors[b] >= num_blocks) {
+      return false;
+    }
+  }
+
+  // Every block must be owned by exactly one entry or be on the freelist.
+  std::vector<bool> block_seen(data_blocks_, false);
+  for (EntryNum e = 0; e < num_entries; ++e) {
+    const CacheEntry& entry = entries[e];
+    if (entry.lru_prev < kInvalidEntry || entry.lru_prev >= num_entries ||
+        entry.lru_next < kInvalidEntry || entry.lru_next >= num_entries ||
+        entry.byte_size < 0 ||
+        DataBlocksForSize(entry.byte_size) > data_blocks_) {
+      return false;
+    }
+    BlockNum block = entry.first_block;
+    for (size_t d = DataBlocksForSize(entry.byte_size); d > 0; --d) {
+      if (block < 0 || block >= num_blocks || block_seen[block]) {
+        return false;
+      }
+      block_seen[block] = true;
+      block = successors[block];
+    }
+  }
+
+  int64 free_blocks = 0;
+  for (BlockNum block = header->free_list_front; block != kInvalidBlock;
+       block = successors[block]) {
+    if (block < 0 || block >= num_blocks || block_seen[block]) {
+      return false;
+    }
+    block_seen[block] = true;
+    ++free_blocks;
+  }
+  for (BlockNum b = 0; b < num_blocks; ++b) {
+    if (!block_seen[b]) {
+      return false;
+    }
+  }
+  if (header->stats.used_blocks != num_blocks - free_blocks) {
+    return false;
+  }
+
+  // The LRU must be a proper doubly-linked list from front to rear.
+  EntryNum prev = kInvalidEntry;
+  EntryNum cur = header->lru_list_front;
+  int64 linked_entries = 0;
+  while (cur != kInvalidEntry) {
+    if (cur < 0 || cur >= num_entries || linked_entries >= num_entries ||
+        entries[cur].lru_prev != prev) {
+      return false;
+    }
+    ++linked_entries;
+    prev = cur;
+    cur = entries[cur].lru_next;
+  }
+  return (prev == header->lru_list_rear &&
+          header->stats.used_entries == linked_entries);
+}
+
 SectorStats::SectorStats()
     : num_put(0),
       num_put_update(0),
@@ -253,6 +391,7 @@ SectorStats::SectorStats()
       num_put_spins(0),
       num_get(0),
       num_get_hit(0),
+      num_get_locked(0),
       last_checkpoint_ms(0),
       used_entries(0),
       used_blocks(0) {
@@ -267,6 +406,7 @@ void SectorStats::Add(const SectorStats& other) {
   num_put_spins += other.num_put_spins;
   num_get += other.num_get;
   num_get_hit += other.num_get_hit;
+  num_get_locked += other.num_get_locked;
   used_entries += other.used_entries;
   used_blocks += other.used_blocks;
 }
@@ -295,6 +435,8 @@ GoogleString SectorStats::Dump(size_t total_entries,
   StringAppendF(&out, "  hits: %s (%.2f%%)\n",
                 Integer64ToString(num_get_hit).c_str(),
                 percent(num_get_hit, num_get));
+  StringAppendF(&out, "  retried under lock after racing a writer: %s\n",
+                Integer64ToString(num_get_locked).c_str());
 
   StringAppendF(&out, "Entries used: %s (%.2f%%)\n",
                 Integer64ToString(used_entries).c_str(),
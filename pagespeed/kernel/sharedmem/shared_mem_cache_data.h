@@ -31,6 +31,7 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 
 namespace net_instaweb {
@@ -68,6 +69,7 @@ struct SectorStats {
   int64 num_put_spins;  // # of times writers had to sleep behind readers
   int64 num_get;    // # of calls to get
   int64 num_get_hit;
+  int64 num_get_locked;  // gets that raced a writer and retried under lock
   int64 last_checkpoint_ms;  // When this sector was last checkpointed to disk.
 
   // Current state stats --- updated by SharedMemCacheData
@@ -85,7 +87,10 @@ struct SectorHeader {
   BlockNum free_list_front;
   EntryNum lru_list_front;
   EntryNum lru_list_rear;
-  int32 padding;
+
+  // Non-zero while a process is writing out an incremental checkpoint of the
+  // sector, which it started at stats.last_checkpoint_ms.
+  int32 checkpoint_in_progress;
 
   SectorStats stats;
 
@@ -111,7 +116,10 @@ struct CacheEntry {
   // Number of readers currently accessing the data.
   uint32 open_count : 31;
 
-  uint32 padding;  // ensures we're 8-aligned.
+  // Sequence number for lock-free readers: odd while a writer is changing
+  // the key, size, or blocks of the entry, and bumped again when it is done.
+  // Only modified with the sector lock held.
+  int32 version;
 };
 
 // Helper for operating on a given sector's data structures; helping
@@ -253,6 +261,14 @@ class Sector {
   int BlockListForEntry(CacheEntry* entry, BlockVector* out_blocks)
       EXCLUSIVE_LOCKS_REQUIRED(mutex());
 
+  // Like BlockListForEntry, but for lock-free readers, which may see the entry
+  // and the successor list while they are being rewritten. Rather than trust
+  // them, checks every block number it follows, and returns false if any is
+  // out of range. The caller must still validate the result against the
+  // entry's version.
+  bool BlockListForEntryUnlocked(BlockNum first_block, size_t byte_size,
+                                 BlockVector* out_blocks);
+
   // Statistics stuff
   // ------------------------------------------------------------
 
@@ -262,10 +278,40 @@ class Sector {
   // by the higher-level)
   void DumpStats(MessageHandler* handler);
 
+  // Checkpoint image ops. An image is a byte-for-byte copy of the sector's
+  // memory, with the mutex's bytes left unspecified.
+  // ------------------------------------------------------------
+
+  // Size of images of this sector; same as RequiredSize.
+  size_t ImageSize() const { return image_size_; }
+
+  // Replaces *image with a copy of this sector.
+  void CopyToImage(GoogleString* image) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
+  // Overwrites the sector with the given image, leaving the mutex alone, if
+  // the image has a consistent directory, LRU, and block lists for this
+  // geometry. Returns whether it did. Per-entry state that only makes sense
+  // for the processes that wrote the image (readers and writers in flight)
+  // is copied as well, so it is up to the caller to reset it. Of the
+  // statistics only the usage counts and last_checkpoint_ms are kept.
+  bool RestoreFromImage(StringPiece image) EXCLUSIVE_LOCKS_REQUIRED(mutex());
+
+  bool checkpoint_in_progress() EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    return sector_header_->checkpoint_in_progress != 0;
+  }
+
+  void set_checkpoint_in_progress(bool x) EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    sector_header_->checkpoint_in_progress = x ? 1 : 0;
+  }
+
  private:
   // Helper for doing sizing/memory layout computations.
   struct MemLayout;
 
+  // Helper for RestoreFromImage that checks the image's data structures
+  // without touching the sector.
+  bool ValidateImage(StringPiece image) const;
+
   // How many piece_size pieces suffice to fit total
   static size_t NeededPieces(size_t total, size_t piece_size) {
     return (total + piece_size - 1) / piece_size;
@@ -283,6 +329,8 @@ class Sector {
   char* directory_base_;
   char* blocks_base_;
   size_t sector_offset_;  // offset of the sector within the SHM segment
+  size_t header_bytes_;  // size of the header, including the mutex
+  size_t image_size_;
 
   DISALLOW_COPY_AND_ASSIGN(Sector);
 };
@@ -21,9 +21,11 @@
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data_test_base.h"
 
 #include <cstddef>                     // for size_t
+#include <cstring>
 #include <set>
 
 #include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/util/platform.h"
@@ -35,6 +37,7 @@ using SharedMemCacheData::BlockVector;
 using SharedMemCacheData::CacheEntry;
 using SharedMemCacheData::EntryNum;
 using SharedMemCacheData::Sector;
+using SharedMemCacheData::kInvalidBlock;
 using SharedMemCacheData::kInvalidEntry;
 
 namespace {
@@ -296,6 +299,110 @@ void SharedMemCacheDataTestBase::TestBlockLists() NO_THREAD_SAFETY_ANALYSIS {
   ParentCleanup();
 }
 
+void SharedMemCacheDataTestBase::TestImages() NO_THREAD_SAFETY_ANALYSIS {
+  AbstractSharedMemSegment* seg_raw_ptr = NULL;
+  Sector<kBlockSize>* sector_raw_ptr = NULL;
+  ASSERT_TRUE(ParentInit(&seg_raw_ptr, &sector_raw_ptr));
+  scoped_ptr<AbstractSharedMemSegment> seg(seg_raw_ptr);
+  scoped_ptr<Sector<kBlockSize> > sector(sector_raw_ptr);
+
+  // Store a 3-block entry, and take an image.
+  const int kTestBlocks = 3;
+  BlockVector blocks;
+  ASSERT_EQ(kTestBlocks,
+            sector->AllocBlocksFromFreeList(kTestBlocks, &blocks));
+  sector->LinkBlockSuccessors(blocks);
+  CacheEntry* entry = sector->EntryAt(0);
+  entry->byte_size = kTestBlocks * kBlockSize - 1;
+  entry->first_block = blocks[0];
+  sector->InsertEntryIntoLRU(0);
+  for (int b = 0; b < kTestBlocks; ++b) {
+    std::memset(sector->BlockBytes(blocks[b]), 'a' + b, kBlockSize);
+  }
+  sector->sector_stats()->num_put = 42;
+
+  GoogleString image;
+  sector->CopyToImage(&image);
+  EXPECT_EQ(sector->ImageSize(), image.size());
+  EXPECT_EQ(
+      Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(), kEntries, kBlocks),
+      image.size());
+
+  // Now drop the entry and scribble over its payload.
+  sector->UnlinkEntryFromLRU(0);
+  sector->ReturnBlocksToFreeList(blocks);
+  entry->byte_size = 0;
+  entry->first_block = kInvalidBlock;
+  for (int b = 0; b < kTestBlocks; ++b) {
+    std::memset(sector->BlockBytes(blocks[b]), 'z', kBlockSize);
+  }
+
+  // Damaged images must be refused without touching the sector. Offsets
+  // within the image match those within the sector.
+  const char* base = const_cast<const char*>(seg->Base()) + kExtra;
+  size_t entry_offset = reinterpret_cast<const char*>(entry) - base;
+
+  GoogleString truncated = image.substr(0, image.size() - 1);
+  EXPECT_FALSE(sector->RestoreFromImage(truncated));
+
+  GoogleString bad_block = image;
+  CacheEntry* bad_entry = reinterpret_cast<CacheEntry*>(&bad_block[0] +
+                                                        entry_offset);
+  bad_entry->first_block = kBlocks;
+  EXPECT_FALSE(sector->RestoreFromImage(bad_block));
+
+  // Far enough out of range that indexing with it would leave the image.
+  GoogleString wild_block = image;
+  bad_entry = reinterpret_cast<CacheEntry*>(&wild_block[0] + entry_offset);
+  bad_entry->first_block = kBlocks * 1000;
+  EXPECT_FALSE(sector->RestoreFromImage(wild_block));
+
+  GoogleString negative_block = image;
+  bad_entry = reinterpret_cast<CacheEntry*>(&negative_block[0] + entry_offset);
+  bad_entry->first_block = kInvalidBlock - 1;
+  EXPECT_FALSE(sector->RestoreFromImage(negative_block));
+
+  GoogleString shared_block = image;
+  bad_entry = reinterpret_cast<CacheEntry*>(&shared_block[0] + entry_offset);
+  bad_entry[1].byte_size = 1;
+  bad_entry[1].first_block = blocks[2];
+  EXPECT_FALSE(sector->RestoreFromImage(shared_block));
+
+  GoogleString bad_lru = image;
+  bad_entry = reinterpret_cast<CacheEntry*>(&bad_lru[0] + entry_offset);
+  bad_entry->lru_prev = 1;
+  EXPECT_FALSE(sector->RestoreFromImage(bad_lru));
+
+  EXPECT_EQ(0, sector->sector_stats()->used_entries);
+  EXPECT_EQ(0, sector->sector_stats()->used_blocks);
+  EXPECT_EQ(kInvalidBlock, entry->first_block);
+
+  // The intact image brings everything back, except for the operation
+  // statistics.
+  ASSERT_TRUE(sector->RestoreFromImage(image));
+  EXPECT_EQ(kTestBlocks * kBlockSize - 1, entry->byte_size);
+  std::vector<EntryNum> lru;
+  ExtractAndSanityCheckLRU(sector.get(), &lru);
+  ASSERT_EQ(1u, lru.size());
+  EXPECT_EQ(0, lru[0]);
+  EXPECT_EQ(kTestBlocks, sector->sector_stats()->used_blocks);
+  EXPECT_EQ(0, sector->sector_stats()->num_put);
+
+  BlockVector restored_blocks;
+  sector->BlockListForEntry(entry, &restored_blocks);
+  EXPECT_EQ(blocks, restored_blocks);
+  for (int b = 0; b < kTestBlocks; ++b) {
+    EXPECT_EQ(GoogleString(kBlockSize, 'a' + b),
+              GoogleString(sector->BlockBytes(blocks[b]), kBlockSize));
+  }
+
+  // The mutex still works.
+  sector->mutex()->Lock();
+  sector->mutex()->Unlock();
+
+  ParentCleanup();
+}
+
 bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
                                             Sector<kBlockSize>** out_sector) {
   size_t bytes =
@@ -46,6 +46,7 @@ class SharedMemCacheDataTestBase : public testing::Test {
   void TestFreeList();
   void TestLRU();
   void TestBlockLists();
+  void TestImages();
 
  private:
   bool CreateChild(TestMethod method);
@@ -97,8 +98,12 @@ TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestBlockLists) {
   SharedMemCacheDataTestBase::TestBlockLists();
 }
 
+TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestImages) {
+  SharedMemCacheDataTestBase::TestImages();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemCacheDataTestTemplate, TestFreeList,
-                           TestLRU, TestBlockLists);
+                           TestLRU, TestBlockLists, TestImages);
 
 }  // namespace net_instaweb
 
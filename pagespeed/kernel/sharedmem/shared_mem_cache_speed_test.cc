@@ -0,0 +1,167 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+//
+// Measures SharedMemCache throughput when several processes hammer the same
+// segment with a read-mostly workload, as happens with a pool of server
+// children sharing the metadata cache.  The range argument is the number of
+// processes.  Every process does a fixed amount of work, so the total grows
+// with N; ideally the time would stay flat.  The timing includes forking and
+// reaping the children, which is small next to the cache operations.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
+#include "pagespeed/kernel/thread/pthread_shared_mem.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_random.h"
+
+namespace {
+
+const int kNumKeys = 10000;
+const int kPayloadSize = 1000;
+const int kOpsPerProcess = 100000;
+const int kPutFrequency = 32;  // One op in 32 is a Put.
+const int kSectors = 16;
+const int kCacheSizeKb = 32 * 1024;
+const char kSegmentName[] = "/shared_mem_cache_speed_test_segment";
+
+typedef net_instaweb::SharedMemCache<4096> ShmCache;
+
+class EmptyCallback : public net_instaweb::CacheInterface::Callback {
+ public:
+  EmptyCallback() {}
+  virtual ~EmptyCallback() {}
+  virtual void Done(net_instaweb::CacheInterface::KeyState state) {}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EmptyCallback);
+};
+
+class ShmCacheFactory {
+ public:
+  ShmCacheFactory() : timer_(net_instaweb::Platform::CreateTimer()) {
+    int64 size_cap;
+    ShmCache::ComputeDimensions(kCacheSizeKb, 2 /* block/entry ratio */,
+                                kSectors, &entries_, &blocks_, &size_cap);
+  }
+
+  ~ShmCacheFactory() {
+    ShmCache::GlobalCleanup(&shm_runtime_, kSegmentName, &handler_);
+  }
+
+  ShmCache* NewCache() {
+    return new ShmCache(&shm_runtime_, kSegmentName, timer_.get(), &hasher_,
+                        kSectors, entries_, blocks_, &handler_);
+  }
+
+ private:
+  net_instaweb::scoped_ptr<net_instaweb::Timer> timer_;
+  net_instaweb::PthreadSharedMem shm_runtime_;
+  net_instaweb::MD5Hasher hasher_;
+  net_instaweb::NullMessageHandler handler_;
+  int entries_;
+  int blocks_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShmCacheFactory);
+};
+
+// Runs in a forked child: attaches to the segment and does a Get/Put mix
+// over the common key set, starting at a per-process offset and stride so
+// the processes touch the same keys but not in lock-step.
+void RunChild(ShmCacheFactory* factory, int index,
+              const net_instaweb::StringVector& keys,
+              const std::vector<net_instaweb::SharedString>& values) {
+  net_instaweb::scoped_ptr<ShmCache> cache(factory->NewCache());
+  CHECK(cache->Attach());
+  EmptyCallback callback;
+  int offset = index * 7919;
+  int stride = 2 * index + 1;
+  for (int i = 0; i < kOpsPerProcess; ++i) {
+    int k = (offset + i * stride) % kNumKeys;
+    if ((i % kPutFrequency) == 0) {
+      cache->Put(keys[k], values[k]);
+    } else {
+      cache->Get(keys[k], &callback);
+    }
+  }
+}
+
+static void ShmCacheContendedProcesses(int iters, int num_processes) {
+  StopBenchmarkTiming();
+  ShmCacheFactory factory;
+  net_instaweb::scoped_ptr<ShmCache> root_cache(factory.NewCache());
+  CHECK(root_cache->Initialize());
+
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  GoogleString value_prefix = random.GenerateHighEntropyString(kPayloadSize);
+  net_instaweb::StringVector keys(kNumKeys);
+  std::vector<net_instaweb::SharedString> values(kNumKeys);
+  for (int k = 0; k < kNumKeys; ++k) {
+    keys[k] = net_instaweb::StrCat("key", net_instaweb::IntegerToString(k));
+    values[k].Assign(net_instaweb::StrCat(value_prefix,
+                                          net_instaweb::IntegerToString(k)));
+    root_cache->Put(keys[k], values[k]);
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    std::vector<pid_t> children;
+    for (int p = 0; p < num_processes; ++p) {
+      pid_t pid = fork();
+      CHECK_NE(-1, pid);
+      if (pid == 0) {
+        RunChild(&factory, p, keys, values);
+        // Skip atexit handlers and destructors inherited from the parent.
+        _exit(0);
+      }
+      children.push_back(pid);
+    }
+    for (int p = 0, n = children.size(); p < n; ++p) {
+      int status;
+      CHECK_EQ(children[p], waitpid(children[p], &status, 0));
+      CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+  }
+}
+
+}  // namespace
+
+BENCHMARK_RANGE(ShmCacheContendedProcesses, 1, 16);
@@ -247,6 +247,47 @@ void SharedMemCacheTestBase::TestReaderWriterChild() {
   }
 }
 
+void SharedMemCacheTestBase::TestConcurrentOverwrite() {
+  // The child keeps replacing 'key' with values of different contents and
+  // sizes while we read it; every hit must be one of them, whole.
+  GoogleString other(large_.size() + kBlockSize, '-');
+  CheckPut("key", large_);
+  CreateChild(&SharedMemCacheTestBase::TestConcurrentOverwriteChild);
+
+  int hits = 0;
+  CacheTestBase::Callback done;
+  while (done.state() != CacheInterface::kAvailable) {
+    CacheTestBase::Callback callback;
+    cache_->Get("key", &callback);
+    ASSERT_TRUE(callback.called());
+    if (callback.state() == CacheInterface::kAvailable) {
+      ++hits;
+      StringPiece value = callback.value().Value();
+      EXPECT_TRUE(value == large_ || value == other) << value.size();
+    }
+    cache_->Get("done", done.Reset());
+  }
+  EXPECT_LT(0, hits);
+
+  test_env_->WaitForChildren();
+}
+
+void SharedMemCacheTestBase::TestConcurrentOverwriteChild() {
+  scoped_ptr<SharedMemCache<kBlockSize> > child_cache(MakeCache());
+  if (!child_cache->Attach()) {
+    test_env_->ChildFailed();
+  }
+  SharedString large(large_);
+  SharedString other(GoogleString(large_.size() + kBlockSize, '-'));
+  for (int i = 0; i < kSpinRuns * 10; ++i) {
+    child_cache->Put("key", (i % 2 == 0) ? other : large);
+    if (i % 10 == 0) {
+      YieldToThread();
+    }
+  }
+  child_cache->Put("done", SharedString("1"));
+}
+
 void SharedMemCacheTestBase::TestConflict() {
   const int kAssociativity = SharedMemCache<kBlockSize>::kAssociativity;
 
@@ -542,4 +583,93 @@ void SharedMemCacheTestBase::TestCheckpointAndRestore() {
   CheckNotFound("200");
 }
 
+int SharedMemCacheTestBase::CheckpointAllSectors(MemFileSystem* file_system) {
+  file_system->ClearStats();
+  for (int sector_num = 0; sector_num < kSectors; ++sector_num) {
+    cache_->WriteOutSnapshotForTesting(
+        sector_num, cache_->GetLastWriteMsForTesting(sector_num));
+  }
+  return file_system->num_temp_file_opens();
+}
+
+void SharedMemCacheTestBase::TestIncrementalCheckpointAndRestore() {
+  const GoogleString kPath = "/a-path";
+
+  cache_.reset(new SharedMemCache<kBlockSize>(
+      shmem_runtime_.get(), kPath, &timer_, &hasher_, kSectors,
+      kSectorEntries, kSectorBlocks, &handler_));
+  scoped_ptr<FileCacheTestWrapper> file_cache_wrapper(
+      new FileCacheTestWrapper(
+          kPath, thread_system_.get(), &timer_, &handler_));
+  MemFileSystem* file_system = file_cache_wrapper->filesystem();
+  cache_->set_incremental_checkpoints(true);
+  cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                    kSnapshotIntervalMs);
+  EXPECT_TRUE(cache_->Initialize());
+
+  CheckPut("200", "OK");
+  CheckPut("large", large_);
+  CheckPut("gigantic", gigantic_);
+  int full_writes = CheckpointAllSectors(file_system);
+  EXPECT_LT(2 * kSectors, full_writes);
+
+  // An unchanged sector only needs its manifest rewritten, and a small change
+  // only a couple of chunks besides.
+  EXPECT_EQ(kSectors, CheckpointAllSectors(file_system));
+  CheckPut("201", "Created");
+  int incremental_writes = CheckpointAllSectors(file_system);
+  EXPECT_LT(kSectors, incremental_writes);
+  EXPECT_GE(kSectors + 2, incremental_writes);
+  EXPECT_LT(incremental_writes, full_writes);
+
+  CheckPut("202", "Accepted");
+  CheckpointAllSectors(file_system);
+
+  // Restarting brings everything back from the images.
+  cache_.reset(new SharedMemCache<kBlockSize>(
+      shmem_runtime_.get(), kPath, &timer_, &hasher_, kSectors,
+      kSectorEntries, kSectorBlocks, &handler_));
+  cache_->set_incremental_checkpoints(true);
+  cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                    kSnapshotIntervalMs);
+  EXPECT_TRUE(cache_->Initialize());
+  SanityCheck();
+  CheckGet("200", "OK");
+  CheckGet("201", "Created");
+  CheckGet("202", "Accepted");
+  CheckGet("large", large_);
+  CheckGet("gigantic", gigantic_);
+  CheckNotFound("404");
+
+  // The restored cache keeps working normally.
+  CheckPut("203", "Non-Authoritative");
+  CheckDelete("large");
+  CheckNotFound("large");
+  CheckGet("203", "Non-Authoritative");
+  SanityCheck();
+
+  // Without incremental checkpoints, the images are not used.
+  cache_.reset(new SharedMemCache<kBlockSize>(
+      shmem_runtime_.get(), kPath, &timer_, &hasher_, kSectors,
+      kSectorEntries, kSectorBlocks, &handler_));
+  cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                    kSnapshotIntervalMs);
+  EXPECT_TRUE(cache_->Initialize());
+  CheckNotFound("200");
+
+  // But with them, a snapshot in the regular format is still restored when
+  // there are no images.
+  file_system->Clear();
+  CheckPut("200", "OK");
+  CheckpointAllSectors(file_system);
+  cache_.reset(new SharedMemCache<kBlockSize>(
+      shmem_runtime_.get(), kPath, &timer_, &hasher_, kSectors,
+      kSectorEntries, kSectorBlocks, &handler_));
+  cache_->set_incremental_checkpoints(true);
+  cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                    kSnapshotIntervalMs);
+  EXPECT_TRUE(cache_->Initialize());
+  CheckGet("200", "OK");
+}
+
 }  // namespace net_instaweb
@@ -57,11 +57,13 @@ class SharedMemCacheTestBase : public CacheTestBase {
   void TestReinsert();
   void TestReplacement();
   void TestReaderWriter();
+  void TestConcurrentOverwrite();
   void TestConflict();
   void TestEvict();
   void TestSnapshot();
   void TestRegisterSnapshotFileCache();
   void TestCheckpointAndRestore();
+  void TestIncrementalCheckpointAndRestore();
 
   void ResetCache();
 
@@ -73,8 +75,13 @@ class SharedMemCacheTestBase : public CacheTestBase {
                        const char* test_label);
 
   SharedMemCache<kBlockSize>* MakeCache();
+
+  // Checkpoints every sector of cache_ right away, and returns how many files
+  // that wrote.
+  int CheckpointAllSectors(MemFileSystem* file_system);
   void CheckDelete(const char* key);
   void TestReaderWriterChild();
+  void TestConcurrentOverwriteChild();
 
   scoped_ptr<SharedMemTestEnv> test_env_;
   scoped_ptr<AbstractSharedMem> shmem_runtime_;
@@ -154,6 +161,10 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestReaderWriter) {
   SharedMemCacheTestBase::TestReaderWriter();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestConcurrentOverwrite) {
+  SharedMemCacheTestBase::TestConcurrentOverwrite();
+}
+
 TYPED_TEST_P(SharedMemCacheTestTemplate, TestConflict) {
   SharedMemCacheTestBase::TestConflict();
 }
@@ -174,11 +185,17 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestCheckpointAndRestore) {
   SharedMemCacheTestBase::TestCheckpointAndRestore();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestIncrementalCheckpointAndRestore) {
+  SharedMemCacheTestBase::TestIncrementalCheckpointAndRestore();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemCacheTestTemplate, TestBasic, TestReinsert,
-                           TestReplacement, TestReaderWriter, TestConflict,
+                           TestReplacement, TestReaderWriter,
+                           TestConcurrentOverwrite, TestConflict,
                            TestEvict, TestSnapshot,
                            TestRegisterSnapshotFileCache,
-                           TestCheckpointAndRestore);
+                           TestCheckpointAndRestore,
+                           TestIncrementalCheckpointAndRestore);
 
 }  // namespace net_instaweb
 
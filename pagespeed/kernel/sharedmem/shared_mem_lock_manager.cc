@@ -19,18 +19,26 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/sharedmem/shared_futex.h"
 #include "pagespeed/kernel/thread/scheduler.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
 
@@ -40,6 +48,10 @@ namespace SharedMemLockData {
 
 // Memory structure:
 //
+// Header:
+//  async unlock sequence number (32-bit)
+//  number of processes with async waiters (32-bit)
+//  (pad to 64-byte alignment)
 // Bucket 0:
 //  Slot 0
 //     lock name hash (64-bit)
@@ -47,6 +59,8 @@ namespace SharedMemLockData {
 //  Slot 1
 //  ...
 //  Slot kSlotsPerBucket - 1
+//  unlock sequence number (32-bit)
+//  number of blocked waiters (32-bit)
 //  Mutex
 //  (pad to 64-byte alignment)
 // Bucket 1:
@@ -75,6 +89,17 @@ namespace SharedMemLockData {
 // getting filled suggests it's under heavy load as it is, in which case
 // blocking further operations is desirable.
 //
+// Waiting for a held lock is done by sleeping on a futex (see SharedFutex).
+// A thread blocked in LockTimedWait registers itself in the bucket's waiter
+// count and sleeps on the bucket's unlock sequence number, which Unlock bumps
+// whenever there are waiters.  Both happen under the bucket mutex, so an
+// unlock can't slip in between a failed attempt and the sleep.  Callback waits
+// are instead made by one waiter thread per process, which sleeps on the
+// header's sequence number; every unlock bumps that while any process has
+// such a thread with waits pending.  That wakes up more often than strictly
+// needed, but keeps the per-bucket state small, and it's only paid when
+// callback waits are actually outstanding.
+//
 const size_t kBuckets = 512;   // needs to be <= 65536 as we use 2 bytes of
                                // hash to pick a bucket.
 const size_t kSlotsPerBucket = 32;
@@ -86,8 +111,15 @@ struct Slot {
 
 const int64 kNotAcquired = 0;
 
+struct Header {
+  SharedFutex::Word async_unlock_seq;
+  SharedFutex::Word num_async_watchers;
+};
+
 struct Bucket {
   Slot slots[kSlotsPerBucket];
+  SharedFutex::Word unlock_seq;  // Only changed with the mutex held.
+  SharedFutex::Word num_waiters;  // Ditto.
   char mutex_base[1];
 };
 
@@ -95,12 +127,16 @@ inline size_t Align64(size_t in) {
   return (in + 63) & ~63;
 }
 
+inline size_t HeaderSize() {
+  return Align64(sizeof(Header));
+}
+
 inline size_t BucketSize(size_t lock_size) {
   return Align64(offsetof(Bucket, mutex_base) + lock_size);
 }
 
 inline size_t SegmentSize(size_t lock_size) {
-  return kBuckets * BucketSize(lock_size);
+  return HeaderSize() + kBuckets * BucketSize(lock_size);
 }
 
 }  // namespace SharedMemLockData
@@ -126,26 +162,33 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
       return;
     }
 
-    // Protect the bucket.
-    scoped_ptr<AbstractMutex> lock(AttachMutex());
-    ScopedMutex hold_lock(lock.get());
-
-    // Search for this lock.
-    // note: we permit empty slots in the middle, and start search at different
-    // positions depending on the hash to increase chance of quick hit.
-    // TODO(morlovich): Consider remembering which bucket we locked to avoid
-    // the search. (Could potentially be made lock-free, too).
-    size_t base = hash_ % Data::kSlotsPerBucket;
-    for (size_t offset = 0; offset < Data::kSlotsPerBucket; ++offset) {
-      size_t s = (base + offset) % Data::kSlotsPerBucket;
-      Data::Slot& slot = bucket_->slots[s];
-      if (slot.hash == hash_ && slot.acquired_at_ms == acquisition_time_) {
-        slot.acquired_at_ms = Data::kNotAcquired;
-        break;
+    bool wake_blocked = false;
+    bool wake_async = false;
+    {
+      // Protect the bucket.
+      scoped_ptr<AbstractMutex> lock(AttachMutex());
+      ScopedMutex hold_lock(lock.get());
+      ClearSlot();
+
+      // A blocked waiter registers itself and reads unlock_seq in the same
+      // critical section as its failed attempt, so it either saw the slot
+      // cleared or will see the bump.  The waiter thread similarly counts
+      // itself before its attempts, so reading the count under the mutex
+      // can't miss it.
+      if (bucket_->num_waiters != 0) {
+        base::subtle::NoBarrier_AtomicIncrement(&bucket_->unlock_seq, 1);
+        wake_blocked = true;
       }
+      wake_async = (base::subtle::Acquire_Load(
+          &manager_->Header()->num_async_watchers) != 0);
     }
 
-    acquisition_time_ = Data::kNotAcquired;
+    if (wake_blocked) {
+      SharedFutex::WakeAll(&bucket_->unlock_seq);
+    }
+    if (wake_async) {
+      manager_->WakeAsyncWaiters();
+    }
   }
 
   virtual GoogleString name() const {
@@ -156,6 +199,49 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
     return (acquisition_time_ != Data::kNotAcquired);
   }
 
+  virtual bool LockTimedWait(int64 wait_ms) {
+    if (!manager_->wake_waiters_) {
+      return SchedulerBasedAbstractLock::LockTimedWait(wait_ms);
+    }
+    return SleepUntilLocked(false, 0, wait_ms);
+  }
+
+  virtual void LockTimedWait(int64 wait_ms, Function* callback) {
+    if (!manager_->wake_waiters_) {
+      SchedulerBasedAbstractLock::LockTimedWait(wait_ms, callback);
+    } else {
+      LockOrAddAsyncWaiter(false, 0, wait_ms, callback);
+    }
+  }
+
+  virtual bool LockTimedWaitStealOld(int64 wait_ms, int64 steal_ms) {
+    if (!manager_->wake_waiters_) {
+      return SchedulerBasedAbstractLock::LockTimedWaitStealOld(wait_ms,
+                                                               steal_ms);
+    }
+    return SleepUntilLocked(true, steal_ms, wait_ms);
+  }
+
+  virtual void LockTimedWaitStealOld(int64 wait_ms, int64 steal_ms,
+                                     Function* callback) {
+    if (!manager_->wake_waiters_) {
+      SchedulerBasedAbstractLock::LockTimedWaitStealOld(wait_ms, steal_ms,
+                                                        callback);
+    } else {
+      LockOrAddAsyncWaiter(true, steal_ms, wait_ms, callback);
+    }
+  }
+
+  // Like TryLock/TryLockStealOld, but on failure also sets *retry_at_ms to
+  // when the lock will become stealable, or kint64max if only an unlock can
+  // free it.
+  bool TryLockWithRetryTime(bool steal, int64 steal_timeout_ms,
+                            int64* retry_at_ms) {
+    scoped_ptr<AbstractMutex> lock(AttachMutex());
+    ScopedMutex hold_lock(lock.get());
+    return TryLockMutexHeld(steal, steal_timeout_ms, retry_at_ms);
+  }
+
  protected:
   virtual Scheduler* scheduler() const {
     return manager_->scheduler_;
@@ -174,6 +260,68 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
     bucket_ = manager_->Bucket(bucket_num);
   }
 
+  // Frees our slot.  The bucket mutex must be held.
+  void ClearSlot() {
+    // Search for this lock.
+    // note: we permit empty slots in the middle, and start search at different
+    // positions depending on the hash to increase chance of quick hit.
+    // TODO(morlovich): Consider remembering which bucket we locked to avoid
+    // the search. (Could potentially be made lock-free, too).
+    size_t base = hash_ % Data::kSlotsPerBucket;
+    for (size_t offset = 0; offset < Data::kSlotsPerBucket; ++offset) {
+      size_t s = (base + offset) % Data::kSlotsPerBucket;
+      Data::Slot& slot = bucket_->slots[s];
+      if (slot.hash == hash_ && slot.acquired_at_ms == acquisition_time_) {
+        slot.acquired_at_ms = Data::kNotAcquired;
+        break;
+      }
+    }
+
+    acquisition_time_ = Data::kNotAcquired;
+  }
+
+  // Blocks the calling thread until we get the lock or wait_ms passes,
+  // sleeping on the bucket's unlock sequence number between attempts.
+  bool SleepUntilLocked(bool steal, int64 steal_timeout_ms, int64 wait_ms) {
+    Timer* timer = manager_->scheduler_->timer();
+    int64 end_ms = timer->NowMs() + wait_ms;
+
+    scoped_ptr<AbstractMutex> lock(AttachMutex());
+    lock->Lock();
+    for (;;) {
+      int64 retry_at_ms;
+      if (TryLockMutexHeld(steal, steal_timeout_ms, &retry_at_ms)) {
+        break;
+      }
+      int64 now_ms = timer->NowMs();
+      if (now_ms >= end_ms) {
+        break;
+      }
+      int64 sleep_ms = std::min(end_ms, retry_at_ms) - now_ms;
+      SharedFutex::Word seq = bucket_->unlock_seq;
+      ++bucket_->num_waiters;
+      lock->Unlock();
+      SharedFutex::Wait(&bucket_->unlock_seq, seq,
+                        std::max<int64>(sleep_ms, 1) * Timer::kMsUs);
+      lock->Lock();
+      --bucket_->num_waiters;
+    }
+    lock->Unlock();
+    return Held();
+  }
+
+  void LockOrAddAsyncWaiter(bool steal, int64 steal_timeout_ms, int64 wait_ms,
+                            Function* callback) {
+    if (TryLockImpl(steal, steal_timeout_ms)) {
+      callback->CallRun();
+    } else if (wait_ms <= 0) {
+      callback->CallCancel();
+    } else {
+      manager_->AddAsyncWaiter(this, steal, steal_timeout_ms, wait_ms,
+                               callback);
+    }
+  }
+
   // Compute hash and bucket used to store the lock for a given lock name.
   void GetHashAndBucket(const StringPiece& name, uint64* hash_out,
                         size_t* bucket_out) {
@@ -201,10 +349,13 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
   }
 
   bool TryLockImpl(bool steal, int64 steal_timeout_ms) {
-    // Protect the bucket.
-    scoped_ptr<AbstractMutex> lock(AttachMutex());
-    ScopedMutex hold_lock(lock.get());
+    int64 retry_at_ms;
+    return TryLockWithRetryTime(steal, steal_timeout_ms, &retry_at_ms);
+  }
 
+  bool TryLockMutexHeld(bool steal, int64 steal_timeout_ms,
+                        int64* retry_at_ms) {
+    *retry_at_ms = kint64max;
     int64 now_ms = manager_->scheduler_->timer()->NowMs();
     if (now_ms == Data::kNotAcquired) {
       ++now_ms;
@@ -234,6 +385,9 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
           return true;
         } else {
           // Not permitted to steal or not stale enough to steal.
+          if (steal && slot.acquired_at_ms <= kint64max - steal_timeout_ms) {
+            *retry_at_ms = slot.acquired_at_ms + steal_timeout_ms;
+          }
           return false;
         }
       } else if (slot.acquired_at_ms == Data::kNotAcquired) {
@@ -276,6 +430,154 @@ class SharedMemLock : public SchedulerBasedAbstractLock {
   DISALLOW_COPY_AND_ASSIGN(SharedMemLock);
 };
 
+// Waits for locks on behalf of LockTimedWait calls with callbacks, so that
+// any number of them cost only one sleeping thread per process.  Each pass
+// tries every pending lock, runs the callbacks of those acquired or timed
+// out, and then sleeps on the segment's async unlock sequence number until
+// some process unlocks something or the next deadline comes up.
+class SharedMemLockManager::WaiterThread : public ThreadSystem::Thread {
+ public:
+  WaiterThread(SharedMemLockManager* manager, ThreadSystem* thread_system)
+      : Thread(thread_system, "shm_lock_waiter", ThreadSystem::kJoinable),
+        manager_(manager),
+        mutex_(thread_system->NewMutex()),
+        idle_condvar_(mutex_->NewCondvar()),
+        watching_(false),
+        sleeping_(false),
+        shut_down_(false) {
+  }
+
+  virtual ~WaiterThread() {
+  }
+
+  void Add(SharedMemLock* lock, bool steal, int64 steal_ms, int64 end_ms,
+           Function* callback) {
+    Waiter waiter = {lock, steal, steal_ms, end_ms, callback};
+    ScopedMutex hold_lock(mutex_.get());
+    incoming_.push_back(waiter);
+    WakeUpLocked();
+  }
+
+  // Stops the thread, canceling any waits still pending.
+  void ShutDown() {
+    {
+      ScopedMutex hold_lock(mutex_.get());
+      shut_down_ = true;
+      WakeUpLocked();
+    }
+    Join();
+  }
+
+ protected:
+  virtual void Run() {
+    Timer* timer = manager_->scheduler_->timer();
+    Data::Header* header = manager_->Header();
+    std::vector<Waiter> pending;
+
+    mutex_->Lock();
+    while (!shut_down_) {
+      pending.insert(pending.end(), incoming_.begin(), incoming_.end());
+      incoming_.clear();
+      if (pending.empty()) {
+        SetWatching(false);
+        idle_condvar_->Wait();
+        continue;
+      }
+
+      // Unlocks only bump the sequence number while some process is
+      // watching, so register before reading it, and read it before trying
+      // the locks: an unlock after any failed attempt will then change it
+      // and keep us from sleeping through.
+      SetWatching(true);
+      SharedFutex::Word seq =
+          base::subtle::Acquire_Load(&header->async_unlock_seq);
+      mutex_->Unlock();
+
+      int64 next_ms = TryPending(timer, &pending);
+
+      mutex_->Lock();
+      if (!pending.empty() && incoming_.empty() && !shut_down_) {
+        sleeping_ = true;
+        mutex_->Unlock();
+        int64 sleep_ms = next_ms - timer->NowMs();
+        SharedFutex::Wait(&header->async_unlock_seq, seq,
+                          std::max<int64>(sleep_ms, 1) * Timer::kMsUs);
+        mutex_->Lock();
+        sleeping_ = false;
+      }
+    }
+    SetWatching(false);
+    pending.insert(pending.end(), incoming_.begin(), incoming_.end());
+    incoming_.clear();
+    mutex_->Unlock();
+
+    for (int i = 0, n = pending.size(); i < n; ++i) {
+      pending[i].callback->CallCancel();
+    }
+  }
+
+ private:
+  struct Waiter {
+    SharedMemLock* lock;
+    bool steal;
+    int64 steal_ms;
+    int64 end_ms;
+    Function* callback;
+  };
+
+  // Makes one attempt at each pending lock, running callbacks for the ones
+  // that are done with, and returns the time by which we should look again
+  // even if nothing gets unlocked.  Called without mutex_ held, as the
+  // callbacks may well start new waits.
+  int64 TryPending(Timer* timer, std::vector<Waiter>* pending) {
+    std::vector<Waiter> still_pending;
+    int64 next_ms = kint64max;
+    for (int i = 0, n = pending->size(); i < n; ++i) {
+      const Waiter& waiter = (*pending)[i];
+      int64 retry_at_ms;
+      if (waiter.lock->TryLockWithRetryTime(waiter.steal, waiter.steal_ms,
+                                            &retry_at_ms)) {
+        waiter.callback->CallRun();
+      } else if (timer->NowMs() >= waiter.end_ms) {
+        waiter.callback->CallCancel();
+      } else {
+        next_ms = std::min(next_ms, std::min(waiter.end_ms, retry_at_ms));
+        still_pending.push_back(waiter);
+      }
+    }
+    pending->swap(still_pending);
+    return next_ms;
+  }
+
+  // Gets the thread to look at incoming_ or shut_down_.  mutex_ must be held.
+  void WakeUpLocked() {
+    if (sleeping_) {
+      manager_->WakeAsyncWaiters();
+    } else {
+      idle_condvar_->Signal();
+    }
+  }
+
+  // Updates this process' contribution to the segment's count of watchers.
+  void SetWatching(bool watching) {
+    if (watching != watching_) {
+      watching_ = watching;
+      base::subtle::Barrier_AtomicIncrement(
+          &manager_->Header()->num_async_watchers, watching ? 1 : -1);
+    }
+  }
+
+  SharedMemLockManager* manager_;
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> idle_condvar_;
+  std::vector<Waiter> incoming_;
+  bool watching_;  // Only accessed by the thread itself.
+  bool sleeping_;  // Whether the thread is (about to be) in a futex wait.
+  bool shut_down_;
+
+  DISALLOW_COPY_AND_ASSIGN(WaiterThread);
+};
+
 SharedMemLockManager::SharedMemLockManager(
     AbstractSharedMem* shm, const GoogleString& path, Scheduler* scheduler,
     Hasher* hasher, MessageHandler* handler)
@@ -284,11 +586,20 @@ SharedMemLockManager::SharedMemLockManager(
       scheduler_(scheduler),
       hasher_(hasher),
       handler_(handler),
-      lock_size_(shm->SharedMutexSize()) {
+      lock_size_(shm->SharedMutexSize()),
+      wake_waiters_(SharedFutex::Supported()),
+      waiter_thread_mutex_(scheduler->thread_system()->NewMutex()) {
   CHECK_GE(hasher_->RawHashSizeInBytes(), 9) << "Need >= 9 byte hashes";
 }
 
 SharedMemLockManager::~SharedMemLockManager() {
+  if (waiter_thread_.get() != NULL) {
+    waiter_thread_->ShutDown();
+  }
+}
+
+void SharedMemLockManager::set_wake_waiters(bool x) {
+  wake_waiters_ = x && SharedFutex::Supported();
 }
 
 bool SharedMemLockManager::Initialize() {
@@ -333,9 +644,44 @@ SchedulerBasedAbstractLock* SharedMemLockManager::CreateNamedLock(
   return new SharedMemLock(this, name);
 }
 
+Data::Header* SharedMemLockManager::Header() {
+  return reinterpret_cast<Data::Header*>(const_cast<char*>(seg_->Base()));
+}
+
 Data::Bucket* SharedMemLockManager::Bucket(size_t bucket) {
   return reinterpret_cast<Data::Bucket*>(
-      const_cast<char*>(seg_->Base()) + bucket * Data::BucketSize(lock_size_));
+      const_cast<char*>(seg_->Base()) + Data::HeaderSize() +
+      bucket * Data::BucketSize(lock_size_));
+}
+
+void SharedMemLockManager::AddAsyncWaiter(
+    SharedMemLock* lock, bool steal, int64 steal_ms, int64 wait_ms,
+    Function* callback) {
+  int64 end_ms = scheduler_->timer()->NowMs() + wait_ms;
+  WaiterThread* waiter_thread;
+  {
+    ScopedMutex hold_lock(waiter_thread_mutex_.get());
+    if (waiter_thread_.get() == NULL) {
+      waiter_thread_.reset(
+          new WaiterThread(this, scheduler_->thread_system()));
+      if (!waiter_thread_->Start()) {
+        waiter_thread_.reset(NULL);
+      }
+    }
+    waiter_thread = waiter_thread_.get();
+  }
+  if (waiter_thread == NULL) {
+    handler_->Message(kError, "Unable to start lock waiter thread.");
+    callback->CallCancel();
+    return;
+  }
+  waiter_thread->Add(lock, steal, steal_ms, end_ms, callback);
+}
+
+void SharedMemLockManager::WakeAsyncWaiters() {
+  Data::Header* header = Header();
+  base::subtle::Barrier_AtomicIncrement(&header->async_unlock_seq, 1);
+  SharedFutex::WakeAll(&header->async_unlock_seq);
 }
 
 size_t SharedMemLockManager::MutexOffset(SharedMemLockData::Bucket* bucket) {
@@ -32,22 +32,31 @@
 
 namespace net_instaweb {
 
+class AbstractMutex;
 class AbstractSharedMem;
 class AbstractSharedMemSegment;
+class Function;
 class Hasher;
 class MessageHandler;
 class Scheduler;
+class SharedMemLock;
 
 namespace SharedMemLockData {
 
 struct Bucket;
+struct Header;
 
 }  // namespace SharedMemLockData
 
-// A simple shared memory named locking manager, which uses scheduler alarms
-// (via SchedulerBasedAbstractLock) when it needs to block.
+// A simple shared memory named locking manager.
 //
-// TODO(morlovich): Implement condvars?
+// Where SharedFutex is supported, waiters for a held lock sleep until some
+// process unlocks a lock in the same bucket (or the lock becomes stealable, or
+// the wait times out), rather than polling.  Blocking waits sleep in the
+// calling thread; callback waits are handed to a per-manager thread which
+// sleeps on behalf of all of them and runs each callback once its lock is
+// taken or its wait runs out.  Elsewhere, or with set_wake_waiters(false),
+// waits poll using scheduler alarms via SchedulerBasedAbstractLock.
 class SharedMemLockManager : public NamedLockManager {
  public:
   // Note that you must call Initialize() in the root process, and Attach in
@@ -77,11 +86,30 @@ class SharedMemLockManager : public NamedLockManager {
 
   virtual SchedulerBasedAbstractLock* CreateNamedLock(const StringPiece& name);
 
+  // Whether waits on locks from this manager sleep until woken by an unlock
+  // instead of polling; defaults to true where supported, and setting it has
+  // no effect elsewhere.  Unlocks always wake sleeping waiters, so processes
+  // sharing a segment need not agree on this.  Must not be changed while any
+  // wait is in progress.
+  void set_wake_waiters(bool x);
+  bool wake_waiters() const { return wake_waiters_; }
+
  private:
+  class WaiterThread;
   friend class SharedMemLock;
 
+  SharedMemLockData::Header* Header();
   SharedMemLockData::Bucket* Bucket(size_t bucket);
 
+  // Hands a callback wait for lock to the waiter thread, starting it if
+  // needed.
+  void AddAsyncWaiter(SharedMemLock* lock, bool steal, int64 steal_ms,
+                      int64 wait_ms, Function* callback);
+
+  // Called after every unlock to let any waiter threads, in any process,
+  // re-check their locks.
+  void WakeAsyncWaiters();
+
   // Offset of mutex wrt to segment base.
   size_t MutexOffset(SharedMemLockData::Bucket*);
 
@@ -93,6 +121,10 @@ class SharedMemLockManager : public NamedLockManager {
   Hasher* hasher_;
   MessageHandler* handler_;
   size_t lock_size_;
+  bool wake_waiters_;
+
+  scoped_ptr<AbstractMutex> waiter_thread_mutex_;
+  scoped_ptr<WaiterThread> waiter_thread_;  // Started on first async wait.
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemLockManager);
 };
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+//
+// Measures SharedMemLockManager under contention: several processes take
+// turns holding a couple of hot locks for a few microseconds each, much as
+// server children do when they all want to rewrite the same popular resource.
+// The range argument is the number of processes.  Waiters either poll with
+// backoff (the SchedulerBasedAbstractLock default) or sleep until woken by the
+// unlock; each is run through both the blocking and the callback APIs.  The
+// companion correctness test for this kind of traffic is LockManagerSpammer.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
+#include "pagespeed/kernel/thread/pthread_shared_mem.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+#include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace {
+
+const int kNumNames = 2;
+const int kLocksPerProcess = 100;
+const int64 kHoldUs = 200;
+const int64 kWaitMs = 10 * net_instaweb::Timer::kSecondMs;
+const char kSegmentName[] = "/shared_mem_lock_manager_speed_test_segment";
+
+enum WaitStyle {
+  kPoll,
+  kWake
+};
+
+enum WaitApi {
+  kBlocking,
+  kCallback
+};
+
+// Runs in a forked child: repeatedly waits for one of the hot locks, holds
+// it for kHoldUs (sleeping, as if doing I/O), and lets it go.
+void RunChild(net_instaweb::AbstractSharedMem* shm_runtime, int index,
+              WaitStyle style, WaitApi api) {
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::scoped_ptr<net_instaweb::Timer> timer(
+      net_instaweb::Platform::CreateTimer());
+  net_instaweb::Scheduler scheduler(thread_system.get(), timer.get());
+  net_instaweb::MD5Hasher hasher;
+  net_instaweb::NullMessageHandler handler;
+  net_instaweb::SharedMemLockManager lock_manager(
+      shm_runtime, kSegmentName, &scheduler, &hasher, &handler);
+  CHECK(lock_manager.Attach());
+  lock_manager.set_wake_waiters(style == kWake);
+
+  std::vector<net_instaweb::SchedulerBasedAbstractLock*> locks;
+  for (int n = 0; n < kNumNames; ++n) {
+    locks.push_back(lock_manager.CreateNamedLock(
+        net_instaweb::StrCat("lock", net_instaweb::IntegerToString(n))));
+  }
+
+  for (int i = 0; i < kLocksPerProcess; ++i) {
+    net_instaweb::SchedulerBasedAbstractLock* lock =
+        locks[(index + i) % kNumNames];
+    if (api == kBlocking) {
+      CHECK(lock->LockTimedWait(kWaitMs));
+    } else {
+      net_instaweb::SchedulerBlockingFunction callback(&scheduler);
+      lock->LockTimedWait(kWaitMs, &callback);
+      CHECK(callback.Block());
+    }
+    timer->SleepUs(kHoldUs);
+    lock->Unlock();
+  }
+
+  for (int n = 0; n < kNumNames; ++n) {
+    delete locks[n];
+  }
+}
+
+void ContendedLocks(int iters, int num_processes, WaitStyle style,
+                    WaitApi api) {
+  StopBenchmarkTiming();
+  net_instaweb::PthreadSharedMem shm_runtime;
+  net_instaweb::NullMessageHandler handler;
+  {
+    net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+        net_instaweb::Platform::CreateThreadSystem());
+    net_instaweb::scoped_ptr<net_instaweb::Timer> timer(
+        net_instaweb::Platform::CreateTimer());
+    net_instaweb::Scheduler scheduler(thread_system.get(), timer.get());
+    net_instaweb::MD5Hasher hasher;
+    net_instaweb::SharedMemLockManager root(
+        &shm_runtime, kSegmentName, &scheduler, &hasher, &handler);
+    CHECK(root.Initialize());
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    std::vector<pid_t> children;
+    for (int p = 0; p < num_processes; ++p) {
+      pid_t pid = fork();
+      CHECK_NE(-1, pid);
+      if (pid == 0) {
+        RunChild(&shm_runtime, p, style, api);
+        // Skip atexit handlers and destructors inherited from the parent.
+        _exit(0);
+      }
+      children.push_back(pid);
+    }
+    for (int p = 0, n = children.size(); p < n; ++p) {
+      int status;
+      CHECK_EQ(children[p], waitpid(children[p], &status, 0));
+      CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+  }
+
+  StopBenchmarkTiming();
+  net_instaweb::SharedMemLockManager::GlobalCleanup(&shm_runtime, kSegmentName,
+                                                    &handler);
+}
+
+static void ShmLockBlockingPoll(int iters, int num_processes) {
+  ContendedLocks(iters, num_processes, kPoll, kBlocking);
+}
+
+static void ShmLockBlockingWake(int iters, int num_processes) {
+  ContendedLocks(iters, num_processes, kWake, kBlocking);
+}
+
+static void ShmLockCallbackPoll(int iters, int num_processes) {
+  ContendedLocks(iters, num_processes, kPoll, kCallback);
+}
+
+static void ShmLockCallbackWake(int iters, int num_processes) {
+  ContendedLocks(iters, num_processes, kWake, kCallback);
+}
+
+}  // namespace
+
+BENCHMARK_RANGE(ShmLockBlockingPoll, 1, 16);
+BENCHMARK_RANGE(ShmLockBlockingWake, 1, 16);
+BENCHMARK_RANGE(ShmLockCallbackPoll, 1, 16);
+BENCHMARK_RANGE(ShmLockCallbackWake, 1, 16);
@@ -20,12 +20,16 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager_test_base.h"
 
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/mock_message_handler.h"
 #include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_test_base.h"
 #include "pagespeed/kernel/thread/scheduler_based_abstract_lock.h"
@@ -39,6 +43,56 @@ const char kPath[] = "shm_locks";
 const char kLockA[] = "lock_a";
 const char kLockB[] = "lock_b";
 
+// How long the waiting tests hold a lock before releasing it, and how long
+// waiters are prepared to wait for it.  A woken waiter must get the lock
+// within kWakeSlackMs of the unlock.  SchedulerBasedAbstractLock's polling
+// backoff has grown to ~470ms by the time kHoldMs runs out, so its next poll
+// comes too late to pass; only an actual wakeup does.
+const int64 kHoldMs = Timer::kSecondMs;
+const int64 kWakeSlackMs = 150;
+const int64 kLongWaitMs = 10 * Timer::kSecondMs;
+
+// Lets a thread block until a lock callback is run or canceled.
+class WaitForCallback : public Function {
+ public:
+  explicit WaitForCallback(ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        condvar_(mutex_->NewCondvar()),
+        done_(false),
+        ran_(false) {
+    set_delete_after_callback(false);
+  }
+
+  // Returns true if the callback was run within timeout_ms, false if it was
+  // canceled or never called.
+  bool Wait(int64 timeout_ms) {
+    ScopedMutex lock(mutex_.get());
+    if (!done_) {
+      condvar_->TimedWait(timeout_ms);
+    }
+    return ran_;
+  }
+
+ protected:
+  virtual void Run() { Done(true); }
+  virtual void Cancel() { Done(false); }
+
+ private:
+  void Done(bool ran) {
+    ScopedMutex lock(mutex_.get());
+    done_ = true;
+    ran_ = ran;
+    condvar_->Signal();
+  }
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  scoped_ptr<ThreadSystem::Condvar> condvar_;
+  bool done_;
+  bool ran_;
+
+  DISALLOW_COPY_AND_ASSIGN(WaitForCallback);
+};
+
 }  // namespace
 
 SharedMemLockManagerTestBase::SharedMemLockManagerTestBase(
@@ -48,7 +102,9 @@ SharedMemLockManagerTestBase::SharedMemLockManagerTestBase(
       thread_system_(Platform::CreateThreadSystem()),
       timer_(thread_system_->NewMutex(), 0),
       handler_(thread_system_->NewMutex()),
-      scheduler_(thread_system_.get(), &timer_) {
+      scheduler_(thread_system_.get(), &timer_),
+      real_timer_(Platform::CreateTimer()),
+      real_scheduler_(thread_system_.get(), real_timer_.get()) {
 }
 
 void SharedMemLockManagerTestBase::SetUp() {
@@ -80,6 +136,16 @@ SharedMemLockManager* SharedMemLockManagerTestBase::AttachDefault() {
   return lock_man;
 }
 
+SharedMemLockManager* SharedMemLockManagerTestBase::AttachRealTime() {
+  SharedMemLockManager* lock_man = new SharedMemLockManager(
+      shmem_runtime_.get(), kPath, &real_scheduler_, &hasher_, &handler_);
+  if (!lock_man->Attach()) {
+    delete lock_man;
+    lock_man = NULL;
+  }
+  return lock_man;
+}
+
 void SharedMemLockManagerTestBase::TestBasic() {
   scoped_ptr<SharedMemLockManager> lock_manager(AttachDefault());
   ASSERT_TRUE(lock_manager.get() != NULL);
@@ -197,4 +263,130 @@ void SharedMemLockManagerTestBase::TestStealChild() {
   }
 }
 
+void SharedMemLockManagerTestBase::HoldWhileChildWaits(TestMethod child) {
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachRealTime());
+  ASSERT_TRUE(lock_manager.get() != NULL);
+  if (!lock_manager->wake_waiters()) {
+    return;  // Callback waits would need someone to run scheduler alarms.
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> lock_a(
+      lock_manager->CreateNamedLock(kLockA));
+  ASSERT_TRUE(lock_a->TryLock());
+  ASSERT_TRUE(CreateChild(child));
+  real_timer_->SleepMs(kHoldMs);
+  lock_a->Unlock();
+  test_env_->WaitForChildren();
+}
+
+void SharedMemLockManagerTestBase::TestBlockingWaitWakes() {
+  HoldWhileChildWaits(
+      &SharedMemLockManagerTestBase::TestBlockingWaitWakesChild);
+}
+
+void SharedMemLockManagerTestBase::TestBlockingWaitWakesChild() {
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachRealTime());
+  if (lock_manager.get() == NULL) {
+    test_env_->ChildFailed();
+    return;
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> lock_a(
+      lock_manager->CreateNamedLock(kLockA));
+  int64 start_ms = real_timer_->NowMs();
+  if (!lock_a->LockTimedWait(kLongWaitMs) || !lock_a->Held()) {
+    test_env_->ChildFailed();
+  }
+  if (real_timer_->NowMs() - start_ms > kHoldMs + kWakeSlackMs) {
+    test_env_->ChildFailed();
+  }
+}
+
+void SharedMemLockManagerTestBase::TestCallbackWaitWakes() {
+  HoldWhileChildWaits(
+      &SharedMemLockManagerTestBase::TestCallbackWaitWakesChild);
+}
+
+void SharedMemLockManagerTestBase::TestCallbackWaitWakesChild() {
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachRealTime());
+  if (lock_manager.get() == NULL) {
+    test_env_->ChildFailed();
+    return;
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> lock_a(
+      lock_manager->CreateNamedLock(kLockA));
+  WaitForCallback callback(thread_system_.get());
+  int64 start_ms = real_timer_->NowMs();
+  lock_a->LockTimedWait(kLongWaitMs, &callback);
+  if (!callback.Wait(kLongWaitMs / 2) || !lock_a->Held()) {
+    test_env_->ChildFailed();
+  }
+  if (real_timer_->NowMs() - start_ms > kHoldMs + kWakeSlackMs) {
+    test_env_->ChildFailed();
+  }
+}
+
+void SharedMemLockManagerTestBase::TestWaitTimesOut() {
+  const int64 kWaitMs = 100;
+
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachRealTime());
+  ASSERT_TRUE(lock_manager.get() != NULL);
+  if (!lock_manager->wake_waiters()) {
+    return;  // Callback waits would need someone to run scheduler alarms.
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> holder(
+      lock_manager->CreateNamedLock(kLockA));
+  scoped_ptr<SchedulerBasedAbstractLock> waiter(
+      lock_manager->CreateNamedLock(kLockA));
+  ASSERT_TRUE(holder->TryLock());
+
+  int64 start_ms = real_timer_->NowMs();
+  EXPECT_FALSE(waiter->LockTimedWait(kWaitMs));
+  EXPECT_FALSE(waiter->Held());
+  EXPECT_LE(kWaitMs, real_timer_->NowMs() - start_ms);
+
+  WaitForCallback callback(thread_system_.get());
+  start_ms = real_timer_->NowMs();
+  waiter->LockTimedWait(kWaitMs, &callback);
+  EXPECT_FALSE(callback.Wait(kLongWaitMs));
+  EXPECT_FALSE(waiter->Held());
+  EXPECT_LE(kWaitMs, real_timer_->NowMs() - start_ms);
+
+  // A zero wait gives up right away, without involving another thread.
+  WaitForCallback no_wait(thread_system_.get());
+  waiter->LockTimedWait(0, &no_wait);
+  EXPECT_FALSE(no_wait.Wait(0));
+  EXPECT_TRUE(holder->Held());
+}
+
+void SharedMemLockManagerTestBase::TestWaitSteals() {
+  const int64 kStealMs = 200;
+
+  scoped_ptr<SharedMemLockManager> lock_manager(AttachRealTime());
+  ASSERT_TRUE(lock_manager.get() != NULL);
+  if (!lock_manager->wake_waiters()) {
+    return;  // Callback waits would need someone to run scheduler alarms.
+  }
+  scoped_ptr<SchedulerBasedAbstractLock> holder(
+      lock_manager->CreateNamedLock(kLockA));
+  scoped_ptr<SchedulerBasedAbstractLock> waiter(
+      lock_manager->CreateNamedLock(kLockA));
+
+  // Nobody unlocks, so the waiters have to wake up on their own once the
+  // lock gets old enough to steal.
+  ASSERT_TRUE(holder->TryLock());
+  int64 start_ms = real_timer_->NowMs();
+  EXPECT_TRUE(waiter->LockTimedWaitStealOld(kLongWaitMs, kStealMs));
+  EXPECT_TRUE(waiter->Held());
+  EXPECT_LE(kStealMs, real_timer_->NowMs() - start_ms);
+  EXPECT_GT(kLongWaitMs / 2, real_timer_->NowMs() - start_ms);
+
+  scoped_ptr<SchedulerBasedAbstractLock> async_waiter(
+      lock_manager->CreateNamedLock(kLockA));
+  WaitForCallback callback(thread_system_.get());
+  start_ms = real_timer_->NowMs();
+  async_waiter->LockTimedWaitStealOld(kLongWaitMs, kStealMs, &callback);
+  EXPECT_TRUE(callback.Wait(kLongWaitMs / 2));
+  EXPECT_TRUE(async_waiter->Held());
+  EXPECT_LE(kStealMs, real_timer_->NowMs() - start_ms);
+}
+
 }  // namespace net_instaweb
@@ -29,9 +29,11 @@
 #include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_test_base.h"
 #include "pagespeed/kernel/thread/mock_scheduler.h"
+#include "pagespeed/kernel/thread/scheduler.h"
 
 namespace net_instaweb {
 
@@ -46,6 +48,10 @@ class SharedMemLockManagerTestBase : public testing::Test {
   void TestBasic();
   void TestDestructorUnlock();
   void TestSteal();
+  void TestBlockingWaitWakes();
+  void TestCallbackWaitWakes();
+  void TestWaitTimesOut();
+  void TestWaitSteals();
 
  private:
   bool CreateChild(TestMethod method);
@@ -53,8 +59,16 @@ class SharedMemLockManagerTestBase : public testing::Test {
   SharedMemLockManager* CreateLockManager();
   SharedMemLockManager* AttachDefault();
 
+  // Attaches a manager running on real time, for the tests of waiting.
+  SharedMemLockManager* AttachRealTime();
+
   void TestBasicChild();
   void TestStealChild();
+  void TestBlockingWaitWakesChild();
+  void TestCallbackWaitWakesChild();
+
+  // Holds kLockA for a bit in a fresh manager while a child waits for it.
+  void HoldWhileChildWaits(TestMethod child);
 
   scoped_ptr<SharedMemTestEnv> test_env_;
   scoped_ptr<AbstractSharedMem> shmem_runtime_;
@@ -66,6 +80,8 @@ class SharedMemLockManagerTestBase : public testing::Test {
   MockMessageHandler handler_;
   MockScheduler scheduler_;
   MD5Hasher hasher_;
+  scoped_ptr<Timer> real_timer_;
+  Scheduler real_scheduler_;
   scoped_ptr<SharedMemLockManager> root_lock_manager_;  // used for init only.
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemLockManagerTestBase);
@@ -93,8 +109,26 @@ TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestSteal) {
   SharedMemLockManagerTestBase::TestSteal();
 }
 
+TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestBlockingWaitWakes) {
+  SharedMemLockManagerTestBase::TestBlockingWaitWakes();
+}
+
+TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestCallbackWaitWakes) {
+  SharedMemLockManagerTestBase::TestCallbackWaitWakes();
+}
+
+TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestWaitTimesOut) {
+  SharedMemLockManagerTestBase::TestWaitTimesOut();
+}
+
+TYPED_TEST_P(SharedMemLockManagerTestTemplate, TestWaitSteals) {
+  SharedMemLockManagerTestBase::TestWaitSteals();
+}
+
 REGISTER_TYPED_TEST_CASE_P(SharedMemLockManagerTestTemplate, TestBasic,
-                           TestDestructorUnlock, TestSteal);
+                           TestDestructorUnlock, TestSteal,
+                           TestBlockingWaitWakes, TestCallbackWaitWakes,
+                           TestWaitTimesOut, TestWaitSteals);
 
 }  // namespace net_instaweb
 
@@ -20,6 +20,10 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include <algorithm>
 #include <cmath>
 #include <cstddef>
@@ -28,11 +32,13 @@
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/atomicops.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/util/statistics_logger.h"
@@ -56,6 +62,19 @@ const char kStatisticsObjName[] = "statistics";
 // statistics.
 const char kTimestampVariable[] = "timestamp_";
 
+// Histogram stripes are padded to this, so that Add() calls running on
+// different CPUs don't contend for the same cache line.
+const size_t kCacheLineSize = 64;
+
+#ifdef ARCH_CPU_64_BITS
+// Variables are read and updated with atomic operations on their shared-memory
+// word. All values are independent counters, so no ordering with respect to
+// other memory locations is needed.
+inline volatile base::subtle::Atomic64* AtomicPtr(volatile int64* value_ptr) {
+  return reinterpret_cast<volatile base::subtle::Atomic64*>(value_ptr);
+}
+#endif
+
 }  // namespace
 
 // Our shared memory storage format is an array of (mutex, int64).
@@ -93,6 +112,65 @@ SharedMemStatistics::Hist* SharedMemStatistics::NewHistogram(
   return new Hist(name, this);
 }
 
+#ifdef ARCH_CPU_64_BITS
+
+int64 SharedMemVariable::Get() const {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  return GetLockHeld();
+}
+
+void SharedMemVariable::Set(int64 new_value) {
+  if (mutex_.get() != NULL) {
+    SetLockHeld(new_value);
+  }
+}
+
+int64 SharedMemVariable::SetReturningPreviousValue(int64 new_value) {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  return SetReturningPreviousValueLockHeld(new_value);
+}
+
+int64 SharedMemVariable::AddHelper(int64 delta) {
+  if (mutex_.get() == NULL) {
+    return -1;
+  }
+  return base::subtle::NoBarrier_AtomicIncrement(AtomicPtr(value_ptr_), delta);
+}
+
+// The *LockHeld methods are only called by StatisticsLogger, with mutex_ held,
+// but other processes may be touching the value concurrently without it.
+int64 SharedMemVariable::GetLockHeld() const {
+  return base::subtle::NoBarrier_Load(AtomicPtr(value_ptr_));
+}
+
+int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
+  return base::subtle::NoBarrier_AtomicExchange(AtomicPtr(value_ptr_),
+                                                new_value);
+}
+
+#else  // !ARCH_CPU_64_BITS
+
+// No 64-bit atomics; take the per-variable mutex for every access.
+int64 SharedMemVariable::Get() const {
+  return MutexedScalar::Get();
+}
+
+void SharedMemVariable::Set(int64 new_value) {
+  MutexedScalar::Set(new_value);
+}
+
+int64 SharedMemVariable::SetReturningPreviousValue(int64 new_value) {
+  return MutexedScalar::SetReturningPreviousValue(new_value);
+}
+
+int64 SharedMemVariable::AddHelper(int64 delta) {
+  return MutexedScalar::AddHelper(delta);
+}
+
 int64 SharedMemVariable::GetLockHeld() const {
   return *value_ptr_;
 }
@@ -103,6 +181,8 @@ int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
   return previous_value;
 }
 
+#endif  // ARCH_CPU_64_BITS
+
 void SharedMemVariable::AttachTo(
     AbstractSharedMemSegment* segment, size_t offset,
     MessageHandler* message_handler) {
@@ -115,6 +195,8 @@ void SharedMemVariable::AttachTo(
 
   value_ptr_ = reinterpret_cast<volatile int64*>(
       segment->Base() + offset + segment->SharedMutexSize());
+  DCHECK_EQ(0u, reinterpret_cast<uintptr_t>(value_ptr_) % sizeof(int64))
+      << "Misaligned statistics variable " << name_;
 }
 
 void SharedMemVariable::Reset() {
@@ -125,12 +207,55 @@ AbstractMutex* SharedMemVariable::mutex() const {
   return mutex_.get();
 }
 
+const int SharedMemHistogram::kNumStripes;
+
 SharedMemHistogram::SharedMemHistogram(StringPiece name, Statistics* stats)
-    : num_buckets_(kDefaultNumBuckets + kOutOfBoundsCatcherBuckets),
+    : all_stripes_lock_(this),
+      num_buckets_(kDefaultNumBuckets + kOutOfBoundsCatcherBuckets),
       buffer_(NULL) {
+  for (int i = 0; i < kNumStripes; ++i) {
+    stripes_[i] = NULL;
+  }
 }
 
 SharedMemHistogram::~SharedMemHistogram() {
+  STLDeleteElements(&mutexes_);
+}
+
+SharedMemHistogram::AllStripesLock::~AllStripesLock() {
+}
+
+bool SharedMemHistogram::AllStripesLock::TryLock() {
+  std::vector<AbstractMutex*>& mutexes = histogram_->mutexes_;
+  for (int i = 0, n = mutexes.size(); i < n; ++i) {
+    if (!mutexes[i]->TryLock()) {
+      while (--i >= 0) {
+        mutexes[i]->Unlock();
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+void SharedMemHistogram::AllStripesLock::Lock() {
+  std::vector<AbstractMutex*>& mutexes = histogram_->mutexes_;
+  for (int i = 0, n = mutexes.size(); i < n; ++i) {
+    mutexes[i]->Lock();
+  }
+}
+
+void SharedMemHistogram::AllStripesLock::Unlock() {
+  std::vector<AbstractMutex*>& mutexes = histogram_->mutexes_;
+  for (int i = mutexes.size() - 1; i >= 0; --i) {
+    mutexes[i]->Unlock();
+  }
+}
+
+size_t SharedMemHistogram::StripeSize(size_t mutex_size) {
+  size_t size = mutex_size + sizeof(HistogramBody) +
+      sizeof(double) * NumBuckets();
+  return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
 }
 
 void SharedMemHistogram::Init() {
@@ -138,34 +263,73 @@ void SharedMemHistogram::Init() {
     return;
   }
 
-  ScopedMutex hold_lock(mutex_.get());
-  buffer_->enable_negative_ = false;
-  buffer_->min_value_ = 0;
-  buffer_->max_value_ = kMaxValue;
+  ScopedMutex hold_lock(lock());
+  for (int i = 0; i < kNumStripes; ++i) {
+    stripes_[i]->enable_negative_ = false;
+    stripes_[i]->min_value_ = 0;
+    stripes_[i]->max_value_ = kMaxValue;
+  }
   ClearInternal();
 }
 
 void SharedMemHistogram::DCheckRanges() const {
-  DCHECK_LT(buffer_->min_value_, buffer_->max_value_);
+  for (int i = 0; i < kNumStripes; ++i) {
+    DCHECK_LT(stripes_[i]->min_value_, stripes_[i]->max_value_);
+  }
+}
+
+bool SharedMemHistogram::InitMutexes(AbstractSharedMemSegment* segment,
+                                     size_t offset,
+                                     MessageHandler* message_handler) {
+  size_t stripe_size = StripeSize(segment->SharedMutexSize());
+  for (int i = 0; i < kNumStripes; ++i) {
+    if (!segment->InitializeSharedMutex(offset + i * stripe_size,
+                                        message_handler)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void SharedMemHistogram::AttachTo(
     AbstractSharedMemSegment* segment, size_t offset,
     MessageHandler* message_handler) {
-  mutex_.reset(segment->AttachToSharedMutex(offset));
-  if (mutex_.get() == NULL) {
-    message_handler->Message(
-        kError, "Unable to attach to mutex for statistics histogram");
-    Reset();
-    return;
+  // Init may be called more than once in a process; drop any previous
+  // attachment rather than holding two handles to the same mutex.
+  STLDeleteElements(&mutexes_);
+  size_t stripe_size = StripeSize(segment->SharedMutexSize());
+  for (int i = 0; i < kNumStripes; ++i) {
+    size_t stripe_offset = offset + i * stripe_size;
+    AbstractMutex* mutex = segment->AttachToSharedMutex(stripe_offset);
+    if (mutex == NULL) {
+      message_handler->Message(
+          kError, "Unable to attach to mutex for statistics histogram");
+      Reset();
+      return;
+    }
+    mutexes_.push_back(mutex);
+    stripes_[i] = reinterpret_cast<HistogramBody*>(const_cast<char*>(
+        segment->Base() + stripe_offset + segment->SharedMutexSize()));
   }
-  buffer_ = reinterpret_cast<HistogramBody*>(const_cast<char*>(
-      segment->Base() + offset + segment->SharedMutexSize()));
+  buffer_ = stripes_[0];
 }
 
 void SharedMemHistogram::Reset() {
-  mutex_.reset(new NullMutex);
+  STLDeleteElements(&mutexes_);
   buffer_ = NULL;
+  for (int i = 0; i < kNumStripes; ++i) {
+    stripes_[i] = NULL;
+  }
+}
+
+int SharedMemHistogram::CurrentStripe() {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if (cpu > 0) {
+    return cpu % kNumStripes;
+  }
+#endif
+  return 0;
 }
 
 int SharedMemHistogram::FindBucket(double value) {
@@ -190,25 +354,32 @@ int SharedMemHistogram::FindBucket(double value) {
 }
 
 void SharedMemHistogram::Add(double value) {
+  AddToStripe(CurrentStripe(), value);
+}
+
+void SharedMemHistogram::AddToStripe(int stripe, double value) {
   if (buffer_ == NULL) {
     return;
   }
-  ScopedMutex hold_lock(mutex_.get());
+  DCHECK(stripe >= 0 && stripe < kNumStripes);
+  HistogramBody* body = stripes_[stripe];
+  ScopedMutex hold_lock(mutexes_[stripe]);
   // See if we should put the value in one of the out-of-bounds catcher buckets,
-  // in which case we will change index from -1.
+  // in which case we will change index from -1.  The bounds are the same in
+  // every stripe, so FindBucket may consult buffer_'s copy.
   int index = -1;
-  if (buffer_->enable_negative_) {
+  if (body->enable_negative_) {
     // If negative buckets is enabled, the minimum value in-range in Histogram
-    // is -buffer_->max_value_.
-    if (value < -buffer_->max_value_) {
+    // is -body->max_value_.
+    if (value < -body->max_value_) {
       index = 0;
-    } else if (value >= buffer_->max_value_) {
+    } else if (value >= body->max_value_) {
       index = num_buckets_ - 1;
     }
   } else {
-    if (value < buffer_->min_value_) {
+    if (value < body->min_value_) {
       index = 0;
-    } else if (value >= buffer_->max_value_) {
+    } else if (value >= body->max_value_) {
       index = num_buckets_ - 1;
     }
   }
@@ -222,19 +393,19 @@ void SharedMemHistogram::Add(double value) {
     LOG(ERROR) << "Invalid bucket index found for" << value;
     return;
   }
-  buffer_->values_[index]++;
+  body->values_[index]++;
   // Update actual min & max values;
-  if (buffer_->count_ == 0) {
-    buffer_->min_ = value;
-    buffer_->max_ = value;
-  } else if (value < buffer_->min_) {
-    buffer_->min_ = value;
-  } else if (value > buffer_->max_) {
-    buffer_->max_ = value;
+  if (body->count_ == 0) {
+    body->min_ = value;
+    body->max_ = value;
+  } else if (value < body->min_) {
+    body->min_ = value;
+  } else if (value > body->max_) {
+    body->max_ = value;
   }
-  buffer_->count_++;
-  buffer_->sum_ += value;
-  buffer_->sum_of_squares_ += value * value;
+  body->count_++;
+  body->sum_ += value;
+  body->sum_of_squares_ += value * value;
 }
 
 void SharedMemHistogram::Clear() {
@@ -242,19 +413,22 @@ void SharedMemHistogram::Clear() {
     return;
   }
 
-  ScopedMutex hold_lock(mutex_.get());
+  ScopedMutex hold_lock(lock());
   ClearInternal();
 }
 
 void SharedMemHistogram::ClearInternal() {
   // Throw away data.
-  buffer_->min_ = 0;
-  buffer_->max_ = 0;
-  buffer_->count_ = 0;
-  buffer_->sum_ = 0;
-  buffer_->sum_of_squares_ = 0;
-  for (int i = 0; i < num_buckets_; ++i) {
-    buffer_->values_[i] = 0;
+  for (int s = 0; s < kNumStripes; ++s) {
+    HistogramBody* body = stripes_[s];
+    body->min_ = 0;
+    body->max_ = 0;
+    body->count_ = 0;
+    body->sum_ = 0;
+    body->sum_of_squares_ = 0;
+    for (int i = 0; i < num_buckets_; ++i) {
+      body->values_[i] = 0;
+    }
   }
 }
 
@@ -269,9 +443,11 @@ void SharedMemHistogram::EnableNegativeBuckets() {
   DCHECK_EQ(0, buffer_->min_value_) << "Cannot call EnableNegativeBuckets and"
                                         "SetMinValue on the same histogram.";
 
-  ScopedMutex hold_lock(mutex_.get());
+  ScopedMutex hold_lock(lock());
   if (!buffer_->enable_negative_) {
-    buffer_->enable_negative_ = true;
+    for (int i = 0; i < kNumStripes; ++i) {
+      stripes_[i]->enable_negative_ = true;
+    }
     ClearInternal();
   }
 }
@@ -285,9 +461,11 @@ void SharedMemHistogram::SetMinValue(double value) {
   DCHECK_LT(value, buffer_->max_value_) << "Lower-bound of a histogram "
       "should be smaller than its upper-bound.";
 
-  ScopedMutex hold_lock(mutex_.get());
+  ScopedMutex hold_lock(lock());
   if (buffer_->min_value_ != value) {
-    buffer_->min_value_ = value;
+    for (int i = 0; i < kNumStripes; ++i) {
+      stripes_[i]->min_value_ = value;
+    }
     ClearInternal();
   }
 }
@@ -299,9 +477,11 @@ void SharedMemHistogram::SetMaxValue(double value) {
   DCHECK_LT(0, value) << "Upper-bound of a histogram should be larger than 0.";
   DCHECK_LT(buffer_->min_value_, value) << "Upper-bound of a histogram should "
       "be larger than its lower-bound.";
-  ScopedMutex hold_lock(mutex_.get());
+  ScopedMutex hold_lock(lock());
   if (buffer_->max_value_ != value) {
-    buffer_->max_value_ = value;
+    for (int i = 0; i < kNumStripes; ++i) {
+      stripes_[i]->max_value_ = value;
+    }
     ClearInternal();
   }
 }
@@ -311,14 +491,39 @@ void SharedMemHistogram::SetSuggestedNumBuckets(int i) {
   num_buckets_ = i + kOutOfBoundsCatcherBuckets;
 }
 
+double SharedMemHistogram::MergedCount() {
+  double count = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    count += stripes_[i]->count_;
+  }
+  return count;
+}
+
+double SharedMemHistogram::MergedSum() {
+  double sum = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    sum += stripes_[i]->sum_;
+  }
+  return sum;
+}
+
+double SharedMemHistogram::MergedSumOfSquares() {
+  double sum_of_squares = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    sum_of_squares += stripes_[i]->sum_of_squares_;
+  }
+  return sum_of_squares;
+}
+
 double SharedMemHistogram::AverageInternal() {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  if (buffer_->count_ == 0) {
+  double count = MergedCount();
+  if (count == 0) {
     return 0.0;
   }
-  return buffer_->sum_ / buffer_->count_;
+  return MergedSum() / count;
 }
 
 // Return estimated value that is larger than perc% of all data.
@@ -328,19 +533,21 @@ double SharedMemHistogram::PercentileInternal(const double perc) {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  if (buffer_->count_ == 0 || perc < 0) {
+  double total_count = MergedCount();
+  if (total_count == 0 || perc < 0) {
     return 0.0;
   }
   // Floor of count_below is the number of values below the percentile.
   // We are indeed looking for the next value in histogram.
-  double count_below = floor(buffer_->count_ * perc / 100);
+  double count_below = floor(total_count * perc / 100);
   double count = 0;
   int i;
   // Find the bucket which is closest to the bucket that contains
   // the number we want.
   for (i = 0; i < num_buckets_; ++i) {
-    if (count + buffer_->values_[i] <= count_below) {
-      count += buffer_->values_[i];
+    double bucket_count = BucketCount(i);
+    if (count + bucket_count <= count_below) {
+      count += bucket_count;
       if (count == count_below) {
         // The first number in (i+1)th bucket is the number we want. Its
         // estimated value is the lower-bound of (i+1)th bucket.
@@ -354,7 +561,7 @@ double SharedMemHistogram::PercentileInternal(const double perc) {
   // However, we do not know its exact value as we do not have a trace of all
   // values.
   double fraction = (count_below + 1 - count) / BucketCount(i);
-  double bound = std::min(BucketWidth(), buffer_->max_ - BucketStart(i));
+  double bound = std::min(BucketWidth(), MaximumInternal() - BucketStart(i));
   double ret = BucketStart(i) + fraction * bound;
   return ret;
 }
@@ -363,13 +570,14 @@ double SharedMemHistogram::StandardDeviationInternal() {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  if (buffer_->count_ == 0) {
+  double count = MergedCount();
+  if (count == 0) {
     return 0.0;
   }
-  const double v = (buffer_->sum_of_squares_ * buffer_->count_ -
-                   buffer_->sum_ * buffer_->sum_) /
-                   (buffer_->count_ * buffer_->count_);
-  if (v < buffer_->sum_of_squares_ * std::numeric_limits<double>::epsilon()) {
+  double sum = MergedSum();
+  double sum_of_squares = MergedSumOfSquares();
+  const double v = (sum_of_squares * count - sum * sum) / (count * count);
+  if (v < sum_of_squares * std::numeric_limits<double>::epsilon()) {
     return 0.0;
   }
   return std::sqrt(v);
@@ -379,21 +587,37 @@ double SharedMemHistogram::CountInternal() {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  return buffer_->count_;
+  return MergedCount();
 }
 
 double SharedMemHistogram::MaximumInternal() {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  return buffer_->max_;
+  bool found = false;
+  double max = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    if (stripes_[i]->count_ != 0 && (!found || stripes_[i]->max_ > max)) {
+      max = stripes_[i]->max_;
+      found = true;
+    }
+  }
+  return max;
 }
 
 double SharedMemHistogram::MinimumInternal() {
   if (buffer_ == NULL) {
     return -1.0;
   }
-  return buffer_->min_;
+  bool found = false;
+  double min = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    if (stripes_[i]->count_ != 0 && (!found || stripes_[i]->min_ < min)) {
+      min = stripes_[i]->min_;
+      found = true;
+    }
+  }
+  return min;
 }
 
 double SharedMemHistogram::BucketStart(int index) {
@@ -432,7 +656,11 @@ double SharedMemHistogram::BucketCount(int index) {
   if (index < 0 || index >= num_buckets_) {
     return -1.0;
   }
-  return buffer_->values_[index];
+  double count = 0;
+  for (int i = 0; i < kNumStripes; ++i) {
+    count += stripes_[i]->values_[index];
+  }
+  return count;
 }
 
 double SharedMemHistogram::BucketWidth() {
@@ -499,13 +727,13 @@ bool SharedMemStatistics::InitMutexes(size_t per_var,
     }
   }
   for (size_t i = 0; i < histograms_size();) {
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
+    SharedMemHistogram* hist = histograms(i);
+    if (!hist->InitMutexes(segment_.get(), pos, message_handler)) {
       message_handler->Message(
           kError, "Unable to create mutex for statistics histogram %s",
           histogram_names(i).c_str());
       return false;
     }
-    SharedMemHistogram* hist = histograms(i);
     pos += hist->AllocationSize(shm_runtime_);
     i++;
   }
@@ -22,6 +22,7 @@
 #define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
@@ -31,6 +32,7 @@
 #include "pagespeed/kernel/base/statistics_template.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
 
 namespace net_instaweb {
 
@@ -41,10 +43,15 @@ class Timer;
 
 // An implementation of Statistics using our shared memory infrastructure.
 // These statistics will be shared amongst all processes and threads
-// spawned by our host.  Note that we will be obtaining a per-variable mutex for
-// every read and write to these variables.  Since this may be expensive,
-// we may need each thread to keep a local cache and infrequently write
-// through to this Statistics object.  TODO(abliss): actually do this.
+// spawned by our host.  Variables are updated with atomic operations directly
+// on the shared-memory word, so the common Add/Get paths take no lock.  Each
+// variable still owns a shared mutex; it is used only by StatisticsLogger
+// (which needs a TryLock to elect a single dumping process), and on platforms
+// without 64-bit atomics, where we fall back to locking every access.
+//
+// Histograms are striped: each one keeps several copies of its buckets and
+// totals, each with its own mutex, and Add() only locks the stripe for the
+// CPU it is running on.  Readers lock every stripe and merge them.
 //
 // Because we must allocate shared memory segments and mutexes before any child
 // processes and threads are created, all AddVariable calls must be done in
@@ -63,6 +70,15 @@ class SharedMemVariable : public MutexedScalar {
   virtual ~SharedMemVariable() {}
   virtual StringPiece GetName() const { return name_; }
 
+  // These hide the mutex-taking versions in MutexedScalar; VarTemplate and
+  // UpDownTemplate call them on the concrete type, so the lock-free versions
+  // are the ones used for all ordinary stats traffic.  As with MutexedScalar,
+  // they return -1 (or do nothing) if initialization failed.
+  int64 Get() const;
+  void Set(int64 value);
+  int64 SetReturningPreviousValue(int64 value);
+  int64 AddHelper(int64 delta);
+
  protected:
   virtual AbstractMutex* mutex() const;
   virtual int64 GetLockHeld() const;
@@ -84,7 +100,8 @@ class SharedMemVariable : public MutexedScalar {
   // The name of this variable.
   const GoogleString name_;
 
-  // Lock protecting us. NULL if for some reason initialization failed.
+  // Lock used by StatisticsLogger, and to protect the value when atomics are
+  // not available. NULL if for some reason initialization failed.
   scoped_ptr<AbstractMutex> mutex_;
 
   // The data...
@@ -121,15 +138,14 @@ class SharedMemHistogram : public Histogram {
   // Return the amount of shared memory this Histogram objects needs for its
   // use.
   size_t AllocationSize(AbstractSharedMem* shm_runtime) {
-    // Shared memory space should include a mutex, HistogramBody and the storage
-    // for the actual buckets.
-    return shm_runtime->SharedMutexSize() + sizeof(HistogramBody) +
-        sizeof(double) * NumBuckets();
+    return kNumStripes * StripeSize(shm_runtime->SharedMutexSize());
   }
 
  protected:
+  // Locks all the stripes, in order, so the *Internal methods see a
+  // consistent merged view.
   virtual AbstractMutex* lock() {
-    return mutex_.get();
+    return &all_stripes_lock_;
   }
   virtual double AverageInternal();
   virtual double PercentileInternal(const double perc);
@@ -142,9 +158,50 @@ class SharedMemHistogram : public Histogram {
 
  private:
   friend class SharedMemStatistics;
+  friend class SharedMemStatisticsTestBase;
+  struct HistogramBody;
+
+  // Number of independently-locked copies of the histogram data.  This must
+  // be the same in every process attached to the segment.
+  static const int kNumStripes = 4;
+
+  // A mutex that locks every stripe's mutex, in stripe order.
+  class LOCKABLE AllStripesLock : public AbstractMutex {
+   public:
+    explicit AllStripesLock(SharedMemHistogram* histogram)
+        : histogram_(histogram) {}
+    virtual ~AllStripesLock();
+    virtual bool TryLock() EXCLUSIVE_TRYLOCK_FUNCTION(true);
+    virtual void Lock() EXCLUSIVE_LOCK_FUNCTION();
+    virtual void Unlock() UNLOCK_FUNCTION();
+
+   private:
+    SharedMemHistogram* histogram_;
+    DISALLOW_COPY_AND_ASSIGN(AllStripesLock);
+  };
+
+  // Shared memory space for each stripe includes a mutex, HistogramBody and
+  // the storage for the actual buckets, rounded up to a cache line so that
+  // stripes touched by different CPUs do not share one.
+  size_t StripeSize(size_t mutex_size);
+
+  // Initializes the mutexes for all stripes of a histogram at offset.
+  bool InitMutexes(AbstractSharedMemSegment* segment, size_t offset,
+                   MessageHandler* message_handler);
   void AttachTo(AbstractSharedMemSegment* segment, size_t offset,
                 MessageHandler* message_handler);
 
+  // Picks the stripe for the CPU the calling thread is running on.
+  static int CurrentStripe();
+
+  // Records value into the given stripe; Add() is AddToStripe(CurrentStripe()).
+  void AddToStripe(int stripe, double value);
+
+  // Merged totals across all stripes. Expect lock() held.
+  double MergedCount();
+  double MergedSum();
+  double MergedSumOfSquares();
+
   // Returns the width of normal buckets (as in not the two extreme outermost
   // buckets which have infinite width).
   double BucketWidth();
@@ -155,11 +212,16 @@ class SharedMemHistogram : public Histogram {
   void Init();
   void DCheckRanges() const;
   void Reset();
-  void ClearInternal();  // expects mutex_ held, buffer_ != NULL
+  void ClearInternal();  // expects lock() held, buffer_ != NULL
   const GoogleString name_;
-  scoped_ptr<AbstractMutex> mutex_;
+  // One mutex per stripe; empty if initialization failed.
+  std::vector<AbstractMutex*> mutexes_;
+  AllStripesLock all_stripes_lock_;
   // TODO(fangfei): implement a non-shared-mem histogram.
   struct HistogramBody {
+    // The bounds configuration is replicated in every stripe, and only
+    // changed with all stripes locked.
+    //
     // Enable negative values in histogram, false by default.
     bool enable_negative_;
     // Minimum value allowed in Histogram, 0 by default.
@@ -179,7 +241,8 @@ class SharedMemHistogram : public Histogram {
   };
   // Number of buckets in this histogram.
   int num_buckets_;
-  HistogramBody* buffer_;  // may be NULL if init failed.
+  HistogramBody* buffer_;  // stripe 0; may be NULL if init failed.
+  HistogramBody* stripes_[kNumStripes];  // all NULL if init failed.
   DISALLOW_COPY_AND_ASSIGN(SharedMemHistogram);
 };
 
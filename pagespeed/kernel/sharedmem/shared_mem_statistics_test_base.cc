@@ -455,6 +455,44 @@ void SharedMemStatisticsTestBase::TestHistogramExtremeBuckets() {
   EXPECT_LE(h1->Median(), h1->BucketLimit(0));
 }
 
+void SharedMemStatisticsTestBase::TestHistogramStripes() {
+  ParentInit();
+  SharedMemHistogram* h1 = stats_->histograms(0);
+  ASSERT_EQ(kHist1, stats_->histogram_names(0));
+  h1->SetMaxValue(100.0);
+
+  // Spread values across all the stripes; the readers should merge them as
+  // if they had all gone into one.
+  for (int i = 0; i < 8; ++i) {
+    h1->AddToStripe(i % SharedMemHistogram::kNumStripes, 10 * i + 5);
+  }
+  EXPECT_EQ(8, h1->Count());
+  EXPECT_EQ(5, h1->Minimum());
+  EXPECT_EQ(75, h1->Maximum());
+  EXPECT_EQ(40, h1->Average());
+  EXPECT_FALSE(h1->Empty());
+
+  double total = 0;
+  for (int i = 0; i < h1->NumBuckets(); ++i) {
+    total += h1->BucketCount(i);
+  }
+  EXPECT_EQ(8, total);
+  EXPECT_EQ(0, h1->BucketCount(0));
+
+  // Clear must reset every stripe.
+  h1->Clear();
+  EXPECT_EQ(0, h1->Count());
+  EXPECT_TRUE(h1->Empty());
+
+  // Changing the bounds applies to every stripe.
+  h1->SetMaxValue(10.0);
+  for (int i = 0; i < SharedMemHistogram::kNumStripes; ++i) {
+    h1->AddToStripe(i, 20);
+  }
+  EXPECT_EQ(SharedMemHistogram::kNumStripes,
+            h1->BucketCount(h1->NumBuckets() - 1));
+}
+
 void SharedMemStatisticsTestBase::TestTimedVariableEmulation() {
   // Simple test of timed variable emulation. Not using ParentInit
   // here since we want to add some custom things.
@@ -60,6 +60,7 @@ class SharedMemStatisticsTestBase : public testing::Test {
   void TestHistogramRender();
   void TestHistogramNoExtraClear();
   void TestHistogramExtremeBuckets();
+  void TestHistogramStripes();
   void TestTimedVariableEmulation();
   void TestConsoleStatisticsLogger();
 
@@ -142,6 +143,10 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestHistogramNoExtraClear) {
   SharedMemStatisticsTestBase::TestHistogramNoExtraClear();
 }
 
+TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestHistogramStripes) {
+  SharedMemStatisticsTestBase::TestHistogramStripes();
+}
+
 TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestTimedVariableEmulation) {
   SharedMemStatisticsTestBase::TestTimedVariableEmulation();
 }
@@ -152,6 +157,7 @@ REGISTER_TYPED_TEST_CASE_P(SharedMemStatisticsTestTemplate, TestCreate,
                            TestHistogram, TestHistogramRender,
                            TestHistogramNoExtraClear,
                            TestHistogramExtremeBuckets,
+                           TestHistogramStripes,
                            TestTimedVariableEmulation);
 
 }  // namespace net_instaweb
@@ -28,6 +28,8 @@
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -46,8 +48,46 @@ inline void UpdateWaveform(Waveform* queue_size, int delta) {
 
 const size_t kUnboundedQueue = 0;
 
+// Whether ticket a was issued before ticket b, allowing for wraparound.
+inline bool TicketBefore(int32 a, int32 b) {
+  return static_cast<int32>(static_cast<uint32>(a) - static_cast<uint32>(b)) <
+      0;
+}
+
 }  // namespace
 
+// A work-stealing worker's share of the pool's state.  Sequences made runnable
+// are appended to some worker's queue, and workers take sequences from the
+// front of their own queue, or, failing that, of other workers' queues.  A
+// worker that finds nothing marks itself idle and waits on its condvar, so
+// that whoever next queues a sequence can hand it over directly.
+struct QueuedWorkerPool::WorkerQueue {
+  explicit WorkerQueue(ThreadSystem* thread_system)
+      : mutex(thread_system->NewMutex()),
+        condvar(mutex->NewCondvar()),
+        assigned(NULL),
+        idle(false),
+        woken(false),
+        shut_down(false) {
+  }
+
+  struct Entry {
+    Sequence* sequence;
+    int32 ticket;  // Order in which sequences were queued.
+  };
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex;
+  scoped_ptr<ThreadSystem::Condvar> condvar;
+  std::deque<Entry> sequences;  // All remaining fields guarded by mutex.
+  Sequence* assigned;  // Handed to this worker while idle.
+  bool idle;  // Waiting on condvar, or about to.
+  bool woken;  // Told to look for work again.
+  bool shut_down;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WorkerQueue);
+};
+
 QueuedWorkerPool::QueuedWorkerPool(
     int max_workers, StringPiece thread_name_base, ThreadSystem* thread_system)
     : thread_system_(thread_system),
@@ -69,6 +109,7 @@ QueuedWorkerPool::~QueuedWorkerPool() {
     sequence->WaitForShutDown();
     delete sequence;
   }
+  STLDeleteElements(&worker_queues_);
 }
 
 void QueuedWorkerPool::ShutDown() {
@@ -87,9 +128,19 @@ void QueuedWorkerPool::InitiateShutDown() {
       // delete those till the pool itself is deleted.
       DCHECK(active_workers_.empty());
       DCHECK(available_workers_.empty());
+      DCHECK(stealing_workers_.empty());
       return;
     }
     shutdown_ = true;
+
+    // Let work-stealing workers leave their loops once done with their
+    // current sequences.  No more will be started now.
+    for (int i = 0, n = stealing_workers_.size(); i < n; ++i) {
+      WorkerQueue* queue = worker_queues_[i];
+      ScopedMutex queue_lock(queue->mutex.get());
+      queue->shut_down = true;
+      queue->condvar->Signal();
+    }
   }
 
   // Clear out all the sequences, so that no one adds any more runnable
@@ -144,6 +195,13 @@ void QueuedWorkerPool::WaitForShutDownComplete() {
     delete worker;
   }
   available_workers_.clear();
+
+  for (int i = 0, n = stealing_workers_.size(); i < n; ++i) {
+    QueuedWorker* worker = stealing_workers_[i];
+    worker->ShutDown();
+    delete worker;
+  }
+  stealing_workers_.clear();
 }
 
 // Runs computable tasks through a worker.  Note that a first
@@ -184,6 +242,11 @@ QueuedWorkerPool::Sequence* QueuedWorkerPool::AssignWorkerToNextSequence(
 }
 
 void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
+  if (!worker_queues_.empty()) {
+    QueueSequenceStealing(sequence);
+    return;
+  }
+
   QueuedWorker* worker = NULL;
   Sequence* drop_sequence = NULL;
   {
@@ -232,6 +295,242 @@ void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
   }
 }
 
+void QueuedWorkerPool::RunStealing(Sequence* sequence, int index) {
+  while (sequence != NULL) {
+    while (Function* function = sequence->NextFunction()) {
+      function->CallRun();
+    }
+    sequence = NextSequenceStealing(index);
+  }
+}
+
+void QueuedWorkerPool::QueueSequenceStealing(Sequence* sequence) {
+  if ((num_idle_workers_.value() > 0) && HandOffToIdleWorker(sequence)) {
+    return;
+  }
+
+  // Start workers on demand, as in the shared-queue case, handing each its
+  // first sequence directly.
+  int num_started = num_started_workers_.value();
+  if (static_cast<size_t>(num_started) < max_workers_) {
+    QueuedWorker* worker = NULL;
+    {
+      ScopedMutex lock(mutex_.get());
+      if (shutdown_) {
+        // The sequence is being shut down too, and will cancel its work.
+        return;
+      }
+      num_started = stealing_workers_.size();
+      if (static_cast<size_t>(num_started) < max_workers_) {
+        worker = new QueuedWorker(
+            StrCat(thread_name_base_, "-", IntegerToString(num_started)),
+            thread_system_);
+        worker->Start();
+        stealing_workers_.push_back(worker);
+        num_started_workers_.set_value(num_started + 1);
+      }
+    }
+    if (worker != NULL) {
+      worker->RunInWorkThread(
+          new MemberFunction2<QueuedWorkerPool, QueuedWorkerPool::Sequence*,
+                              int>(
+              &QueuedWorkerPool::RunStealing, this, sequence, num_started));
+      return;
+    }
+  }
+
+  int index =
+      static_cast<uint32>(next_queue_.NoBarrierIncrement(1)) % num_started;
+  PushQueuedSequence(sequence, index);
+}
+
+void QueuedWorkerPool::PushQueuedSequence(Sequence* sequence, int index) {
+  WorkerQueue* queue = worker_queues_[index];
+  WorkerQueue::Entry entry = {sequence, next_ticket_.NoBarrierIncrement(1)};
+  {
+    ScopedMutex lock(queue->mutex.get());
+    queue->sequences.push_back(entry);
+  }
+
+  // Idle workers count themselves before their last look at the queues,
+  // and we count the sequence before looking for idle workers, so one of us
+  // will notice the other.
+  int num_queued = num_queued_sequences_.BarrierIncrement(1);
+  if ((load_shedding_threshold_ != kNoLoadShedding) &&
+      (num_queued > load_shedding_threshold_)) {
+    ShedOldestQueuedSequence();
+  }
+  if (num_idle_workers_.value() > 0) {
+    WakeIdleWorker();
+  }
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::NextSequenceStealing(int index) {
+  WorkerQueue* queue = worker_queues_[index];
+  while (true) {
+    Sequence* sequence = NULL;
+    {
+      ScopedMutex lock(queue->mutex.get());
+      if (queue->shut_down) {
+        return NULL;
+      }
+      sequence = queue->assigned;
+      queue->assigned = NULL;
+    }
+    if (sequence == NULL) {
+      sequence = PopAnyQueuedSequence(index);
+    }
+    if (sequence != NULL) {
+      return sequence;
+    }
+
+    // Nothing to do, so go idle, then take a last look before sleeping (see
+    // PushQueuedSequence).
+    {
+      ScopedMutex lock(queue->mutex.get());
+      queue->idle = true;
+    }
+    num_idle_workers_.BarrierIncrement(1);
+    sequence = PopAnyQueuedSequence(index);
+    Sequence* displaced = NULL;
+    bool shut_down;
+    {
+      ScopedMutex lock(queue->mutex.get());
+      if (sequence == NULL) {
+        while ((queue->assigned == NULL) && !queue->woken &&
+               !queue->shut_down) {
+          queue->condvar->Wait();
+        }
+        sequence = queue->assigned;
+      } else {
+        // Someone handed us a sequence just as we found one ourselves.
+        displaced = queue->assigned;
+      }
+      queue->assigned = NULL;
+      queue->idle = false;
+      queue->woken = false;
+      shut_down = queue->shut_down;
+    }
+    num_idle_workers_.BarrierIncrement(-1);
+
+    if (shut_down) {
+      return NULL;
+    }
+    if (displaced != NULL) {
+      // Queue it where other workers can get it, rather than leave it
+      // waiting behind whatever we are about to run.
+      PushQueuedSequence(displaced, index);
+    }
+    if (sequence != NULL) {
+      return sequence;
+    }
+  }
+}
+
+bool QueuedWorkerPool::HandOffToIdleWorker(Sequence* sequence) {
+  // Always prefer the lowest-numbered idle worker, so that under light load
+  // the same few threads (and their caches) stay warm.
+  int num_started = num_started_workers_.value();
+  for (int i = 0; i < num_started; ++i) {
+    WorkerQueue* queue = worker_queues_[i];
+    ScopedMutex lock(queue->mutex.get());
+    if (queue->idle && (queue->assigned == NULL) && !queue->shut_down) {
+      queue->assigned = sequence;
+      queue->condvar->Signal();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool QueuedWorkerPool::WakeIdleWorker() {
+  int num_started = num_started_workers_.value();
+  for (int i = 0; i < num_started; ++i) {
+    WorkerQueue* queue = worker_queues_[i];
+    ScopedMutex lock(queue->mutex.get());
+    if (queue->idle && (queue->assigned == NULL) && !queue->woken) {
+      queue->woken = true;
+      queue->condvar->Signal();
+      return true;
+    }
+  }
+  return false;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::PopQueuedSequence(int index) {
+  WorkerQueue* queue = worker_queues_[index];
+  Sequence* sequence = NULL;
+  {
+    ScopedMutex lock(queue->mutex.get());
+    if (!queue->sequences.empty()) {
+      sequence = queue->sequences.front().sequence;
+      queue->sequences.pop_front();
+    }
+  }
+  if (sequence != NULL) {
+    num_queued_sequences_.BarrierIncrement(-1);
+  }
+  return sequence;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::PopAnyQueuedSequence(
+    int index) {
+  Sequence* sequence = PopQueuedSequence(index);
+  if ((sequence == NULL) && (num_queued_sequences_.value() > 0)) {
+    int num_started = num_started_workers_.value();
+    for (int i = 1; (i < num_started) && (sequence == NULL); ++i) {
+      sequence = PopQueuedSequence((index + i) % num_started);
+    }
+  }
+  return sequence;
+}
+
+void QueuedWorkerPool::ShedOldestQueuedSequence() {
+  int num_started = num_started_workers_.value();
+  while (true) {
+    int oldest_index = -1;
+    int32 oldest_ticket = 0;
+    for (int i = 0; i < num_started; ++i) {
+      WorkerQueue* queue = worker_queues_[i];
+      ScopedMutex lock(queue->mutex.get());
+      if (!queue->sequences.empty()) {
+        int32 ticket = queue->sequences.front().ticket;
+        if ((oldest_index == -1) || TicketBefore(ticket, oldest_ticket)) {
+          oldest_index = i;
+          oldest_ticket = ticket;
+        }
+      }
+    }
+    if (oldest_index == -1) {
+      return;  // Others emptied the queues while we looked.
+    }
+
+    Sequence* drop_sequence = NULL;
+    {
+      WorkerQueue* queue = worker_queues_[oldest_index];
+      ScopedMutex lock(queue->mutex.get());
+      if (!queue->sequences.empty() &&
+          (queue->sequences.front().ticket == oldest_ticket)) {
+        drop_sequence = queue->sequences.front().sequence;
+        queue->sequences.pop_front();
+      }
+    }
+    if (drop_sequence != NULL) {
+      num_queued_sequences_.BarrierIncrement(-1);
+      drop_sequence->Cancel();
+      return;
+    }
+    // Someone took it while we weren't looking; try again.
+  }
+}
+
+void QueuedWorkerPool::EnableWorkStealing() {
+  DCHECK(worker_queues_.empty());
+  for (size_t i = 0; i < max_workers_; ++i) {
+    worker_queues_.push_back(new WorkerQueue(thread_system_));
+  }
+}
+
 bool QueuedWorkerPool::AreBusy(const SequenceSet& sequences)
     NO_THREAD_SAFETY_ANALYSIS {
   // This is the only operation that accesses multiple workers at once.
@@ -33,6 +33,7 @@
 #include <vector>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -223,13 +224,38 @@ class QueuedWorkerPool {
   // This must be called prior to creating sequences.
   void set_queue_size_stat(Waveform* x) { queue_size_ = x; }
 
+  // Gives each worker its own queue of runnable sequences, with idle workers
+  // stealing from busy ones, rather than having every Sequence::Add that
+  // makes a sequence runnable and every worker looking for its next sequence
+  // contend on one pool-wide mutex.  Sequence ordering, per-sequence queue
+  // bounds and load-shedding work as before, though with several threads
+  // queueing at once the load-shedding threshold may be briefly exceeded.
+  //
+  // Should be called before starting any work.
+  void EnableWorkStealing();
+
+  size_t max_workers() const { return max_workers_; }
+
  private:
   friend class Sequence;
+  struct WorkerQueue;
+
   void Run(Sequence* sequence, QueuedWorker* worker);
   void QueueSequence(Sequence* sequence);
   Sequence* AssignWorkerToNextSequence(QueuedWorker* worker);
   void SequenceNoLongerActive(Sequence* sequence);
 
+  // Work-stealing counterparts of the above.
+  void RunStealing(Sequence* sequence, int index);
+  void QueueSequenceStealing(Sequence* sequence);
+  Sequence* NextSequenceStealing(int index);
+  void PushQueuedSequence(Sequence* sequence, int index);
+  bool HandOffToIdleWorker(Sequence* sequence);
+  bool WakeIdleWorker();
+  Sequence* PopQueuedSequence(int index);
+  Sequence* PopAnyQueuedSequence(int index);
+  void ShedOldestQueuedSequence();
+
   ThreadSystem* thread_system_;
   scoped_ptr<AbstractMutex> mutex_;
 
@@ -251,6 +277,18 @@ class QueuedWorkerPool {
   Waveform* queue_size_;
   int load_shedding_threshold_;
 
+  // Used only with work stealing, in which case workers are kept here rather
+  // than in active_workers_/available_workers_, and sequences are queued in
+  // worker_queues_[i] for workers 0..num_started_workers_-1 rather than in
+  // queued_sequences_.
+  std::vector<WorkerQueue*> worker_queues_;
+  std::vector<QueuedWorker*> stealing_workers_;  // Guarded by mutex_.
+  AtomicInt32 num_started_workers_;
+  AtomicInt32 num_idle_workers_;
+  AtomicInt32 num_queued_sequences_;
+  AtomicInt32 next_queue_;  // Round-robin choice of queue.
+  AtomicInt32 next_ticket_;  // Age of queued sequences, for load-shedding.
+
   DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPool);
 };
 
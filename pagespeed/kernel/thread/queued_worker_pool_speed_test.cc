@@ -0,0 +1,183 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+//
+// Measures QueuedWorkerPool throughput with the shared run queue and with
+// work stealing.  A few producer threads each keep a handful of sequences
+// busy with tiny functions, so almost every Sequence::Add makes a sequence
+// runnable and every worker keeps coming back for the next one, which is the
+// traffic that contends on the pool mutex.  The range argument is the number
+// of workers.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_int32.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace {
+
+const int kNumProducers = 4;
+const int kSequencesPerProducer = 8;
+const int kFunctionsPerProducer = 20000;
+
+// Counts down the functions still to run, waking the benchmark when all
+// have.
+class Completion {
+ public:
+  Completion(net_instaweb::ThreadSystem* thread_system, int count)
+      : mutex_(thread_system->NewMutex()),
+        condvar_(mutex_->NewCondvar()),
+        remaining_(count) {
+  }
+
+  void Done() {
+    if (remaining_.BarrierIncrement(-1) == 0) {
+      net_instaweb::ScopedMutex lock(mutex_.get());
+      condvar_->Signal();
+    }
+  }
+
+  void Wait() {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    while (remaining_.value() != 0) {
+      condvar_->Wait();
+    }
+  }
+
+ private:
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem::CondvarCapableMutex>
+      mutex_;
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem::Condvar> condvar_;
+  net_instaweb::AtomicInt32 remaining_;
+
+  DISALLOW_COPY_AND_ASSIGN(Completion);
+};
+
+class CompleteFunction : public net_instaweb::Function {
+ public:
+  explicit CompleteFunction(Completion* completion)
+      : completion_(completion) {
+  }
+
+ protected:
+  virtual void Run() { completion_->Done(); }
+  virtual void Cancel() { LOG(FATAL) << "Unexpected cancel"; }
+
+ private:
+  Completion* completion_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompleteFunction);
+};
+
+class Producer : public net_instaweb::ThreadSystem::Thread {
+ public:
+  Producer(net_instaweb::ThreadSystem* thread_system,
+           net_instaweb::QueuedWorkerPool* pool, Completion* completion)
+      : Thread(thread_system, "producer",
+               net_instaweb::ThreadSystem::kJoinable),
+        pool_(pool),
+        completion_(completion) {
+    for (int s = 0; s < kSequencesPerProducer; ++s) {
+      sequences_.push_back(pool_->NewSequence());
+    }
+  }
+
+  virtual ~Producer() {
+    for (int s = 0; s < kSequencesPerProducer; ++s) {
+      pool_->FreeSequence(sequences_[s]);
+    }
+  }
+
+ protected:
+  virtual void Run() {
+    for (int i = 0; i < kFunctionsPerProducer; ++i) {
+      sequences_[i % kSequencesPerProducer]->Add(
+          new CompleteFunction(completion_));
+    }
+  }
+
+ private:
+  net_instaweb::QueuedWorkerPool* pool_;
+  Completion* completion_;
+  std::vector<net_instaweb::QueuedWorkerPool::Sequence*> sequences_;
+
+  DISALLOW_COPY_AND_ASSIGN(Producer);
+};
+
+void RunPool(int iters, int num_workers, bool work_stealing) {
+  StopBenchmarkTiming();
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::QueuedWorkerPool pool(num_workers, "speed_test",
+                                      thread_system.get());
+  if (work_stealing) {
+    pool.EnableWorkStealing();
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < iters; ++i) {
+    Completion completion(thread_system.get(),
+                          kNumProducers * kFunctionsPerProducer);
+    std::vector<Producer*> producers;
+    for (int p = 0; p < kNumProducers; ++p) {
+      producers.push_back(
+          new Producer(thread_system.get(), &pool, &completion));
+    }
+    for (int p = 0; p < kNumProducers; ++p) {
+      CHECK(producers[p]->Start());
+    }
+    for (int p = 0; p < kNumProducers; ++p) {
+      producers[p]->Join();
+    }
+    completion.Wait();
+    STLDeleteElements(&producers);
+  }
+
+  StopBenchmarkTiming();
+  pool.ShutDown();
+}
+
+static void QueuedWorkerPoolShared(int iters, int num_workers) {
+  RunPool(iters, num_workers, false);
+}
+
+static void QueuedWorkerPoolStealing(int iters, int num_workers) {
+  RunPool(iters, num_workers, true);
+}
+
+}  // namespace
+
+BENCHMARK_RANGE(QueuedWorkerPoolShared, 1, 16);
+BENCHMARK_RANGE(QueuedWorkerPoolStealing, 1, 16);
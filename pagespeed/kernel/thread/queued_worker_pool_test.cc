@@ -21,6 +21,8 @@
 
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 
+#include <vector>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
@@ -31,16 +33,26 @@
 namespace net_instaweb {
 namespace {
 
-class QueuedWorkerPoolTest: public WorkerTestBase {
+// The parameter says whether to use the work-stealing variant of the pool.
+class QueuedWorkerPoolTest : public WorkerTestBase,
+                             public ::testing::WithParamInterface<bool> {
  public:
   QueuedWorkerPoolTest()
-      : worker_(new QueuedWorkerPool(2, "queued_worker_pool_test",
-                                     thread_runtime_.get())) {
+      : worker_(NewPool(2)) {
   }
 
  protected:
   scoped_ptr<QueuedWorkerPool> worker_;
 
+  QueuedWorkerPool* NewPool(int max_workers) {
+    QueuedWorkerPool* pool = new QueuedWorkerPool(
+        max_workers, "queued_worker_pool_test", thread_runtime_.get());
+    if (GetParam()) {
+      pool->EnableWorkStealing();
+    }
+    return pool;
+  }
+
   // Blocks mainline until a sequence completes all outstanding tasks.
   void WaitUntilSequenceCompletes(QueuedWorkerPool::Sequence* sequence) {
     SyncPoint done(thread_runtime_.get());
@@ -81,7 +93,7 @@ class Increment : public Function {
 };
 
 // Tests that all the jobs queued in one sequence should run sequentially.
-TEST_F(QueuedWorkerPoolTest, BasicOperation) {
+TEST_P(QueuedWorkerPoolTest, BasicOperation) {
   const int kBound = 42;
   int count = 0;
   SyncPoint sync(thread_runtime_.get());
@@ -98,7 +110,7 @@ TEST_F(QueuedWorkerPoolTest, BasicOperation) {
 }
 
 // Test ordinary and cancelled AddFunction callback.
-TEST_F(QueuedWorkerPoolTest, AddFunctionTest) {
+TEST_P(QueuedWorkerPoolTest, AddFunctionTest) {
   const int kBound = 5;
   int count1 = 0;
   int count2 = 0;
@@ -126,7 +138,7 @@ TEST_F(QueuedWorkerPoolTest, AddFunctionTest) {
 // Makes sure that even if one sequence is blocked, another can
 // complete, because we have more than one thread at our disposal in
 // this worker.
-TEST_F(QueuedWorkerPoolTest, SlowAndFastSequences) {
+TEST_P(QueuedWorkerPoolTest, SlowAndFastSequences) {
   const int kBound = 42;
   int count = 0;
   SyncPoint sync(thread_runtime_.get());
@@ -175,7 +187,7 @@ class MakeNewSequence : public Function {
   DISALLOW_COPY_AND_ASSIGN(MakeNewSequence);
 };
 
-TEST_F(QueuedWorkerPoolTest, RestartSequenceFromFunction) {
+TEST_P(QueuedWorkerPoolTest, RestartSequenceFromFunction) {
   SyncPoint sync(thread_runtime_.get());
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
   sequence->Add(new MakeNewSequence(&sync, worker_.get(), sequence));
@@ -204,7 +216,7 @@ class LogOpsFunction : public Function {
 
 // Make sure calling add after worker was shut down Cancel()s the function
 // properly.
-TEST_F(QueuedWorkerPoolTest, AddAfterShutDown) {
+TEST_P(QueuedWorkerPoolTest, AddAfterShutDown) {
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
   worker_->ShutDown();
   LogOpsFunction f;
@@ -214,7 +226,7 @@ TEST_F(QueuedWorkerPoolTest, AddAfterShutDown) {
   EXPECT_FALSE(f.run_called());
 }
 
-TEST_F(QueuedWorkerPoolTest, LoadShedding) {
+TEST_P(QueuedWorkerPoolTest, LoadShedding) {
   const int kThresh = 100;
   worker_->SetLoadSheddingThreshold(kThresh);
   // Tests that load shedding works, and does so in FIFO order.
@@ -248,6 +260,13 @@ TEST_F(QueuedWorkerPoolTest, LoadShedding) {
   wedge2_sync.Notify();
   done_sync.Wait();
 
+  // With work stealing, sequences queued on different workers needn't start
+  // in the order they were queued, so wait for the survivors individually.
+  // Doing this one at a time never queues enough to shed any more.
+  for (int i = kThresh + 1; i < 2 * kThresh; ++i) {
+    WaitUntilSequenceCompletes(log_ops[i]);
+  }
+
   // We want to shutdown here since even though done_sync signaled, there
   // may still be a log op running in the 2nd thread. This will wait for it.
   worker_->ShutDown();
@@ -294,7 +313,7 @@ class NotifyAndWait : public Function {
   WorkerTestBase::SyncPoint* wait_;
 };
 
-TEST_F(QueuedWorkerPoolTest, MaxQueueSize) {
+TEST_P(QueuedWorkerPoolTest, MaxQueueSize) {
   SyncPoint started(thread_runtime_.get());
   SyncPoint wait(thread_runtime_.get());
   SyncPoint done(thread_runtime_.get());
@@ -314,7 +333,7 @@ TEST_F(QueuedWorkerPoolTest, MaxQueueSize) {
   EXPECT_EQ(-97, count);
 }
 
-TEST_F(QueuedWorkerPoolTest, CancelPending) {
+TEST_P(QueuedWorkerPoolTest, CancelPending) {
   SyncPoint wait(thread_runtime_.get());
   SyncPoint done(thread_runtime_.get());
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
@@ -330,6 +349,36 @@ TEST_F(QueuedWorkerPoolTest, CancelPending) {
   EXPECT_EQ(-300, count);
 }
 
+// Feeds many sequences through a larger pool at once, so that workers keep
+// running out of work and stealing, and checks that each sequence still runs
+// its functions in order.
+TEST_P(QueuedWorkerPoolTest, ManySequencesStayOrdered) {
+  const int kNumSequences = 16;
+  const int kNumFunctions = 200;
+  scoped_ptr<QueuedWorkerPool> pool(NewPool(4));
+  std::vector<QueuedWorkerPool::Sequence*> sequences;
+  std::vector<int> counts(kNumSequences, 0);
+  for (int s = 0; s < kNumSequences; ++s) {
+    sequences.push_back(pool->NewSequence());
+  }
+  for (int i = 0; i < kNumFunctions; ++i) {
+    for (int s = 0; s < kNumSequences; ++s) {
+      sequences[s]->Add(new Increment(i + 1, &counts[s]));
+    }
+  }
+
+  for (int s = 0; s < kNumSequences; ++s) {
+    SyncPoint done(thread_runtime_.get());
+    sequences[s]->Add(new NotifyRunFunction(&done));
+    done.Wait();
+    EXPECT_EQ(kNumFunctions, counts[s]);
+    pool->FreeSequence(sequences[s]);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(QueuedWorkerPoolTestInstance, QueuedWorkerPoolTest,
+                        ::testing::Bool());
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <set>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -38,6 +39,7 @@ namespace net_instaweb {
 namespace {
 
 const int kIndexNotSet = 0;
+const int kNotInWheel = -1;
 
 }  // namespace
 
@@ -78,11 +80,15 @@ class Scheduler::Alarm {
  protected:
   Alarm() : wakeup_time_us_(0),
             index_(kIndexNotSet),
-            in_wait_dispatch_(false) { }
+            in_wait_dispatch_(false),
+            wheel_slot_(kNotInWheel),
+            prev_(NULL),
+            next_(NULL) { }
   virtual ~Alarm() { }
 
  private:
   friend class Scheduler;
+  friend class Scheduler::AlarmWheel;
   int64 wakeup_time_us_;
   uint32 index_;  // Set by scheduler to disambiguate equal wakeup times.
 
@@ -90,6 +96,13 @@ class Scheduler::Alarm {
   // as owned by it for purposes of cleanup, so any concurrent timeout will
   // know not to delete it.
   bool in_wait_dispatch_;
+
+  // Position in the AlarmWheel, if this alarm is queued in one: the slot
+  // number (level * kSlotsPerLevel + slot) and the neighbours in the slot's
+  // doubly-linked list.
+  int wheel_slot_;
+  Alarm* prev_;
+  Alarm* next_;
   DISALLOW_COPY_AND_ASSIGN(Alarm);
 };
 
@@ -203,12 +216,270 @@ bool Scheduler::CompareAlarms::operator()(const Alarm* a,
   return a->Compare(b) < 0;
 }
 
+// Priority queue of outstanding alarms, ordered by Alarm::Compare.  All
+// methods are called with the scheduler mutex held.
+class Scheduler::AlarmQueue {
+ public:
+  AlarmQueue() { }
+  virtual ~AlarmQueue() { }
+
+  virtual void Insert(Alarm* alarm) = 0;
+
+  // Removes alarm, returning false if it was not in the queue.
+  virtual bool Erase(Alarm* alarm) = 0;
+
+  // Returns the earliest alarm, or NULL if the queue is empty.
+  virtual Alarm* First() = 0;
+
+  // Informs the queue that time has advanced to now_us, so that it can
+  // reorganize itself around the current time.
+  virtual void AdvanceTo(int64 now_us) { }
+
+  virtual bool Empty() const = 0;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AlarmQueue);
+};
+
+// The original AlarmQueue: a balanced tree, with O(log n) insertion and
+// cancellation, each of which also allocates or frees a tree node.
+class Scheduler::AlarmSetQueue : public Scheduler::AlarmQueue {
+ public:
+  AlarmSetQueue() { }
+  virtual ~AlarmSetQueue() { }
+
+  virtual void Insert(Alarm* alarm) { alarms_.insert(alarm); }
+  virtual bool Erase(Alarm* alarm) { return alarms_.erase(alarm) != 0; }
+  virtual Alarm* First() {
+    return alarms_.empty() ? NULL : *alarms_.begin();
+  }
+  virtual bool Empty() const { return alarms_.empty(); }
+
+ private:
+  AlarmSet alarms_;
+  DISALLOW_COPY_AND_ASSIGN(AlarmSetQueue);
+};
+
+// A hierarchical timing wheel.  Time is divided into millisecond ticks, and
+// level L of the wheel has kSlotsPerLevel slots each spanning
+// kSlotsPerLevel^L ticks.  An alarm lives on the lowest level on which its
+// tick and base_tick_ differ, in the slot given by its tick's digit on that
+// level; slots are intrusive lists, so insertion and cancellation take
+// constant time and never allocate.  As base_tick_ catches up with a
+// higher-level slot, the slot's alarms are cascaded to lower levels, so each
+// alarm moves at most kNumLevels times during its lifetime.
+//
+// Alarms sharing a level-0 slot are due in the same millisecond, but must
+// still run in Compare order, so level-0 lists are kept sorted; insertion
+// searches backwards from the tail, which is constant time when alarms are
+// added in deadline order.  Higher-level slots are unsorted, and cache their
+// earliest alarm so First() needn't walk them.
+class Scheduler::AlarmWheel : public Scheduler::AlarmQueue {
+ public:
+  AlarmWheel() : base_tick_(0), size_(0) {
+    for (int level = 0; level < kNumLevels; ++level) {
+      occupied_[level] = 0;
+      for (int slot = 0; slot < kSlotsPerLevel; ++slot) {
+        Slot* s = &slots_[level][slot];
+        s->head = s->tail = s->earliest = NULL;
+      }
+    }
+  }
+  virtual ~AlarmWheel() { }
+
+  virtual void Insert(Alarm* alarm) {
+    Link(alarm);
+    ++size_;
+  }
+
+  virtual bool Erase(Alarm* alarm) {
+    if (alarm->wheel_slot_ == kNotInWheel) {
+      return false;
+    }
+    Unlink(alarm);
+    --size_;
+    return true;
+  }
+
+  virtual Alarm* First() {
+    int level, slot;
+    if (!FindFirstSlot(&level, &slot)) {
+      return NULL;
+    }
+    Slot* s = &slots_[level][slot];
+    if (level == 0) {
+      return s->head;
+    }
+    if (s->earliest == NULL) {
+      s->earliest = s->head;
+      for (Alarm* a = s->head->next_; a != NULL; a = a->next_) {
+        if (a->Compare(s->earliest) < 0) {
+          s->earliest = a;
+        }
+      }
+    }
+    return s->earliest;
+  }
+
+  virtual void AdvanceTo(int64 now_us) {
+    int64 now_tick = TickForUs(now_us);
+    while (base_tick_ < now_tick) {
+      int level, slot;
+      if (!FindFirstSlot(&level, &slot)) {
+        base_tick_ = now_tick;
+        break;
+      }
+      // The first occupied slot begins at base_tick_ with this level's digit
+      // replaced by slot and the digits below it cleared.
+      int shift = level * kLevelBits;
+      int64 slot_start_tick =
+          ((((base_tick_ >> shift) >> kLevelBits) << kLevelBits) | slot)
+          << shift;
+      if (slot_start_tick > now_tick) {
+        // No alarm is due before now_tick, so every alarm stays put.
+        base_tick_ = now_tick;
+        break;
+      }
+      base_tick_ = slot_start_tick;
+      if (level == 0) {
+        // The alarms at base_tick_ are due.
+        break;
+      }
+      Cascade(level, slot);
+    }
+  }
+
+  virtual bool Empty() const { return size_ == 0; }
+
+ private:
+  static const int kLevelBits = 6;
+  static const int kSlotsPerLevel = 1 << kLevelBits;
+  static const int kSlotMask = kSlotsPerLevel - 1;
+  // Enough levels to cover any non-negative int64 tick.
+  static const int kNumLevels = (63 + kLevelBits - 1) / kLevelBits;
+
+  struct Slot {
+    Alarm* head;
+    Alarm* tail;
+    Alarm* earliest;  // Cached First() for slots above level 0, or NULL.
+  };
+
+  static int64 TickForUs(int64 time_us) {
+    return (time_us > 0) ? (time_us / Timer::kMsUs) : 0;
+  }
+
+  // Links alarm into the slot for its tick.  Alarms whose tick has already
+  // passed go into the slot for base_tick_, ahead of any that are not due.
+  void Link(Alarm* alarm) {
+    int64 tick = std::max(TickForUs(alarm->wakeup_time_us_), base_tick_);
+    uint64 differing_bits = static_cast<uint64>(tick ^ base_tick_);
+    int level = 0;
+    if (differing_bits != 0) {
+      level = (63 - __builtin_clzll(differing_bits)) / kLevelBits;
+    }
+    int slot = (tick >> (level * kLevelBits)) & kSlotMask;
+    Slot* s = &slots_[level][slot];
+    alarm->wheel_slot_ = level * kSlotsPerLevel + slot;
+    Alarm* prev = s->tail;
+    if (level == 0) {
+      while ((prev != NULL) && (alarm->Compare(prev) < 0)) {
+        prev = prev->prev_;
+      }
+    } else if (s->head == NULL) {
+      s->earliest = alarm;
+    } else if ((s->earliest != NULL) && (alarm->Compare(s->earliest) < 0)) {
+      s->earliest = alarm;
+    }
+    alarm->prev_ = prev;
+    if (prev == NULL) {
+      alarm->next_ = s->head;
+      s->head = alarm;
+    } else {
+      alarm->next_ = prev->next_;
+      prev->next_ = alarm;
+    }
+    if (alarm->next_ == NULL) {
+      s->tail = alarm;
+    } else {
+      alarm->next_->prev_ = alarm;
+    }
+    occupied_[level] |= static_cast<uint64>(1) << slot;
+  }
+
+  void Unlink(Alarm* alarm) {
+    int level = alarm->wheel_slot_ / kSlotsPerLevel;
+    int slot = alarm->wheel_slot_ % kSlotsPerLevel;
+    Slot* s = &slots_[level][slot];
+    if (alarm->prev_ == NULL) {
+      s->head = alarm->next_;
+    } else {
+      alarm->prev_->next_ = alarm->next_;
+    }
+    if (alarm->next_ == NULL) {
+      s->tail = alarm->prev_;
+    } else {
+      alarm->next_->prev_ = alarm->prev_;
+    }
+    if (s->earliest == alarm) {
+      s->earliest = NULL;
+    }
+    if (s->head == NULL) {
+      occupied_[level] &= ~(static_cast<uint64>(1) << slot);
+    }
+    alarm->wheel_slot_ = kNotInWheel;
+    alarm->prev_ = alarm->next_ = NULL;
+  }
+
+  // Finds the occupied slot holding the earliest alarm, returning false if
+  // the wheel is empty.  Every occupied slot on a level is at or after
+  // base_tick_'s digit on that level, and every alarm on a level precedes
+  // those on the levels above it.
+  bool FindFirstSlot(int* level, int* slot) const {
+    for (int l = 0; l < kNumLevels; ++l) {
+      int base_slot = (base_tick_ >> (l * kLevelBits)) & kSlotMask;
+      uint64 candidates = (occupied_[l] >> base_slot) << base_slot;
+      if (candidates != 0) {
+        *level = l;
+        *slot = __builtin_ctzll(candidates);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Redistributes the alarms in a slot whose span base_tick_ has reached
+  // onto the levels below.  They are relinked in Compare order so that the
+  // sorted insertion into level-0 lists stays cheap.
+  void Cascade(int level, int slot) {
+    Slot* s = &slots_[level][slot];
+    cascading_.clear();
+    for (Alarm* a = s->head; a != NULL; a = a->next_) {
+      cascading_.push_back(a);
+    }
+    s->head = s->tail = s->earliest = NULL;
+    occupied_[level] &= ~(static_cast<uint64>(1) << slot);
+    std::sort(cascading_.begin(), cascading_.end(), CompareAlarms());
+    for (int i = 0, n = cascading_.size(); i < n; ++i) {
+      Link(cascading_[i]);
+    }
+  }
+
+  Slot slots_[kNumLevels][kSlotsPerLevel];
+  uint64 occupied_[kNumLevels];  // Bitmap of non-empty slots on each level.
+  int64 base_tick_;  // No alarm is queued for an earlier tick.
+  int64 size_;
+  std::vector<Alarm*> cascading_;  // Scratch space for Cascade.
+  DISALLOW_COPY_AND_ASSIGN(AlarmWheel);
+};
+
 Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
     : thread_system_(thread_system),
       timer_(timer),
       mutex_(thread_system->NewMutex()),
       condvar_(mutex_->NewCondvar()),
       index_(kIndexNotSet),
+      use_timer_wheel_(true),
+      outstanding_alarms_(new AlarmWheel),
       signal_count_(0),
       running_waiting_alarms_(false) {
 }
@@ -216,15 +487,27 @@ Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
 Scheduler::~Scheduler() {
 #if SCHEDULER_CANCEL_OUTSTANDING_ALARMS_ON_DESTRUCTION
   ScopedMutex lock(mutex_.get());
-  while (!outstanding_alarms_.empty()) {
-    AlarmSet::iterator p = outstanding_alarms_.begin();
-    Alarm* alarm = *p;
-    outstanding_alarms_.erase(p);
+  while (!outstanding_alarms_->Empty()) {
+    Alarm* alarm = outstanding_alarms_->First();
+    outstanding_alarms_->Erase(alarm);
     alarm->CancelAlarm();
   }
 #endif
 }
 
+void Scheduler::set_use_timer_wheel(bool x) {
+  ScopedMutex lock(mutex_.get());
+  DCHECK(outstanding_alarms_->Empty());
+  if (x != use_timer_wheel_) {
+    use_timer_wheel_ = x;
+    if (x) {
+      outstanding_alarms_.reset(new AlarmWheel);
+    } else {
+      outstanding_alarms_.reset(new AlarmSetQueue);
+    }
+  }
+}
+
 void Scheduler::BlockingTimedWaitUs(int64 timeout_us) {
   mutex_->DCheckLocked();
   int64 now_us = timer_->NowUs();
@@ -314,14 +597,15 @@ void Scheduler::InsertAlarmAtUsMutexHeld(int64 wakeup_time_us,
   alarm->index_ = ++index_;
 
   if (broadcast_on_wakeup_change) {
-    bool wakeup_time_changed = outstanding_alarms_.empty() ||
-        (wakeup_time_us < (*outstanding_alarms_.begin())->wakeup_time_us_);
+    Alarm* first_alarm = outstanding_alarms_->First();
+    bool wakeup_time_changed = (first_alarm == NULL) ||
+        (wakeup_time_us < first_alarm->wakeup_time_us_);
     if (wakeup_time_changed) {
       condvar_->Broadcast();
     }
   }
 
-  outstanding_alarms_.insert(alarm);
+  outstanding_alarms_->Insert(alarm);
 }
 
 Scheduler::Alarm* Scheduler::AddAlarmAtUs(int64 wakeup_time_us,
@@ -342,7 +626,7 @@ Scheduler::Alarm* Scheduler::AddAlarmAtUsMutexHeld(int64 wakeup_time_us,
 
 bool Scheduler::CancelAlarm(Alarm* alarm) {
   mutex_->DCheckLocked();
-  if (outstanding_alarms_.erase(alarm) != 0) {
+  if (outstanding_alarms_->Erase(alarm)) {
     // Note: the following call may drop and re-lock the scheduler mutex.
     alarm->CancelAlarm();
     return true;
@@ -352,20 +636,21 @@ bool Scheduler::CancelAlarm(Alarm* alarm) {
 }
 
 int64 Scheduler::RunAlarms(bool* ran_alarms) {
-  while (!outstanding_alarms_.empty()) {
+  while (!outstanding_alarms_->Empty()) {
     mutex_->DCheckLocked();
-    // We don't use the iterator to go through the set, because we're dropping
-    // the lock in mid-loop thus permitting new insertions and cancellations.
-    AlarmSet::iterator first_alarm_iterator = outstanding_alarms_.begin();
-    Alarm* first_alarm = *first_alarm_iterator;
+    // We look up the first alarm afresh each time around, because we're
+    // dropping the lock in mid-loop thus permitting new insertions and
+    // cancellations.
     int64 now_us = timer_->NowUs();
+    outstanding_alarms_->AdvanceTo(now_us);
+    Alarm* first_alarm = outstanding_alarms_->First();
     if (now_us < first_alarm->wakeup_time_us_) {
       // The next deadline lies in the future.
       return first_alarm->wakeup_time_us_;
     }
     // first_alarm should be run.  It can't have been cancelled as we've held
     // the lock since we found it.
-    outstanding_alarms_.erase(first_alarm_iterator);  // Prevent cancellation.
+    outstanding_alarms_->Erase(first_alarm);  // Prevent cancellation.
     if (ran_alarms != NULL) {
       *ran_alarms = true;
     }
@@ -403,13 +688,13 @@ bool Scheduler::ProcessAlarmsOrWaitUs(int64 timeout_us) {
 
     next_wakeup_us = RunAlarms(NULL);
   }
-  return !outstanding_alarms_.empty();
+  return !outstanding_alarms_->Empty();
 }
 
 // For testing purposes, let a tester know when the scheduler has quiesced.
 bool Scheduler::NoPendingAlarms() {
   mutex_->DCheckLocked();
-  return (outstanding_alarms_.empty());
+  return outstanding_alarms_->Empty();
 }
 
 SchedulerBlockingFunction::SchedulerBlockingFunction(Scheduler* scheduler)
@@ -46,6 +46,11 @@ namespace net_instaweb {
 // occur.  Finally, implements a hybrid between these: a callback that can be
 // run when the condition variable is signaled.
 //
+// Outstanding alarms are kept in a hierarchical timing wheel with millisecond
+// slots, so that adding and cancelling an alarm takes constant time no matter
+// how many alarms are pending.  set_use_timer_wheel(false) switches back to a
+// balanced tree, which is mostly of interest for benchmarking.
+//
 // This class is designed to be overridden, but only to re-implement its
 // internal notion of blocking to permit time to be mocked by MockScheduler.
 class Scheduler {
@@ -72,6 +77,12 @@ class Scheduler {
     return mutex_.get();
   }
 
+  // Selects the data structure holding outstanding alarms: a timing wheel
+  // (the default) or an ordered set.  Alarms run in the same order either
+  // way.  Must be called before any alarms are added.
+  void set_use_timer_wheel(bool x);
+  bool use_timer_wheel() const { return use_timer_wheel_; }
+
   // Optionally check that mutex is locked for debugging purposes.
   void DCheckLocked() EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
     mutex_->DCheckLocked();
@@ -193,6 +204,9 @@ class Scheduler {
  private:
   class CondVarTimeout;
   class CondVarCallbackTimeout;
+  class AlarmQueue;
+  class AlarmSetQueue;
+  class AlarmWheel;
   friend class SchedulerTest;
 
   typedef std::set<Alarm*, CompareAlarms> AlarmSet;
@@ -212,7 +226,9 @@ class Scheduler {
   // signal_count_ increasing) events occur.
   scoped_ptr<ThreadSystem::Condvar> condvar_;
   uint32 index_;  // Used to disambiguate alarms with equal deadlines
-  AlarmSet outstanding_alarms_;  // Priority queue of future alarms
+  bool use_timer_wheel_;
+  // Priority queue of future alarms.
+  scoped_ptr<AlarmQueue> outstanding_alarms_;
   // An alarm may be deleted iff it is successfully removed from
   // outstanding_alarms_.
   int64 signal_count_;           // Number of times Signal has been called
@@ -0,0 +1,127 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+//
+// Measures Scheduler alarm churn with the timer wheel and with the ordered
+// set of alarms.  The scheduler holds a steady population of outstanding
+// alarms, like the fetch and rewrite deadlines of a busy server; each
+// iteration cancels the oldest one and adds a replacement due up to ten
+// seconds out, and every so often the clock ticks forward a millisecond and
+// any alarms that came due are run.  The range argument is the number of
+// outstanding alarms, in thousands.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/mock_timer.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/thread/scheduler.h"
+#include "pagespeed/kernel/util/platform.h"
+
+namespace {
+
+const int64 kMaxDelayUs = 10 * net_instaweb::Timer::kSecondUs;
+const int kChurnsPerTick = 16;
+
+// Alarm callback that forgets its alarm once it has run, so that it is not
+// cancelled later.
+class ForgetAlarmFunction : public net_instaweb::Function {
+ public:
+  explicit ForgetAlarmFunction(net_instaweb::Scheduler::Alarm** alarm)
+      : alarm_(alarm) {
+  }
+
+ protected:
+  virtual void Run() { *alarm_ = NULL; }
+  virtual void Cancel() { }
+
+ private:
+  net_instaweb::Scheduler::Alarm** alarm_;
+
+  DISALLOW_COPY_AND_ASSIGN(ForgetAlarmFunction);
+};
+
+void ChurnAlarms(int iters, int thousands_of_alarms, bool timer_wheel) {
+  StopBenchmarkTiming();
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::MockTimer timer(thread_system->NewMutex(),
+                                net_instaweb::MockTimer::kApr_5_2010_ms);
+  net_instaweb::Scheduler scheduler(thread_system.get(), &timer);
+  scheduler.set_use_timer_wheel(timer_wheel);
+  net_instaweb::ScopedMutex lock(scheduler.mutex());
+
+  uint32 seed = 1;
+  std::vector<net_instaweb::Scheduler::Alarm*> alarms(
+      thousands_of_alarms * 1000);
+  for (int i = 0, n = alarms.size(); i < n; ++i) {
+    seed = seed * 1103515245 + 12345;
+    alarms[i] = scheduler.AddAlarmAtUsMutexHeld(
+        timer.NowUs() + (seed >> 8) % kMaxDelayUs,
+        new ForgetAlarmFunction(&alarms[i]));
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0, next = 0; i < iters; ++i) {
+    if (alarms[next] != NULL) {
+      scheduler.CancelAlarm(alarms[next]);
+    }
+    seed = seed * 1103515245 + 12345;
+    alarms[next] = scheduler.AddAlarmAtUsMutexHeld(
+        timer.NowUs() + (seed >> 8) % kMaxDelayUs,
+        new ForgetAlarmFunction(&alarms[next]));
+    if (++next == static_cast<int>(alarms.size())) {
+      next = 0;
+    }
+    if (i % kChurnsPerTick == 0) {
+      timer.AdvanceMs(1);
+      scheduler.RunAlarms(NULL);
+    }
+  }
+
+  StopBenchmarkTiming();
+  for (int i = 0, n = alarms.size(); i < n; ++i) {
+    if (alarms[i] != NULL) {
+      scheduler.CancelAlarm(alarms[i]);
+    }
+  }
+}
+
+static void SchedulerAlarmChurnSet(int iters, int thousands_of_alarms) {
+  ChurnAlarms(iters, thousands_of_alarms, false);
+}
+
+static void SchedulerAlarmChurnWheel(int iters, int thousands_of_alarms) {
+  ChurnAlarms(iters, thousands_of_alarms, true);
+}
+
+}  // namespace
+
+BENCHMARK_RANGE(SchedulerAlarmChurnSet, 1, 64);
+BENCHMARK_RANGE(SchedulerAlarmChurnWheel, 1, 64);
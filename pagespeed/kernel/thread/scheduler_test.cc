@@ -20,10 +20,14 @@
 
 #include "pagespeed/kernel/thread/scheduler.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/mock_timer.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -33,13 +37,17 @@ namespace net_instaweb {
 
 // Many tests cribbed from mock_timer_test, only without the mockery.  This
 // actually restricts the timing dependencies we can detect, though not in a
-// terrible way.
-class SchedulerTest : public WorkerTestBase {
+// terrible way.  Each test is run against both the timer wheel and the
+// ordered set of alarms.
+class SchedulerTest : public WorkerTestBase,
+                      public ::testing::WithParamInterface<bool> {
  protected:
   SchedulerTest()
       : thread_system_(Platform::CreateThreadSystem()),
         timer_(thread_system_->NewTimer()),
-        scheduler_(thread_system_.get(), timer_.get()) { }
+        scheduler_(thread_system_.get(), timer_.get()) {
+    scheduler_.set_use_timer_wheel(GetParam());
+  }
 
   int Compare(const Scheduler::Alarm* a, const Scheduler::Alarm* b) const {
     Scheduler::CompareAlarms comparator;
@@ -74,7 +82,7 @@ namespace {
 const int64 kDsUs = Timer::kSecondUs / 10;
 const int64 kYearUs = Timer::kYearMs * Timer::kMsUs;
 
-TEST_F(SchedulerTest, AlarmsGetRun) {
+TEST_P(SchedulerTest, AlarmsGetRun) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   // Note that we give this test extra time (50ms) to start up so that
@@ -116,7 +124,7 @@ TEST_F(SchedulerTest, AlarmsGetRun) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, MidpointBlock) {
+TEST_P(SchedulerTest, MidpointBlock) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 2 * Timer::kMsUs,
@@ -141,7 +149,7 @@ TEST_F(SchedulerTest, MidpointBlock) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, AlarmInPastRuns) {
+TEST_P(SchedulerTest, AlarmInPastRuns) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us - 2 * Timer::kMsUs,
@@ -160,7 +168,7 @@ TEST_F(SchedulerTest, AlarmInPastRuns) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, MidpointCancellation) {
+TEST_P(SchedulerTest, MidpointCancellation) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 3 * Timer::kMsUs,
@@ -191,7 +199,7 @@ TEST_F(SchedulerTest, MidpointCancellation) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, SimultaneousAlarms) {
+TEST_P(SchedulerTest, SimultaneousAlarms) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 2 * Timer::kMsUs,
@@ -209,7 +217,7 @@ TEST_F(SchedulerTest, SimultaneousAlarms) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitExpire) {
+TEST_P(SchedulerTest, TimedWaitExpire) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -227,7 +235,7 @@ TEST_F(SchedulerTest, TimedWaitExpire) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitSignal) {
+TEST_P(SchedulerTest, TimedWaitSignal) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -244,7 +252,7 @@ TEST_F(SchedulerTest, TimedWaitSignal) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitMidpointSignal) {
+TEST_P(SchedulerTest, TimedWaitMidpointSignal) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -295,7 +303,7 @@ class RetryWaitFunction : public Function {
   DISALLOW_COPY_AND_ASSIGN(RetryWaitFunction);
 };
 
-TEST_F(SchedulerTest, TimedWaitFromSignalWakeup) {
+TEST_P(SchedulerTest, TimedWaitFromSignalWakeup) {
   int counter = 0;
   int64 start_ms = timer_->NowMs();
   {
@@ -309,6 +317,99 @@ TEST_F(SchedulerTest, TimedWaitFromSignalWakeup) {
   EXPECT_GE(2, counter);
 }
 
+// Function that records the order in which alarms run.
+class RecordFunction : public Function {
+ public:
+  RecordFunction(int id, std::vector<int>* record)
+      : id_(id), record_(record) { }
+  virtual ~RecordFunction() { }
+  virtual void Run() { record_->push_back(id_); }
+  virtual void Cancel() { record_->push_back(-1 - id_); }
+
+ private:
+  int id_;
+  std::vector<int>* record_;
+  DISALLOW_COPY_AND_ASSIGN(RecordFunction);
+};
+
+// Alarms spread from microseconds to years ahead, with several sharing a
+// deadline or a millisecond, must run in deadline order, ties in the order
+// they were added, each no earlier than its deadline.  Uses a mock timer and
+// drives RunAlarms directly so that deadlines are exact.
+TEST_P(SchedulerTest, ManyAlarmsRunInOrder) {
+  MockTimer mock_timer(thread_system_->NewMutex(), 0);
+  mock_timer.SetTimeUs(1234567891011LL);
+  Scheduler scheduler(thread_system_.get(), &mock_timer);
+  scheduler.set_use_timer_wheel(GetParam());
+  const int64 start_us = mock_timer.NowUs();
+  ScopedMutex lock(scheduler.mutex());
+
+  // Run an alarm first, so that the scheduler has caught up with the time.
+  int counter = 0;
+  scheduler.AddAlarmAtUsMutexHeld(start_us, new CountFunction(&counter));
+  EXPECT_EQ(0, scheduler.RunAlarms(NULL));
+  EXPECT_EQ(1, counter);
+
+  // Deadlines and the order in which alarms must run, computed by a simple
+  // insertion sort.
+  std::vector<int64> deadlines;
+  std::vector<int> expected;
+  std::vector<Scheduler::Alarm*> alarms;
+  std::vector<int> record;
+  uint64 seed = 1;
+  for (int i = 0; i < 2000; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    // Pick a magnitude from 1us to 2^40us (~12 days), then a deadline
+    // within it; every tenth alarm reuses an earlier deadline.
+    int64 deadline_us;
+    if ((i % 10 == 9) && !deadlines.empty()) {
+      deadline_us = deadlines[(seed >> 40) % deadlines.size()];
+    } else {
+      int64 magnitude = static_cast<int64>(1) << ((seed >> 58) % 41);
+      deadline_us = start_us + ((seed >> 16) % magnitude) - magnitude / 64;
+    }
+    deadlines.push_back(deadline_us);
+    alarms.push_back(scheduler.AddAlarmAtUsMutexHeld(
+        deadline_us, new RecordFunction(i, &record)));
+    std::vector<int>::iterator pos = expected.end();
+    while ((pos != expected.begin()) && (deadlines[*(pos - 1)] > deadline_us)) {
+      --pos;
+    }
+    expected.insert(pos, i);
+  }
+
+  // Cancel every seventh alarm, including some that are already due.
+  for (int i = 0; i < 2000; i += 7) {
+    EXPECT_TRUE(scheduler.CancelAlarm(alarms[i]));
+    EXPECT_EQ(-1 - i, record.back());
+    record.pop_back();
+    expected.erase(std::find(expected.begin(), expected.end(), i));
+  }
+
+  // Alarms already due run straight away.  After that, repeatedly jump to
+  // the next deadline RunAlarms reports; exactly the alarms with that
+  // deadline should run.
+  int64 next_us = scheduler.RunAlarms(NULL);
+  for (size_t i = 0; i < record.size(); ++i) {
+    EXPECT_LE(deadlines[record[i]], start_us);
+  }
+  while (next_us != 0) {
+    ASSERT_LT(mock_timer.NowUs(), next_us);
+    mock_timer.SetTimeUs(next_us);
+    size_t num_run = record.size();
+    next_us = scheduler.RunAlarms(NULL);
+    ASSERT_LT(num_run, record.size());
+    for (size_t i = num_run; i < record.size(); ++i) {
+      EXPECT_EQ(mock_timer.NowUs(), deadlines[record[i]]);
+    }
+  }
+  EXPECT_TRUE(expected == record);
+  EXPECT_FALSE(scheduler.ProcessAlarmsOrWaitUs(0));
+}
+
+INSTANTIATE_TEST_CASE_P(SchedulerTestInstance, SchedulerTest,
+                        ::testing::Bool());
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -317,6 +317,17 @@ void GzipInflater::ShutDown() {
 // TODO(jmarantz): make an incremental interface to Deflate.
 bool GzipInflater::Deflate(StringPiece in, InflateType format,
                            int compression_level, Writer *writer) {
+  return DeflateHelper(in, format, StringPiece(), compression_level, writer);
+}
+
+bool GzipInflater::DeflateWithDictionary(StringPiece in, StringPiece dictionary,
+                                         Writer* writer) {
+  return DeflateHelper(in, kDeflate, dictionary, Z_DEFAULT_COMPRESSION, writer);
+}
+
+bool GzipInflater::DeflateHelper(StringPiece in, InflateType format,
+                                 StringPiece dictionary, int compression_level,
+                                 Writer *writer) {
   z_stream strm;
   char out[kStackBufferSize];
 
@@ -339,6 +350,13 @@ bool GzipInflater::Deflate(StringPiece in, InflateType format,
   if (ret != Z_OK) {
     return false;
   }
+  if (!dictionary.empty() &&
+      deflateSetDictionary(
+          &strm, reinterpret_cast<const Bytef*>(dictionary.data()),
+          dictionary.size()) != Z_OK) {
+    deflateEnd(&strm);
+    return false;
+  }
 
   // compress until end of file
   strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
@@ -374,6 +392,16 @@ bool GzipInflater::Deflate(StringPiece in, InflateType format, Writer* writer) {
 // TODO(jmarantz): Consider using the incremental interface to implement
 // Inflate.
 bool GzipInflater::Inflate(StringPiece in, InflateType format, Writer* writer) {
+  return InflateHelper(in, format, StringPiece(), writer);
+}
+
+bool GzipInflater::InflateWithDictionary(StringPiece in, StringPiece dictionary,
+                                         Writer* writer) {
+  return InflateHelper(in, kDeflate, dictionary, writer);
+}
+
+bool GzipInflater::InflateHelper(StringPiece in, InflateType format,
+                                 StringPiece dictionary, Writer* writer) {
   z_stream strm;
   char out[kStackBufferSize];
   const int kOutSize = sizeof(out);
@@ -401,7 +429,17 @@ bool GzipInflater::Inflate(StringPiece in, InflateType format, Writer* writer) {
   do {
     strm.avail_out = kOutSize;
     strm.next_out = reinterpret_cast<Bytef*>(out);
-    switch (inflate(&strm, Z_NO_FLUSH)) {
+    int ret = inflate(&strm, Z_NO_FLUSH);
+    if (ret == Z_NEED_DICT && !dictionary.empty()) {
+      // inflateSetDictionary fails if the dictionary's id does not match
+      // the one recorded in the stream header.
+      if (inflateSetDictionary(
+              &strm, reinterpret_cast<const Bytef*>(dictionary.data()),
+              dictionary.size()) == Z_OK) {
+        ret = inflate(&strm, Z_NO_FLUSH);
+      }
+    }
+    switch (ret) {
       case Z_STREAM_ERROR:
         LOG(DFATAL) << "state should not be not clobbered";
         FALLTHROUGH_INTENDED;
@@ -428,6 +466,27 @@ bool GzipInflater::Inflate(StringPiece in, InflateType format, Writer* writer) {
   return true;
 }
 
+uint32 GzipInflater::DictionaryId(StringPiece dictionary) {
+  return adler32(adler32(0L, Z_NULL, 0),
+                 reinterpret_cast<const Bytef*>(dictionary.data()),
+                 dictionary.size());
+}
+
+bool GzipInflater::GetDictionaryId(StringPiece in, uint32* id) {
+  // A zlib stream header is CMF, FLG, and then, if the FDICT bit of FLG is
+  // set, the big-endian DICTID.  See RFC1950 section 2.2.
+  const uint8 kFdictBit = 0x20;
+  if (in.size() < 6 || !IsValidZlibStreamHeaderByte(in[0]) ||
+      (static_cast<uint8>(in[1]) & kFdictBit) == 0) {
+    return false;
+  }
+  *id = 0;
+  for (int i = 2; i < 6; ++i) {
+    *id = (*id << 8) | static_cast<uint8>(in[i]);
+  }
+  return true;
+}
+
 // All gzip files start with a ten-byte header beginning with 0x1f8b.
 bool GzipInflater::HasGzipMagicBytes(StringPiece in) {
   return in.size() >= 10 &&
@@ -78,6 +78,27 @@ class GzipInflater {
   // if there was some kind of failure, such as a corrupt input.
   static bool Inflate(StringPiece in, InflateType format, Writer* writer);
 
+  // Like Deflate with kDeflate, but primes the compressor with a preset
+  // dictionary (RFC1950 section 2.2), which helps a lot for small inputs
+  // that share structure with the dictionary.  The zlib header records the
+  // dictionary's id; see GetDictionaryId.
+  static bool DeflateWithDictionary(StringPiece in, StringPiece dictionary,
+                                    Writer* writer);
+
+  // Inflates a zlib stream produced by DeflateWithDictionary.  Returns false
+  // if dictionary is not the one the stream was compressed with.  Streams
+  // that don't need a dictionary are inflated normally.
+  static bool InflateWithDictionary(StringPiece in, StringPiece dictionary,
+                                    Writer* writer);
+
+  // Returns the id zlib uses to identify a preset dictionary (its Adler-32
+  // checksum).
+  static uint32 DictionaryId(StringPiece dictionary);
+
+  // If in starts with a zlib stream header that calls for a preset
+  // dictionary, sets *id to that dictionary's id and returns true.
+  static bool GetDictionaryId(StringPiece in, uint32* id);
+
   // Checks whether in starts with the gzip file signature.
   static bool HasGzipMagicBytes(StringPiece in);
 
@@ -92,6 +113,11 @@ class GzipInflater {
 
   static bool GetWindowBitsForFormat(
       StreamFormat format, int* out_window_bits);
+  static bool DeflateHelper(StringPiece in, InflateType format,
+                            StringPiece dictionary, int compression_level,
+                            Writer* writer);
+  static bool InflateHelper(StringPiece in, InflateType format,
+                            StringPiece dictionary, Writer* writer);
   void Free();
   void SetInputInternal(const void *in, size_t in_size);
   void SwitchToRawDeflateFormat();
@@ -271,6 +271,49 @@ TEST_F(GzipInflaterTest, TestGzipUnGzip) {
   EXPECT_STREQ(payload, inflated);
 }
 
+TEST_F(GzipInflaterTest, DeflateWithDictionary) {
+  const char kDictionary[] = "{\"url\":\"http://example.com/\",\"type\":";
+  const char kPayload[] =
+      "{\"url\":\"http://example.com/a.css\",\"type\":\"text/css\"}";
+  GoogleString plain, with_dictionary, inflated;
+  StringWriter plain_writer(&plain);
+  EXPECT_TRUE(GzipInflater::Deflate(kPayload, GzipInflater::kDeflate,
+                                    &plain_writer));
+  StringWriter dictionary_writer(&with_dictionary);
+  EXPECT_TRUE(GzipInflater::DeflateWithDictionary(kPayload, kDictionary,
+                                                  &dictionary_writer));
+  EXPECT_GT(plain.size(), with_dictionary.size());
+
+  // The stream header identifies the dictionary; a plain stream has none.
+  uint32 id = 0;
+  EXPECT_TRUE(GzipInflater::GetDictionaryId(with_dictionary, &id));
+  EXPECT_EQ(GzipInflater::DictionaryId(kDictionary), id);
+  EXPECT_FALSE(GzipInflater::GetDictionaryId(plain, &id));
+
+  StringWriter inflate_writer(&inflated);
+  EXPECT_TRUE(GzipInflater::InflateWithDictionary(with_dictionary, kDictionary,
+                                                  &inflate_writer));
+  EXPECT_STREQ(kPayload, inflated);
+
+  // Plain streams inflate fine with a dictionary on hand.
+  inflated.clear();
+  EXPECT_TRUE(GzipInflater::InflateWithDictionary(plain, kDictionary,
+                                                  &inflate_writer));
+  EXPECT_STREQ(kPayload, inflated);
+}
+
+TEST_F(GzipInflaterTest, InflateWithWrongDictionary) {
+  GoogleString deflated, inflated;
+  StringWriter deflate_writer(&deflated);
+  EXPECT_TRUE(GzipInflater::DeflateWithDictionary(
+      "hello, world", "hello, dictionary", &deflate_writer));
+  StringWriter inflate_writer(&inflated);
+  EXPECT_FALSE(GzipInflater::InflateWithDictionary(
+      deflated, "goodbye, dictionary", &inflate_writer));
+  EXPECT_FALSE(GzipInflater::Inflate(deflated, GzipInflater::kDeflate,
+                                     &inflate_writer));
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -0,0 +1,793 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include "pagespeed/system/async_redis_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "third_party/hiredis/src/async.h"
+#include "third_party/hiredis/src/hiredis.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// The event loop wakes up at least this often even when it has nothing to
+// wait for, which bounds the cost of any slack in PollTimeoutMs().
+const int kMaxPollMs = Timer::kSecondMs;
+
+const int kRedisDatabaseIndexNotSet = -1;
+
+void SetNonBlockingAndCloseOnExec(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+}  // namespace
+
+// A connection and the operations sent on it whose replies have not arrived
+// yet.  hiredis calls back in the order commands were sent, so in_flight is
+// a queue and its front carries the earliest deadline.
+struct AsyncRedisCache::Connection {
+  explicit Connection(AsyncRedisCache* cache_in)
+      : cache(cache_in),
+        context(nullptr),
+        connected(false),
+        reading(false),
+        writing(false),
+        connect_deadline_ms(0),
+        reconnect_at_ms(0) {}
+
+  // hiredis event-library adapter: records what to poll() the socket for.
+  static void AddRead(void* data) {
+    static_cast<Connection*>(data)->reading = true;
+  }
+  static void DelRead(void* data) {
+    static_cast<Connection*>(data)->reading = false;
+  }
+  static void AddWrite(void* data) {
+    static_cast<Connection*>(data)->writing = true;
+  }
+  static void DelWrite(void* data) {
+    static_cast<Connection*>(data)->writing = false;
+  }
+  static void Cleanup(void* data) {
+    Connection* connection = static_cast<Connection*>(data);
+    connection->reading = false;
+    connection->writing = false;
+  }
+
+  AsyncRedisCache* cache;
+  redisAsyncContext* context;  // nullptr while disconnected.
+  bool connected;              // False while the connection is in progress.
+  bool reading;
+  bool writing;
+  int64 connect_deadline_ms;
+  int64 reconnect_at_ms;
+  std::deque<Operation*> in_flight;
+};
+
+class AsyncRedisCache::Operation {
+ public:
+  explicit Operation(AsyncRedisCache* cache) : cache_(cache), deadline_ms_(0) {}
+  virtual ~Operation() {}
+
+  // Sends the command on context, with ReplyCallback and this as privdata.
+  // Returns false if the command could not be queued.
+  virtual bool Send(redisAsyncContext* context) = 0;
+
+  // Called with the reply, or with nullptr if the operation failed.
+  virtual void Done(const redisReply* reply) = 0;
+
+  // Key which picks the connection to send the operation on.
+  virtual StringPiece ShardKey() const = 0;
+
+  int64 deadline_ms() const { return deadline_ms_; }
+  void set_deadline_ms(int64 x) { deadline_ms_ = x; }
+
+ protected:
+  // Logs an error reply, or a reply of unexpected type, for command.
+  void LogUnexpectedReply(const redisReply* reply, const char* command) {
+    if (reply->type == REDIS_REPLY_ERROR) {
+      cache_->message_handler_->Message(
+          kError, "%s: redis returned error: %s", command,
+          GoogleString(reply->str, reply->len).c_str());
+    } else {
+      cache_->message_handler_->Message(
+          kError, "%s: unexpected reply type from redis: %d", command,
+          reply->type);
+    }
+  }
+
+  AsyncRedisCache* cache_;
+
+ private:
+  int64 deadline_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(Operation);
+};
+
+class AsyncRedisCache::GetOperation : public AsyncRedisCache::Operation {
+ public:
+  GetOperation(AsyncRedisCache* cache, const GoogleString& key,
+               Callback* callback)
+      : Operation(cache), key_(key), callback_(callback) {}
+
+  bool Send(redisAsyncContext* context) override {
+    return redisAsyncCommand(context, &AsyncRedisCache::ReplyCallback, this,
+                             "GET %b", key_.data(), key_.size()) == REDIS_OK;
+  }
+
+  void Done(const redisReply* reply) override {
+    KeyState state = kNotFound;
+    if (reply != nullptr) {
+      if (reply->type == REDIS_REPLY_STRING) {
+        callback_->set_value(SharedString(StringPiece(reply->str, reply->len)));
+        state = kAvailable;
+      } else if (reply->type != REDIS_REPLY_NIL) {
+        LogUnexpectedReply(reply, "GET");
+      }
+    }
+    cache_->ValidateAndReportResult(key_, state, callback_);
+  }
+
+  StringPiece ShardKey() const override { return key_; }
+
+ private:
+  const GoogleString key_;
+  Callback* callback_;
+};
+
+class AsyncRedisCache::MultiGetOperation : public AsyncRedisCache::Operation {
+ public:
+  MultiGetOperation(AsyncRedisCache* cache, MultiGetRequest* request)
+      : Operation(cache), request_(request) {}
+
+  bool Send(redisAsyncContext* context) override {
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    argv.push_back("MGET");
+    argvlen.push_back(4);
+    for (const KeyCallback& key_callback : *request_) {
+      argv.push_back(key_callback.key.data());
+      argvlen.push_back(key_callback.key.size());
+    }
+    return redisAsyncCommandArgv(context, &AsyncRedisCache::ReplyCallback,
+                                 this, argv.size(), argv.data(),
+                                 argvlen.data()) == REDIS_OK;
+  }
+
+  void Done(const redisReply* reply) override {
+    bool valid = false;
+    if (reply != nullptr) {
+      valid = (reply->type == REDIS_REPLY_ARRAY &&
+               reply->elements == request_->size());
+      if (!valid) {
+        LogUnexpectedReply(reply, "MGET");
+      }
+    }
+    for (int i = 0, n = request_->size(); i < n; ++i) {
+      KeyCallback& key_callback = (*request_)[i];
+      KeyState state = kNotFound;
+      if (valid && reply->element[i]->type == REDIS_REPLY_STRING) {
+        const redisReply* value = reply->element[i];
+        key_callback.callback->set_value(
+            SharedString(StringPiece(value->str, value->len)));
+        state = kAvailable;
+      }
+      cache_->ValidateAndReportResult(key_callback.key, state,
+                                      key_callback.callback);
+    }
+  }
+
+  StringPiece ShardKey() const override { return (*request_)[0].key; }
+
+ private:
+  scoped_ptr<MultiGetRequest> request_;
+};
+
+class AsyncRedisCache::PutOperation : public AsyncRedisCache::Operation {
+ public:
+  PutOperation(AsyncRedisCache* cache, const GoogleString& key,
+               const SharedString& value)
+      : Operation(cache), key_(key), value_(value) {}
+
+  bool Send(redisAsyncContext* context) override {
+    return redisAsyncCommand(context, &AsyncRedisCache::ReplyCallback, this,
+                             "SET %b %b", key_.data(), key_.size(),
+                             value_.data(),
+                             static_cast<size_t>(value_.size())) == REDIS_OK;
+  }
+
+  void Done(const redisReply* reply) override {
+    if (reply != nullptr && reply->type != REDIS_REPLY_STATUS) {
+      LogUnexpectedReply(reply, "SET");
+    }
+  }
+
+  StringPiece ShardKey() const override { return key_; }
+
+ private:
+  const GoogleString key_;
+  SharedString value_;
+};
+
+class AsyncRedisCache::DeleteOperation : public AsyncRedisCache::Operation {
+ public:
+  DeleteOperation(AsyncRedisCache* cache, const GoogleString& key)
+      : Operation(cache), key_(key) {}
+
+  bool Send(redisAsyncContext* context) override {
+    return redisAsyncCommand(context, &AsyncRedisCache::ReplyCallback, this,
+                             "DEL %b", key_.data(), key_.size()) == REDIS_OK;
+  }
+
+  void Done(const redisReply* reply) override {
+    if (reply != nullptr && reply->type != REDIS_REPLY_INTEGER) {
+      LogUnexpectedReply(reply, "DEL");
+    }
+  }
+
+  StringPiece ShardKey() const override { return key_; }
+
+ private:
+  const GoogleString key_;
+};
+
+// Sent first on every new connection when a database index is configured.
+// If it fails, the connection is useless, so we drop it.
+class AsyncRedisCache::SelectOperation : public AsyncRedisCache::Operation {
+ public:
+  SelectOperation(AsyncRedisCache* cache, Connection* connection)
+      : Operation(cache), connection_(connection) {}
+
+  bool Send(redisAsyncContext* context) override {
+    return redisAsyncCommand(context, &AsyncRedisCache::ReplyCallback, this,
+                             "SELECT %d", cache_->database_index_) == REDIS_OK;
+  }
+
+  void Done(const redisReply* reply) override {
+    if (reply == nullptr) {
+      return;  // The connection is going away already.
+    }
+    if (reply->type != REDIS_REPLY_STATUS) {
+      LogUnexpectedReply(reply, "SELECT");
+      cache_->Close(connection_, cache_->timer_->NowMs() +
+                                     cache_->reconnection_delay_ms_);
+    }
+  }
+
+  // Sent directly on its connection rather than dispatched.
+  StringPiece ShardKey() const override { return StringPiece(); }
+
+ private:
+  Connection* connection_;
+};
+
+class AsyncRedisCache::EventLoopThread : public ThreadSystem::Thread {
+ public:
+  EventLoopThread(AsyncRedisCache* cache, ThreadSystem* thread_system)
+      : ThreadSystem::Thread(thread_system, "redis_event_loop",
+                             ThreadSystem::kJoinable),
+        cache_(cache) {}
+
+ protected:
+  void Run() override { cache_->RunEventLoop(); }
+
+ private:
+  AsyncRedisCache* cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventLoopThread);
+};
+
+AsyncRedisCache::AsyncRedisCache(StringPiece host, int port,
+                                 int database_index, int num_connections,
+                                 ThreadSystem* thread_system,
+                                 MessageHandler* message_handler, Timer* timer,
+                                 int64 reconnection_delay_ms, int64 timeout_us)
+    : host_(host.as_string()),
+      port_(port),
+      database_index_(database_index),
+      thread_system_(thread_system),
+      message_handler_(message_handler),
+      timer_(timer),
+      reconnection_delay_ms_(reconnection_delay_ms),
+      timeout_ms_(std::max(static_cast<int64>(1),
+                           timeout_us / Timer::kMsUs)),
+      num_connections_(num_connections),
+      mutex_(thread_system->NewMutex()),
+      connect_done_(mutex_->NewCondvar()),
+      shut_down_(false),
+      is_cluster_(false),
+      num_connected_(0),
+      num_connecting_(0),
+      wakeup_read_fd_(-1),
+      wakeup_write_fd_(-1) {
+  CHECK_LT(0, num_connections);
+  for (int i = 0; i < num_connections; ++i) {
+    connections_.push_back(new Connection(this));
+  }
+}
+
+AsyncRedisCache::~AsyncRedisCache() {
+  ShutDown();
+  for (Connection* connection : connections_) {
+    DCHECK(connection->context == nullptr);
+    delete connection;
+  }
+  if (wakeup_read_fd_ != -1) {
+    close(wakeup_read_fd_);
+    close(wakeup_write_fd_);
+  }
+}
+
+GoogleString AsyncRedisCache::ServerDescription() const {
+  return StrCat(host_, ":", IntegerToString(port_));
+}
+
+void AsyncRedisCache::StartUp() {
+  CHECK(thread_ == nullptr);
+  int fds[2];
+  CHECK_EQ(0, pipe(fds));
+  wakeup_read_fd_ = fds[0];
+  wakeup_write_fd_ = fds[1];
+  SetNonBlockingAndCloseOnExec(wakeup_read_fd_);
+  SetNonBlockingAndCloseOnExec(wakeup_write_fd_);
+
+  // The event loop does not run yet, so we can start connecting here.
+  for (Connection* connection : connections_) {
+    Connect(connection);
+  }
+  thread_.reset(new EventLoopThread(this, thread_system_));
+  CHECK(thread_->Start());
+
+  ScopedMutex lock(mutex_.get());
+  int64 deadline_ms = timer_->NowMs() + timeout_ms_;
+  while (num_connecting_ > 0) {
+    int64 remaining_ms = deadline_ms - timer_->NowMs();
+    if (remaining_ms <= 0) {
+      break;
+    }
+    connect_done_->TimedWait(remaining_ms);
+  }
+}
+
+bool AsyncRedisCache::IsHealthy() const {
+  ScopedMutex lock(mutex_.get());
+  return !shut_down_ && !is_cluster_ && num_connected_ > 0;
+}
+
+void AsyncRedisCache::ShutDown() {
+  std::vector<Operation*> operations;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      return;
+    }
+    shut_down_ = true;
+    if (thread_ == nullptr) {
+      // Nobody will ever take these.
+      operations.swap(incoming_);
+    }
+  }
+  for (Operation* operation : operations) {
+    operation->Done(nullptr);
+    delete operation;
+  }
+  if (thread_ != nullptr) {
+    // The event loop fails whatever is queued or in flight, then exits.
+    WakeUp();
+    thread_->Join();
+  }
+}
+
+void AsyncRedisCache::Get(const GoogleString& key, Callback* callback) {
+  Enqueue(new GetOperation(this, key, callback));
+}
+
+void AsyncRedisCache::Put(const GoogleString& key, const SharedString& value) {
+  Enqueue(new PutOperation(this, key, value));
+}
+
+void AsyncRedisCache::Delete(const GoogleString& key) {
+  Enqueue(new DeleteOperation(this, key));
+}
+
+void AsyncRedisCache::MultiGet(MultiGetRequest* request) {
+  // Each key is looked up on the connection a Get of it would use, so that
+  // the lookup stays ordered with Puts and Deletes of the same key.
+  std::vector<MultiGetRequest*> requests(num_connections_, nullptr);
+  for (const KeyCallback& key_callback : *request) {
+    MultiGetRequest*& shard = requests[ConnectionIndex(key_callback.key)];
+    if (shard == nullptr) {
+      shard = new MultiGetRequest;
+    }
+    shard->push_back(key_callback);
+  }
+  delete request;
+  for (MultiGetRequest* shard : requests) {
+    if (shard != nullptr) {
+      Enqueue(new MultiGetOperation(this, shard));
+    }
+  }
+}
+
+void AsyncRedisCache::Enqueue(Operation* operation) {
+  bool wake_up = false;
+  bool failed = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      failed = true;
+    } else {
+      // The event loop empties incoming_ each time it wakes up, so only the
+      // first operation since then needs to wake it.
+      wake_up = incoming_.empty();
+      incoming_.push_back(operation);
+    }
+  }
+  if (failed) {
+    operation->Done(nullptr);
+    delete operation;
+  } else if (wake_up) {
+    WakeUp();
+  }
+}
+
+void AsyncRedisCache::WakeUp() {
+  if (wakeup_write_fd_ != -1) {
+    char byte = 0;
+    // If the pipe is full, the loop is due to wake up anyway.
+    if (write(wakeup_write_fd_, &byte, 1) < 0 && errno != EAGAIN) {
+      LOG(ERROR) << "Cannot wake up redis event loop: " << strerror(errno);
+    }
+  }
+}
+
+int AsyncRedisCache::ConnectionIndex(StringPiece key) const {
+  return HashString<CasePreserve, size_t>(key.data(), key.size()) %
+      num_connections_;
+}
+
+bool AsyncRedisCache::CheckForClusterReply(const redisReply* reply) {
+  if (reply == nullptr || reply->type != REDIS_REPLY_ERROR) {
+    return false;
+  }
+  StringPiece error(reply->str, reply->len);
+  if (!error.starts_with("MOVED ") && !error.starts_with("ASK ") &&
+      !error.starts_with("CROSSSLOT ")) {
+    return false;
+  }
+  bool first;
+  {
+    ScopedMutex lock(mutex_.get());
+    first = !is_cluster_;
+    is_cluster_ = true;
+  }
+  if (first) {
+    message_handler_->Message(
+        kError, "Redis at %s is a Redis Cluster node (%s), which "
+        "AsyncRedisCache does not support; no longer using it. Use the "
+        "blocking redis cache for clusters.",
+        ServerDescription().c_str(), error.as_string().c_str());
+  }
+  return true;
+}
+
+void AsyncRedisCache::RunEventLoop() {
+  std::vector<Operation*> operations;
+  std::vector<pollfd> fds;
+  std::vector<Connection*> polled_connections;
+  while (true) {
+    bool shut_down;
+    bool is_cluster;
+    {
+      ScopedMutex lock(mutex_.get());
+      operations.swap(incoming_);
+      shut_down = shut_down_;
+      is_cluster = is_cluster_;
+    }
+    if (shut_down || is_cluster) {
+      for (Operation* operation : operations) {
+        operation->Done(nullptr);
+        delete operation;
+      }
+      operations.clear();
+    }
+    if (shut_down) {
+      break;
+    }
+
+    int64 now_ms = timer_->NowMs();
+    for (Connection* connection : connections_) {
+      if (connection->context == nullptr &&
+          connection->reconnect_at_ms <= now_ms) {
+        Connect(connection);
+      }
+    }
+    for (Operation* operation : operations) {
+      Dispatch(operation);
+    }
+    operations.clear();
+    ExpireTimeouts(now_ms);
+
+    fds.clear();
+    polled_connections.clear();
+    pollfd wakeup = {wakeup_read_fd_, POLLIN, 0};
+    fds.push_back(wakeup);
+    for (Connection* connection : connections_) {
+      if (connection->context != nullptr &&
+          (connection->reading || connection->writing)) {
+        pollfd fd = {connection->context->c.fd, 0, 0};
+        if (connection->reading) {
+          fd.events |= POLLIN;
+        }
+        if (connection->writing) {
+          fd.events |= POLLOUT;
+        }
+        fds.push_back(fd);
+        polled_connections.push_back(connection);
+      }
+    }
+    if (poll(fds.data(), fds.size(), PollTimeoutMs(timer_->NowMs())) < 0) {
+      if (errno != EINTR) {
+        LOG(ERROR) << "poll() failed in redis event loop: " << strerror(errno);
+      }
+      continue;
+    }
+
+    if (fds[0].revents != 0) {
+      char buf[64];
+      while (read(wakeup_read_fd_, buf, sizeof(buf)) > 0) {
+      }
+    }
+    for (size_t i = 1; i < fds.size(); ++i) {
+      Connection* connection = polled_connections[i - 1];
+      redisAsyncContext* context = connection->context;
+      // A callback may have closed the connection since we polled.
+      if (context == nullptr) {
+        continue;
+      }
+      if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+        redisAsyncHandleRead(context);
+      }
+      if (connection->context == context && (fds[i].revents & POLLOUT)) {
+        redisAsyncHandleWrite(context);
+      }
+    }
+  }
+
+  // Fails everything still in flight.
+  for (Connection* connection : connections_) {
+    Close(connection, 0);
+  }
+}
+
+void AsyncRedisCache::Dispatch(Operation* operation) {
+  int first = ConnectionIndex(operation->ShardKey());
+  // If the connection for this key is down, any other will do.
+  for (int i = 0; i < num_connections_; ++i) {
+    Connection* connection = connections_[(first + i) % num_connections_];
+    if (connection->context != nullptr && connection->connected) {
+      Send(connection, operation);
+      return;
+    }
+  }
+  // No connection is up; fail fast rather than pile work up.
+  operation->Done(nullptr);
+  delete operation;
+}
+
+void AsyncRedisCache::Send(Connection* connection, Operation* operation) {
+  operation->set_deadline_ms(timer_->NowMs() + timeout_ms_);
+  if (operation->Send(connection->context)) {
+    connection->in_flight.push_back(operation);
+  } else {
+    operation->Done(nullptr);
+    delete operation;
+  }
+}
+
+void AsyncRedisCache::Connect(Connection* connection) {
+  DCHECK(connection->context == nullptr);
+  int64 now_ms = timer_->NowMs();
+  redisAsyncContext* context = redisAsyncConnect(host_.c_str(), port_);
+  if (context == nullptr || context->err) {
+    message_handler_->Message(
+        kError, "Error while connecting to redis at %s: %s",
+        ServerDescription().c_str(),
+        context == nullptr ? "cannot allocate context" : context->errstr);
+    if (context != nullptr) {
+      redisAsyncFree(context);
+    }
+    connection->reconnect_at_ms = now_ms + reconnection_delay_ms_;
+    return;
+  }
+
+  context->data = connection;
+  context->ev.data = connection;
+  context->ev.addRead = &Connection::AddRead;
+  context->ev.delRead = &Connection::DelRead;
+  context->ev.addWrite = &Connection::AddWrite;
+  context->ev.delWrite = &Connection::DelWrite;
+  context->ev.cleanup = &Connection::Cleanup;
+  redisAsyncSetConnectCallback(context, &AsyncRedisCache::ConnectCallback);
+  redisAsyncSetDisconnectCallback(context,
+                                  &AsyncRedisCache::DisconnectCallback);
+
+  connection->context = context;
+  connection->connected = false;
+  // hiredis learns that a non-blocking connect finished when the socket
+  // becomes writable.
+  connection->writing = true;
+  connection->connect_deadline_ms = now_ms + timeout_ms_;
+  {
+    ScopedMutex lock(mutex_.get());
+    ++num_connecting_;
+  }
+  if (database_index_ != kRedisDatabaseIndexNotSet) {
+    Send(connection, new SelectOperation(this, connection));
+  }
+}
+
+void AsyncRedisCache::Close(Connection* connection, int64 reconnect_at_ms) {
+  redisAsyncContext* context = connection->context;
+  if (context == nullptr) {
+    return;
+  }
+  // If we never got connected, this counts as a failed attempt.
+  SetConnected(connection, false);
+  connection->context = nullptr;
+  connection->reading = false;
+  connection->writing = false;
+  connection->reconnect_at_ms = reconnect_at_ms;
+  // Runs ReplyCallback with nullptr for everything in flight, right away or,
+  // if we are inside a hiredis callback, once it returns.
+  redisAsyncFree(context);
+}
+
+void AsyncRedisCache::ExpireTimeouts(int64 now_ms) {
+  for (Connection* connection : connections_) {
+    if (connection->context == nullptr) {
+      continue;
+    }
+    if (!connection->connected) {
+      if (connection->connect_deadline_ms <= now_ms) {
+        message_handler_->Message(
+            kError, "Timed out connecting to redis at %s",
+            ServerDescription().c_str());
+        Close(connection, now_ms + reconnection_delay_ms_);
+      }
+    } else if (!connection->in_flight.empty() &&
+               connection->in_flight.front()->deadline_ms() <= now_ms) {
+      // There is no way to abandon a single command, so we drop the
+      // connection, failing all in flight on it, and reconnect right away.
+      message_handler_->Message(
+          kError, "Redis operation timed out on %s, reconnecting",
+          ServerDescription().c_str());
+      Close(connection, now_ms);
+    }
+  }
+}
+
+int AsyncRedisCache::PollTimeoutMs(int64 now_ms) {
+  int64 wake_at_ms = now_ms + kMaxPollMs;
+  for (Connection* connection : connections_) {
+    if (connection->context == nullptr) {
+      wake_at_ms = std::min(wake_at_ms, connection->reconnect_at_ms);
+    } else if (!connection->connected) {
+      wake_at_ms = std::min(wake_at_ms, connection->connect_deadline_ms);
+    } else if (!connection->in_flight.empty()) {
+      wake_at_ms = std::min(wake_at_ms,
+                            connection->in_flight.front()->deadline_ms());
+    }
+  }
+  return std::max(static_cast<int64>(0), wake_at_ms - now_ms);
+}
+
+void AsyncRedisCache::SetConnected(Connection* connection, bool connected) {
+  ScopedMutex lock(mutex_.get());
+  if (!connection->connected) {
+    // The connection attempt is over, either way.
+    --num_connecting_;
+    connect_done_->Broadcast();
+  } else {
+    --num_connected_;
+  }
+  if (connected) {
+    ++num_connected_;
+  }
+  connection->connected = connected;
+}
+
+void AsyncRedisCache::ConnectCallback(const redisAsyncContext* context,
+                                      int status) {
+  Connection* connection = static_cast<Connection*>(context->data);
+  AsyncRedisCache* cache = connection->cache;
+  if (status == REDIS_OK) {
+    cache->SetConnected(connection, true);
+  } else {
+    cache->message_handler_->Message(
+        kError, "Error while connecting to redis at %s: %s",
+        cache->ServerDescription().c_str(), context->errstr);
+    // hiredis frees the context when we return.
+    cache->SetConnected(connection, false);
+    connection->context = nullptr;
+    connection->reading = false;
+    connection->writing = false;
+    connection->reconnect_at_ms =
+        cache->timer_->NowMs() + cache->reconnection_delay_ms_;
+  }
+}
+
+void AsyncRedisCache::DisconnectCallback(const redisAsyncContext* context,
+                                         int status) {
+  Connection* connection = static_cast<Connection*>(context->data);
+  if (connection->context != context) {
+    return;  // We dropped it ourselves, in Close().
+  }
+  AsyncRedisCache* cache = connection->cache;
+  if (status != REDIS_OK) {
+    cache->message_handler_->Message(
+        kError, "Lost connection to redis at %s: %s",
+        cache->ServerDescription().c_str(), context->errstr);
+  }
+  // hiredis frees the context when we return.  Like RedisCache, reconnect
+  // without delay after a communication error.
+  cache->SetConnected(connection, false);
+  connection->context = nullptr;
+  connection->reading = false;
+  connection->writing = false;
+  connection->reconnect_at_ms = cache->timer_->NowMs();
+}
+
+void AsyncRedisCache::ReplyCallback(redisAsyncContext* context, void* reply,
+                                    void* privdata) {
+  Connection* connection = static_cast<Connection*>(context->data);
+  Operation* operation = static_cast<Operation*>(privdata);
+  DCHECK(!connection->in_flight.empty());
+  DCHECK_EQ(operation, connection->in_flight.front());
+  if (!connection->in_flight.empty() &&
+      connection->in_flight.front() == operation) {
+    connection->in_flight.pop_front();
+  }
+  const redisReply* redis_reply = static_cast<const redisReply*>(reply);
+  if (connection->cache->CheckForClusterReply(redis_reply)) {
+    // Fail it, rather than report a miss for a key that may well be there.
+    redis_reply = nullptr;
+  }
+  operation->Done(redis_reply);
+  delete operation;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,172 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef PAGESPEED_SYSTEM_ASYNC_REDIS_CACHE_H_
+#define PAGESPEED_SYSTEM_ASYNC_REDIS_CACHE_H_
+
+#include <deque>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+struct redisAsyncContext;
+struct redisReply;
+
+namespace net_instaweb {
+
+class SharedString;
+
+// Non-blocking interface to a single Redis server, using the asynchronous
+// hiredis API.  One event-loop thread per AsyncRedisCache owns a few
+// connections and multiplexes all in-flight requests over them, so unlike
+// RedisCache wrapped in AsyncCache, an outstanding operation does not pin a
+// thread and bursts are not dropped for want of queue space.
+//
+// Get/Put/Delete/MultiGet only queue the operation and wake the event loop.
+// Callbacks are run on the event-loop thread, so they must not block; the
+// caches above this one in SystemCaches only hand results on.  Operations are
+// spread over the connections by key hash, so those on the same key are seen
+// by the server in the order they were issued while that connection stays up.
+// MultiGet is split the same way, into one MGET per connection.
+//
+// Reconnection follows RedisCache: after an operation fails because of a
+// communication error or timeout, the connection is re-established right
+// away, but after a failed connection attempt not for reconnection_delay_ms.
+// Operations issued while no connection is up fail immediately.
+//
+// Redis Cluster is not supported.  The first redirection (MOVED or ASK) or
+// CROSSSLOT error is logged, and from then on the cache reports itself
+// unhealthy and fails every operation.
+class AsyncRedisCache : public CacheInterface {
+ public:
+  // database_index of -1 means not to SELECT a database.  Does not take
+  // ownership of thread_system, message_handler, or timer.
+  AsyncRedisCache(StringPiece host, int port, int database_index,
+                  int num_connections, ThreadSystem* thread_system,
+                  MessageHandler* message_handler, Timer* timer,
+                  int64 reconnection_delay_ms, int64 timeout_us);
+  ~AsyncRedisCache() override;
+
+  // Starts the event-loop thread and waits, up to timeout_us, for the
+  // connections to be established.
+  void StartUp();
+
+  GoogleString ServerDescription() const;
+
+  static GoogleString FormatName() { return "AsyncRedisCache"; }
+
+  // CacheInterface implementations.
+  void Get(const GoogleString& key, Callback* callback) override;
+  void Put(const GoogleString& key, const SharedString& value) override;
+  void Delete(const GoogleString& key) override;
+  void MultiGet(MultiGetRequest* request) override;
+  GoogleString Name() const override { return FormatName(); }
+  bool IsBlocking() const override { return false; }
+  bool IsHealthy() const override;
+  void ShutDown() override;
+
+ private:
+  struct Connection;
+  class EventLoopThread;
+  class Operation;
+  class GetOperation;
+  class MultiGetOperation;
+  class PutOperation;
+  class DeleteOperation;
+  class SelectOperation;
+
+  // Hands operation to the event loop, or fails it right away if we are shut
+  // down.  Takes ownership.
+  void Enqueue(Operation* operation) LOCKS_EXCLUDED(mutex_);
+  void WakeUp();
+
+  // Index into connections_ of the connection operations on key are sent on.
+  int ConnectionIndex(StringPiece key) const;
+
+  // Logs and remembers that reply came from a Redis Cluster node.  Returns
+  // false if reply is an ordinary one.
+  bool CheckForClusterReply(const redisReply* reply) LOCKS_EXCLUDED(mutex_);
+
+  // Everything below runs on the event-loop thread only, or in StartUp()
+  // before that thread exists.
+  void RunEventLoop();
+  void Dispatch(Operation* operation);
+  void Send(Connection* connection, Operation* operation);
+  void Connect(Connection* connection);
+  void Close(Connection* connection, int64 reconnect_at_ms);
+  void ExpireTimeouts(int64 now_ms);
+  int PollTimeoutMs(int64 now_ms);
+
+  // Records the outcome of a connection attempt, or the loss of a connection
+  // (with connected false).  Keeps num_connected_ and num_connecting_ in step.
+  void SetConnected(Connection* connection, bool connected)
+      LOCKS_EXCLUDED(mutex_);
+
+  // hiredis callbacks.
+  static void ConnectCallback(const redisAsyncContext* context, int status);
+  static void DisconnectCallback(const redisAsyncContext* context,
+                                 int status);
+  static void ReplyCallback(redisAsyncContext* context, void* reply,
+                            void* privdata);
+
+  const GoogleString host_;
+  const int port_;
+  const int database_index_;
+  ThreadSystem* thread_system_;
+  MessageHandler* message_handler_;
+  Timer* timer_;
+  const int64 reconnection_delay_ms_;
+  const int64 timeout_ms_;
+  const int num_connections_;
+
+  scoped_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  // Signalled when a connection attempt completes, for StartUp().
+  scoped_ptr<ThreadSystem::Condvar> connect_done_;
+  std::vector<Operation*> incoming_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+  bool is_cluster_ GUARDED_BY(mutex_);
+  int num_connected_ GUARDED_BY(mutex_);
+  int num_connecting_ GUARDED_BY(mutex_);
+
+  // Pipe written to by Enqueue() and ShutDown() to wake the event loop up.
+  // Created by StartUp(), so that forked children do not share it.
+  int wakeup_read_fd_;
+  int wakeup_write_fd_;
+
+  // Owned by the event-loop thread once it is started.
+  std::vector<Connection*> connections_;
+
+  scoped_ptr<EventLoopThread> thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(AsyncRedisCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_SYSTEM_ASYNC_REDIS_CACHE_H_
@@ -0,0 +1,465 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+// Unit-test the event-driven redis interface.
+
+#include "pagespeed/system/async_redis_cache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "apr_network_io.h"  // NOLINT
+#include "base/logging.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/gtest.h"
+#include "pagespeed/kernel/base/posix_timer.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_test_base.h"
+#include "pagespeed/kernel/thread/worker_test_base.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/system/tcp_connection_for_testing.h"
+#include "pagespeed/system/tcp_server_thread_for_testing.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kReconnectionDelayMs = 10;
+const int kTimeoutUs = 100 * Timer::kMsUs;
+const int kDatabaseIndex = 0;
+
+// See RedisCacheTest for how these gaps were chosen.
+const int kTimedOutOperationMinTimeUs = kTimeoutUs - 5 * Timer::kMsUs;
+const int kTimedOutOperationMaxTimeUs = kTimeoutUs + 50 * Timer::kMsUs;
+
+const char kSelectRequest[] =
+    "*2\r\n"
+    "$6\r\nSELECT\r\n"
+    "$1\r\n0\r\n";
+const char kSelectAnswer[] = "+OK\r\n";
+
+}  // namespace
+
+class AsyncRedisCacheTest : public CacheTestBase {
+ protected:
+  // Replies arrive on the event-loop thread, so the test has to wait for them.
+  class AsyncCallback : public CacheTestBase::Callback {
+   public:
+    explicit AsyncCallback(AsyncRedisCacheTest* test)
+        : Callback(test),
+          sync_point_(test->thread_system_.get()) {}
+
+    void Done(CacheInterface::KeyState state) override {
+      Callback::Done(state);
+      sync_point_.Notify();
+    }
+
+    void Wait() override { sync_point_.Wait(); }
+
+   private:
+    WorkerTestBase::SyncPoint sync_point_;
+  };
+
+  AsyncRedisCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()) {
+    set_mutex(thread_system_->NewMutex());
+  }
+
+  ~AsyncRedisCacheTest() override {
+    if (cache_ != nullptr) {
+      cache_->ShutDown();
+    }
+  }
+
+  bool PrepareRedisOrSkip() {
+    const char* port_string = getenv("REDIS_PORT");
+    int port;
+    if (port_string == nullptr || !StringToInt(port_string, &port)) {
+      LOG(ERROR) << "AsyncRedisCache tests are skipped because env var "
+                 << "$REDIS_PORT is not set to an integer. Set that "
+                 << "to the port number where redis is running to "
+                 << "enable the tests. See install/run_program_with_redis.sh";
+      return false;
+    }
+
+    {
+      TcpConnectionForTesting conn;
+      CHECK(conn.Connect("localhost", port))
+          << "Cannot connect to Redis server";
+      conn.Send("FLUSHALL\r\n");
+      CHECK_EQ("+OK\r\n", conn.ReadLineCrLf());
+    }
+    InitCache("localhost", port, 4 /* num_connections */);
+    cache_->StartUp();
+    return true;
+  }
+
+  // Stand-in servers accept a single connection.
+  void InitCacheWithCustomServer() {
+    InitCache("localhost", custom_server_port_, 1 /* num_connections */);
+  }
+
+  void InitCacheWithUnreachableServer() {
+    // 192.0.2.0/24 is reserved for documentation purposes in RFC5737 and no
+    // machine should ever be routable in that subnet.
+    InitCache("192.0.2.1", 12345, 1 /* num_connections */);
+  }
+
+  void InitCache(StringPiece host, int port, int num_connections) {
+    cache_.reset(new AsyncRedisCache(
+        host, port, kDatabaseIndex, num_connections, thread_system_.get(),
+        &handler_, &timer_, kReconnectionDelayMs, kTimeoutUs));
+  }
+
+  static void SetUpTestCase() {
+    apr_initialize();
+    TcpServerThreadForTesting::PickListenPortOnce(&custom_server_port_);
+    CHECK_NE(custom_server_port_, 0);
+  }
+
+  static void TearDownTestCase() {
+    apr_terminate();
+  }
+
+  template<class ServerThread>
+  bool StartCustomServer() {
+    custom_server_.reset(
+        new ServerThread(custom_server_port_, thread_system_.get()));
+    if (!custom_server_->Start()) {
+      return false;
+    }
+    return custom_server_->GetListeningPort() == custom_server_port_;
+  }
+
+  CacheInterface* Cache() override { return cache_.get(); }
+  Callback* NewCallback() override { return new AsyncCallback(this); }
+
+  scoped_ptr<ThreadSystem> thread_system_;
+  PosixTimer timer_;
+  GoogleMessageHandler handler_;
+  scoped_ptr<AsyncRedisCache> cache_;
+
+  scoped_ptr<TcpServerThreadForTesting> custom_server_;
+  static apr_port_t custom_server_port_;
+};
+
+apr_port_t AsyncRedisCacheTest::custom_server_port_ = 0;
+
+TEST_F(AsyncRedisCacheTest, PutGetDelete) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  EXPECT_TRUE(Cache()->IsHealthy());
+
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+}
+
+TEST_F(AsyncRedisCacheTest, MultiGet) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  TestMultiGet();  // Test from CacheTestBase is good enough.
+}
+
+// Many lookups can be in flight at once without any of them being dropped.
+TEST_F(AsyncRedisCacheTest, ManyOutstandingGets) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  const int kNumKeys = 1000;
+  for (int i = 0; i < kNumKeys; ++i) {
+    CheckPut(StrCat("key", IntegerToString(i)),
+             StrCat("value", IntegerToString(i)));
+  }
+  std::vector<Callback*> callbacks;
+  for (int i = 0; i < kNumKeys; ++i) {
+    callbacks.push_back(InitiateGet(StrCat("key", IntegerToString(i))));
+  }
+  for (int i = 0; i < kNumKeys; ++i) {
+    WaitAndCheck(callbacks[i], StrCat("value", IntegerToString(i)));
+  }
+}
+
+// A MultiGet is split by connection the same way Puts are, so it sees every
+// Put issued before it without waiting for their replies.
+TEST_F(AsyncRedisCacheTest, MultiGetSeesEarlierPuts) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  const int kNumKeys = 100;
+  std::vector<Callback*> callbacks;
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  for (int i = 0; i < kNumKeys; ++i) {
+    GoogleString key = StrCat("key", IntegerToString(i));
+    Cache()->Put(key, SharedString(StrCat("value", IntegerToString(i))));
+    callbacks.push_back(AddCallback());
+    request->push_back(CacheInterface::KeyCallback(key, callbacks.back()));
+  }
+  Cache()->MultiGet(request);
+  for (int i = 0; i < kNumKeys; ++i) {
+    WaitAndCheck(callbacks[i], StrCat("value", IntegerToString(i)));
+  }
+}
+
+// Stand-in server which expects SELECT followed by a scripted series of
+// exchanges. The request of each exchange must arrive in full before its
+// answer is sent.
+class AsyncRedisScriptedServerThread : public TcpServerThreadForTesting {
+ public:
+  typedef std::vector<std::pair<GoogleString, GoogleString>> Exchanges;
+
+  AsyncRedisScriptedServerThread(apr_port_t listen_port,
+                                 ThreadSystem* thread_system,
+                                 const Exchanges& exchanges)
+      : TcpServerThreadForTesting(listen_port, "redis_scripted_server",
+                                  thread_system),
+        exchanges_(exchanges) {}
+
+  virtual ~AsyncRedisScriptedServerThread() { ShutDown(); }
+
+ private:
+  void HandleClientConnection(apr_socket_t* sock) override {
+    EXPECT_EQ(kSelectRequest,
+              RecvExactly(sock, STATIC_STRLEN(kSelectRequest)));
+    apr_size_t answer_size_select = STATIC_STRLEN(kSelectAnswer);
+    apr_socket_send(sock, kSelectAnswer, &answer_size_select);
+
+    for (const auto& exchange : exchanges_) {
+      EXPECT_EQ(exchange.first, RecvExactly(sock, exchange.first.size()));
+      apr_size_t answer_size = exchange.second.size();
+      apr_socket_send(sock, exchange.second.data(), &answer_size);
+    }
+    apr_socket_close(sock);
+  }
+
+  static GoogleString RecvExactly(apr_socket_t* sock, size_t size) {
+    GoogleString result;
+    char buf[1024];
+    while (result.size() < size) {
+      apr_size_t recv_size = std::min(sizeof(buf), size - result.size());
+      if (apr_socket_recv(sock, buf, &recv_size) != APR_SUCCESS) {
+        break;
+      }
+      result.append(buf, recv_size);
+    }
+    return result;
+  }
+
+  const Exchanges exchanges_;
+};
+
+// Both GETs must arrive before either is answered, so a client which waits
+// for each reply before sending the next request times out.
+class AsyncRedisPipelinedGetServerThread
+    : public AsyncRedisScriptedServerThread {
+ public:
+  AsyncRedisPipelinedGetServerThread(apr_port_t listen_port,
+                                     ThreadSystem* thread_system)
+      : AsyncRedisScriptedServerThread(listen_port, thread_system,
+                                       MakeExchanges()) {}
+
+ private:
+  static Exchanges MakeExchanges() {
+    Exchanges exchanges;
+    exchanges.emplace_back(
+        "*2\r\n"
+        "$3\r\nGET\r\n"
+        "$2\r\nk1\r\n"
+        "*2\r\n"
+        "$3\r\nGET\r\n"
+        "$2\r\nk2\r\n",
+        "$2\r\nv1\r\n"
+        "$-1\r\n");
+    return exchanges;
+  }
+};
+
+// A MultiGet goes out as a single MGET.
+class AsyncRedisMultiGetServerThread : public AsyncRedisScriptedServerThread {
+ public:
+  AsyncRedisMultiGetServerThread(apr_port_t listen_port,
+                                 ThreadSystem* thread_system)
+      : AsyncRedisScriptedServerThread(listen_port, thread_system,
+                                       MakeExchanges()) {}
+
+ private:
+  static Exchanges MakeExchanges() {
+    Exchanges exchanges;
+    exchanges.emplace_back(
+        "*4\r\n"
+        "$4\r\nMGET\r\n"
+        "$2\r\nk1\r\n"
+        "$2\r\nk2\r\n"
+        "$2\r\nk3\r\n",
+        "*3\r\n"
+        "$2\r\nv1\r\n"
+        "$-1\r\n"
+        "$2\r\nv3\r\n");
+    return exchanges;
+  }
+};
+
+// Answers a GET with a Redis Cluster redirection.
+class AsyncRedisClusterServerThread : public AsyncRedisScriptedServerThread {
+ public:
+  AsyncRedisClusterServerThread(apr_port_t listen_port,
+                                ThreadSystem* thread_system)
+      : AsyncRedisScriptedServerThread(listen_port, thread_system,
+                                       MakeExchanges()) {}
+
+ private:
+  static Exchanges MakeExchanges() {
+    Exchanges exchanges;
+    exchanges.emplace_back(
+        "*2\r\n"
+        "$3\r\nGET\r\n"
+        "$2\r\nk1\r\n",
+        "-MOVED 12706 127.0.0.1:7001\r\n");
+    return exchanges;
+  }
+};
+
+// Answers SELECT, then nothing; holds the connection open until destroyed.
+class AsyncRedisNotRespondingServerThread : public TcpServerThreadForTesting {
+ public:
+  AsyncRedisNotRespondingServerThread(apr_port_t listen_port,
+                                      ThreadSystem* thread_system)
+      : TcpServerThreadForTesting(listen_port, "redis_not_responding_server",
+                                  thread_system),
+        connection_received_(thread_system) {}
+
+  ~AsyncRedisNotRespondingServerThread() {
+    connection_received_.Wait();
+    ShutDown();
+  }
+
+ protected:
+  void HandleClientConnection(apr_socket_t* sock) override {
+    char buf[STATIC_STRLEN(kSelectRequest) + 1];
+    apr_size_t recv_size = sizeof(buf) - 1;
+    apr_socket_recv(sock, buf, &recv_size);
+    EXPECT_EQ(STATIC_STRLEN(kSelectRequest), recv_size);
+    apr_size_t answer_size_select = STATIC_STRLEN(kSelectAnswer);
+    apr_socket_send(sock, kSelectAnswer, &answer_size_select);
+    connection_received_.Notify();
+  }
+
+ private:
+  WorkerTestBase::SyncPoint connection_received_;
+};
+
+TEST_F(AsyncRedisCacheTest, GetsArePipelined) {
+  InitCacheWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<AsyncRedisPipelinedGetServerThread>());
+  cache_->StartUp();
+  EXPECT_TRUE(Cache()->IsHealthy());
+
+  Callback* k1 = InitiateGet("k1");
+  Callback* k2 = InitiateGet("k2");
+  WaitAndCheck(k1, "v1");
+  WaitAndCheckNotFound(k2);
+}
+
+TEST_F(AsyncRedisCacheTest, MultiGetIsOneMget) {
+  InitCacheWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<AsyncRedisMultiGetServerThread>());
+  cache_->StartUp();
+
+  Callback* k1 = AddCallback();
+  Callback* k2 = AddCallback();
+  Callback* k3 = AddCallback();
+  IssueMultiGet(k1, "k1", k2, "k2", k3, "k3");
+  WaitAndCheck(k1, "v1");
+  WaitAndCheckNotFound(k2);
+  WaitAndCheck(k3, "v3");
+}
+
+TEST_F(AsyncRedisCacheTest, ConnectionTimeout) {
+  InitCacheWithUnreachableServer();
+  int64 started_at_us = timer_.NowUs();
+  cache_->StartUp();  // Waits for the connection attempt.
+  int64 waited_for_us = timer_.NowUs() - started_at_us;
+  EXPECT_FALSE(Cache()->IsHealthy());
+  EXPECT_GE(waited_for_us, kTimedOutOperationMinTimeUs);
+  EXPECT_LE(waited_for_us, kTimedOutOperationMaxTimeUs);
+
+  // With no connection up, lookups fail right away.
+  started_at_us = timer_.NowUs();
+  CheckNotFound("Key");
+  EXPECT_LT(timer_.NowUs() - started_at_us, kTimedOutOperationMinTimeUs);
+}
+
+TEST_F(AsyncRedisCacheTest, OperationTimeout) {
+  InitCacheWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<AsyncRedisNotRespondingServerThread>());
+  cache_->StartUp();
+  EXPECT_TRUE(Cache()->IsHealthy());
+
+  int64 started_at_us = timer_.NowUs();
+  Callback* n0 = InitiateGet("Key0");
+  Callback* n1 = InitiateGet("Key1");
+  WaitAndCheckNotFound(n0);
+  WaitAndCheckNotFound(n1);
+  int64 waited_for_us = timer_.NowUs() - started_at_us;
+  EXPECT_GE(waited_for_us, kTimedOutOperationMinTimeUs);
+  EXPECT_LE(waited_for_us, kTimedOutOperationMaxTimeUs);
+}
+
+TEST_F(AsyncRedisCacheTest, ShutDownFailsPendingAndLaterOperations) {
+  InitCacheWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<AsyncRedisNotRespondingServerThread>());
+  cache_->StartUp();
+
+  Callback* pending = InitiateGet("Key");
+  cache_->ShutDown();
+  WaitAndCheckNotFound(pending);
+  EXPECT_FALSE(Cache()->IsHealthy());
+  CheckNotFound("Key");
+}
+
+// A cluster node is not mistaken for a server which is missing the key: the
+// cache gives up on it and fails everything from then on.
+TEST_F(AsyncRedisCacheTest, ClusterRedirectionMakesCacheUnhealthy) {
+  InitCacheWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<AsyncRedisClusterServerThread>());
+  cache_->StartUp();
+  EXPECT_TRUE(Cache()->IsHealthy());
+
+  CheckNotFound("k1");
+  EXPECT_FALSE(Cache()->IsHealthy());
+  CheckNotFound("k2");
+}
+
+}  // namespace net_instaweb
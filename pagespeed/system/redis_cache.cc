@@ -82,9 +82,35 @@ static const int kMaxRedirections = 1;
 static const int kDefaultDatabaseIndex = 0;
 static const int kRedisDatabaseIndexNotSet = -1;
 
+// Put() does not wait for the reply to its SET, but we still read replies
+// once this many are outstanding so that neither the server's output buffer
+// nor the time the next waiting command spends draining them grows unbounded.
+static const size_t kMaxPendingPuts = 64;
+
 const char kRedisClusterRedirections[] = "redis_cluster_redirections";
 const char kRedisClusterSlotsFetches[] = "redis_cluster_slots_fetches";
 
+namespace {
+
+bool IsRedirectionError(const redisReply* reply) {
+  if (reply == nullptr || reply->type != REDIS_REPLY_ERROR) {
+    return false;
+  }
+  StringPiece error(reply->str, reply->len);
+  return (strings::StartsWith(error, "MOVED ") ||
+          strings::StartsWith(error, "ASK "));
+}
+
+// Returned by a cluster node for an MGET whose keys span several slots, which
+// happens when we have not yet learned that the server is a cluster.
+bool IsCrossSlotError(const redisReply* reply) {
+  return (reply != nullptr && reply->type == REDIS_REPLY_ERROR &&
+          strings::StartsWith(StringPiece(reply->str, reply->len),
+                              "CROSSSLOT "));
+}
+
+}  // namespace
+
 RedisCache::RedisCache(StringPiece host, int port, ThreadSystem* thread_system,
                        MessageHandler* message_handler, Timer* timer,
                        int64 reconnection_delay_ms, int64 timeout_us,
@@ -160,7 +186,7 @@ void RedisCache::ShutDown() {
 void RedisCache::Get(const GoogleString& key, Callback* callback) {
   KeyState keyState = CacheInterface::kNotFound;
   RedisReply reply = RedisCommand(
-      LookupConnection(key),
+      ConnectionForKey(key),
       "GET %b", {REDIS_REPLY_STRING, REDIS_REPLY_NIL},
       key.data(), key.length());
 
@@ -177,35 +203,175 @@ void RedisCache::Get(const GoogleString& key, Callback* callback) {
 }
 
 void RedisCache::Put(const GoogleString& key, const SharedString& value) {
-  RedisReply reply = RedisCommand(
-      LookupConnection(key),
-      "SET %b %b",
-      {REDIS_REPLY_STATUS},
-      key.data(), key.length(),
-      value.data(), static_cast<size_t>(value.size()));
+  // The reply is checked by whichever command next waits on this connection.
+  Connection* connection = LookupConnection(key);
+  std::vector<PendingPut> redirected;
+  {
+    ScopedMutex lock(connection->GetOperationMutex());
+    connection->AppendSet(key, value);
+    connection->TakeRedirectedPuts(&redirected);
+  }
+  RedoPuts(redirected);
+}
 
-  if (!reply) {
-    return;
+void RedisCache::RedoPuts(const std::vector<PendingPut>& puts) {
+  for (const PendingPut& put : puts) {
+    const GoogleString& key = put.first;
+    const SharedString& value = put.second;
+    // RedisCommand() follows the redirection and, for MOVED, refreshes the
+    // slot mapping.
+    RedisReply reply = RedisCommand(
+        LookupConnection(key),
+        "SET %b %b",
+        {REDIS_REPLY_STATUS},
+        key.data(), key.length(),
+        value.data(), static_cast<size_t>(value.size()));
+    if (reply != nullptr && StringPiece(reply->str, reply->len) != "OK") {
+      GoogleString answer(reply->str, reply->len);
+      LOG(DFATAL) << "Unexpected status from redis as answer to SET: "
+                  << answer;
+      message_handler_->Message(
+          kError, "Unexpected status from redis as answer to SET: %s",
+          answer.c_str());
+    }
   }
+}
 
-  GoogleString answer(reply->str, reply->len);
-  if (answer == "OK") {
-    // Success, nothing to do.
-  } else {
-    LOG(DFATAL) << "Unexpected status from redis as answer to SET: " << answer;
-    message_handler_->Message(
-        kError, "Unexpected status from redis as answer to SET: %s",
-        answer.c_str());
+RedisCache::Connection* RedisCache::ConnectionForKey(StringPiece key) {
+  Connection* connection = LookupConnection(key);
+  std::vector<PendingPut> redirected;
+  bool ok;
+  {
+    ScopedMutex lock(connection->GetOperationMutex());
+    ok = connection->ReadPendingReplies();
+    connection->TakeRedirectedPuts(&redirected);
+  }
+  if (!ok) {
+    return nullptr;
+  }
+  if (!redirected.empty()) {
+    RedoPuts(redirected);
+    connection = LookupConnection(key);
   }
+  return connection;
 }
 
 void RedisCache::Delete(const GoogleString& key) {
   // Redis returns amount of keys deleted (probably, zero), no need in check
   // that amount; all other errors are handled by RedisCommand.
-  RedisCommand(LookupConnection(key),
+  RedisCommand(ConnectionForKey(key),
                "DEL %b", {REDIS_REPLY_INTEGER}, key.data(), key.length());
 }
 
+void RedisCache::MultiGet(MultiGetRequest* request) {
+  if (request->size() == 1) {
+    KeyCallback& key_callback = (*request)[0];
+    Get(key_callback.key, key_callback.callback);
+    delete request;
+    return;
+  }
+
+  // Redis Cluster only accepts an MGET whose keys all hash to the same slot,
+  // so in cluster mode group the keys by server and then by slot.  Each
+  // server gets its MGETs in slot order.  A plain server gets a single MGET.
+  // Keys whose connection failed are reported as not found.
+  bool cluster_mode;
+  {
+    ScopedMutex lock(cluster_map_lock_.get());
+    cluster_mode = !cluster_mappings_.empty();
+  }
+  std::map<Connection*, KeyIndicesBySlot> keys_by_connection;
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    const GoogleString& key = (*request)[i].key;
+    Connection* connection = ConnectionForKey(key);
+    if (connection != nullptr) {
+      int slot = cluster_mode ? HashSlot(key) : 0;
+      keys_by_connection[connection][slot].push_back(i);
+    }
+  }
+
+  // values point into replies, so the latter must outlive the callbacks.
+  std::vector<RedisReply> replies;
+  std::vector<const redisReply*> values(request->size(), nullptr);
+  std::vector<bool> redirected(request->size(), false);
+  for (const auto& entry : keys_by_connection) {
+    PipelinedMultiGet(entry.first, entry.second, *request, &replies, &values,
+                      &redirected);
+  }
+
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback& key_callback = (*request)[i];
+    if (redirected[i]) {
+      // Get() knows how to follow redirections and to refresh the mapping.
+      Get(key_callback.key, key_callback.callback);
+      continue;
+    }
+    KeyState key_state = CacheInterface::kNotFound;
+    const redisReply* value = values[i];
+    if (value != nullptr && value->type == REDIS_REPLY_STRING) {
+      key_callback.callback->set_value(
+          SharedString(StringPiece(value->str, value->len)));
+      key_state = CacheInterface::kAvailable;
+    }
+    ValidateAndReportResult(key_callback.key, key_state,
+                            key_callback.callback);
+  }
+  delete request;
+}
+
+void RedisCache::PipelinedMultiGet(Connection* connection,
+                                   const KeyIndicesBySlot& keys_by_slot,
+                                   const MultiGetRequest& request,
+                                   std::vector<RedisReply>* replies,
+                                   std::vector<const redisReply*>* values,
+                                   std::vector<bool>* redirected) {
+  std::vector<StringPieceVector> commands;
+  for (const auto& entry : keys_by_slot) {
+    commands.emplace_back();
+    StringPieceVector& command = commands.back();
+    command.push_back("MGET");
+    for (int index : entry.second) {
+      command.push_back(request[index].key);
+    }
+  }
+
+  std::vector<RedisReply> mget_replies;
+  {
+    ScopedMutex lock(connection->GetOperationMutex());
+    connection->RedisPipeline(commands, &mget_replies);
+  }
+
+  int command_index = 0;
+  for (const auto& entry : keys_by_slot) {
+    const std::vector<int>& indices = entry.second;
+    const RedisReply& reply = mget_replies[command_index++];
+    if (reply == nullptr) {
+      // Connection failure, already logged; report the keys as not found.
+    } else if (IsRedirectionError(reply.get()) ||
+               IsCrossSlotError(reply.get())) {
+      for (int index : indices) {
+        (*redirected)[index] = true;
+      }
+    } else if (reply->type == REDIS_REPLY_ARRAY &&
+               reply->elements == indices.size()) {
+      // Each element is either a string or nil for a missing key.
+      for (size_t i = 0; i < indices.size(); ++i) {
+        (*values)[indices[i]] = reply->element[i];
+      }
+    } else {
+      GoogleString error = (reply->type == REDIS_REPLY_ERROR)
+          ? GoogleString(reply->str, reply->len)
+          : StrCat("unexpected reply type ", IntegerToString(reply->type));
+      LOG(DFATAL) << "MGET: redis returned error: " << error;
+      message_handler_->Message(kError, "MGET: redis returned error: %s",
+                                error.c_str());
+    }
+  }
+  for (RedisReply& reply : mget_replies) {
+    replies->push_back(std::move(reply));
+  }
+}
+
 void RedisCache::GetStatus(GoogleString* buffer) {
   StrAppend(buffer, "Statistics for Redis (", ServerDescription(), "):\n");
 
@@ -561,9 +727,8 @@ void RedisCache::Connection::ShutDown() {
   // that a shutdown happens while it has released its lock and is waiting
   // for TryConnect().
   //
-  // TODO(yeputons): be careful when adding async requests: ShutDown can be
-  // called while there are some unfinished requests, they should return.
-  redis_.reset();
+  // Unread replies to pipelined SETs are dropped along with the context.
+  ResetContext();
   state_ = kShutDown;
 }
 
@@ -630,7 +795,7 @@ bool RedisCache::Connection::EnsureDatabaseSelection() {
     if (reply == nullptr) {
       ScopedMutex lock(state_mutex_.get());
       state_ = kDisconnected;
-      redis_.reset();
+      ResetContext();
       return false;
     }
   }
@@ -687,13 +852,18 @@ void RedisCache::Connection::UpdateState() {
     state_ = kConnected;
   } else {
     state_ = kDisconnected;
-    redis_.reset();
+    ResetContext();
   }
 }
 
+void RedisCache::Connection::ResetContext() {
+  redis_.reset();
+  pending_puts_.clear();
+}
+
 RedisCache::RedisReply RedisCache::Connection::RedisCommand(const char* format,
                                                             va_list args) {
-  if (!EnsureConnectionAndDatabaseSelection()) {
+  if (!EnsureConnectionAndDatabaseSelection() || !ReadPendingReplies()) {
     return nullptr;
   }
 
@@ -713,6 +883,97 @@ RedisCache::RedisReply RedisCache::Connection::RedisCommand(
   return reply;
 }
 
+bool RedisCache::Connection::AppendSet(const GoogleString& key,
+                                       const SharedString& value) {
+  if (!EnsureConnectionAndDatabaseSelection()) {
+    return false;
+  }
+  if (pending_puts_.size() >= kMaxPendingPuts && !ReadPendingReplies()) {
+    return false;
+  }
+
+  int status = redisAppendCommand(
+      redis_.get(), "SET %b %b", key.data(), key.length(),
+      value.data(), static_cast<size_t>(value.size()));
+  // Push the command out right away, so the server works on it while we
+  // don't wait.  Blocks only if the socket buffer is full.
+  int done = 0;
+  while (status == REDIS_OK && !done) {
+    status = redisBufferWrite(redis_.get(), &done);
+  }
+  if (status == REDIS_OK) {
+    pending_puts_.emplace_back(key, value);
+  } else {
+    LogRedisContextError(redis_.get(), "SET");
+  }
+  ScopedMutex lock(state_mutex_.get());
+  UpdateState();
+  return status == REDIS_OK;
+}
+
+bool RedisCache::Connection::ReadPendingReplies() {
+  if (pending_puts_.empty()) {
+    return true;
+  }
+  // A failure clears pending_puts_ along with redis_, ending the loop.
+  while (!pending_puts_.empty()) {
+    void* result = nullptr;
+    redisGetReply(redis_.get(), &result);
+    RedisReply reply(static_cast<redisReply*>(result));
+    if (IsRedirectionError(reply.get())) {
+      redirected_puts_.push_back(std::move(pending_puts_.front()));
+      pending_puts_.pop_front();
+    } else {
+      pending_puts_.pop_front();
+      ValidateRedisReply(reply, {REDIS_REPLY_STATUS}, "SET");
+    }
+  }
+  return redis_ != nullptr;
+}
+
+void RedisCache::Connection::RedisPipeline(
+    const std::vector<StringPieceVector>& commands,
+    std::vector<RedisReply>* replies) {
+  replies->clear();
+  if (!EnsureConnectionAndDatabaseSelection() || !ReadPendingReplies()) {
+    replies->resize(commands.size());
+    return;
+  }
+
+  // hiredis buffers appended commands and writes them all out when the first
+  // reply is requested.
+  std::vector<const char*> argv;
+  std::vector<size_t> argvlen;
+  for (const StringPieceVector& command : commands) {
+    argv.clear();
+    argvlen.clear();
+    for (StringPiece arg : command) {
+      argv.push_back(arg.data());
+      argvlen.push_back(arg.size());
+    }
+    redisAppendCommandArgv(redis_.get(), argv.size(), argv.data(),
+                           argvlen.data());
+  }
+  for (size_t i = 0; i < commands.size(); ++i) {
+    void* result = nullptr;
+    if (redisGetReply(redis_.get(), &result) != REDIS_OK) {
+      LogRedisContextError(redis_.get(), "Pipelined command");
+      break;
+    }
+    replies->emplace_back(static_cast<redisReply*>(result));
+  }
+  replies->resize(commands.size());
+
+  ScopedMutex lock(state_mutex_.get());
+  UpdateState();
+}
+
+void RedisCache::Connection::TakeRedirectedPuts(
+    std::vector<PendingPut>* puts) {
+  puts->clear();
+  puts->swap(redirected_puts_);
+}
+
 void RedisCache::Connection::LogRedisContextError(redisContext* context,
                                       const char* cause) {
   if (context == nullptr) {
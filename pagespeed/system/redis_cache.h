@@ -23,9 +23,11 @@
 
 #include <stdarg.h>
 
+#include <deque>
 #include <memory>
 #include <initializer_list>
 #include <map>
+#include <utility>
 #include <vector>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -71,6 +73,15 @@ namespace net_instaweb {
 //
 // http://redis.io/topics/cluster-spec explains this all.
 //
+// To keep bursts of lookups cheap, MultiGet() sends one MGET per hash slot
+// and pipelines all MGETs bound for the same server, so a burst costs a
+// single round trip per server.  Put() is write-behind: SET is sent without
+// waiting for its reply, and replies are checked before the next command on
+// that connection waits for one of its own.  Commands on a connection are
+// executed in order, and SETs a cluster node redirected are redone before the
+// next command for their connection, so a Get() always sees an earlier Put()
+// of the same key.
+//
 // TODO(yeputons): consider extracting a common interface with AprMemCache.
 // TODO(yeputons): consider making Redis-reported errors treated as failures.
 // TODO(yeputons): add redis AUTH command support.
@@ -103,6 +114,7 @@ class RedisCache : public CacheInterface {
   void Get(const GoogleString& key, Callback* callback) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
+  void MultiGet(MultiGetRequest* request) override;
 
   // Appends detailed status for each server to a string.  If a server fails to
   // report a status, then for that server we append an error message instead.
@@ -142,6 +154,9 @@ class RedisCache : public CacheInterface {
   };
   typedef std::unique_ptr<redisContext, RedisContextDeleter> RedisContext;
 
+  // Key and value of a SET sent without waiting for its reply.
+  typedef std::pair<GoogleString, SharedString> PendingPut;
+
   class Connection {
    public:
     Connection(RedisCache* redis_cache, StringPiece host, int port,
@@ -171,6 +186,31 @@ class RedisCache : public CacheInterface {
                             const char* command_executed)
         EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
 
+    // Sends SET without waiting for its reply, which is read later by
+    // ReadPendingReplies().  Returns false if the command could not be sent.
+    bool AppendSet(const GoogleString& key, const SharedString& value)
+        EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
+
+    // Reads and checks the replies to SETs sent by AppendSet().  This happens
+    // before any command which waits for its reply, and once kMaxPendingPuts
+    // replies are outstanding.  Returns false if the connection broke while
+    // doing so.
+    bool ReadPendingReplies()
+        EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
+
+    // Moves the SETs which a cluster node redirected elsewhere, and so were
+    // not done, to *puts.  They should be redone by RedisCache.
+    void TakeRedirectedPuts(std::vector<PendingPut>* puts)
+        EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_);
+
+    // Sends all commands in a single write, then reads their replies into
+    // *replies in the same order.  A reply that could not be read is nullptr,
+    // and so are all replies after it.  Unlike RedisCommand(), this updates
+    // the connection state itself; the replies' types are left to the caller.
+    void RedisPipeline(const std::vector<StringPieceVector>& commands,
+                       std::vector<RedisReply>* replies)
+        EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
+
    private:
     enum State {
       kShutDown,
@@ -193,6 +233,9 @@ class RedisCache : public CacheInterface {
 
     RedisContext TryConnect() LOCKS_EXCLUDED(redis_mutex_, state_mutex_);
 
+    // Drops redis_ along with the SETs whose replies we will never get.
+    void ResetContext() EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_);
+
     void LogRedisContextError(redisContext* redis, const char* cause);
 
     const RedisCache* redis_cache_;
@@ -202,6 +245,8 @@ class RedisCache : public CacheInterface {
     const scoped_ptr<AbstractMutex> state_mutex_;
 
     RedisContext redis_ GUARDED_BY(redis_mutex_);
+    std::deque<PendingPut> pending_puts_ GUARDED_BY(redis_mutex_);
+    std::vector<PendingPut> redirected_puts_ GUARDED_BY(redis_mutex_);
     State state_ GUARDED_BY(state_mutex_);
     int64 next_reconnect_at_ms_ GUARDED_BY(state_mutex_);
 
@@ -238,6 +283,31 @@ class RedisCache : public CacheInterface {
   RedisReply RedisCommand(Connection* connection, const char* format,
                           std::initializer_list<int> valid_reply_types, ...);
 
+  // Returns the connection for key, having first read the replies to any SETs
+  // pipelined on it.  Redirected SETs are redone, so the caller sees them,
+  // and as that can refresh the slot mapping, key is then looked up again.
+  // Returns nullptr if the connection failed while reading the replies.
+  Connection* ConnectionForKey(StringPiece key)
+      LOCKS_EXCLUDED(cluster_map_lock_);
+
+  // Redoes SETs, following redirections, and waits for them.
+  void RedoPuts(const std::vector<PendingPut>& puts);
+
+  typedef std::map<int, std::vector<int>> KeyIndicesBySlot;
+
+  // Sends one MGET per slot in keys_by_slot, all pipelined to connection, for
+  // the keys of request at the listed indices.  Outside cluster mode all the
+  // keys are listed under a single slot.  The replies are appended to
+  // *replies, and the entry for each looked-up key is stored into
+  // (*values)[index].  Keys the server redirected elsewhere, or refused
+  // because they span slots, are marked in *redirected instead.
+  void PipelinedMultiGet(Connection* connection,
+                         const KeyIndicesBySlot& keys_by_slot,
+                         const MultiGetRequest& request,
+                         std::vector<RedisReply>* replies,
+                         std::vector<const redisReply*>* values,
+                         std::vector<bool>* redirected);
+
   ThreadSynchronizer* GetThreadSynchronizerForTesting() const {
     return thread_synchronizer_.get();
   }
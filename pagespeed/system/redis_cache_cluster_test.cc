@@ -179,8 +179,10 @@ TEST_F(RedisCacheClusterTest, OtherNodesPutGetDelete) {
   }
 
   CheckPut(kKeyOnNode2, kValue1);
+  CheckGet(kKeyOnNode2, kValue1);
   // This should have redirected us from node1 to node2, and prompted us to
-  // update our cluster map.
+  // update our cluster map.  Put() does not wait for its reply, so the
+  // redirection is only noticed, and the SET redone, by the Get().
   EXPECT_EQ(1, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 
@@ -200,6 +202,41 @@ TEST_F(RedisCacheClusterTest, OtherNodesPutGetDelete) {
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 }
 
+TEST_F(RedisCacheClusterTest, MultiGetAcrossNodes) {
+  if (!InitRedisClusterOrSkip()) {
+    return;
+  }
+
+  CheckPut(kKeyOnNode1, kValue1);
+
+  // Before the cluster map is known, the keys all go to the first node in a
+  // single MGET, which it refuses; each key is then looked up on its own.
+  Callback* n1 = AddCallback();
+  Callback* n1b = AddCallback();
+  Callback* n2 = AddCallback();
+  IssueMultiGet(n1, kKeyOnNode1, n1b, kKeyOnNode1b, n2, kKeyOnNode2);
+  WaitAndCheck(n1, kValue1);
+  WaitAndCheckNotFound(n1b);
+  WaitAndCheckNotFound(n2);
+
+  CheckPut(kKeyOnNode2, kValue2);
+  CheckGet(kKeyOnNode2, kValue2);
+  CheckPut(kKeyOnNode3, kValue3);
+  CheckGet(kKeyOnNode3, kValue3);
+  int64 redirections = cache_->Redirections();
+
+  // Once it is known, every node gets one MGET per slot, and none of them is
+  // redirected.
+  Callback* m1 = AddCallback();
+  Callback* m2 = AddCallback();
+  Callback* m3 = AddCallback();
+  IssueMultiGet(m1, kKeyOnNode1, m2, kKeyOnNode2, m3, kKeyOnNode3);
+  WaitAndCheck(m1, kValue1);
+  WaitAndCheck(m2, kValue2);
+  WaitAndCheck(m3, kValue3);
+  EXPECT_EQ(redirections, cache_->Redirections());
+}
+
 TEST_F(RedisCacheClusterTest, SlotBoundaries) {
   // These are designed to exercise the slot lookup code at slot boundaries.
   // 0 and 16384 are min/max slot. Slot 10999 is on node 2 and 11000 is on node
@@ -220,6 +257,7 @@ TEST_F(RedisCacheClusterTest, SlotBoundaries) {
 
   // Do one lookup with a redirection, to prime the table.
   CheckPut(kKeyOnNode2, kValue1);
+  CheckGet(kKeyOnNode2, kValue1);
   EXPECT_EQ(1, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 
@@ -268,6 +306,10 @@ TEST_F(RedisCacheClusterTest, GetStatus) {
 
   CheckPut(kKeyOnNode2, kValue2);
   CheckPut(kKeyOnNode3, kValue1);
+  // The SETs were pipelined to the main node; getting the keys makes us
+  // follow the redirections.
+  CheckGet(kKeyOnNode2, kValue2);
+  CheckGet(kKeyOnNode3, kValue1);
 
   // Now we're connected to all the nodes.
   status.clear();
@@ -357,10 +399,9 @@ TEST_F(RedisCacheClusterTestWithReconfiguration, HandlesMigrations) {
   EXPECT_EQ(2, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 
+  // The pipelined SET is redirected once, and redone with ASKING before the
+  // Get(), which is redirected as well.
   CheckPut(kKeyOnNode1, kValue3);
-  EXPECT_EQ(3, cache_->Redirections());
-  EXPECT_EQ(1, cache_->ClusterSlotsFetches());
-
   CheckGet(kKeyOnNode1, kValue3);
   EXPECT_EQ(4, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
@@ -0,0 +1,192 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Measures the round trips MultiGet() and pipelined Put() save over issuing
+// Redis commands one by one, for a burst of kBurstSize keys such as a
+// property-cache or metadata lookup produces.  Time is dominated by network
+// latency, so run it against a server on a realistic network path as well as
+// on localhost.
+//
+// These benchmarks need a running redis-server: set $REDIS_PORT to its port on
+// localhost, e.g. via install/run_program_with_redis.sh.  Otherwise they log
+// an error and measure nothing.
+//
+// RedisSequentialGets  does kBurstSize Get()s, each a round trip.
+// RedisMultiGet        does one MultiGet() of the same keys: one round trip.
+// RedisAwaitedPuts     does kBurstSize Put()s, each followed by a Get() so
+//                      that it waits for the reply, as Put() used to.
+// RedisPipelinedPuts   does kBurstSize Put()s followed by one Get().
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include "pagespeed/system/redis_cache.h"
+
+#include <cstdlib>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/posix_timer.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+
+namespace {
+
+const int kBurstSize = 32;
+const int kPayloadSize = 1000;
+const int kReconnectionDelayMs = 10;
+const int kTimeoutUs = 1000 * 1000;
+
+class EmptyCallback : public net_instaweb::CacheInterface::Callback {
+ public:
+  EmptyCallback() {}
+  virtual ~EmptyCallback() {}
+  virtual void Done(net_instaweb::CacheInterface::KeyState state) {}
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EmptyCallback);
+};
+
+class RedisBenchmark {
+ public:
+  RedisBenchmark()
+      : thread_system_(net_instaweb::Platform::CreateThreadSystem()),
+        statistics_(thread_system_.get()) {
+    StopBenchmarkTiming();
+    const char* port_string = getenv("REDIS_PORT");
+    int port;
+    if (port_string == nullptr ||
+        !net_instaweb::StringToInt(port_string, &port)) {
+      LOG(ERROR) << "Redis benchmarks are skipped because env var "
+                 << "$REDIS_PORT is not set to an integer.";
+    } else {
+      net_instaweb::RedisCache::InitStats(&statistics_);
+      cache_.reset(new net_instaweb::RedisCache(
+          "localhost", port, thread_system_.get(), &handler_, &timer_,
+          kReconnectionDelayMs, kTimeoutUs, &statistics_,
+          0 /* database_index */));
+      cache_->StartUp();
+      value_.Assign(GoogleString(kPayloadSize, 'v'));
+      for (int k = 0; k < kBurstSize; ++k) {
+        keys_.push_back(net_instaweb::StrCat(
+            "redis_benchmark_key_", net_instaweb::IntegerToString(k)));
+        cache_->Put(keys_.back(), value_);
+      }
+      // Flush the pipelined Put()s before timing starts.
+      cache_->Get(keys_[0], &empty_callback_);
+    }
+    StartBenchmarkTiming();
+  }
+
+  ~RedisBenchmark() {
+    StopBenchmarkTiming();
+    if (cache_.get() != nullptr) {
+      for (const GoogleString& key : keys_) {
+        cache_->Delete(key);
+      }
+    }
+  }
+
+  bool ok() const { return cache_.get() != nullptr; }
+
+  void DoSequentialGets() {
+    for (const GoogleString& key : keys_) {
+      cache_->Get(key, &empty_callback_);
+    }
+  }
+
+  void DoMultiGet() {
+    net_instaweb::CacheInterface::MultiGetRequest* request =
+        new net_instaweb::CacheInterface::MultiGetRequest;
+    for (const GoogleString& key : keys_) {
+      request->push_back(
+          net_instaweb::CacheInterface::KeyCallback(key, &empty_callback_));
+    }
+    cache_->MultiGet(request);
+  }
+
+  void DoPuts(bool await_each) {
+    for (const GoogleString& key : keys_) {
+      cache_->Put(key, value_);
+      if (await_each) {
+        cache_->Get(key, &empty_callback_);
+      }
+    }
+    if (!await_each) {
+      cache_->Get(keys_[0], &empty_callback_);
+    }
+  }
+
+ private:
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system_;
+  net_instaweb::SimpleStats statistics_;
+  net_instaweb::PosixTimer timer_;
+  net_instaweb::NullMessageHandler handler_;
+  net_instaweb::scoped_ptr<net_instaweb::RedisCache> cache_;
+  net_instaweb::StringVector keys_;
+  net_instaweb::SharedString value_;
+  EmptyCallback empty_callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(RedisBenchmark);
+};
+
+static void RedisSequentialGets(int iters) {
+  RedisBenchmark benchmark;
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.DoSequentialGets();
+  }
+}
+
+static void RedisMultiGet(int iters) {
+  RedisBenchmark benchmark;
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.DoMultiGet();
+  }
+}
+
+static void RedisAwaitedPuts(int iters) {
+  RedisBenchmark benchmark;
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.DoPuts(true /* await_each */);
+  }
+}
+
+static void RedisPipelinedPuts(int iters) {
+  RedisBenchmark benchmark;
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.DoPuts(false /* await_each */);
+  }
+}
+
+}  // namespace
+
+BENCHMARK(RedisSequentialGets);
+BENCHMARK(RedisMultiGet);
+BENCHMARK(RedisAwaitedPuts);
+BENCHMARK(RedisPipelinedPuts);
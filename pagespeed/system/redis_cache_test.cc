@@ -22,7 +22,10 @@
 
 #include "pagespeed/system/redis_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <utility>
+#include <vector>
 
 #include "apr_network_io.h"  // NOLINT
 #include "base/logging.h"
@@ -221,6 +224,63 @@ TEST_F(RedisCacheTest, MultiGet) {
   TestMultiGet();  // Test from CacheTestBase is just fine.
 }
 
+// Enough keys to span many hash slots, which a plain server still gets in a
+// single MGET.
+TEST_F(RedisCacheTest, MultiGetManyKeys) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  InitRedisWithCustomDatabaseIndex(0);
+
+  static const int kNumKeys = 100;
+  for (int i = 0; i < kNumKeys; i += 2) {
+    CheckPut(StrCat("Key", IntegerToString(i)),
+             StrCat("Value", IntegerToString(i)));
+  }
+
+  std::vector<Callback*> callbacks;
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  for (int i = 0; i < kNumKeys; ++i) {
+    callbacks.push_back(AddCallback());
+    request->push_back(CacheInterface::KeyCallback(
+        StrCat("Key", IntegerToString(i)), callbacks.back()));
+  }
+  Cache()->MultiGet(request);
+
+  for (int i = 0; i < kNumKeys; ++i) {
+    if (i % 2 == 0) {
+      WaitAndCheck(callbacks[i], StrCat("Value", IntegerToString(i)));
+    } else {
+      WaitAndCheckNotFound(callbacks[i]);
+    }
+  }
+}
+
+// Puts are not waited for, so make sure enough of them to trigger draining
+// their replies mid-stream still land, and are seen by later commands.
+TEST_F(RedisCacheTest, PipelinedPutsAreVisible) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  InitRedisWithCustomDatabaseIndex(0);
+
+  static const int kNumKeys = 200;
+  for (int i = 0; i < kNumKeys; ++i) {
+    CheckPut(StrCat("Key", IntegerToString(i)),
+             StrCat("Value", IntegerToString(i)));
+  }
+  CheckDelete("Key0");
+  CheckPut("Key1", "NewValue1");
+
+  CheckNotFound("Key0");
+  CheckGet("Key1", "NewValue1");
+  for (int i = 2; i < kNumKeys; ++i) {
+    CheckGet(StrCat("Key", IntegerToString(i)),
+             StrCat("Value", IntegerToString(i)));
+  }
+}
+
 TEST_F(RedisCacheTest, BasicInvalid) {
   if (!PrepareRedisOrSkip()) {
     return;
@@ -354,6 +414,140 @@ class RedisGetRespondingServerThread : public TcpServerThreadForTesting {
   }
 };
 
+// Stand-in server which expects SELECT followed by a scripted series of
+// exchanges. The request of each exchange must arrive in full, in however many
+// packets, before its answer is sent, so a client which waits for an answer
+// before it has sent the whole request times out instead.
+class RedisScriptedServerThread : public TcpServerThreadForTesting {
+ public:
+  typedef std::vector<std::pair<GoogleString, GoogleString>> Exchanges;
+
+  RedisScriptedServerThread(apr_port_t listen_port,
+                            ThreadSystem* thread_system,
+                            const Exchanges& exchanges)
+      : TcpServerThreadForTesting(listen_port, "redis_scripted_server",
+                                  thread_system),
+        exchanges_(exchanges) {}
+
+  virtual ~RedisScriptedServerThread() { ShutDown(); }
+
+ private:
+  void HandleClientConnection(apr_socket_t* sock) override {
+    static const char kSelectRequest[] =
+        "*2\r\n"
+        "$6\r\nSELECT\r\n"
+        "$1\r\n0\r\n";
+    static const char kSelectAnswer[] = "+OK\r\n";
+    EXPECT_EQ(kSelectRequest,
+              RecvExactly(sock, STATIC_STRLEN(kSelectRequest)));
+    apr_size_t answer_size_select = STATIC_STRLEN(kSelectAnswer);
+    apr_socket_send(sock, kSelectAnswer, &answer_size_select);
+
+    for (const auto& exchange : exchanges_) {
+      EXPECT_EQ(exchange.first, RecvExactly(sock, exchange.first.size()));
+      apr_size_t answer_size = exchange.second.size();
+      apr_socket_send(sock, exchange.second.data(), &answer_size);
+    }
+    apr_socket_close(sock);
+  }
+
+  static GoogleString RecvExactly(apr_socket_t* sock, size_t size) {
+    GoogleString result;
+    char buf[1024];
+    while (result.size() < size) {
+      apr_size_t recv_size = std::min(sizeof(buf), size - result.size());
+      if (apr_socket_recv(sock, buf, &recv_size) != APR_SUCCESS) {
+        break;
+      }
+      result.append(buf, recv_size);
+    }
+    return result;
+  }
+
+  const Exchanges exchanges_;
+};
+
+// Outside cluster mode, keys from different hash slots still go out in a
+// single MGET.
+class RedisMultiGetRespondingServerThread : public RedisScriptedServerThread {
+ public:
+  RedisMultiGetRespondingServerThread(apr_port_t listen_port,
+                                      ThreadSystem* thread_system)
+      : RedisScriptedServerThread(listen_port, thread_system,
+                                  MakeExchanges()) {}
+
+ private:
+  static Exchanges MakeExchanges() {
+    Exchanges exchanges;
+    exchanges.emplace_back(
+        "*4\r\n"
+        "$4\r\nMGET\r\n"
+        "$4\r\n{a}1\r\n"
+        "$4\r\n{a}2\r\n"
+        "$4\r\n{b}3\r\n",
+        "*3\r\n"
+        "$2\r\nv1\r\n"
+        "$-1\r\n"
+        "$2\r\nv3\r\n");
+    return exchanges;
+  }
+};
+
+// Both SETs must arrive before either is answered, and GET comes after.
+class RedisPipelinedPutServerThread : public RedisScriptedServerThread {
+ public:
+  RedisPipelinedPutServerThread(apr_port_t listen_port,
+                                ThreadSystem* thread_system)
+      : RedisScriptedServerThread(listen_port, thread_system,
+                                  MakeExchanges()) {}
+
+ private:
+  static Exchanges MakeExchanges() {
+    Exchanges exchanges;
+    exchanges.emplace_back(
+        "*3\r\n"
+        "$3\r\nSET\r\n"
+        "$2\r\nk1\r\n"
+        "$2\r\nv1\r\n"
+        "*3\r\n"
+        "$3\r\nSET\r\n"
+        "$2\r\nk2\r\n"
+        "$2\r\nv2\r\n",
+        "+OK\r\n"
+        "+OK\r\n");
+    exchanges.emplace_back(
+        "*2\r\n"
+        "$3\r\nGET\r\n"
+        "$2\r\nk1\r\n",
+        "$2\r\nv1\r\n");
+    return exchanges;
+  }
+};
+
+TEST_F(RedisCacheTest, MultiGetIsOneMgetOutsideCluster) {
+  InitRedisWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<RedisMultiGetRespondingServerThread>());
+  cache_[0]->StartUp();
+
+  Callback* a1 = AddCallback();
+  Callback* a2 = AddCallback();
+  Callback* b3 = AddCallback();
+  IssueMultiGet(a1, "{a}1", a2, "{a}2", b3, "{b}3");
+  WaitAndCheck(a1, "v1");
+  WaitAndCheckNotFound(a2);
+  WaitAndCheck(b3, "v3");
+}
+
+TEST_F(RedisCacheTest, PutDoesNotWaitForReply) {
+  InitRedisWithCustomServer();
+  ASSERT_TRUE(StartCustomServer<RedisPipelinedPutServerThread>());
+  cache_[0]->StartUp();
+
+  CheckPut("k1", "v1");
+  CheckPut("k2", "v2");
+  CheckGet("k1", "v1");
+}
+
 TEST_F(RedisCacheTest, ReconnectsInstantly) {
   InitRedisWithCustomServer();
   ASSERT_TRUE(StartCustomServer<RedisGetRespondingServerThread>());
@@ -653,7 +847,8 @@ TEST_F(RedisCacheTest, ShutDownDuringConnection) {
 
 // All RedisCacheOperationTimeoutTests start with a cache connected to a server
 // which accepts single connection and does not answer until test is finished.
-// The test calls a single command. If the timeout handling is correct, it times
+// The test calls a single command (or, for Put, which does not wait for its
+// reply, a command which has to). If the timeout handling is correct, it times
 // out and the test terminates correctly. If the timeout handling is not
 // correct, the test hangs.
 class RedisCacheOperationTimeoutTest : public RedisCacheTest {
@@ -680,10 +875,21 @@ TEST_F(RedisCacheOperationTimeoutTest, Get) {
   CheckNotFound("Key");
 }
 
-// TODO(yeputons): test MultiGet when it's a single command, not sequenced GET()
+TEST_F(RedisCacheOperationTimeoutTest, MultiGet) {
+  Callback* n0 = AddCallback();
+  Callback* n1 = AddCallback();
+  Callback* n2 = AddCallback();
+  IssueMultiGet(n0, "Key0", n1, "Key1", n2, "Key2");
+  WaitAndCheckNotFound(n0);
+  WaitAndCheckNotFound(n1);
+  WaitAndCheckNotFound(n2);
+}
 
 TEST_F(RedisCacheOperationTimeoutTest, Put) {
+  // Put() returns right away; the Get() behind it times out waiting for the
+  // reply to SET.
   CheckPut("Key", "Value");
+  CheckNotFound("Key");
 }
 
 TEST_F(RedisCacheOperationTimeoutTest, Delete) {
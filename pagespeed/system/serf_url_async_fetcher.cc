@@ -27,6 +27,7 @@
 
 #include <cstddef>
 #include <list>
+#include <map>
 #include <vector>
 
 #include "apr.h"
@@ -46,6 +47,8 @@
 #include "pagespeed/kernel/base/pool.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string_hash.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -71,6 +74,32 @@ enum HttpsOptions {
 const int kReliabilityCheckPeriodMs = 30 * net_instaweb::Timer::kMinuteMs;
 const int kReliabilityCheckMinFetches = 5;
 
+// Caps the idle keep-alive connections parked per origin.  Bursts of
+// concurrent fetches to one origin open more connections than this; the
+// excess is closed as those fetches finish.
+const size_t kMaxIdleConnectionsPerHost = 16;
+
+// How often Poll() looks for expired idle connections.
+const int64 kIdleSweepIntervalMs = net_instaweb::Timer::kSecondMs;
+
+// Each fetch thread owns this many points on the consistent-hash ring, which
+// evens out the share of origins each thread gets.
+const int kFetchThreadRingPoints = 64;
+
+// Hashes s onto the consistent-hash ring.  HashString alone maps similar
+// strings, such as one thread's ring point names, to nearby values, so its
+// result goes through the MurmurHash3 finalizer to spread them around.
+uint64 FetchThreadRingHash(StringPiece s) {
+  uint64 hash = net_instaweb::HashString<net_instaweb::CaseFold, uint64>(
+      s.data(), s.size());
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
 }  // namespace
 
 extern "C" {
@@ -114,6 +143,18 @@ const char SerfStats::kSerfFetchUltimateFailure[] =
     "serf_fetch_ultimate_failure";
 const char SerfStats::kSerfFetchLastCheckTimestampMs[] =
     "serf_fetch_last_check_timestamp_ms";
+const char SerfStats::kSerfFetchConnectionCreateCount[] =
+    "serf_fetch_connection_create_count";
+const char SerfStats::kSerfFetchConnectionReuseCount[] =
+    "serf_fetch_connection_reuse_count";
+const char SerfStats::kSerfFetchConnectionEvictCount[] =
+    "serf_fetch_connection_evict_count";
+const char SerfStats::kSerfFetchIdleConnections[] =
+    "serf_fetch_idle_connections";
+const char SerfStats::kSerfFetchThreadQueueDepthPrefix[] =
+    "serf_fetch_queue_depth_thread_";
+const char SerfStats::kSerfFetchThreadPollTimeUsPrefix[] =
+    "serf_fetch_poll_time_us_thread_";
 
 GoogleString GetAprErrorString(apr_status_t status) {
   char error_str[1024];
@@ -121,6 +162,216 @@ GoogleString GetAprErrorString(apr_status_t status) {
   return error_str;
 }
 
+// A serf connection to one origin, along with the pool, bucket allocator and
+// SSL context it needs.  It carries one SerfFetch at a time.  Between fetches
+// SerfUrlAsyncFetcher may park it in its keep-alive pool, so that the next
+// fetch to the same origin skips the TCP and TLS handshakes.  All methods
+// must be called with the fetcher's mutex_ held.
+class SerfConnection {
+ public:
+  SerfConnection(SerfUrlAsyncFetcher* fetcher, const GoogleString& key,
+                 bool using_https, const char* sni_host)
+      : fetcher_(fetcher),
+        key_(key),
+        using_https_(using_https),
+        pool_(NULL),
+        bucket_alloc_(NULL),
+        sni_host_(NULL),
+        connection_(NULL),
+        ssl_context_(NULL),
+        fetch_(NULL),
+        closed_(false),
+        idle_since_ms_(0) {
+    apr_pool_create(&pool_, fetcher_->pool());
+    bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
+    if (sni_host != NULL) {
+      sni_host_ = apr_pstrdup(pool_, sni_host);
+    }
+  }
+
+  ~SerfConnection() {
+    DCHECK(fetch_ == NULL);
+    if (connection_ != NULL) {
+      serf_connection_close(connection_);
+    }
+    apr_pool_destroy(pool_);
+  }
+
+  // Creates the serf connection to the host and port of url.
+  apr_status_t Open(serf_context_t* context, const apr_uri_t& url) {
+    return serf_connection_create2(&connection_, context, url,
+                                   ConnectionSetup, this,
+                                   ClosedConnection, this,
+                                   pool_);
+  }
+
+  // Queues fetch's request.  The connection must not be carrying another.
+  void StartRequest(SerfFetch* fetch) {
+    DCHECK(fetch_ == NULL);
+    fetch_ = fetch;
+    serf_connection_request_create(connection_, SerfFetch::SetupRequest,
+                                   fetch);
+  }
+
+  void FinishRequest() { fetch_ = NULL; }
+
+  // Whether the socket can take another request: serf has not closed it and
+  // the last poll saw no error on it.
+  bool IsHealthy() const {
+    return !closed_ && (connection_ != NULL) &&
+        !serf_connection_is_in_error_state(connection_);
+  }
+
+  // Whether the last poll saw an error on a socket serf still considers
+  // open.  Once serf has closed the socket it handles any retry itself.
+  bool IsInErrorState() const {
+    return !closed_ && (connection_ != NULL) &&
+        serf_connection_is_in_error_state(connection_);
+  }
+
+  const GoogleString& key() const { return key_; }
+  int64 idle_since_ms() const { return idle_since_ms_; }
+  void set_idle_since_ms(int64 x) { idle_since_ms_ = x; }
+
+ private:
+  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
+  // (surfacepatterns@gmail.com).
+  //
+  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
+  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
+  //
+  // Certificates are only checked during the handshake, which happens on
+  // behalf of the fetch that opened (or re-opened) the socket.  A connection
+  // whose fetch saw a certificate error is never pooled.
+#if SERF_HTTPS_FETCHING
+  static apr_status_t SSLCertValidate(void *data, int failures,
+                                      const serf_ssl_certificate_t *cert) {
+    SerfFetch* fetch = static_cast<SerfConnection*>(data)->fetch_;
+    if (fetch == NULL) {
+      return APR_EGENERAL;
+    }
+    return fetch->HandleSSLCertValidation(failures, 0, cert);
+  }
+
+  static apr_status_t SSLCertChainValidate(
+      void *data, int failures, int error_depth,
+      const serf_ssl_certificate_t * const *certs,
+      apr_size_t certs_count) {
+    SerfFetch* fetch = static_cast<SerfConnection*>(data)->fetch_;
+    if (fetch == NULL) {
+      return APR_EGENERAL;
+    }
+    return fetch->HandleSSLCertValidation(failures, error_depth, NULL);
+  }
+#endif
+
+  static apr_status_t ConnectionSetup(
+      apr_socket_t* socket, serf_bucket_t **read_bkt,
+      serf_bucket_t **write_bkt, void* setup_baton, apr_pool_t* pool);
+
+  static void ClosedConnection(serf_connection_t* conn,
+                               void* closed_baton,
+                               apr_status_t why,
+                               apr_pool_t* pool);
+
+  SerfUrlAsyncFetcher* fetcher_;
+  const GoogleString key_;
+  const bool using_https_;
+  apr_pool_t* pool_;
+  serf_bucket_alloc_t* bucket_alloc_;
+  const char* sni_host_;  // in pool_
+  serf_connection_t* connection_;
+  serf_ssl_context_t* ssl_context_;
+  SerfFetch* fetch_;  // The fetch currently carried, if any.
+  bool closed_;  // Set once serf has closed the socket.
+  int64 idle_since_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfConnection);
+};
+
+// static
+apr_status_t SerfConnection::ConnectionSetup(
+    apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
+    void* setup_baton, apr_pool_t* pool) {
+  SerfConnection* connection = static_cast<SerfConnection*>(setup_baton);
+  *read_bkt = serf_bucket_socket_create(socket, connection->bucket_alloc_);
+#if SERF_HTTPS_FETCHING
+  apr_status_t status = APR_SUCCESS;
+  if (connection->using_https_) {
+    *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt,
+                                               connection->ssl_context_,
+                                               connection->bucket_alloc_);
+    if (connection->ssl_context_ == NULL) {
+      connection->ssl_context_ = serf_bucket_ssl_decrypt_context_get(*read_bkt);
+      if (connection->ssl_context_ == NULL) {
+        status = APR_EGENERAL;
+      } else {
+        SerfUrlAsyncFetcher* fetcher = connection->fetcher_;
+        const GoogleString& certs_dir = fetcher->ssl_certificates_dir();
+        const GoogleString& certs_file = fetcher->ssl_certificates_file();
+
+        if (!certs_file.empty()) {
+          status = serf_ssl_set_certificates_file(
+              connection->ssl_context_, certs_file.c_str());
+        }
+        if ((status == APR_SUCCESS) && !certs_dir.empty()) {
+          status = serf_ssl_set_certificates_directory(connection->ssl_context_,
+                                                       certs_dir.c_str());
+        }
+
+        // If no explicit file or directory is specified, then use the
+        // compiled-in default.
+        if (certs_dir.empty() && certs_file.empty()) {
+          status = serf_ssl_use_default_certificates(connection->ssl_context_);
+        }
+      }
+      if (status != APR_SUCCESS) {
+        return status;
+      }
+    }
+
+    serf_ssl_server_cert_callback_set(
+        connection->ssl_context_, SSLCertValidate, connection);
+
+    serf_ssl_server_cert_chain_callback_set(
+        connection->ssl_context_, SSLCertValidate, SSLCertChainValidate,
+        connection);
+
+    status = serf_ssl_set_hostname(connection->ssl_context_,
+                                   connection->sni_host_);
+    if (status != APR_SUCCESS) {
+      LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
+                   "setup failed";
+      return status;
+    }
+    *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt,
+                                                connection->ssl_context_,
+                                                connection->bucket_alloc_);
+  }
+#endif
+  return APR_SUCCESS;
+}
+
+// static
+void SerfConnection::ClosedConnection(serf_connection_t* conn,
+                                      void* closed_baton,
+                                      apr_status_t why,
+                                      apr_pool_t* pool) {
+  SerfConnection* connection = static_cast<SerfConnection*>(closed_baton);
+  if (why != APR_SUCCESS) {
+    SerfFetch* fetch = connection->fetch_;
+    MessageHandler* handler = (fetch != NULL) ?
+        fetch->message_handler() : connection->fetcher_->message_handler_;
+    handler->Warning(
+        (fetch != NULL) ? fetch->DebugInfo().c_str() : connection->key_.c_str(),
+        0, "Connection close (code=%d %s).",
+        why, GetAprErrorString(why).c_str());
+  }
+  // Serf would reopen the socket for a later request, but a closed
+  // connection is not worth keeping in the idle pool.
+  connection->closed_ = true;
+}
+
 SerfFetch::SerfFetch(const GoogleString& url,
                      AsyncFetch* async_fetch,
                      MessageHandler* message_handler,
@@ -133,15 +384,14 @@ SerfFetch::SerfFetch(const GoogleString& url,
       status_line_read_(false),
       message_handler_(message_handler),
       pool_(NULL),  // filled in once assigned to a thread, to use its pool.
-      bucket_alloc_(NULL),
       host_header_(NULL),
       sni_host_(NULL),
       connection_(NULL),
+      connection_reusable_(false),
       bytes_received_(0),
       fetch_start_ms_(0),
       fetch_end_ms_(0),
       using_https_(false),
-      ssl_context_(NULL),
       ssl_error_message_(NULL) {
   memset(&url_, 0, sizeof(url_));
 }
@@ -149,7 +399,7 @@ SerfFetch::SerfFetch(const GoogleString& url,
 SerfFetch::~SerfFetch() {
   DCHECK(async_fetch_ == NULL);
   if (connection_ != NULL) {
-    serf_connection_close(connection_);
+    fetcher_->ReleaseConnection(connection_, connection_reusable_);
   }
   if (pool_ != NULL) {
     apr_pool_destroy(pool_);
@@ -190,7 +440,10 @@ void SerfFetch::Cancel(CancelCause cause) {
     // keep re-detecting it, which will interfere with other jobs getting
     // handled (until we finally cleanup the old fetch and close things in
     // ~SerfFetch).
-    serf_connection_close(connection_);
+    //
+    // Either way the connection is in an unknown state, so it is closed
+    // rather than returned to the keep-alive pool.
+    fetcher_->ReleaseConnection(connection_, false /* reusable */);
     connection_ = NULL;
   }
 
@@ -205,6 +458,7 @@ void SerfFetch::CallCallback(SerfCompletionResult result) {
   }
 
   if (async_fetch_ != NULL) {
+    connection_reusable_ = (result == SerfCompletionResult::kSuccess);
     fetch_end_ms_ = timer_->NowMs();
     fetcher_->ReportCompletedFetchStats(this);
     CallbackDone(result);
@@ -241,8 +495,7 @@ void SerfFetch::CallbackDone(SerfCompletionResult result) {
 }
 
 void SerfFetch::CleanupIfError() {
-  if ((connection_ != NULL) &&
-      serf_connection_is_in_error_state(connection_)) {
+  if ((connection_ != NULL) && connection_->IsInErrorState()) {
     message_handler_->Message(
         kInfo, "Serf cleanup for error'd fetch of: %s", DebugInfo().c_str());
     Cancel(CancelCause::kSerfError);
@@ -257,100 +510,6 @@ int64 SerfFetch::TimeDuration() const {
   }
 }
 
-#if SERF_HTTPS_FETCHING
-// static
-apr_status_t SerfFetch::SSLCertValidate(void *data, int failures,
-                                     const serf_ssl_certificate_t *cert) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, 0, cert);
-}
-
-// static
-apr_status_t SerfFetch::SSLCertChainValidate(
-    void *data, int failures, int error_depth,
-    const serf_ssl_certificate_t * const *certs,
-    apr_size_t certs_count) {
-  return static_cast<SerfFetch*>(data)->HandleSSLCertValidation(
-      failures, error_depth, NULL);
-}
-#endif
-
-// static
-apr_status_t SerfFetch::ConnectionSetup(
-    apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-    void* setup_baton, apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(setup_baton);
-  *read_bkt = serf_bucket_socket_create(socket, fetch->bucket_alloc_);
-#if SERF_HTTPS_FETCHING
-  apr_status_t status = APR_SUCCESS;
-  if (fetch->using_https_) {
-    *read_bkt = serf_bucket_ssl_decrypt_create(*read_bkt,
-                                               fetch->ssl_context_,
-                                               fetch->bucket_alloc_);
-    if (fetch->ssl_context_ == NULL) {
-      fetch->ssl_context_ = serf_bucket_ssl_decrypt_context_get(*read_bkt);
-      if (fetch->ssl_context_ == NULL) {
-        status = APR_EGENERAL;
-      } else {
-        SerfUrlAsyncFetcher* fetcher = fetch->fetcher_;
-        const GoogleString& certs_dir = fetcher->ssl_certificates_dir();
-        const GoogleString& certs_file = fetcher->ssl_certificates_file();
-
-        if (!certs_file.empty()) {
-          status = serf_ssl_set_certificates_file(
-              fetch->ssl_context_, certs_file.c_str());
-        }
-        if ((status == APR_SUCCESS) && !certs_dir.empty()) {
-          status = serf_ssl_set_certificates_directory(fetch->ssl_context_,
-                                                       certs_dir.c_str());
-        }
-
-        // If no explicit file or directory is specified, then use the
-        // compiled-in default.
-        if (certs_dir.empty() && certs_file.empty()) {
-          status = serf_ssl_use_default_certificates(fetch->ssl_context_);
-        }
-      }
-      if (status != APR_SUCCESS) {
-        return status;
-      }
-    }
-
-    serf_ssl_server_cert_callback_set(
-        fetch->ssl_context_, SSLCertValidate, fetch);
-
-    serf_ssl_server_cert_chain_callback_set(
-        fetch->ssl_context_, SSLCertValidate, SSLCertChainValidate, fetch);
-
-    status = serf_ssl_set_hostname(fetch->ssl_context_, fetch->sni_host_);
-    if (status != APR_SUCCESS) {
-      LOG(INFO) << "Unable to set hostname from serf fetcher. Connection "
-                   "setup failed";
-      return status;
-    }
-    *write_bkt = serf_bucket_ssl_encrypt_create(*write_bkt,
-                                                fetch->ssl_context_,
-                                                fetch->bucket_alloc_);
-  }
-#endif
-  return APR_SUCCESS;
-}
-
-// static
-void SerfFetch::ClosedConnection(serf_connection_t* conn,
-                                 void* closed_baton,
-                                 apr_status_t why,
-                                 apr_pool_t* pool) {
-  SerfFetch* fetch = static_cast<SerfFetch*>(closed_baton);
-  if (why != APR_SUCCESS) {
-    fetch->message_handler_->Warning(
-        fetch->DebugInfo().c_str(), 0, "Connection close (code=%d %s).",
-        why, GetAprErrorString(why).c_str());
-  }
-  // Connection is closed.
-  fetch->connection_ = NULL;
-}
-
 // static
 serf_bucket_t* SerfFetch::AcceptResponse(serf_request_t* request,
                                          serf_bucket_t* stream,
@@ -761,9 +920,13 @@ bool SerfFetch::ParseUrl() {
 
 class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
  public:
-  SerfThreadedFetcher(SerfUrlAsyncFetcher* parent, const char* proxy) :
+  SerfThreadedFetcher(SerfUrlAsyncFetcher* parent, const char* proxy,
+                      UpDownCounter* queue_depth, Variable* poll_time_us) :
       SerfUrlAsyncFetcher(parent, proxy),
       thread_id_(NULL),
+      queue_depth_(queue_depth),
+      reported_queue_depth_(0),
+      poll_time_us_(poll_time_us),
       initiate_mutex_(parent->thread_system()->NewMutex()),
       initiate_fetches_(new SerfFetchPool()),
       initiate_fetches_nonempty_(initiate_mutex_->NewCondvar()),
@@ -789,6 +952,7 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
     LOG(INFO) << "Waiting for threaded serf fetcher to terminate";
     apr_status_t ignored_retval;
     apr_thread_join(&ignored_retval, thread_id_);
+    queue_depth_->Add(-reported_queue_depth_);
 
     // Under normal circumstances there shouldn't be any active fetches at
     // this point.  However, in practice we may have some lingering fetches that
@@ -851,6 +1015,8 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
     }
     TransferFetchesAndCheckDone(false);
     CancelActiveFetches();
+    ScopedMutex hold(mutex_);
+    EvictIdleConnections(kint64max);
   }
 
  protected:
@@ -965,13 +1131,29 @@ class SerfThreadedFetcher : public SerfUrlAsyncFetcher {
       // If active_fetches_ is empty, we will not do any work and won't block
       // here.  num_active_fetches will be 0, and we'll block in the next
       // call to TransferFetches above.
+      int64 poll_start_us = timer_->NowUs();
       num_active_fetches = Poll(kPollIntervalMs);
+      poll_time_us_->Add(timer_->NowUs() - poll_start_us);
+      // Every process's threads share the counter, so apply our change
+      // rather than overwriting the others'.
+      int64 queue_depth = num_active_fetches + NumInitiatedFetches();
+      queue_depth_->Add(queue_depth - reported_queue_depth_);
+      reported_queue_depth_ = queue_depth;
       SERF_DEBUG(LOG(INFO) << "Finished polling from serf thread ("
                  << this << ")");
     }
   }
 
+  // Returns the number of fetches queued for the thread but not yet started.
+  int NumInitiatedFetches() {
+    ScopedMutex lock(initiate_mutex_.get());
+    return initiate_fetches_->size();
+  }
+
   apr_thread_t* thread_id_;
+  UpDownCounter* queue_depth_;
+  int64 reported_queue_depth_;  // Our share of queue_depth_.
+  Variable* poll_time_us_;
 
   // protects initiate_fetches_, initiate_fetches_nonempty_, thread_finish_
   // and thread_started_.
@@ -1001,7 +1183,6 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher,
   // the pool ops.
   fetcher_ = fetcher;
   apr_pool_create(&pool_, fetcher_->pool());
-  bucket_alloc_ = serf_bucket_allocator_create(pool_, NULL, NULL);
 
   fetch_start_ms_ = timer_->NowMs();
   // Parse and validate the URL.
@@ -1012,23 +1193,26 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher,
   using_https_ = StringCaseEqual("https", url_.scheme);
   DCHECK(fetcher->allow_https() || !using_https_);
 
-  apr_status_t status = serf_connection_create2(&connection_,
-                                                serf_context,
-                                                url_,
-                                                ConnectionSetup, this,
-                                                ClosedConnection, this,
-                                                pool_);
-  if (status != APR_SUCCESS) {
-    message_handler_->Error(DebugInfo().c_str(), 0,
-                            "Error status=%d (%s) serf_connection_create2",
-                            status, GetAprErrorString(status).c_str());
-    return false;
+  GoogleString key = ConnectionKey();
+  connection_ = fetcher_->TakeIdleConnection(key);
+  if (connection_ == NULL) {
+    scoped_ptr<SerfConnection> connection(
+        new SerfConnection(fetcher_, key, using_https_, sni_host_));
+    apr_status_t status = connection->Open(serf_context, url_);
+    if (status != APR_SUCCESS) {
+      message_handler_->Error(DebugInfo().c_str(), 0,
+                              "Error status=%d (%s) serf_connection_create2",
+                              status, GetAprErrorString(status).c_str());
+      return false;
+    }
+    fetcher_->connection_create_count_->Add(1);
+    connection_ = connection.release();
   }
-  serf_connection_request_create(connection_, SetupRequest, this);
+  connection_->StartRequest(this);
 
   // Start the fetch. It will connect to the remote host, send the request,
   // and accept the response, without blocking.
-  status =
+  apr_status_t status =
       serf_context_run(serf_context, SERF_DURATION_NOBLOCK, fetcher_->pool());
 
   if (status == APR_SUCCESS || APR_STATUS_IS_TIMEUP(status)) {
@@ -1041,6 +1225,19 @@ bool SerfFetch::Start(SerfUrlAsyncFetcher* fetcher,
   }
 }
 
+GoogleString SerfFetch::ConnectionKey() const {
+  // url_.hostname and url_.port are what serf connects to.  The Host header
+  // goes out with each request so it need not match, but for https the SNI
+  // host is bound into the TLS session.
+  GoogleString key = StrCat(url_.scheme, "://",
+                            (url_.hostname == NULL) ? "" : url_.hostname, ":",
+                            IntegerToString(url_.port));
+  if (sni_host_ != NULL) {
+    StrAppend(&key, " sni=", sni_host_);
+  }
+  return key;
+}
+
 void SerfFetch::ParseUrlForTesting(bool* status,
                                    apr_uri_t** url,
                                    const char** host_header,
@@ -1088,9 +1285,11 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       thread_system_(thread_system),
       timer_(timer),
       mutex_(NULL),
-      threaded_fetcher_(NULL),
       active_count_(NULL),
       serf_context_(NULL),
+      next_idle_sweep_ms_(0),
+      statistics_(statistics),
+      proxy_((proxy == NULL) ? "" : proxy),
       request_count_(NULL),
       byte_count_(NULL),
       time_duration_ms_(NULL),
@@ -1102,7 +1301,12 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       ultimate_success_(NULL),
       ultimate_failure_(NULL),
       last_check_timestamp_ms_(NULL),
+      connection_create_count_(NULL),
+      connection_reuse_count_(NULL),
+      connection_evict_count_(NULL),
+      idle_connections_count_(NULL),
       timeout_ms_(timeout_ms),
+      keep_alive_timeout_ms_(0),
       shutdown_(false),
       list_outstanding_urls_on_error_(false),
       track_original_content_length_(false),
@@ -1128,8 +1332,16 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
       statistics->GetVariable(SerfStats::kSerfFetchUltimateFailure);
   last_check_timestamp_ms_ =
       statistics->GetUpDownCounter(SerfStats::kSerfFetchLastCheckTimestampMs);
+  connection_create_count_ =
+      statistics->GetVariable(SerfStats::kSerfFetchConnectionCreateCount);
+  connection_reuse_count_ =
+      statistics->GetVariable(SerfStats::kSerfFetchConnectionReuseCount);
+  connection_evict_count_ =
+      statistics->GetVariable(SerfStats::kSerfFetchConnectionEvictCount);
+  idle_connections_count_ =
+      statistics->GetUpDownCounter(SerfStats::kSerfFetchIdleConnections);
   Init(pool, proxy);
-  threaded_fetcher_ = new SerfThreadedFetcher(this, proxy);
+  AddThreadedFetcher();
 }
 
 SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
@@ -1138,9 +1350,10 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       thread_system_(parent->thread_system_),
       timer_(parent->timer_),
       mutex_(NULL),
-      threaded_fetcher_(NULL),
       active_count_(parent->active_count_),
       serf_context_(NULL),
+      next_idle_sweep_ms_(0),
+      statistics_(NULL),
       request_count_(parent->request_count_),
       byte_count_(parent->byte_count_),
       time_duration_ms_(parent->time_duration_ms_),
@@ -1152,12 +1365,19 @@ SerfUrlAsyncFetcher::SerfUrlAsyncFetcher(SerfUrlAsyncFetcher* parent,
       ultimate_success_(parent->ultimate_success_),
       ultimate_failure_(parent->ultimate_failure_),
       last_check_timestamp_ms_(parent->last_check_timestamp_ms_),
+      connection_create_count_(parent->connection_create_count_),
+      connection_reuse_count_(parent->connection_reuse_count_),
+      connection_evict_count_(parent->connection_evict_count_),
+      idle_connections_count_(parent->idle_connections_count_),
       timeout_ms_(parent->timeout_ms()),
+      keep_alive_timeout_ms_(parent->keep_alive_timeout_ms_),
       shutdown_(false),
       list_outstanding_urls_on_error_(parent->list_outstanding_urls_on_error_),
       track_original_content_length_(parent->track_original_content_length_),
       https_options_(parent->https_options_),
-      message_handler_(parent->message_handler_) {
+      message_handler_(parent->message_handler_),
+      ssl_certificates_dir_(parent->ssl_certificates_dir_),
+      ssl_certificates_file_(parent->ssl_certificates_file_) {
   Init(parent->pool(), proxy);
 }
 
@@ -1178,23 +1398,26 @@ SerfUrlAsyncFetcher::~SerfUrlAsyncFetcher() {
   }
 
   active_fetches_.DeleteAll();
-  if (threaded_fetcher_ != NULL) {
-    delete threaded_fetcher_;
+  {
+    ScopedMutex lock(mutex_);
+    EvictIdleConnections(kint64max);
   }
+  STLDeleteElements(&threaded_fetchers_);
   delete mutex_;
   apr_pool_destroy(pool_);  // also calls apr_allocator_destroy on the allocator
 }
 
 void SerfUrlAsyncFetcher::ShutDown() {
-  // Note that we choose not to delete the threaded_fetcher_ to avoid worrying
-  // about races on its deletion.
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->ShutDown();
+  // Note that we choose not to delete the threaded_fetchers_ to avoid worrying
+  // about races on their deletion.
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->ShutDown();
   }
 
   ScopedMutex lock(mutex_);
   shutdown_ = true;
   CancelActiveFetchesMutexHeld();
+  EvictIdleConnections(kint64max);
 }
 
 void SerfUrlAsyncFetcher::Init(apr_pool_t* parent_pool, const char* proxy) {
@@ -1258,10 +1481,70 @@ void SerfUrlAsyncFetcher::Fetch(const GoogleString& url,
   SerfFetch* fetch = new SerfFetch(url, async_fetch, message_handler, timer_);
 
   request_count_->Add(1);
-  threaded_fetcher_->InitiateFetch(fetch);
+  threaded_fetchers_[FetchThreadIndex(url)]->InitiateFetch(fetch);
 
   // TODO(morlovich): There is quite a bit of code related to doing work
-  // both on 'this' and threaded_fetcher_ that could use cleaning up.
+  // both on 'this' and threaded_fetchers_ that could use cleaning up.
+}
+
+void SerfUrlAsyncFetcher::set_num_fetch_threads(int x) {
+  DCHECK(!threaded_fetchers_.empty()) << "Not a top-level fetcher";
+  if ((x < 1) || (x > kMaxFetchThreads)) {
+    message_handler_->Message(
+        kWarning, "Serf fetch thread count %d is out of range; using %d",
+        x, (x < 1) ? 1 : kMaxFetchThreads);
+    x = (x < 1) ? 1 : kMaxFetchThreads;
+  }
+  while (num_fetch_threads() < x) {
+    AddThreadedFetcher();
+  }
+  while (num_fetch_threads() > x) {
+    delete threaded_fetchers_.back();
+    threaded_fetchers_.pop_back();
+  }
+
+  fetch_thread_ring_.clear();
+  if (x > 1) {
+    for (int i = 0; i < x; ++i) {
+      for (int point = 0; point < kFetchThreadRingPoints; ++point) {
+        fetch_thread_ring_[FetchThreadRingHash(StrCat(
+            "fetch_thread_", IntegerToString(i), "/",
+            IntegerToString(point)))] = i;
+      }
+    }
+  }
+}
+
+void SerfUrlAsyncFetcher::AddThreadedFetcher() {
+  GoogleString index = IntegerToString(threaded_fetchers_.size());
+  threaded_fetchers_.push_back(new SerfThreadedFetcher(
+      this, proxy_.c_str(),
+      statistics_->GetUpDownCounter(
+          StrCat(SerfStats::kSerfFetchThreadQueueDepthPrefix, index)),
+      statistics_->GetVariable(
+          StrCat(SerfStats::kSerfFetchThreadPollTimeUsPrefix, index))));
+}
+
+int SerfUrlAsyncFetcher::FetchThreadIndex(StringPiece url) const {
+  if (fetch_thread_ring_.empty()) {
+    return 0;
+  }
+  // Hash only the scheme, host and port, which is what decides whether two
+  // fetches can share a connection.
+  stringpiece_ssize_type host_start = url.find("://");
+  if (host_start != StringPiece::npos) {
+    stringpiece_ssize_type host_end = url.find_first_of("/?#", host_start + 3);
+    if (host_end != StringPiece::npos) {
+      url = url.substr(0, host_end);
+    }
+  }
+  // The origin belongs to the thread owning the next point clockwise.
+  FetchThreadRing::const_iterator p =
+      fetch_thread_ring_.lower_bound(FetchThreadRingHash(url));
+  if (p == fetch_thread_ring_.end()) {
+    p = fetch_thread_ring_.begin();
+  }
+  return p->second;
 }
 
 void SerfUrlAsyncFetcher::PrintActiveFetches(
@@ -1333,7 +1616,7 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
           "Serf status %d(%s) polling for %ld %s fetches for %g seconds",
           status, GetAprErrorString(status).c_str(),
           static_cast<long>(active_fetches_.size()),  // NOLINT
-          (threaded_fetcher_ == NULL) ? "threaded" : "non-blocking",
+          threaded_fetchers_.empty() ? "threaded" : "non-blocking",
           max_wait_ms/1.0e3);
       if (list_outstanding_urls_on_error_) {
         int64 now_ms = timer_->NowMs();
@@ -1349,9 +1632,99 @@ int SerfUrlAsyncFetcher::Poll(int64 max_wait_ms) {
       CleanupFetchesWithErrors();
     }
   }
+  if (!idle_connections_.empty()) {
+    int64 now_ms = timer_->NowMs();
+    if (now_ms >= next_idle_sweep_ms_) {
+      EvictIdleConnections(now_ms - keep_alive_timeout_ms_);
+      next_idle_sweep_ms_ = now_ms + kIdleSweepIntervalMs;
+    }
+  }
   return active_fetches_.size();
 }
 
+SerfConnection* SerfUrlAsyncFetcher::TakeIdleConnection(
+    const GoogleString& key) NO_THREAD_SAFETY_ANALYSIS {
+  IdleConnectionMap::iterator p = idle_connections_.find(key);
+  if (p == idle_connections_.end()) {
+    return NULL;
+  }
+  // Take the most recently parked connection: it is the least likely to have
+  // been dropped by the origin.
+  SerfConnectionVector& idle = p->second;
+  int64 stale_cutoff_ms = timer_->NowMs() - keep_alive_timeout_ms_;
+  SerfConnection* connection = NULL;
+  while ((connection == NULL) && !idle.empty()) {
+    SerfConnection* candidate = idle.back();
+    idle.pop_back();
+    idle_connections_count_->Add(-1);
+    if ((candidate->idle_since_ms() >= stale_cutoff_ms) &&
+        candidate->IsHealthy()) {
+      connection = candidate;
+    } else {
+      connection_evict_count_->Add(1);
+      delete candidate;
+    }
+  }
+  if (idle.empty()) {
+    idle_connections_.erase(p);
+  }
+  if (connection != NULL) {
+    connection_reuse_count_->Add(1);
+  }
+  return connection;
+}
+
+void SerfUrlAsyncFetcher::ReleaseConnection(SerfConnection* connection,
+                                            bool reusable)
+    NO_THREAD_SAFETY_ANALYSIS {
+  connection->FinishRequest();
+  if (reusable && (keep_alive_timeout_ms_ > 0) && !shutdown_ &&
+      connection->IsHealthy()) {
+    SerfConnectionVector& idle = idle_connections_[connection->key()];
+    if (idle.size() < kMaxIdleConnectionsPerHost) {
+      connection->set_idle_since_ms(timer_->NowMs());
+      idle.push_back(connection);
+      idle_connections_count_->Add(1);
+      return;
+    }
+  }
+  delete connection;
+}
+
+void SerfUrlAsyncFetcher::EvictIdleConnections(int64 stale_cutoff_ms) {
+  int num_evicted = 0;
+  for (IdleConnectionMap::iterator p = idle_connections_.begin();
+       p != idle_connections_.end(); ) {
+    // Connections are parked in order, so the stale ones are at the front.
+    // The origin may also have hung up on any of them since the last sweep.
+    SerfConnectionVector& idle = p->second;
+    SerfConnectionVector kept;
+    for (int i = 0, n = idle.size(); i < n; ++i) {
+      SerfConnection* connection = idle[i];
+      if ((stale_cutoff_ms != kint64max) &&
+          (connection->idle_since_ms() >= stale_cutoff_ms) &&
+          connection->IsHealthy()) {
+        kept.push_back(connection);
+      } else {
+        delete connection;
+        ++num_evicted;
+      }
+    }
+    if (kept.empty()) {
+      idle_connections_.erase(p++);
+    } else {
+      idle.swap(kept);
+      ++p;
+    }
+  }
+  if (num_evicted != 0) {
+    idle_connections_count_->Add(-num_evicted);
+    if (stale_cutoff_ms != kint64max) {
+      connection_evict_count_->Add(num_evicted);
+    }
+  }
+}
+
 void SerfUrlAsyncFetcher::FetchComplete(SerfFetch* fetch)
     NO_THREAD_SAFETY_ANALYSIS {
   // This method should really be EXCLUSIVE_LOCKS_REQUIRED(mutex_).
@@ -1430,9 +1803,11 @@ int SerfUrlAsyncFetcher:: ApproximateNumActiveFetches() {
 bool SerfUrlAsyncFetcher::WaitForActiveFetches(
     int64 max_ms, MessageHandler* message_handler, WaitChoice wait_choice) {
   bool ret = true;
-  if ((threaded_fetcher_ != NULL) && (wait_choice != kMainlineOnly)) {
-    ret &= threaded_fetcher_->WaitForActiveFetchesHelper(
-        max_ms, message_handler);
+  if (wait_choice != kMainlineOnly) {
+    for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+      ret &= threaded_fetcher->WaitForActiveFetchesHelper(
+          max_ms, message_handler);
+    }
   }
   if (wait_choice != kThreadedOnly) {
     ret &= WaitForActiveFetchesHelper(max_ms, message_handler);
@@ -1499,19 +1874,37 @@ void SerfUrlAsyncFetcher::InitStats(Statistics* statistics) {
   statistics->AddVariable(SerfStats::kSerfFetchUltimateSuccess);
   statistics->AddVariable(SerfStats::kSerfFetchUltimateFailure);
   statistics->AddUpDownCounter(SerfStats::kSerfFetchLastCheckTimestampMs);
+  statistics->AddVariable(SerfStats::kSerfFetchConnectionCreateCount);
+  statistics->AddVariable(SerfStats::kSerfFetchConnectionReuseCount);
+  statistics->AddVariable(SerfStats::kSerfFetchConnectionEvictCount);
+  statistics->AddUpDownCounter(SerfStats::kSerfFetchIdleConnections);
+  for (int i = 0; i < kMaxFetchThreads; ++i) {
+    GoogleString index = IntegerToString(i);
+    statistics->AddUpDownCounter(
+        StrCat(SerfStats::kSerfFetchThreadQueueDepthPrefix, index));
+    statistics->AddVariable(
+        StrCat(SerfStats::kSerfFetchThreadPollTimeUsPrefix, index));
+  }
 }
 
 void SerfUrlAsyncFetcher::set_list_outstanding_urls_on_error(bool x) {
   list_outstanding_urls_on_error_ = x;
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_list_outstanding_urls_on_error(x);
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->set_list_outstanding_urls_on_error(x);
+  }
+}
+
+void SerfUrlAsyncFetcher::set_keep_alive_timeout_ms(int64 x) {
+  keep_alive_timeout_ms_ = x;
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->set_keep_alive_timeout_ms(x);
   }
 }
 
 void SerfUrlAsyncFetcher::set_track_original_content_length(bool x) {
   track_original_content_length_ = x;
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_track_original_content_length(x);
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->set_track_original_content_length(x);
   }
 }
 
@@ -1592,23 +1985,23 @@ bool SerfUrlAsyncFetcher::SetHttpsOptions(StringPiece directive) {
     https_options_ = 0;
   }
 #endif
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->set_https_options(https_options_);
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->set_https_options(https_options_);
   }
   return true;
 }
 
 void SerfUrlAsyncFetcher::SetSslCertificatesDir(StringPiece dir) {
   dir.CopyToString(&ssl_certificates_dir_);
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->SetSslCertificatesDir(dir);
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->SetSslCertificatesDir(dir);
   }
 }
 
 void SerfUrlAsyncFetcher::SetSslCertificatesFile(StringPiece file) {
   file.CopyToString(&ssl_certificates_file_);
-  if (threaded_fetcher_ != NULL) {
-    threaded_fetcher_->SetSslCertificatesFile(file);
+  for (SerfThreadedFetcher* threaded_fetcher : threaded_fetchers_) {
+    threaded_fetcher->SetSslCertificatesFile(file);
   }
 }
 
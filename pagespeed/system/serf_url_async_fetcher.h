@@ -22,6 +22,7 @@
 #define PAGESPEED_SYSTEM_SERF_URL_ASYNC_FETCHER_H_
 
 #include <cstddef>
+#include <map>
 #include <vector>
 
 #include "apr_network_io.h"
@@ -61,6 +62,7 @@ namespace net_instaweb {
 class AsyncFetch;
 class MessageHandler;
 class Statistics;
+class SerfConnection;
 class SerfFetch;
 class SerfThreadedFetcher;
 class Timer;
@@ -89,6 +91,23 @@ struct SerfStats {
   // When we last checked the ultimate failure/success numbers for a
   // possible concern.
   static const char kSerfFetchLastCheckTimestampMs[];
+
+  // Keep-alive connection pool.  The reuse rate is
+  // reuse_count / (reuse_count + create_count).
+  static const char kSerfFetchConnectionCreateCount[];
+  static const char kSerfFetchConnectionReuseCount[];
+  // Idle connections dropped because they expired, errored, or were closed by
+  // the origin while parked.
+  static const char kSerfFetchConnectionEvictCount[];
+  static const char kSerfFetchIdleConnections[];
+
+  // Per fetch thread; the thread's index is appended to the name.  Queue
+  // depth counts the fetches queued for or running on the thread, sampled
+  // after each poll.  Poll time accumulates the microseconds the thread spent
+  // in serf's event loop, which includes copying response bodies to their
+  // AsyncFetch writers.
+  static const char kSerfFetchThreadQueueDepthPrefix[];
+  static const char kSerfFetchThreadPollTimeUsPrefix[];
 };
 
 enum class SerfCompletionResult {
@@ -119,6 +138,10 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
     kThreadedAndMainline
   };
 
+  // Upper bound for set_num_fetch_threads.  Per-thread statistics are
+  // declared for this many threads.
+  static const int kMaxFetchThreads = 8;
+
   SerfUrlAsyncFetcher(const char* proxy, apr_pool_t* pool,
                       ThreadSystem* thread_system,
                       Statistics* statistics, Timer* timer, int64 timeout_ms,
@@ -203,6 +226,21 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
     return ssl_certificates_file_;
   }
 
+  // When positive, connections are kept open after a successful fetch and
+  // reused by later fetches to the same scheme, host and port for up to
+  // this long.  Keep this below the origin's own keep-alive timeout so we
+  // rarely send a request down a socket the origin is about to close.  0, the
+  // default, closes every connection once its fetch is done.
+  int64 keep_alive_timeout_ms() const { return keep_alive_timeout_ms_; }
+  void set_keep_alive_timeout_ms(int64 x);
+
+  // Spreads fetches over this many threads, each running its own serf
+  // context.  Fetches are assigned by a consistent hash of their scheme, host
+  // and port, so each origin stays on one thread and keeps its keep-alive
+  // connections.  Defaults to 1.  Must be called before the first Fetch.
+  int num_fetch_threads() const { return threaded_fetchers_.size(); }
+  void set_num_fetch_threads(int x);
+
  protected:
   typedef Pool<SerfFetch> SerfFetchPool;
 
@@ -242,6 +280,22 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   // Must be called only immediately after running the serf event loop.
   void CleanupFetchesWithErrors() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Returns the most recently parked healthy connection for key, or NULL if
+  // there is none.  Expired or broken connections found on the way are closed.
+  // Like FetchComplete, this is called from SerfFetch with mutex_ held.
+  SerfConnection* TakeIdleConnection(const GoogleString& key);
+
+  // Called when connection's fetch is deleted or canceled.  Parks the
+  // connection in the idle pool if reusable is true, keep-alive is on and
+  // there is room; otherwise closes it.  Called from SerfFetch with mutex_
+  // held.
+  void ReleaseConnection(SerfConnection* connection, bool reusable);
+
+  // Closes idle connections parked before stale_cutoff_ms, or all of them if
+  // stale_cutoff_ms is kint64max.
+  void EvictIdleConnections(int64 stale_cutoff_ms)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   bool shutdown() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) { return shutdown_; }
   void set_shutdown(bool s) EXCLUSIVE_LOCKS_REQUIRED(mutex_) { shutdown_ = s; }
 
@@ -255,15 +309,31 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
 
   typedef std::vector<SerfFetch*> FetchVector;
   SerfFetchPool completed_fetches_;
-  SerfThreadedFetcher* threaded_fetcher_;
+  // The fetch threads; empty in the SerfThreadedFetchers themselves.
+  std::vector<SerfThreadedFetcher*> threaded_fetchers_;
 
   // This is protected because it's updated along with active_fetches_,
   // which happens in subclass SerfThreadedFetcher as well as this class.
   UpDownCounter* active_count_;
 
  private:
+  friend class SerfConnection;  // To access stats variables below.
   friend class SerfFetch;  // To access stats variables below.
 
+  // Idle connections by SerfConnection::key(), oldest first.
+  typedef std::vector<SerfConnection*> SerfConnectionVector;
+  typedef std::map<GoogleString, SerfConnectionVector> IdleConnectionMap;
+
+  // Points on the consistent-hash ring, each owned by a fetch thread index.
+  typedef std::map<uint64, int> FetchThreadRing;
+
+  // Creates the next fetch thread, wired to its per-thread statistics.
+  void AddThreadedFetcher();
+
+  // Returns the index of the fetch thread that carries fetches of url.
+  int FetchThreadIndex(StringPiece url) const;
+  FRIEND_TEST(SerfUrlAsyncFetcherTest, FetchThreadAssignment);
+
   // Note: returned string memory substring of memory in the pool.
   static const char* ExtractHostHeader(const apr_uri_t& uri,
                                        apr_pool_t* pool);
@@ -279,6 +349,13 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
 
   serf_context_t* serf_context_ GUARDED_BY(mutex_);
   SerfFetchPool active_fetches_ GUARDED_BY(mutex_);
+  IdleConnectionMap idle_connections_ GUARDED_BY(mutex_);
+  int64 next_idle_sweep_ms_ GUARDED_BY(mutex_);
+
+  // Used only to create fetch threads, so NULL in the threads themselves.
+  Statistics* statistics_;
+  GoogleString proxy_;
+  FetchThreadRing fetch_thread_ring_;
 
   Variable* request_count_;
   Variable* byte_count_;
@@ -291,7 +368,12 @@ class SerfUrlAsyncFetcher : public UrlAsyncFetcher {
   Variable* ultimate_success_;
   Variable* ultimate_failure_;
   UpDownCounter* last_check_timestamp_ms_;
+  Variable* connection_create_count_;
+  Variable* connection_reuse_count_;
+  Variable* connection_evict_count_;
+  UpDownCounter* idle_connections_count_;
   const int64 timeout_ms_;
+  int64 keep_alive_timeout_ms_;
   bool shutdown_ GUARDED_BY(mutex_);
   bool list_outstanding_urls_on_error_;
   bool track_original_content_length_;
@@ -360,30 +442,10 @@ class SerfFetch : public PoolElement<SerfFetch> {
   MessageHandler* message_handler() { return message_handler_; }
 
  private:
-  // Static functions used in callbacks.
-
-  // The code under SERF_HTTPS_FETCHING was contributed by Devin Anderson
-  // (surfacepatterns@gmail.com).
-  //
-  // Note this must be ifdef'd because calling serf_bucket_ssl_decrypt_create
-  // requires ssl_buckets.c in the link.  ssl_buckets.c requires openssl.
-#if SERF_HTTPS_FETCHING
-  static apr_status_t SSLCertValidate(void *data, int failures,
-                                   const serf_ssl_certificate_t *cert);
-
-  static apr_status_t SSLCertChainValidate(
-      void *data, int failures, int error_depth,
-      const serf_ssl_certificate_t * const *certs,
-      apr_size_t certs_count);
-#endif
+  // SerfConnection forwards certificate validation to the fetch it carries.
+  friend class SerfConnection;
 
-  static apr_status_t ConnectionSetup(
-      apr_socket_t* socket, serf_bucket_t **read_bkt, serf_bucket_t **write_bkt,
-      void* setup_baton, apr_pool_t* pool);
-  static void ClosedConnection(serf_connection_t* conn,
-                               void* closed_baton,
-                               apr_status_t why,
-                               apr_pool_t* pool);
+  // Static functions used in callbacks.
   static serf_bucket_t* AcceptResponse(serf_request_t* request,
                                        serf_bucket_t* stream,
                                        void* acceptor_baton,
@@ -431,6 +493,10 @@ class SerfFetch : public PoolElement<SerfFetch> {
   // Ensures that a user-agent string is included, and that the mod_pagespeed
   // version is appended.
   void FixUserAgent();
+
+  // The key under which SerfUrlAsyncFetcher pools connections that can carry
+  // this fetch: scheme, host and port, plus the SNI host for https.
+  GoogleString ConnectionKey() const;
   static apr_status_t SetupRequest(serf_request_t* request,
                                    void* setup_baton,
                                    serf_bucket_t** req_bkt,
@@ -450,18 +516,18 @@ class SerfFetch : public PoolElement<SerfFetch> {
   MessageHandler* message_handler_;
 
   apr_pool_t* pool_;
-  serf_bucket_alloc_t* bucket_alloc_;
   apr_uri_t url_;
   const char* host_header_;  // in pool_
   const char* sni_host_;  // in pool_
-  serf_connection_t* connection_;
+  SerfConnection* connection_;
+  // Set once the fetch completes cleanly, so its connection may be reused.
+  bool connection_reusable_;
   size_t bytes_received_;
   int64 fetch_start_ms_;
   int64 fetch_end_ms_;
 
   // Variables used for HTTPS connection handling
   bool using_https_;
-  serf_ssl_context_t* ssl_context_;
   const char* ssl_error_message_;
 
   DISALLOW_COPY_AND_ASSIGN(SerfFetch);
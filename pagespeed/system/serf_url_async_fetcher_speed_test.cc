@@ -0,0 +1,408 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Measures what keep-alive connection reuse saves SerfUrlAsyncFetcher when
+// fetching many small resources from one origin.  A thread on localhost stands
+// in for the origin, answering every request with a short keep-alive response,
+// so the numbers show the fetcher's own connection setup and polling costs.
+// Over a real network the saving grows with the round-trip time, and with
+// https by the TLS handshake as well.
+//
+// Each iteration fetches kBurstSize resources, so ns/iter divided by
+// kBurstSize is the mean fetch latency and its inverse the throughput.  Each
+// run also logs both directly, along with how many connections it created
+// and reused.
+//
+// SerfSequentialNewConnections  fetches one resource at a time, each on a
+//                               new connection, as before keep-alive pooling.
+// SerfSequentialKeepAlive       the same with FetchKeepAliveTimeoutMs set, so
+//                               all fetches share one connection.
+// SerfConcurrentNewConnections  starts kConcurrency fetches at a time and
+//                               waits for all of them before the next batch.
+// SerfConcurrentKeepAlive       the same with keep-alive: each batch reuses the
+//                               connections the previous batch parked.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include "pagespeed/system/serf_url_async_fetcher.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "apr_network_io.h"
+#include "apr_poll.h"
+#include "apr_pools.h"
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/benchmark.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/posix_timer.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "pagespeed/system/apr_thread_compatible_pool.h"
+
+namespace {
+
+const int kBurstSize = 32;
+const int kConcurrency = 8;
+const int kFetchTimeoutMs = 5 * net_instaweb::Timer::kSecondMs;
+const int kKeepAliveTimeoutMs = 4 * net_instaweb::Timer::kSecondMs;
+const int kMaxConnections = 256;
+const int kPollIntervalUs = 100 * net_instaweb::Timer::kMsUs;
+
+const char kResponse[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 2048\r\n"
+    "Content-Type: text/css\r\n"
+    "Cache-Control: max-age=300\r\n"
+    "\r\n";
+
+// Stands in for an origin: answers each request on any connection with a
+// small keep-alive response.  Connections are multiplexed with an
+// apr_pollset, so fetches that open connections of their own proceed
+// concurrently, as they would against a real server.
+class OriginStandIn : public net_instaweb::ThreadSystem::Thread {
+ public:
+  explicit OriginStandIn(net_instaweb::ThreadSystem* thread_system)
+      : Thread(thread_system, "origin_stand_in",
+               net_instaweb::ThreadSystem::kJoinable),
+        pool_(net_instaweb::AprCreateThreadCompatiblePool(NULL)),
+        listen_sock_(NULL),
+        pollset_(NULL),
+        response_(kResponse) {
+    response_.append(2048, 'x');
+  }
+
+  virtual ~OriginStandIn() {
+    stop_.set_value(true);
+    if (Started()) {
+      Join();
+    }
+    for (Connection* connection : connections_) {
+      apr_socket_close(connection->sock);
+    }
+    STLDeleteElements(&connections_);
+    apr_pool_destroy(pool_);
+  }
+
+  // Binds a listening socket on localhost, starts serving, and returns the
+  // port, or 0 on failure.
+  apr_port_t Listen() {
+    apr_sockaddr_t* address;
+    apr_sockaddr_t* bound_address;
+    if ((apr_socket_create(&listen_sock_, APR_INET, SOCK_STREAM,
+                           APR_PROTO_TCP, pool_) != APR_SUCCESS) ||
+        (apr_socket_opt_set(listen_sock_, APR_SO_REUSEADDR, 1) !=
+         APR_SUCCESS) ||
+        (apr_sockaddr_info_get(&address, "127.0.0.1", APR_INET, 0, 0,
+                               pool_) != APR_SUCCESS) ||
+        (apr_socket_bind(listen_sock_, address) != APR_SUCCESS) ||
+        (apr_socket_listen(listen_sock_, kMaxConnections) != APR_SUCCESS) ||
+        (apr_socket_addr_get(&bound_address, APR_LOCAL, listen_sock_) !=
+         APR_SUCCESS) ||
+        (apr_pollset_create(&pollset_, kMaxConnections + 1, pool_, 0) !=
+         APR_SUCCESS)) {
+      LOG(ERROR) << "Could not set up the origin stand-in";
+      return 0;
+    }
+    apr_pollfd_t pollfd = { 0 };
+    pollfd.p = pool_;
+    pollfd.desc_type = APR_POLL_SOCKET;
+    pollfd.desc.s = listen_sock_;
+    pollfd.reqevents = APR_POLLIN;
+    pollfd.client_data = NULL;
+    apr_pollset_add(pollset_, &pollfd);
+    if (!Start()) {
+      return 0;
+    }
+    return bound_address->port;
+  }
+
+ private:
+  struct Connection {
+    apr_socket_t* sock;
+    apr_pool_t* pool;
+    GoogleString received;
+  };
+
+  void Run() override {
+    while (!stop_.value()) {
+      apr_int32_t num_ready;
+      const apr_pollfd_t* ready;
+      if (apr_pollset_poll(pollset_, kPollIntervalUs, &num_ready, &ready) !=
+          APR_SUCCESS) {
+        continue;  // Timed out or interrupted.
+      }
+      for (int i = 0; i < num_ready; ++i) {
+        Connection* connection = static_cast<Connection*>(ready[i].client_data);
+        if (connection == NULL) {
+          Accept();
+        } else if (!Serve(connection)) {
+          Close(connection, ready[i]);
+        }
+      }
+    }
+  }
+
+  void Accept() {
+    Connection* connection = new Connection;
+    apr_pool_create(&connection->pool, pool_);
+    if (apr_socket_accept(&connection->sock, listen_sock_,
+                          connection->pool) != APR_SUCCESS) {
+      apr_pool_destroy(connection->pool);
+      delete connection;
+      return;
+    }
+    apr_pollfd_t pollfd = { 0 };
+    pollfd.p = connection->pool;
+    pollfd.desc_type = APR_POLL_SOCKET;
+    pollfd.desc.s = connection->sock;
+    pollfd.reqevents = APR_POLLIN;
+    pollfd.client_data = connection;
+    apr_pollset_add(pollset_, &pollfd);
+    connections_.insert(connection);
+  }
+
+  // Reads what the client sent and answers each complete request.  Returns
+  // false once the client has hung up.
+  bool Serve(Connection* connection) {
+    char buffer[4096];
+    apr_size_t size = sizeof(buffer);
+    apr_status_t status = apr_socket_recv(connection->sock, buffer, &size);
+    if ((status != APR_SUCCESS) || (size == 0)) {
+      return false;
+    }
+    connection->received.append(buffer, size);
+    // The fetcher only sends bodiless GETs.
+    for (size_t end = connection->received.find("\r\n\r\n");
+         end != GoogleString::npos;
+         end = connection->received.find("\r\n\r\n")) {
+      connection->received.erase(0, end + 4);
+      apr_size_t response_size = response_.size();
+      apr_socket_send(connection->sock, response_.data(), &response_size);
+    }
+    return true;
+  }
+
+  void Close(Connection* connection, const apr_pollfd_t& pollfd) {
+    apr_pollset_remove(pollset_, &pollfd);
+    apr_socket_close(connection->sock);
+    apr_pool_destroy(connection->pool);
+    connections_.erase(connection);
+    delete connection;
+  }
+
+  apr_pool_t* pool_;
+  apr_socket_t* listen_sock_;
+  apr_pollset_t* pollset_;
+  GoogleString response_;
+  std::set<Connection*> connections_;
+  net_instaweb::AtomicBool stop_;
+
+  DISALLOW_COPY_AND_ASSIGN(OriginStandIn);
+};
+
+// Counts finished fetches so the benchmark can wait for a batch.
+class BenchmarkFetch : public net_instaweb::StringAsyncFetch {
+ public:
+  BenchmarkFetch(const net_instaweb::RequestContextPtr& request_context,
+                 net_instaweb::ThreadSystem::CondvarCapableMutex* mutex,
+                 net_instaweb::ThreadSystem::Condvar* done_condvar,
+                 int* num_done)
+      : StringAsyncFetch(request_context),
+        mutex_(mutex),
+        done_condvar_(done_condvar),
+        num_done_(num_done) {}
+
+  void HandleDone(bool success) override {
+    StringAsyncFetch::HandleDone(success);
+    net_instaweb::ScopedMutex lock(mutex_);
+    ++*num_done_;
+    done_condvar_->Signal();
+  }
+
+ private:
+  net_instaweb::ThreadSystem::CondvarCapableMutex* mutex_;
+  net_instaweb::ThreadSystem::Condvar* done_condvar_;
+  int* num_done_;
+
+  DISALLOW_COPY_AND_ASSIGN(BenchmarkFetch);
+};
+
+class SerfBenchmark {
+ public:
+  explicit SerfBenchmark(int64 keep_alive_timeout_ms)
+      : thread_system_(net_instaweb::Platform::CreateThreadSystem()),
+        statistics_(thread_system_.get()),
+        mutex_(thread_system_->NewMutex()),
+        done_condvar_(mutex_->NewCondvar()),
+        num_done_(0),
+        num_fetched_(0),
+        start_us_(0) {
+    StopBenchmarkTiming();
+    apr_initialize();
+    origin_.reset(new OriginStandIn(thread_system_.get()));
+    apr_port_t port = origin_->Listen();
+    if (port != 0) {
+      // Route every fetch to the stand-in, whatever its host.
+      GoogleString proxy = net_instaweb::StrCat(
+          "127.0.0.1:", net_instaweb::IntegerToString(port));
+      net_instaweb::SerfUrlAsyncFetcher::InitStats(&statistics_);
+      fetcher_.reset(new net_instaweb::SerfUrlAsyncFetcher(
+          proxy.c_str(), NULL, thread_system_.get(), &statistics_, &timer_,
+          kFetchTimeoutMs, &handler_));
+      fetcher_->set_keep_alive_timeout_ms(keep_alive_timeout_ms);
+      for (int i = 0; i < kBurstSize; ++i) {
+        urls_.push_back(net_instaweb::StrCat(
+            "http://origin.example.com/style_",
+            net_instaweb::IntegerToString(i), ".css"));
+      }
+      // Starts the serf thread, and with keep-alive, warms up the pool.
+      FetchBurst(kConcurrency);
+      num_fetched_ = 0;
+    }
+    start_us_ = timer_.NowUs();
+    StartBenchmarkTiming();
+  }
+
+  ~SerfBenchmark() {
+    StopBenchmarkTiming();
+    int64 elapsed_us = timer_.NowUs() - start_us_;
+    if ((num_fetched_ > 0) && (elapsed_us > 0)) {
+      LOG(INFO) << "Fetches: " << num_fetched_
+                << ", mean latency: " << elapsed_us / num_fetched_ << "us"
+                << ", throughput: "
+                << num_fetched_ * net_instaweb::Timer::kSecondUs / elapsed_us
+                << " fetches/s";
+    }
+    if (fetcher_.get() != NULL) {
+      int64 created = statistics_.GetVariable(
+          net_instaweb::SerfStats::kSerfFetchConnectionCreateCount)->Get();
+      int64 reused = statistics_.GetVariable(
+          net_instaweb::SerfStats::kSerfFetchConnectionReuseCount)->Get();
+      LOG(INFO) << "Connections created: " << created
+                << ", reused: " << reused;
+      fetcher_->ShutDown();
+      fetcher_.reset();
+    }
+    origin_.reset();
+    apr_terminate();
+  }
+
+  bool ok() const { return fetcher_.get() != NULL; }
+
+  // Fetches every URL, keeping up to concurrency fetches in flight, and
+  // waiting for each batch to finish before starting the next.
+  void FetchBurst(int concurrency) {
+    for (int first = 0; first < kBurstSize; first += concurrency) {
+      int last = std::min(first + concurrency, kBurstSize);
+      std::vector<BenchmarkFetch*> fetches;
+      {
+        net_instaweb::ScopedMutex lock(mutex_.get());
+        num_done_ = 0;
+      }
+      for (int i = first; i < last; ++i) {
+        fetches.push_back(new BenchmarkFetch(
+            net_instaweb::RequestContext::NewTestRequestContext(
+                thread_system_.get()),
+            mutex_.get(), done_condvar_.get(), &num_done_));
+        fetcher_->Fetch(urls_[i], &handler_, fetches.back());
+      }
+      {
+        net_instaweb::ScopedMutex lock(mutex_.get());
+        while (num_done_ < last - first) {
+          done_condvar_->TimedWait(kFetchTimeoutMs);
+        }
+      }
+      for (BenchmarkFetch* fetch : fetches) {
+        CHECK(fetch->success()) << "Fetch from the origin stand-in failed";
+      }
+      num_fetched_ += fetches.size();
+      STLDeleteElements(&fetches);
+    }
+  }
+
+ private:
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem> thread_system_;
+  net_instaweb::SimpleStats statistics_;
+  net_instaweb::PosixTimer timer_;
+  net_instaweb::NullMessageHandler handler_;
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem::CondvarCapableMutex>
+      mutex_;
+  net_instaweb::scoped_ptr<net_instaweb::ThreadSystem::Condvar> done_condvar_;
+  int num_done_;
+  int64 num_fetched_;  // Since the warm-up burst.
+  int64 start_us_;
+  net_instaweb::scoped_ptr<OriginStandIn> origin_;
+  net_instaweb::scoped_ptr<net_instaweb::SerfUrlAsyncFetcher> fetcher_;
+  net_instaweb::StringVector urls_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerfBenchmark);
+};
+
+static void SerfSequentialNewConnections(int iters) {
+  SerfBenchmark benchmark(0);
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.FetchBurst(1);
+  }
+}
+
+static void SerfSequentialKeepAlive(int iters) {
+  SerfBenchmark benchmark(kKeepAliveTimeoutMs);
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.FetchBurst(1);
+  }
+}
+
+static void SerfConcurrentNewConnections(int iters) {
+  SerfBenchmark benchmark(0);
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.FetchBurst(kConcurrency);
+  }
+}
+
+static void SerfConcurrentKeepAlive(int iters) {
+  SerfBenchmark benchmark(kKeepAliveTimeoutMs);
+  for (int i = 0; benchmark.ok() && i < iters; ++i) {
+    benchmark.FetchBurst(kConcurrency);
+  }
+}
+
+}  // namespace
+
+BENCHMARK(SerfSequentialNewConnections);
+BENCHMARK(SerfSequentialKeepAlive);
+BENCHMARK(SerfConcurrentNewConnections);
+BENCHMARK(SerfConcurrentKeepAlive);
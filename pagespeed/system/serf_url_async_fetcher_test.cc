@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <cstddef>
 #include <cstdlib>
+#include <set>
 #include <vector>
 
 #include "apr_network_io.h"
@@ -874,6 +875,57 @@ TEST_F(SerfUrlAsyncFetcherTest, TestPortRemoval) {
       SerfUrlAsyncFetcher::RemovePortFromHostHeader("[::1]:80"));
 }
 
+TEST_F(SerfUrlAsyncFetcherTest, FetchThreadAssignment) {
+  // With one thread, everything goes to it.
+  EXPECT_EQ(1, serf_url_async_fetcher_->num_fetch_threads());
+  EXPECT_EQ(0, serf_url_async_fetcher_->FetchThreadIndex(
+      "http://www.example.com/a.css"));
+
+  // Only the scheme, host and port pick the thread.
+  serf_url_async_fetcher_->set_num_fetch_threads(4);
+  EXPECT_EQ(4, serf_url_async_fetcher_->num_fetch_threads());
+  int index = serf_url_async_fetcher_->FetchThreadIndex(
+      "http://www.example.com/a.css");
+  EXPECT_EQ(index, serf_url_async_fetcher_->FetchThreadIndex(
+      "http://www.example.com/b/c.js?d=e"));
+  EXPECT_EQ(index, serf_url_async_fetcher_->FetchThreadIndex(
+      "http://WWW.Example.com/f.png#g"));
+
+  // Many origins are spread over all the threads.
+  const int kNumHosts = 200;
+  std::vector<int> indices4;
+  std::set<int> used;
+  for (int i = 0; i < kNumHosts; ++i) {
+    int host_index = serf_url_async_fetcher_->FetchThreadIndex(
+        StrCat("http://host", IntegerToString(i), ".example.com/"));
+    indices4.push_back(host_index);
+    used.insert(host_index);
+  }
+  EXPECT_EQ(4, used.size());
+
+  // Adding a thread only moves origins onto the new thread.
+  serf_url_async_fetcher_->set_num_fetch_threads(5);
+  int moved = 0;
+  for (int i = 0; i < kNumHosts; ++i) {
+    int host_index = serf_url_async_fetcher_->FetchThreadIndex(
+        StrCat("http://host", IntegerToString(i), ".example.com/"));
+    if (host_index != indices4[i]) {
+      EXPECT_EQ(4, host_index);
+      ++moved;
+    }
+  }
+  EXPECT_LT(0, moved);
+  EXPECT_GT(kNumHosts / 2, moved);
+
+  // Out of range values are clamped.
+  serf_url_async_fetcher_->set_num_fetch_threads(0);
+  EXPECT_EQ(1, serf_url_async_fetcher_->num_fetch_threads());
+  serf_url_async_fetcher_->set_num_fetch_threads(
+      SerfUrlAsyncFetcher::kMaxFetchThreads + 1);
+  EXPECT_EQ(SerfUrlAsyncFetcher::kMaxFetchThreads,
+            serf_url_async_fetcher_->num_fetch_threads());
+}
+
 TEST_F(SerfUrlAsyncFetcherTest, TestPost) {
   int index = AddTestUrl(StrCat("http://", test_host_,
                                 "/do_not_modify/cgi/verify_post.cgi"),
@@ -1129,4 +1181,158 @@ TEST_F(SerfUrlAsyncFetcherTestFakeWebServer, TestHangingGet) {
 #endif
 }
 
+class SerfUrlAsyncFetcherTestKeepAlive : public SerfUrlAsyncFetcherTest {
+ public:
+  // Answers every request arriving on a connection, keeping the connection
+  // open until the client hangs up.  Connections are served one at a time,
+  // so a fetcher that opened a second connection while keeping the first
+  // one open would never get an answer on it.
+  class KeepAliveServerThread : public TcpServerThreadForTesting {
+   public:
+    KeepAliveServerThread(apr_port_t listen_port, ThreadSystem* thread_system)
+        : TcpServerThreadForTesting(listen_port, "keep_alive_webserver",
+                                    thread_system) {
+      set_serve_until_shut_down(true);
+    }
+    virtual ~KeepAliveServerThread() { ShutDown(); }
+
+    void HandleClientConnection(apr_socket_t* sock) override {
+      static const char kResponse[] =
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Length: 5\r\n"
+          "Content-Type: text/plain\r\n"
+          "\r\n"
+          "hello";
+      apr_socket_timeout_set(sock, FetcherTimeoutMs() * Timer::kMsUs);
+      GoogleString received;
+      char buffer[kStackBufferSize];
+      apr_size_t size = sizeof(buffer);
+      while (apr_socket_recv(sock, buffer, &size) == APR_SUCCESS) {
+        received.append(buffer, size);
+        // The fetcher only sends bodiless GETs.
+        for (size_t end = received.find("\r\n\r\n");
+             end != GoogleString::npos; end = received.find("\r\n\r\n")) {
+          received.erase(0, end + 4);
+          apr_size_t response_size = STATIC_STRLEN(kResponse);
+          apr_socket_send(sock, kResponse, &response_size);
+        }
+        size = sizeof(buffer);
+      }
+      apr_socket_close(sock);
+    }
+  };
+
+  static void SetUpTestCase() {
+    TcpServerThreadForTesting::PickListenPortOnce(&desired_listen_port_);
+  }
+
+  void SetUp() override {
+    thread_.reset(
+        new KeepAliveServerThread(desired_listen_port_, thread_system_.get()));
+    ASSERT_TRUE(thread_->Start());
+    int port = thread_->GetListeningPort();
+    GoogleString proxy_address = StrCat("127.0.0.1:", IntegerToString(port));
+    SetUpWithProxy(proxy_address.c_str());
+  }
+
+  // Fetches a fresh URL on the test host and waits for it to finish.
+  void FetchAndExpectHello() {
+    FetchFromHostAndExpectHello(test_host_);
+  }
+
+  // Like FetchAndExpectHello, for any host: all requests go to the proxy.
+  void FetchFromHostAndExpectHello(const GoogleString& host) {
+    int index = AddTestUrl(
+        StrCat("http://", host, "/keep_alive_",
+               IntegerToString(urls_.size())),
+        "hello");
+    prev_done_count = 0;
+    StartFetches(index, index);
+    ASSERT_EQ(1, WaitTillDone(index, index));
+    EXPECT_TRUE(fetches_[index]->success());
+    EXPECT_EQ(HttpStatus::kOK, response_headers(index)->status_code());
+    EXPECT_STREQ("hello", contents(index));
+  }
+
+  int64 StatValue(const char* name) {
+    return statistics_->GetVariable(name)->Get();
+  }
+
+  int64 IdleConnections() {
+    return statistics_->GetUpDownCounter(
+        SerfStats::kSerfFetchIdleConnections)->Get();
+  }
+
+  scoped_ptr<KeepAliveServerThread> thread_;
+
+ private:
+  static apr_port_t desired_listen_port_;
+};
+
+apr_port_t SerfUrlAsyncFetcherTestKeepAlive::desired_listen_port_ = 0;
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, ClosesConnectionByDefault) {
+  FetchAndExpectHello();
+  EXPECT_EQ(1, StatValue(SerfStats::kSerfFetchConnectionCreateCount));
+  EXPECT_EQ(0, StatValue(SerfStats::kSerfFetchConnectionReuseCount));
+  EXPECT_EQ(0, IdleConnections());
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, ReusesConnection) {
+  serf_url_async_fetcher_->set_keep_alive_timeout_ms(Timer::kMinuteMs);
+  const int kNumFetches = 4;
+  for (int i = 0; i < kNumFetches; ++i) {
+    FetchAndExpectHello();
+  }
+  EXPECT_EQ(1, StatValue(SerfStats::kSerfFetchConnectionCreateCount));
+  EXPECT_EQ(kNumFetches - 1,
+            StatValue(SerfStats::kSerfFetchConnectionReuseCount));
+  EXPECT_EQ(0, StatValue(SerfStats::kSerfFetchConnectionEvictCount));
+
+  // The serf thread parks the connection just after it reports the last
+  // fetch done.
+  for (int i = 0; (IdleConnections() == 0) && (i < 100); ++i) {
+    usleep(10 * Timer::kMsUs);
+  }
+  EXPECT_EQ(1, IdleConnections());
+
+  // Shutting down closes the parked connection.
+  serf_url_async_fetcher_->ShutDown();
+  EXPECT_EQ(0, IdleConnections());
+}
+
+TEST_F(SerfUrlAsyncFetcherTestKeepAlive, SeveralFetchThreads) {
+  const int kNumThreads = 4;
+  serf_url_async_fetcher_->set_num_fetch_threads(kNumThreads);
+  const int kNumHosts = 16;
+  for (int i = 0; i < kNumHosts; ++i) {
+    FetchFromHostAndExpectHello(
+        StrCat("origin", IntegerToString(i), ".example.com"));
+  }
+  EXPECT_EQ(kNumHosts, StatValue(SerfStats::kSerfFetchConnectionCreateCount));
+
+  // The origins were spread over several threads, each accounting its own
+  // poll time.
+  int threads_polled = 0;
+  for (int i = 0; i < kNumThreads; ++i) {
+    GoogleString poll_time_us = StrCat(
+        SerfStats::kSerfFetchThreadPollTimeUsPrefix, IntegerToString(i));
+    if (StatValue(poll_time_us.c_str()) > 0) {
+      ++threads_polled;
+    }
+  }
+  EXPECT_LT(1, threads_polled);
+
+  // Each thread takes its fetches back off its queue depth once it finishes
+  // polling for them.
+  for (int i = 0; i < kNumThreads; ++i) {
+    UpDownCounter* queue_depth = statistics_->GetUpDownCounter(StrCat(
+        SerfStats::kSerfFetchThreadQueueDepthPrefix, IntegerToString(i)));
+    for (int j = 0; (queue_depth->Get() != 0) && (j < 100); ++j) {
+      usleep(10 * Timer::kMsUs);
+    }
+    EXPECT_EQ(0, queue_depth->Get());
+  }
+}
+
 }  // namespace net_instaweb
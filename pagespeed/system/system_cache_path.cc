@@ -29,12 +29,15 @@
 #include "pagespeed/kernel/base/callback.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
 #include "pagespeed/kernel/cache/file_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
 #include "pagespeed/kernel/cache/purge_set.h"
+#include "pagespeed/kernel/cache/segment_file_cache.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 #include "pagespeed/kernel/util/file_system_lock_manager.h"
@@ -46,6 +49,19 @@ namespace net_instaweb {
 const char SystemCachePath::kFileCache[] = "file_cache";
 const char SystemCachePath::kLruCache[] = "lru_cache";
 
+namespace {
+
+// Subdirectory of the file cache path holding SegmentFileCache segments.  The
+// '!'s keep it from colliding with FileCache's encoded key filenames.
+const char kSegmentDirectory[] = "!segments!";
+
+// Assumed average size of an LRU cache entry, used to size the admission
+// filter's frequency sketch.  Overestimating the number of entries only
+// costs sketch memory (16 bytes per entry).
+const int64 kLruCacheEntryBytes = 1024;
+
+}  // namespace
+
 // The SystemCachePath encapsulates a cache-sharing model where a user specifies
 // a file-cache path per virtual-host.  With each file-cache object we keep
 // a locking mechanism and an optional per-process LRUCache.
@@ -58,6 +74,7 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       shm_runtime_(shm_runtime),
       lock_manager_(NULL),
       file_cache_backend_(NULL),
+      segment_file_cache_backend_(NULL),
       lru_cache_(NULL),
       file_cache_(NULL),
       cache_flush_filename_(config->cache_flush_filename()),
@@ -114,30 +131,72 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       config->file_cache_clean_interval_ms(),
       config->file_cache_clean_size_kb() * 1024,
       config->file_cache_clean_inode_limit());
+  const bool use_segments = (config->file_cache_segment_size_kb() > 0);
+  if (use_segments) {
+    // Entries go to segment files instead.  The FileCache is still used for
+    // shared-memory cache snapshots, but its cleaner must not walk into the
+    // segment directory, so it is disabled and the segment cache enforces
+    // the size limit instead.
+    policy->clean_interval_ms = FileCache::kDisableCleaning;
+  }
   file_cache_backend_ =
       new FileCache(config->file_cache_path(), factory->file_system(),
                     factory->thread_system(), NULL, policy,
                     factory->statistics(), factory->message_handler());
   factory->TakeOwnership(file_cache_backend_);
-  file_cache_ = new CacheStats(kFileCache, file_cache_backend_,
-                               factory->timer(), factory->statistics());
+
+  CacheInterface* file_cache = file_cache_backend_;
+  if (use_segments) {
+    GoogleString segment_path(config->file_cache_path());
+    EnsureEndsInSlash(&segment_path);
+    StrAppend(&segment_path, kSegmentDirectory);
+    segment_file_cache_backend_ = new SegmentFileCache(
+        segment_path, factory->file_system(), factory->thread_system(), NULL,
+        new SegmentFileCache::CachePolicy(
+            factory->timer(),
+            config->file_cache_segment_size_kb() * 1024,
+            config->file_cache_clean_size_kb() * 1024),
+        factory->statistics(), factory->message_handler());
+    factory->TakeOwnership(segment_file_cache_backend_);
+    file_cache = segment_file_cache_backend_;
+  }
+  file_cache_ = new CacheStats(kFileCache, file_cache, factory->timer(),
+                               factory->statistics());
   factory->TakeOwnership(file_cache_);
 
   if (config->lru_cache_kb_per_process() != 0) {
-    LRUCache* lru_cache = new LRUCache(
-        config->lru_cache_kb_per_process() * 1024);
-    factory->TakeOwnership(lru_cache);
-
-    // We only add the threadsafe-wrapper to the LRUCache.  The FileCache
-    // is naturally thread-safe because it's got no writable member variables.
-    // And surrounding that slower-running class with a mutex would likely
-    // cause contention.
-    ThreadsafeCache* ts_cache =
-        new ThreadsafeCache(lru_cache, factory->thread_system()->NewMutex());
-    factory->TakeOwnership(ts_cache);
+    CacheInterface* ts_cache;
+    if (config->lru_cache_shards() > 1) {
+      // The sharded cache does its own per-shard locking, so that worker
+      // threads don't all serialize on a single mutex.
+      ts_cache = new ShardedLRUCache(
+          config->lru_cache_shards(),
+          config->lru_cache_kb_per_process() * 1024,
+          factory->thread_system());
+      factory->TakeOwnership(ts_cache);
+    } else {
+      LRUCache* lru_cache = new LRUCache(
+          config->lru_cache_kb_per_process() * 1024);
+      factory->TakeOwnership(lru_cache);
+
+      // We only add the threadsafe-wrapper to the LRUCache.  The FileCache
+      // is naturally thread-safe because it's got no writable member
+      // variables.  And surrounding that slower-running class with a mutex
+      // would likely cause contention.
+      ts_cache = new ThreadsafeCache(lru_cache,
+                                     factory->thread_system()->NewMutex());
+      factory->TakeOwnership(ts_cache);
+    }
     lru_cache_ = new CacheStats(kLruCache, ts_cache, factory->timer(),
                                 factory->statistics());
     factory->TakeOwnership(lru_cache_);
+    if (config->lru_cache_admission_filter()) {
+      lru_cache_ = new AdmissionFilterCache(
+          kLruCache, lru_cache_,
+          config->lru_cache_kb_per_process() * 1024 / kLruCacheEntryBytes,
+          factory->thread_system(), factory->statistics());
+      factory->TakeOwnership(lru_cache_);
+    }
   }
 }
 
@@ -154,6 +213,18 @@ GoogleString SystemCachePath::CachePath(SystemRewriteOptions* config) {
 }
 
 void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
+  if (segment_file_cache_backend_ != NULL) {
+    // Segment caches have no cleaning interval or inode count; they clean
+    // whenever they exceed the target size.
+    MergeEntries(config->file_cache_clean_size_kb() * 1024,
+                 config->has_file_cache_clean_size_kb(),
+                 true, "SizeKb",
+                 &segment_file_cache_backend_->mutable_cache_policy()->
+                     target_size_bytes,
+                 &clean_size_explicitly_set_);
+    return;
+  }
+
   FileCache::CachePolicy* policy = file_cache_backend_->mutable_cache_policy();
 
   // For the interval, we take the smaller of the specified intervals, so
@@ -236,6 +307,9 @@ void SystemCachePath::ChildInit(SlowWorker* cache_clean_worker) {
   if (file_cache_backend_ != NULL) {
     file_cache_backend_->set_worker(cache_clean_worker);
   }
+  if (segment_file_cache_backend_ != NULL) {
+    segment_file_cache_backend_->set_worker(cache_clean_worker);
+  }
 
   purge_context_.reset(new PurgeContext(cache_flush_filename_,
                                         factory_->file_system(),
@@ -42,6 +42,7 @@ class NamedLockManager;
 class PurgeContext;
 class PurgeSet;
 class RewriteDriverFactory;
+class SegmentFileCache;
 class SharedMemLockManager;
 class SlowWorker;
 class SystemServerContext;
@@ -75,6 +76,11 @@ class SystemCachePath {
   // Access to backend for testing.  Do not use this directly in production
   // as it lacks statistics wrappers, etc.
   FileCache* file_cache_backend() { return file_cache_backend_; }
+  // NULL unless FileCacheSegmentSizeKb is set, in which case this, rather
+  // than file_cache_backend(), holds the cache entries.
+  SegmentFileCache* segment_file_cache_backend() {
+    return segment_file_cache_backend_;
+  }
   NamedLockManager* lock_manager() { return lock_manager_; }
 
   // See comments in SystemCaches for calling conventions on these.
@@ -140,6 +146,7 @@ class SystemCachePath {
   scoped_ptr<FileSystemLockManager> file_system_lock_manager_;
   NamedLockManager* lock_manager_;
   FileCache* file_cache_backend_;  // owned by file_cache_
+  SegmentFileCache* segment_file_cache_backend_;  // owned by factory_
   CacheInterface* lru_cache_;
   CacheInterface* file_cache_;
   GoogleString cache_flush_filename_;
@@ -39,12 +39,14 @@
 #include "pagespeed/system/external_server_spec.h"
 #include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
 #include "pagespeed/kernel/cache/async_cache.h"
 #include "pagespeed/kernel/cache/cache_batcher.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
@@ -52,6 +54,7 @@
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
+#include "pagespeed/kernel/cache/segment_file_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
@@ -163,15 +166,23 @@ SystemCaches::ConstructExternalCacheInterfacesFromBlocking(
     CacheInterface* backend,
     QueuedWorkerPool* pool, int batcher_max_parallel_lookups,
     const char* async_stats_name, const char* blocking_stats_name) {
+  CacheInterface* async_backend = backend;
+  if (pool != NULL) {
+    async_backend = new AsyncCache(backend, pool);
+    factory_->TakeOwnership(async_backend);
+  }
+  return ConstructExternalCacheInterfaces(
+      async_backend, backend, batcher_max_parallel_lookups, async_stats_name,
+      blocking_stats_name);
+}
 
+SystemCaches::ExternalCacheInterfaces
+SystemCaches::ConstructExternalCacheInterfaces(
+    CacheInterface* async_backend, CacheInterface* blocking_backend,
+    int batcher_max_parallel_lookups,
+    const char* async_stats_name, const char* blocking_stats_name) {
   ExternalCacheInterfaces result;
-
-  if (pool == NULL) {
-    result.async = backend;
-  } else {
-    result.async = new AsyncCache(backend, pool);
-    factory_->TakeOwnership(result.async);
-  }
+  result.async = async_backend;
 
   // Put the batcher above the stats so that the stats sees the MultiGets
   // and can show us the histogram of how they are sized.
@@ -195,7 +206,7 @@ SystemCaches::ConstructExternalCacheInterfacesFromBlocking(
 
   // Populate the blocking interface, giving it its own
   // statistics wrapper.
-  result.blocking = new CacheStats(blocking_stats_name, backend,
+  result.blocking = new CacheStats(blocking_stats_name, blocking_backend,
                                    factory_->timer(), factory_->statistics());
   factory_->TakeOwnership(result.blocking);
   return result;
@@ -254,6 +265,23 @@ SystemCaches::ExternalCacheInterfaces SystemCaches::NewRedis(
       factory_->statistics(), redis_database_index);
   factory_->TakeOwnership(redis_server);
   redis_servers_.push_back(redis_server);
+  if (config->redis_async_connections() > 0) {
+    // The event-driven client serves the async interface itself, so requests
+    // neither queue up behind one another on redis_pool_ nor get dropped when
+    // it falls behind.  RedisCache still serves the blocking interface.
+    AsyncRedisCache* async_redis_server = new AsyncRedisCache(
+        server_spec.host, server_spec.port, redis_database_index,
+        config->redis_async_connections(), factory_->thread_system(),
+        factory_->message_handler(), factory_->timer(),
+        config->redis_reconnection_delay_ms(), config->redis_timeout_us());
+    factory_->TakeOwnership(async_redis_server);
+    async_redis_servers_.push_back(async_redis_server);
+    // Let the batcher keep one MGET in flight per connection, coalescing
+    // whatever arrives meanwhile.
+    return ConstructExternalCacheInterfaces(
+        async_redis_server, redis_server, config->redis_async_connections(),
+        kRedisAsync, kRedisBlocking);
+  }
   if (redis_pool_.get() == NULL) {
     // TODO(yeputons): consider using more than one thread and making the amount
     // configurable. For memcached using more than one thread was not boosting
@@ -290,7 +318,8 @@ SystemCaches::ExternalCacheInterfaces SystemCaches::NewExternalCache(
         StrCat("r;", config->redis_server().ToString(), ";",
                IntegerToString(config->redis_database_index()), ";",
                IntegerToString(config->redis_reconnection_delay_ms()), ";",
-               IntegerToString(config->redis_timeout_us()));
+               IntegerToString(config->redis_timeout_us()), ";",
+               IntegerToString(config->redis_async_connections()));
   } else if (use_memcached) {
     spec_signature = StrCat("m;", config->memcached_servers().ToString(), ";",
                             IntegerToString(config->memcached_threads()), ";",
@@ -365,6 +394,7 @@ bool SystemCaches::CreateShmMetadataCache(
       cache_info = new MetadataShmCacheInfo;
       factory_->TakeOwnership(cache_info);
       cache_info->segment = StrCat(name, "/metadata_cache");
+      cache_info->num_entries = static_cast<int64>(entries) * kSectors;
       cache_info->cache_backend =
           new SharedMemCache<64>(
               shared_mem_runtime_,
@@ -525,7 +555,8 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
       // If we have both a local SHM cache and a cache on an external server
       // we should go L1/L2 because there are likely to be other machines
       // that would like to use our metadata.
-      metadata_l1 = shm_metadata_cache;
+      metadata_l1 = (shm_metadata_cache_info->l1_cache_to_use != NULL) ?
+          shm_metadata_cache_info->l1_cache_to_use : shm_metadata_cache;
       metadata_l2 = external_cache.async;
 
       // Because external cache share the metadata cache across machines,
@@ -596,9 +627,16 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     property_store_cache = metadata_l2;
   }
   if (config->compress_metadata_cache()) {
-    metadata_cache = new CompressedCache(metadata_cache, stats);
+    SharedString dictionary = CompressionDictionary(config);
+    CompressedCache* compressed_metadata_cache =
+        new CompressedCache(metadata_cache, stats);
+    compressed_metadata_cache->set_dictionary(dictionary);
+    metadata_cache = compressed_metadata_cache;
     server_context->DeleteCacheOnDestruction(metadata_cache);
-    property_store_cache = new CompressedCache(property_store_cache, stats);
+    CompressedCache* compressed_property_store_cache =
+        new CompressedCache(property_store_cache, stats);
+    compressed_property_store_cache->set_dictionary(dictionary);
+    property_store_cache = compressed_property_store_cache;
     server_context->DeleteCacheOnDestruction(property_store_cache);
   }
   DCHECK(property_store_cache->IsBlocking());
@@ -621,6 +659,40 @@ void SystemCaches::RegisterConfig(SystemRewriteOptions* config) {
   // GetShmMetadataCacheOrDefault will create a default cache if one is needed
   // and doesn't exist yet.
   GetShmMetadataCacheOrDefault(config);
+
+  // Should fill in compression_dictionaries_.
+  if (config->compress_metadata_cache()) {
+    CompressionDictionary(config);
+  }
+}
+
+SharedString SystemCaches::CompressionDictionary(
+    const SystemRewriteOptions* config) {
+  const GoogleString& dictionary_file =
+      config->compress_metadata_cache_dictionary();
+  if (dictionary_file.empty()) {
+    return SharedString();
+  }
+  CompressionDictionaryMap::iterator p =
+      compression_dictionaries_.find(dictionary_file);
+  if (p != compression_dictionaries_.end()) {
+    return p->second;
+  }
+  GoogleString contents;
+  if (!factory_->file_system()->ReadFile(dictionary_file.c_str(), &contents,
+                                         factory_->message_handler())) {
+    // Remembered as empty, so this is only reported once.
+    factory_->message_handler()->Message(
+        kError, "Could not read %s %s; compressing cache entries without "
+        "a dictionary.",
+        SystemRewriteOptions::kCompressMetadataCacheDictionary,
+        dictionary_file.c_str());
+    contents.clear();
+  }
+  SharedString dictionary;
+  dictionary.SwapWithString(&contents);
+  compression_dictionaries_[dictionary_file] = dictionary;
+  return dictionary;
 }
 
 void SystemCaches::RootInit() {
@@ -657,6 +729,8 @@ void SystemCaches::RootInit() {
           file_cache,
           global_options->shm_metadata_cache_checkpoint_interval_sec());
     }
+    cache_info->cache_backend->set_incremental_checkpoints(
+        global_options->shm_metadata_cache_incremental_checkpoints());
 
     if (cache_info->cache_backend->Initialize()) {
       cache_info->initialized = true;
@@ -664,6 +738,19 @@ void SystemCaches::RootInit() {
           new CacheStats(kShmCache, cache_info->cache_backend,
                          factory_->timer(), factory_->statistics());
       factory_->TakeOwnership(cache_info->cache_to_use);
+      // Only the L1 use of the cache is filtered: when the shm cache is the
+      // sole metadata cache, a rejected Put would drop the entry entirely.
+      // The cache is shared by every child process but the filter's sketch
+      // is not, so a rejection just drops the Put instead of deleting an
+      // entry another child may have admitted.
+      if (global_options->shm_metadata_cache_admission_filter()) {
+        AdmissionFilterCache* filter = new AdmissionFilterCache(
+            kShmCache, cache_info->cache_to_use, cache_info->num_entries,
+            factory_->thread_system(), factory_->statistics());
+        filter->set_delete_on_reject(false);
+        cache_info->l1_cache_to_use = filter;
+        factory_->TakeOwnership(filter);
+      }
     } else {
       factory_->message_handler()->Message(
           kWarning, "Unable to initialize shared memory cache: %s.",
@@ -721,6 +808,9 @@ void SystemCaches::ChildInit() {
   for (RedisCache* redis_cache : redis_servers_) {
     redis_cache->StartUp();
   }
+  for (AsyncRedisCache* async_redis_cache : async_redis_servers_) {
+    async_redis_cache->StartUp();
+  }
 }
 
 void SystemCaches::StopCacheActivity() {
@@ -746,9 +836,12 @@ void SystemCaches::StopCacheActivity() {
 void SystemCaches::InitStats(Statistics* statistics) {
   AprMemCache::InitStats(statistics);
   FileCache::InitStats(statistics);
+  SegmentFileCache::InitStats(statistics);
   CacheStats::InitStats(SystemCachePath::kFileCache, statistics);
   CacheStats::InitStats(SystemCachePath::kLruCache, statistics);
   CacheStats::InitStats(kShmCache, statistics);
+  AdmissionFilterCache::InitStats(SystemCachePath::kLruCache, statistics);
+  AdmissionFilterCache::InitStats(kShmCache, statistics);
   CacheStats::InitStats(kMemcachedAsync, statistics);
   CacheStats::InitStats(kMemcachedBlocking, statistics);
   CacheStats::InitStats(kRedisAsync, statistics);
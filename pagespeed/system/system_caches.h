@@ -29,9 +29,11 @@
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
+#include "pagespeed/system/async_redis_cache.h"
 #include "pagespeed/system/redis_cache.h"
 #include "pagespeed/system/system_rewrite_options.h"
 
@@ -146,12 +148,18 @@ class SystemCaches {
   typedef SharedMemCache<64> MetadataShmCache;
   struct MetadataShmCacheInfo {
     MetadataShmCacheInfo()
-        : cache_to_use(NULL), cache_backend(NULL), initialized(false) {}
+        : cache_to_use(NULL), l1_cache_to_use(NULL), cache_backend(NULL),
+          num_entries(0), initialized(false) {}
 
     // Note that the fields may be NULL if e.g. initialization failed.
     CacheInterface* cache_to_use;  // may be CacheStats or such.
+    // cache_to_use behind an AdmissionFilterCache, for use when the shm cache
+    // is an L1 in front of an external cache.  NULL unless
+    // ShmMetadataCacheAdmissionFilter is on.
+    CacheInterface* l1_cache_to_use;
     GoogleString segment;
     MetadataShmCache* cache_backend;
+    int64 num_entries;  // Across all sectors of cache_backend.
     bool initialized;  // This is needed since in some scenarios we may
                        // not end up as far as calling ->Initialize() before
                        // we get shutdown.
@@ -180,6 +188,15 @@ class SystemCaches {
       int batcher_max_parallel_lookups, const char* async_stats_name,
       const char* blocking_stats_name);
 
+  // Like ConstructExternalCacheInterfacesFromBlocking, but for a backend with
+  // a native non-blocking client: async_backend is used as is for the async
+  // interface (below the stats and batcher) and blocking_backend for the
+  // blocking one.
+  ExternalCacheInterfaces ConstructExternalCacheInterfaces(
+      CacheInterface* async_backend, CacheInterface* blocking_backend,
+      int batcher_max_parallel_lookups, const char* async_stats_name,
+      const char* blocking_stats_name);
+
   // Constructs external cache interfaces for a configuration. Both blocking
   // and (potentially) non-blocking interfaces are constructed, and given
   // separate stats. The returned interfaces are owned by SystemCaches, and must
@@ -210,6 +227,11 @@ class SystemCaches {
   void SetupPcacheCohorts(ServerContext* server_context,
                           bool enable_property_cache);
 
+  // Returns the metadata cache compression dictionary configured in config,
+  // reading it into compression_dictionaries_ the first time it is asked for.
+  // Returns an empty string if there is none or it can't be read.
+  SharedString CompressionDictionary(const SystemRewriteOptions* config);
+
   scoped_ptr<SlowWorker> slow_worker_;
 
   RewriteDriverFactory* factory_;
@@ -246,6 +268,7 @@ class SystemCaches {
   // statistics for only memcached or only Redis (see kIncludeMemcached flag).
   std::vector<AprMemCache*> memcache_servers_;
   std::vector<RedisCache*> redis_servers_;
+  std::vector<AsyncRedisCache*> async_redis_servers_;
 
   // As each external cache object typically holds a TCP connection, we do not
   // want to allocate one per vhost (there can be tens of thousands of vhosts).
@@ -264,6 +287,12 @@ class SystemCaches {
   // Note that entries here may be NULL in cases of config errors.
   MetadataShmCacheMap metadata_shm_caches_;
 
+  // Compression dictionaries, by filename.  Every CompressedCache using a
+  // file shares the one copy read here, which happens when the config is
+  // registered, before any child processes are forked.
+  typedef std::map<GoogleString, SharedString> CompressionDictionaryMap;
+  CompressionDictionaryMap compression_dictionaries_;
+
   MD5Hasher cache_hasher_;
 
   bool default_shm_metadata_cache_creation_failed_;
@@ -65,6 +65,7 @@
 #include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/admission_filter_cache.h"
 #include "pagespeed/kernel/cache/async_cache.h"
 #include "pagespeed/kernel/cache/cache_batcher.h"
 #include "pagespeed/kernel/cache/cache_spammer.h"
@@ -73,6 +74,8 @@
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/cache/segment_file_cache.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -400,6 +403,52 @@ TEST_F(SystemCachesTest, BasicFileAndLruCache) {
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
 }
 
+TEST_F(SystemCachesTest, BasicFileAndShardedLruCache) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(100);
+  options_->set_lru_cache_shards(8);
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  EXPECT_STREQ(Compressed(WriteThrough(
+                   Stats("lru_cache", ShardedLRUCache::FormatName(8)),
+                   FileCacheWithStats())),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(
+      HttpCache(
+          WriteThrough(
+              Stats("lru_cache", ShardedLRUCache::FormatName(8)),
+              FileCacheWithStats())),
+      server_context->http_cache()->Name());
+}
+
+TEST_F(SystemCachesTest, BasicFileAndAdmissionFilteredLruCache) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(100);
+  options_->set_lru_cache_admission_filter(true);
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  EXPECT_STREQ(Compressed(WriteThrough(
+                   AdmissionFilterCache::FormatName(
+                       Stats("lru_cache", ThreadsafeLRU())),
+                   FileCacheWithStats())),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(
+      HttpCache(
+          WriteThrough(
+              AdmissionFilterCache::FormatName(
+                  Stats("lru_cache", ThreadsafeLRU())),
+              FileCacheWithStats())),
+      server_context->http_cache()->Name());
+}
+
 TEST_F(SystemCachesTest, BasicFileOnlyCache) {
   options_->set_file_cache_path(kCachePath);
   options_->set_use_shared_mem_locking(false);
@@ -416,6 +465,23 @@ TEST_F(SystemCachesTest, BasicFileOnlyCache) {
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == NULL);
 }
 
+TEST_F(SystemCachesTest, BasicSegmentFileCache) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_file_cache_segment_size_kb(1024);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(0);
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+
+  scoped_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  GoogleString segment_cache =
+      Stats("file_cache", SegmentFileCache::FormatName());
+  EXPECT_STREQ(Compressed(segment_cache),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(HttpCache(segment_cache), server_context->http_cache()->Name());
+}
+
 TEST_F(SystemCachesTest, UnusableShmAndLru) {
   // Test that we properly fallback when we can't create the shm cache
   // due to too small a size given.
@@ -847,6 +913,24 @@ class SystemCachesRedisCacheTest : public SystemCachesExternalCacheTestBase {
 
 ADD_EXTERNAL_CACHE_TESTS(SystemCachesRedisCacheTest)
 
+class SystemCachesAsyncRedisCacheTest : public SystemCachesRedisCacheTest {
+ protected:
+  static const int kAsyncConnections = 2;
+
+  GoogleString AssembledAsyncCacheWithStats() override {
+    return Batcher(Stats(SystemCaches::kRedisAsync,
+                         AsyncRedisCache::FormatName()),
+                   kAsyncConnections, 1000);
+  }
+
+  void SetUpExternalCache(SystemRewriteOptions* options) override {
+    SystemCachesRedisCacheTest::SetUpExternalCache(options);
+    options->set_redis_async_connections(kAsyncConnections);
+  }
+};
+
+ADD_EXTERNAL_CACHE_TESTS(SystemCachesAsyncRedisCacheTest)
+
 TEST_F(SystemCachesTest, BasicFileLockManager) {
   options_->set_file_cache_path(kCachePath);
   options_->set_use_shared_mem_locking(false);
@@ -869,6 +953,39 @@ TEST_F(SystemCachesTest, BasicShmLockManager) {
   EXPECT_TRUE(dynamic_cast<SharedMemLockManager*>(named_locks) != NULL);
 }
 
+TEST_F(SystemCachesTest, CompressionDictionarySharedAndReadOnce) {
+  const char kDictionaryFile[] = "/mem/dictionary";
+  const char kDictionary[] = "a metadata cache compression dictionary";
+  ASSERT_TRUE(file_system()->WriteFile(kDictionaryFile, kDictionary,
+                                       message_handler()));
+  std::vector<SystemRewriteOptions*> configs;
+  for (int i = 0; i < 2; ++i) {
+    SystemRewriteOptions* config = options_->NewOptions();
+    config->set_file_cache_path(kCachePath);
+    config->set_default_shared_memory_cache_kb(0);
+    config->set_compress_metadata_cache(true);
+    config->set_compress_metadata_cache_dictionary(kDictionaryFile);
+    system_caches_->RegisterConfig(config);
+    configs.push_back(config);
+  }
+  system_caches_->RootInit();
+  // The dictionary was read when the configs were registered.
+  ASSERT_TRUE(file_system()->RemoveFile(kDictionaryFile, message_handler()));
+  // pretend we fork here.
+  system_caches_->ChildInit();
+
+  scoped_ptr<ServerContext> server0(SetupServerContext(configs[0]));
+  scoped_ptr<ServerContext> server1(SetupServerContext(configs[1]));
+  CompressedCache* cache0 =
+      dynamic_cast<CompressedCache*>(server0->metadata_cache());
+  CompressedCache* cache1 =
+      dynamic_cast<CompressedCache*>(server1->metadata_cache());
+  ASSERT_TRUE(cache0 != NULL);
+  ASSERT_TRUE(cache1 != NULL);
+  EXPECT_EQ(kDictionary, cache0->dictionary().Value());
+  EXPECT_EQ(cache0->dictionary().data(), cache1->dictionary().data());
+}
+
 TEST_F(SystemCachesTest, FileShare) {
   // [0], [1], share path, [2] doesn't.
   std::vector<SystemRewriteOptions*> configs;
@@ -1297,6 +1414,29 @@ TEST_F(SystemCachesTest, FileCacheNoConflictOnDefaults) {
   EXPECT_EQ(0, message_handler()->MessagesOfType(kWarning));
 }
 
+TEST_F(SystemCachesTest, SegmentFileCacheMergesSize) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_file_cache_segment_size_kb(1024);
+  options_->set_file_cache_clean_size_kb(10);
+  SystemCachePath* path1 = system_caches_->GetCache(options_.get());
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path(kCachePath);
+  options2.set_file_cache_clean_size_kb(11);        // wins
+  options2.set_file_cache_clean_interval_ms(999);   // ignored
+  SystemCachePath* path2 = system_caches_->GetCache(&options2);
+  ASSERT_EQ(path1, path2);
+  const SegmentFileCache::CachePolicy* policy =
+      path1->segment_file_cache_backend()->cache_policy();
+  EXPECT_EQ(1024 * 1024, policy->segment_size_bytes);
+  EXPECT_EQ(11 * 1024, policy->target_size_bytes);
+
+  // The FileCache, kept for shared memory cache snapshots, never cleans, as
+  // it would otherwise sweep up the segments too.
+  EXPECT_FALSE(
+      path1->file_cache_backend()->mutable_cache_policy()->cleaning_enabled());
+  EXPECT_EQ(1, message_handler()->MessagesOfType(kWarning));
+}
+
 TEST_F(SystemCachesTest, PurgeUrl) {
   options_->set_enable_cache_purge(true);
   SystemServerContext* server_context = PopulateCacheForPurgeTest();
@@ -87,6 +87,7 @@ const char kUsePerVHostStatistics[] = "UsePerVHostStatistics";
 const char kInstallCrashHandler[] = "InstallCrashHandler";
 const char kNumRewriteThreads[] = "NumRewriteThreads";
 const char kNumExpensiveRewriteThreads[] = "NumExpensiveRewriteThreads";
+const char kWorkerPoolWorkStealing[] = "WorkerPoolWorkStealing";
 const char kForceCaching[] = "ForceCaching";
 const char kListOutstandingUrlsOnError[] = "ListOutstandingUrlsOnError";
 const char kMessageBufferSize[] = "MessageBufferSize";
@@ -415,7 +416,8 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
       StringCaseEqual(option, kUsePerVHostStatistics) ||
       StringCaseEqual(option, kInstallCrashHandler) ||
       StringCaseEqual(option, kNumRewriteThreads) ||
-      StringCaseEqual(option, kNumExpensiveRewriteThreads)) {
+      StringCaseEqual(option, kNumExpensiveRewriteThreads) ||
+      StringCaseEqual(option, kWorkerPoolWorkStealing)) {
     if (!process_scope) {
       *msg = StrCat("'", option, "' is global and can't be set at this scope.");
       return RewriteOptions::kOptionValueInvalid;
@@ -457,6 +459,9 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   } else if (StringCaseEqual(option, kInstallCrashHandler)) {
     set_install_crash_handler(is_on);
     return parsed_as_bool;
+  } else if (StringCaseEqual(option, kWorkerPoolWorkStealing)) {
+    set_worker_pool_work_stealing(is_on);
+    return parsed_as_bool;
   } else if (StringCaseEqual(option, kListOutstandingUrlsOnError)) {
     list_outstanding_urls_on_error(is_on);
     return parsed_as_bool;
@@ -628,6 +633,9 @@ GoogleString SystemRewriteDriverFactory::GetFetcherKey(
         list_outstanding_urls_on_error_ ? "list_errors\n" : "no_errors\n",
         config->fetcher_proxy(), "\n",
         config->fetch_with_gzip() ? "fetch_with_gzip\n": "no_gzip\n",
+        "keep_alive: ",
+        Integer64ToString(config->fetch_keep_alive_timeout_ms()), "\n",
+        "fetch_threads: ", IntegerToString(config->num_fetch_threads()), "\n",
         track_original_content_length_ ? "track_content_length\n" : "no_track\n"
         "timeout: ", Integer64ToString(config->blocking_fetch_timeout_ms()),
         "\n");
@@ -697,6 +705,8 @@ UrlAsyncFetcher* SystemRewriteDriverFactory::AllocateFetcher(
       message_handler());
   serf->set_list_outstanding_urls_on_error(list_outstanding_urls_on_error_);
   serf->set_fetch_with_gzip(config->fetch_with_gzip());
+  serf->set_keep_alive_timeout_ms(config->fetch_keep_alive_timeout_ms());
+  serf->set_num_fetch_threads(config->num_fetch_threads());
   serf->set_track_original_content_length(track_original_content_length_);
   serf->SetHttpsOptions(config->https_options());
   serf->SetSslCertificatesDir(config->ssl_cert_directory());
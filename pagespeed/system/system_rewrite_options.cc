@@ -55,6 +55,19 @@ const char SystemRewriteOptions::kRedisReconnectionDelayMs[] =
 const char SystemRewriteOptions::kRedisTimeoutUs[] = "RedisTimeoutUs";
 const char SystemRewriteOptions::kRedisDatabaseIndex[] =
     "RedisDatabaseIndex";
+const char SystemRewriteOptions::kRedisAsyncConnections[] =
+    "RedisAsyncConnections";
+const char SystemRewriteOptions::kLruCacheShards[] = "LRUCacheShards";
+const char SystemRewriteOptions::kFileCacheSegmentSizeKb[] =
+    "FileCacheSegmentSizeKb";
+const char SystemRewriteOptions::kCompressMetadataCacheDictionary[] =
+    "CompressMetadataCacheDictionary";
+const char SystemRewriteOptions::kLruCacheAdmissionFilter[] =
+    "LRUCacheAdmissionFilter";
+const char SystemRewriteOptions::kShmMetadataCacheAdmissionFilter[] =
+    "ShmMetadataCacheAdmissionFilter";
+const char SystemRewriteOptions::kShmMetadataCacheIncrementalCheckpoints[] =
+    "ShmMetadataCacheIncrementalCheckpoints";
 
 RewriteOptions::Properties* SystemRewriteOptions::system_properties_ = nullptr;
 
@@ -135,6 +148,12 @@ void SystemRewriteOptions::AddProperties() {
                     SystemRewriteOptions::kRedisDatabaseIndex,
                     "Redis server database index selection",
                     true);
+  AddSystemProperty(0,
+                    &SystemRewriteOptions::redis_async_connections_, "rdac",
+                    SystemRewriteOptions::kRedisAsyncConnections,
+                    "Number of connections for the event-driven Redis client; "
+                    "0 keeps the blocking client on a worker thread",
+                    true);
   AddSystemProperty(50 * Timer::kMsUs,  // 50 ms
                     &SystemRewriteOptions::slow_file_latency_threshold_us_,
                     "asflt", "SlowFileLatencyUs",
@@ -187,6 +206,11 @@ void SystemRewriteOptions::AddProperties() {
                     "afcl", RewriteOptions::kFileCacheCleanInodeLimit,
                     "Set the target number of inodes for the file cache; 0 "
                         "means no limit", true);
+  AddSystemProperty(0, &SystemRewriteOptions::file_cache_segment_size_kb_,
+                    "afcsk", SystemRewriteOptions::kFileCacheSegmentSizeKb,
+                    "Store the file cache in append-only segment files of "
+                        "this size (in kilobytes) instead of one file per "
+                        "entry; 0 keeps one file per entry", true);
   AddSystemProperty(0, &SystemRewriteOptions::lru_cache_byte_limit_, "alcb",
                     RewriteOptions::kLruCacheByteLimit,
                     "Set the maximum byte size entry to store in the "
@@ -195,6 +219,16 @@ void SystemRewriteOptions::AddProperties() {
                     RewriteOptions::kLruCacheKbPerProcess,
                     "Set the total size, in KB, of the per-process in-memory "
                         "LRU cache", true);
+  AddSystemProperty(1, &SystemRewriteOptions::lru_cache_shards_, "alcs",
+                    SystemRewriteOptions::kLruCacheShards,
+                    "Number of independently locked shards to split the "
+                        "per-process in-memory LRU cache into; 1 uses a "
+                        "single mutex-protected LRU", true);
+  AddSystemProperty(false,
+                    &SystemRewriteOptions::lru_cache_admission_filter_,
+                    "alcaf", SystemRewriteOptions::kLruCacheAdmissionFilter,
+                    "Only admit entries into the per-process in-memory LRU "
+                        "cache once they have been looked up repeatedly", true);
   AddSystemProperty("", &SystemRewriteOptions::cache_flush_filename_, "acff",
                     RewriteOptions::kCacheFlushFilename,
                     "Name of file to check for timestamp updates used to flush "
@@ -211,6 +245,12 @@ void SystemRewriteOptions::AddProperties() {
                     "cc", RewriteOptions::kCompressMetadataCache,
                     "Whether to compress cache entries before writing them to "
                     "memory or disk.", true);
+  AddSystemProperty("",
+                    &SystemRewriteOptions::compress_metadata_cache_dictionary_,
+                    "ccd", kCompressMetadataCacheDictionary,
+                    "File holding a preset dictionary, as produced by "
+                    "train_cache_dictionary, to compress cache entries "
+                    "against.", true);
   AddSystemProperty("enable", &SystemRewriteOptions::https_options_, "fhs",
                     kFetchHttps, "Controls direct fetching of HTTPS resources."
                     "  Value is comma-separated list of keywords: "
@@ -269,6 +309,15 @@ void SystemRewriteOptions::AddProperties() {
                     "FetchWithGzip", kLegacyProcessScope,
                     "Request http content from origin servers using gzip",
                     true);
+  AddSystemProperty(0, &SystemRewriteOptions::fetch_keep_alive_timeout_ms_,
+                    "afkat", "FetchKeepAliveTimeoutMs", kLegacyProcessScope,
+                    "Keep origin connections open for reuse by later fetches "
+                    "to the same host and port for this many milliseconds "
+                    "of idleness.  0 closes them after each fetch.", true);
+  AddSystemProperty(1, &SystemRewriteOptions::num_fetch_threads_,
+                    "anft", "NumFetchThreads", kLegacyProcessScope,
+                    "Number of threads fetching from origin servers.  Each "
+                    "origin is always fetched by the same thread.", true);
   AddSystemProperty(1024 * 1024 * 10,  /* 10 Megabytes */
                     &SystemRewriteOptions::ipro_max_response_bytes_,
                     "imrb", "IproMaxResponseBytes", kLegacyProcessScope,
@@ -293,6 +342,21 @@ void SystemRewriteOptions::AddProperties() {
                     kProcessScopeStrict,
                     "How often to checkpoint the shared memory metadata cache "
                     "to disk.  Set to 0 to turn off checkpointing.", true);
+  AddSystemProperty(false,
+                    &SystemRewriteOptions::shm_metadata_cache_admission_filter_,
+                    "smcaf", kShmMetadataCacheAdmissionFilter,
+                    kProcessScopeStrict,
+                    "Only admit entries into the shared memory metadata cache, "
+                    "when it is an L1 in front of an external cache, once "
+                    "they have been looked up repeatedly.", true);
+  AddSystemProperty(false,
+                    &SystemRewriteOptions::
+                    shm_metadata_cache_incremental_checkpoints_,
+                    "smcic", kShmMetadataCacheIncrementalCheckpoints,
+                    kProcessScopeStrict,
+                    "Checkpoint the shared memory metadata cache as an image "
+                    "of which only the changed parts are rewritten, and which "
+                    "is restored without re-inserting every entry.", true);
   AddSystemProperty("",
                     &SystemRewriteOptions::purge_method_,
                     "pm", "PurgeMethod", kServerScope,
@@ -53,6 +53,13 @@ class SystemRewriteOptions : public RewriteOptions {
   static const char kRedisReconnectionDelayMs[];
   static const char kRedisTimeoutUs[];
   static const char kRedisDatabaseIndex[];
+  static const char kRedisAsyncConnections[];
+  static const char kLruCacheShards[];
+  static const char kFileCacheSegmentSizeKb[];
+  static const char kCompressMetadataCacheDictionary[];
+  static const char kLruCacheAdmissionFilter[];
+  static const char kShmMetadataCacheAdmissionFilter[];
+  static const char kShmMetadataCacheIncrementalCheckpoints[];
 
   static constexpr int kMemcachedDefaultPort = 11211;
   static constexpr int kRedisDefaultPort = 6379;
@@ -100,6 +107,12 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_file_cache_clean_inode_limit(int64 x) {
     set_option(x, &file_cache_clean_inode_limit_);
   }
+  int64 file_cache_segment_size_kb() const {
+    return file_cache_segment_size_kb_.value();
+  }
+  void set_file_cache_segment_size_kb(int64 x) {
+    set_option(x, &file_cache_segment_size_kb_);
+  }
   int64 lru_cache_byte_limit() const {
     return lru_cache_byte_limit_.value();
   }
@@ -112,6 +125,18 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_lru_cache_kb_per_process(int64 x) {
     set_option(x, &lru_cache_kb_per_process_);
   }
+  int lru_cache_shards() const {
+    return lru_cache_shards_.value();
+  }
+  void set_lru_cache_shards(int x) {
+    set_option(x, &lru_cache_shards_);
+  }
+  bool lru_cache_admission_filter() const {
+    return lru_cache_admission_filter_.value();
+  }
+  void set_lru_cache_admission_filter(bool x) {
+    set_option(x, &lru_cache_admission_filter_);
+  }
   bool use_shared_mem_locking() const {
     return use_shared_mem_locking_.value();
   }
@@ -124,6 +149,12 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_compress_metadata_cache(bool x) {
     set_option(x, &compress_metadata_cache_);
   }
+  const GoogleString& compress_metadata_cache_dictionary() const {
+    return compress_metadata_cache_dictionary_.value();
+  }
+  void set_compress_metadata_cache_dictionary(const GoogleString& x) {
+    set_option(x, &compress_metadata_cache_dictionary_);
+  }
   bool statistics_enabled() const {
     return statistics_enabled_.value();
   }
@@ -198,6 +229,12 @@ class SystemRewriteOptions : public RewriteOptions {
   bool has_redis_database_index() const {
     return redis_database_index_.was_set();
   }
+  int redis_async_connections() const {
+    return redis_async_connections_.value();
+  }
+  void set_redis_async_connections(int x) {
+    set_option(x, &redis_async_connections_);
+  }
   int64 slow_file_latency_threshold_us() const {
     return slow_file_latency_threshold_us_.value();
   }
@@ -275,6 +312,12 @@ class SystemRewriteOptions : public RewriteOptions {
   bool fetch_with_gzip() const {
     return fetch_with_gzip_.value();
   }
+  int64 fetch_keep_alive_timeout_ms() const {
+    return fetch_keep_alive_timeout_ms_.value();
+  }
+  int num_fetch_threads() const {
+    return num_fetch_threads_.value();
+  }
   int64 ipro_max_response_bytes() const {
     return ipro_max_response_bytes_.value();
   }
@@ -290,6 +333,18 @@ class SystemRewriteOptions : public RewriteOptions {
   int shm_metadata_cache_checkpoint_interval_sec() const {
     return shm_metadata_cache_checkpoint_interval_sec_.value();
   }
+  bool shm_metadata_cache_admission_filter() const {
+    return shm_metadata_cache_admission_filter_.value();
+  }
+  void set_shm_metadata_cache_admission_filter(bool x) {
+    set_option(x, &shm_metadata_cache_admission_filter_);
+  }
+  bool shm_metadata_cache_incremental_checkpoints() const {
+    return shm_metadata_cache_incremental_checkpoints_.value();
+  }
+  void set_shm_metadata_cache_incremental_checkpoints(bool x) {
+    set_option(x, &shm_metadata_cache_incremental_checkpoints_);
+  }
   void set_purge_method(const GoogleString& x) {
     set_option(x, &purge_method_);
   }
@@ -488,6 +543,7 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<bool> statistics_logging_enabled_;
   Option<bool> use_shared_mem_locking_;
   Option<bool> compress_metadata_cache_;
+  Option<GoogleString> compress_metadata_cache_dictionary_;
 
   Option<bool> slurp_read_only_;
   Option<bool> test_proxy_;
@@ -502,6 +558,13 @@ class SystemRewriteOptions : public RewriteOptions {
   // cleartext.  We'll decompress as we read the content if needed.
   Option<bool> fetch_with_gzip_;
 
+  // How long idle origin connections are kept open for reuse; 0 closes them
+  // after each fetch.
+  Option<int64> fetch_keep_alive_timeout_ms_;
+
+  // How many threads run the origin fetcher's event loop.
+  Option<int> num_fetch_threads_;
+
   ControllerPortOption controller_port_;
   Option<int> popularity_contest_max_inflight_requests_;
   Option<int> popularity_contest_max_queue_size_;
@@ -511,13 +574,17 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> redis_reconnection_delay_ms_;
   Option<int64> redis_timeout_us_;
   Option<int> redis_database_index_;
+  Option<int> redis_async_connections_;
 
   Option<int64> slow_file_latency_threshold_us_;
   Option<int64> file_cache_clean_inode_limit_;
   Option<int64> file_cache_clean_interval_ms_;
   Option<int64> file_cache_clean_size_kb_;
+  Option<int64> file_cache_segment_size_kb_;
   Option<int64> lru_cache_byte_limit_;
   Option<int64> lru_cache_kb_per_process_;
+  Option<int> lru_cache_shards_;
+  Option<bool> lru_cache_admission_filter_;
   Option<int64> statistics_logging_interval_ms_;
   // If cache_flush_poll_interval_sec_<=0 then we turn off polling for
   // cache-flushes.
@@ -528,6 +595,8 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> ipro_max_concurrent_recordings_;
   Option<int64> default_shared_memory_cache_kb_;
   Option<int> shm_metadata_cache_checkpoint_interval_sec_;
+  Option<bool> shm_metadata_cache_admission_filter_;
+  Option<bool> shm_metadata_cache_incremental_checkpoints_;
   Option<GoogleString> purge_method_;
 
   StaticAssetCDNOptions static_assets_to_cdn_;
@@ -41,7 +41,8 @@ TcpServerThreadForTesting::TcpServerThreadForTesting(
       actual_listening_port_(0),
       listen_sock_(nullptr),
       terminating_(false),
-      is_shut_down_(false) {}
+      is_shut_down_(false),
+      serve_until_shut_down_(false) {}
 
 void TcpServerThreadForTesting::ShutDown() {
   // We want to ensure that the thread is terminated and it has accepted exactly
@@ -98,15 +99,24 @@ void TcpServerThreadForTesting::Run() {
     CHECK(!terminating_);
     local_listen_sock = listen_sock_ = CreateAndBindSocket();
   }
-  apr_socket_t* accepted_socket;
-  apr_status_t status =
-      apr_socket_accept(&accepted_socket, local_listen_sock, pool_);
-  EXPECT_EQ(APR_SUCCESS, status)
-      << "TcpServerThreadForTesting: "
-         "apr_socket_accept failed (did not receive a connection?)";
-  if (status == APR_SUCCESS) {
+  bool handled_connection = false;
+  do {
+    apr_socket_t* accepted_socket;
+    apr_status_t status =
+        apr_socket_accept(&accepted_socket, local_listen_sock, pool_);
+    if (status != APR_SUCCESS) {
+      // Once a repeating server has handled a connection, ShutDown()
+      // aborting accept() is how it is expected to stop.
+      if (!handled_connection) {
+        EXPECT_EQ(APR_SUCCESS, status)
+            << "TcpServerThreadForTesting: "
+               "apr_socket_accept failed (did not receive a connection?)";
+      }
+      break;
+    }
     HandleClientConnection(accepted_socket);
-  }
+    handled_connection = true;
+  } while (serve_until_shut_down_);
   {
     ScopedMutex lock(mutex_.get());
     apr_socket_close(listen_sock_);
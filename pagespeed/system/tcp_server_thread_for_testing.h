@@ -37,7 +37,8 @@ namespace net_instaweb {
 // absolutely not suitable for use outside of tests.
 // Please note that even though server stops after processing a single
 // connection, several connections could be established depending on the way
-// OS handles TCP backlog.
+// OS handles TCP backlog.  Subclasses that need to serve more connections can
+// call set_serve_until_shut_down().
 
 class TcpServerThreadForTesting : public ThreadSystem::Thread {
  public:
@@ -69,6 +70,11 @@ class TcpServerThreadForTesting : public ThreadSystem::Thread {
  protected:
   apr_pool_t* pool() { return pool_; }
 
+  // Keeps accepting connections, handling them one at a time, until
+  // ShutDown() rather than stopping after the first.  Must be called before
+  // Start().
+  void set_serve_until_shut_down(bool x) { serve_until_shut_down_ = x; }
+
  private:
   // Called after a successful call to apr_accept. Implementor can close the
   // socket themselves or it will be automatically closed by apr_pool_destroy()
@@ -94,6 +100,7 @@ class TcpServerThreadForTesting : public ThreadSystem::Thread {
   apr_socket_t* listen_sock_ GUARDED_BY(mutex_);
   bool terminating_ GUARDED_BY(mutex_);
   bool is_shut_down_;
+  bool serve_until_shut_down_;
 };
 
 }  // namespace net_instaweb
@@ -105,6 +105,7 @@
       'cflags': ['-funsigned-char', '-Wno-sign-compare', '-Wno-return-type'],
       'sources': [
         '<(css_parser_root)/string_using.h',
+        '<(css_parser_root)/webutil/css/arena.cc',
         '<(css_parser_root)/webutil/css/media.cc',
         '<(css_parser_root)/webutil/css/parser.cc',
         '<(css_parser_root)/webutil/css/selector.cc',
@@ -115,6 +116,7 @@
 
         #'<(css_parser_root)/webutil/css/parse_arg.cc',
         # Tests
+        #'<(css_parser_root)/webutil/css/arena_test.cc',
         #'<(css_parser_root)/webutil/css/gtest_main.cc',
         #'<(css_parser_root)/webutil/css/identifier_test.cc',
         #'<(css_parser_root)/webutil/css/parser_unittest.cc',
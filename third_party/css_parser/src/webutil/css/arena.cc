@@ -0,0 +1,132 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include "webutil/css/arena.h"
+
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace Css {
+
+namespace {
+
+// Header in front of every AST node saying which Arena it is in, or NULL if
+// it is on the heap.  The union keeps the node itself aligned.
+union NodeHeader {
+  Arena* arena;
+  double align_double;
+  void* align_pointer;
+};
+
+// Rounds size up to a multiple of sizeof(NodeHeader), which is all the
+// alignment AST nodes need.
+size_t Align(size_t size) {
+  return (size + sizeof(NodeHeader) - 1) & ~(sizeof(NodeHeader) - 1);
+}
+
+}  // namespace
+
+const size_t Arena::kBlockSize;
+
+Arena::Arena() : next_(NULL), end_(NULL), bytes_allocated_(0) {}
+
+Arena::~Arena() {
+  for (int i = 0, n = blocks_.size(); i < n; ++i) {
+    delete[] blocks_[i];
+  }
+}
+
+char* Arena::AllocateBlock(size_t size) {
+  char* block = new char[size];
+  blocks_.push_back(block);
+  return block;
+}
+
+void* Arena::Allocate(size_t size) {
+  size = Align(size);
+  bytes_allocated_ += size;
+  if (size > kBlockSize / 4) {
+    // Give big requests a block of their own rather than wasting the rest
+    // of the current one.
+    return AllocateBlock(size);
+  }
+  if (size > static_cast<size_t>(end_ - next_)) {
+    next_ = AllocateBlock(kBlockSize);
+    end_ = next_ + kBlockSize;
+  }
+  char* result = next_;
+  next_ += size;
+  return result;
+}
+
+StringPiece Arena::CopyText(const StringPiece& text) {
+  if (text.empty()) {
+    return StringPiece();
+  }
+  char* copy = static_cast<char*>(Allocate(text.size()));
+  memcpy(copy, text.data(), text.size());
+  return StringPiece(copy, text.size());
+}
+
+void* ArenaAllocated::operator new(size_t size) {
+  return operator new(size, static_cast<Arena*>(NULL));
+}
+
+void* ArenaAllocated::operator new(size_t size, Arena* arena) {
+  size += sizeof(NodeHeader);
+  NodeHeader* header = static_cast<NodeHeader*>(
+      arena == NULL ? ::operator new(size) : arena->Allocate(size));
+  header->arena = arena;
+  return header + 1;
+}
+
+void ArenaAllocated::operator delete(void* ptr) {
+  if (ptr != NULL) {
+    NodeHeader* header = static_cast<NodeHeader*>(ptr) - 1;
+    if (header->arena == NULL) {
+      ::operator delete(header);
+    }
+  }
+}
+
+void ArenaAllocated::operator delete(void* ptr, Arena* arena) {
+  operator delete(ptr);
+}
+
+VerbatimBytes& VerbatimBytes::operator=(const VerbatimBytes& other) {
+  if (this != &other) {
+    Copy(other.bytes_);
+  }
+  return *this;
+}
+
+void VerbatimBytes::Copy(const StringPiece& bytes) {
+  bytes.CopyToString(&storage_);
+  bytes_ = storage_;
+}
+
+void VerbatimBytes::PointTo(const StringPiece& bytes) {
+  storage_.clear();
+  bytes_ = bytes;
+}
+
+}  // namespace Css
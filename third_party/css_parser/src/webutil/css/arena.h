@@ -0,0 +1,108 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef WEBUTIL_CSS_ARENA_H__
+#define WEBUTIL_CSS_ARENA_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "strings/stringpiece.h"
+#include "webutil/css/string.h"
+
+namespace Css {
+
+// An Arena hands out memory for the nodes of a parsed stylesheet (see
+// Parser::set_arena()) from large blocks, and frees all of it at once when
+// it is destroyed.  That saves the allocator a call per node, both while
+// parsing and when the stylesheet is deleted.  The Arena must outlive
+// everything allocated in it.  It is not thread-safe.
+class Arena {
+ public:
+  // Small allocations are carved out of blocks of this size; anything over
+  // a quarter of it gets a block of its own.
+  static const size_t kBlockSize = 32 * 1024;
+
+  Arena();
+  ~Arena();
+
+  // Returns size bytes, aligned for any AST node.
+  void* Allocate(size_t size);
+
+  // Returns a copy of text that lives as long as the arena does.
+  StringPiece CopyText(const StringPiece& text);
+
+  // Total bytes handed out so far.
+  size_t bytes_allocated() const { return bytes_allocated_; }
+
+ private:
+  char* AllocateBlock(size_t size);
+
+  std::vector<char*> blocks_;
+  char* next_;  // next free byte in the current block.
+  char* end_;   // end of the current block.
+  size_t bytes_allocated_;
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// Base class of the AST classes that lets each node be allocated either on
+// the heap, with plain new, or in an Arena, with new (arena) (where a NULL
+// arena means the heap).  Either way, a node is deleted with plain delete,
+// so code that edits a parsed stylesheet need not know where it came from;
+// for a node in an arena that only runs the destructor, and the memory is
+// reclaimed with the arena.
+class ArenaAllocated {
+ public:
+  static void* operator new(size_t size);
+  static void* operator new(size_t size, Arena* arena);
+  static void operator delete(void* ptr);
+  // Only called if a constructor throws.
+  static void operator delete(void* ptr, Arena* arena);
+};
+
+// Verbatim bytes from the parsed document, kept by some nodes in preservation
+// mode.  Normally these are a copy, but when parsing into an Arena they are
+// just a view of the arena's copy of the document.  Copying a VerbatimBytes
+// always copies the bytes, since the copy may outlive the arena.
+class VerbatimBytes {
+ public:
+  VerbatimBytes() {}
+  VerbatimBytes(const VerbatimBytes& other) { *this = other; }
+  VerbatimBytes& operator=(const VerbatimBytes& other);
+
+  StringPiece get() const { return bytes_; }
+
+  // Stores a copy of bytes.
+  void Copy(const StringPiece& bytes);
+  // Refers to bytes without copying them; they must outlive this object.
+  void PointTo(const StringPiece& bytes);
+
+ private:
+  StringPiece bytes_;
+  string storage_;  // bytes_ points here if we made a copy.
+};
+
+}  // namespace Css
+
+#endif  // WEBUTIL_CSS_ARENA_H__
@@ -0,0 +1,206 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#include "webutil/css/arena.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include "base/scoped_ptr.h"
+#include <string>
+#include <vector>
+
+#include "testing/base/public/googletest.h"
+#include "testing/base/public/gunit.h"
+
+namespace {
+
+using Css::Arena;
+
+// Alignment every Arena allocation must have.
+const uintptr_t kAlignment =
+    sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+
+bool IsAligned(const void* ptr) {
+  return reinterpret_cast<uintptr_t>(ptr) % kAlignment == 0;
+}
+
+// Counts destructor calls, so tests can see delete run them.
+class Node : public Css::ArenaAllocated {
+ public:
+  Node(int value, int* destroyed) : value_(value), destroyed_(destroyed) {}
+  ~Node() { ++*destroyed_; }
+
+  int value() const { return value_; }
+
+ private:
+  double value_;  // makes the node need double alignment.
+  int* destroyed_;
+};
+
+TEST(ArenaTest, AllocationsAreAligned) {
+  Arena arena;
+  for (size_t size = 1; size <= 100; ++size) {
+    void* ptr = arena.Allocate(size);
+    EXPECT_TRUE(IsAligned(ptr)) << size;
+  }
+  EXPECT_TRUE(IsAligned(arena.Allocate(Arena::kBlockSize)));
+  // Text copies are padded, so whatever follows an odd-sized one is aligned.
+  EXPECT_TRUE(IsAligned(arena.CopyText("odd").data()));
+  EXPECT_TRUE(IsAligned(arena.CopyText("aligned?").data()));
+
+  int destroyed = 0;
+  for (int i = 0; i < 10; ++i) {
+    Node* node = new (&arena) Node(i, &destroyed);
+    EXPECT_TRUE(IsAligned(node));
+    delete node;
+  }
+}
+
+TEST(ArenaTest, BytesAllocatedRoundsUp) {
+  Arena arena;
+  EXPECT_EQ(0, arena.bytes_allocated());
+  arena.Allocate(1);
+  size_t rounded = arena.bytes_allocated();
+  EXPECT_LE(kAlignment, rounded);
+  EXPECT_EQ(0, rounded % kAlignment);
+  arena.Allocate(rounded);
+  EXPECT_EQ(2 * rounded, arena.bytes_allocated());
+}
+
+TEST(ArenaTest, SmallAllocationsSpanBlocks) {
+  // Enough 24-byte allocations to fill several blocks; none may overlap.
+  Arena arena;
+  const int kCount = 10000;
+  const size_t kSize = 24;
+  std::vector<char*> ptrs;
+  for (int i = 0; i < kCount; ++i) {
+    char* ptr = static_cast<char*>(arena.Allocate(kSize));
+    memset(ptr, i % 251, kSize);
+    ptrs.push_back(ptr);
+  }
+  EXPECT_LT(4 * Arena::kBlockSize, arena.bytes_allocated());
+  for (int i = 0; i < kCount; ++i) {
+    for (size_t j = 0; j < kSize; ++j) {
+      ASSERT_EQ(static_cast<char>(i % 251), ptrs[i][j]) << i;
+    }
+  }
+}
+
+TEST(ArenaTest, LargeAllocations) {
+  // Allocations over a quarter block get their own block, and must not
+  // disturb the block small allocations are coming from.
+  Arena arena;
+  char* small = static_cast<char*>(arena.Allocate(16));
+  memset(small, 'a', 16);
+
+  const size_t kSizes[] = {
+    Arena::kBlockSize / 4 + 1, Arena::kBlockSize, 10 * Arena::kBlockSize,
+    1 << 20,
+  };
+  std::vector<char*> large;
+  for (int i = 0; i < arraysize(kSizes); ++i) {
+    char* ptr = static_cast<char*>(arena.Allocate(kSizes[i]));
+    ASSERT_TRUE(ptr != NULL);
+    EXPECT_TRUE(IsAligned(ptr));
+    memset(ptr, 'A' + i, kSizes[i]);
+    large.push_back(ptr);
+  }
+  char* small2 = static_cast<char*>(arena.Allocate(16));
+  memset(small2, 'b', 16);
+  // The current block was kept, so small2 follows small.
+  EXPECT_EQ(small + 16, small2);
+
+  EXPECT_EQ(string(16, 'a'), string(small, 16));
+  for (int i = 0; i < arraysize(kSizes); ++i) {
+    EXPECT_EQ(string(kSizes[i], 'A' + i), string(large[i], kSizes[i]));
+  }
+}
+
+TEST(ArenaTest, CopyText) {
+  Arena arena;
+  string text("a { color: red }");
+  StringPiece copy = arena.CopyText(text);
+  EXPECT_NE(text.data(), copy.data());
+  text[0] = 'b';
+  EXPECT_EQ("a { color: red }", copy);
+  EXPECT_TRUE(arena.CopyText("").empty());
+}
+
+TEST(ArenaTest, DeleteRunsDestructors) {
+  // Nodes are deleted with plain delete wherever they were allocated.
+  Arena arena;
+  int destroyed = 0;
+  Node* heap_node = new Node(1, &destroyed);
+  Node* null_arena_node = new (static_cast<Arena*>(NULL)) Node(2, &destroyed);
+  Node* arena_node = new (&arena) Node(3, &destroyed);
+  EXPECT_EQ(1, heap_node->value());
+  EXPECT_EQ(2, null_arena_node->value());
+  EXPECT_EQ(3, arena_node->value());
+  delete heap_node;
+  delete null_arena_node;
+  delete arena_node;
+  EXPECT_EQ(3, destroyed);
+}
+
+TEST(ArenaTest, ArenaMemoryLastsUntilArenaIsDestroyed) {
+  // Deleting an arena node runs its destructor but leaves the memory to the
+  // arena, so allocations made after it stay valid and distinct.
+  scoped_ptr<Arena> arena(new Arena);
+  int destroyed = 0;
+  Node* first = new (arena.get()) Node(1, &destroyed);
+  StringPiece text = arena->CopyText("still here");
+  delete first;
+  Node* second = new (arena.get()) Node(2, &destroyed);
+  EXPECT_NE(first, second);
+  EXPECT_EQ("still here", text);
+  delete second;
+  EXPECT_EQ(2, destroyed);
+
+  // A new arena after the old one is gone starts from scratch.
+  arena.reset(new Arena);
+  EXPECT_EQ(0, arena->bytes_allocated());
+  Node* third = new (arena.get()) Node(3, &destroyed);
+  EXPECT_EQ(3, third->value());
+  delete third;
+  EXPECT_EQ(3, destroyed);
+}
+
+TEST(ArenaTest, VerbatimBytesCopiesOutliveArena) {
+  scoped_ptr<Arena> arena(new Arena);
+  StringPiece text = arena->CopyText("/* verbatim */");
+
+  Css::VerbatimBytes view;
+  view.PointTo(text);
+  EXPECT_EQ(text.data(), view.get().data());
+
+  // Copies own their bytes, so they survive the arena.
+  Css::VerbatimBytes copy(view);
+  Css::VerbatimBytes assigned;
+  assigned = view;
+  EXPECT_NE(text.data(), copy.get().data());
+  EXPECT_NE(text.data(), assigned.get().data());
+  arena.reset();
+  EXPECT_EQ("/* verbatim */", copy.get());
+  EXPECT_EQ("/* verbatim */", assigned.get());
+}
+
+}  // namespace
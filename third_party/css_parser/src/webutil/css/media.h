@@ -30,6 +30,7 @@
 
 #include "base/macros.h"
 #include "util/utf8/public/unicodetext.h"
+#include "webutil/css/arena.h"
 
 namespace Css {
 
@@ -56,7 +57,7 @@ class Ruleset;
 //   ;
 
 // Ex: (max-width: 500px)
-class MediaExpression {
+class MediaExpression : public ArenaAllocated {
  public:
   // Media feature without a value. Ex: (color).
   explicit MediaExpression(const UnicodeText& name)
@@ -83,7 +84,8 @@ class MediaExpression {
 };
 
 // Ex: (max-width: 500px) and (color)
-class MediaExpressions : public std::vector<MediaExpression*> {
+class MediaExpressions : public std::vector<MediaExpression*>,
+                         public ArenaAllocated {
  public:
   MediaExpressions() : std::vector<MediaExpression*>() {}
   ~MediaExpressions();
@@ -95,7 +97,7 @@ class MediaExpressions : public std::vector<MediaExpression*> {
 };
 
 // Ex: not screen and (max-width: 500px) and (color)
-class MediaQuery {
+class MediaQuery : public ArenaAllocated {
  public:
   MediaQuery() : qualifier_(NO_QUALIFIER) {}
   ~MediaQuery();
@@ -125,7 +127,7 @@ class MediaQuery {
 };
 
 // Ex: not screen and (max-width: 500px), projection and (color)
-class MediaQueries : public std::vector<MediaQuery*> {
+class MediaQueries : public std::vector<MediaQuery*>, public ArenaAllocated {
  public:
   MediaQueries() : std::vector<MediaQuery*>() {}
   ~MediaQueries();
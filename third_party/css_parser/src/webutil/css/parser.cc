@@ -80,6 +80,7 @@ Parser::Parser(const char* utf8text, const char* textend)
     : begin_(utf8text),
       in_(begin_),
       end_(textend),
+      arena_(NULL),
       quirks_mode_(true),
       preservation_mode_(false),
       max_function_depth_(kDefaultMaxFunctionDepth),
@@ -91,6 +92,7 @@ Parser::Parser(const char* utf8text)
     : begin_(utf8text),
       in_(begin_),
       end_(utf8text + strlen(utf8text)),
+      arena_(NULL),
       quirks_mode_(true),
       preservation_mode_(false),
       max_function_depth_(kDefaultMaxFunctionDepth),
@@ -102,6 +104,7 @@ Parser::Parser(StringPiece s)
     : begin_(s.begin()),
       in_(begin_),
       end_(s.end()),
+      arena_(NULL),
       quirks_mode_(true),
       preservation_mode_(false),
       max_function_depth_(kDefaultMaxFunctionDepth),
@@ -109,6 +112,17 @@ Parser::Parser(StringPiece s)
       unparseable_sections_seen_mask_(kNoError) {
 }
 
+void Parser::set_arena(Arena* arena) {
+  DCHECK(in_ == begin_) << "set_arena() must be called before parsing.";
+  arena_ = arena;
+  if (arena_ != NULL) {
+    StringPiece copy = arena_->CopyText(StringPiece(begin_, end_ - begin_));
+    begin_ = copy.data();
+    in_ = begin_;
+    end_ = begin_ + copy.size();
+  }
+}
+
 int Parser::ErrorNumber(uint64 error_flag) {
   for (int i = 0; i < 64; ++i) {
     if (error_flag & (1ULL << i)) {
@@ -176,6 +190,35 @@ static int DeHex(char c) {
   }
 }
 
+// Whether c is one of the ASCII characters allowed in an identifier.
+static bool IsAsciiIdentChar(char c) {
+  return ((c >= 'A' && c <= 'Z')
+          || (c >= 'a' && c <= 'z')
+          || (c >= '0' && c <= '9')
+          || c == '-' || c == '_');
+}
+
+// Whether c is printable ASCII.  UnicodeText takes runs of these as they are,
+// unlike control characters, which push_back() turns into spaces.
+static bool IsPrintableAscii(char c) {
+  return c >= ' ' && c <= '~';
+}
+
+// Appends [begin, end), which must be printable ASCII, to s.  This copies the
+// run at once instead of calling push_back() and revalidating each character,
+// and when s is empty just points s at the run; every AST node copies the
+// strings it is given, so the alias never outlives the parse.
+static void AppendAsciiRun(const char* begin, const char* end,
+                           UnicodeText* s) {
+  if (begin == end) {
+    return;
+  } else if (s->empty()) {
+    s->PointToUTF8(begin, end - begin);
+  } else {
+    s->append(UTF8ToUnicodeText(begin, end - begin, false /* do_copy */));
+  }
+}
+
 // ****************
 // Recursive-descent functions.
 //
@@ -479,12 +522,12 @@ UnicodeText Parser::ParseIdent() {
   Tracer trace(__func__, this);
   UnicodeText s;
   while (in_ < end_) {
-    if ((*in_ >= 'A' && *in_ <= 'Z')
-        || (*in_ >= 'a' && *in_ <= 'z')
-        || (*in_ >= '0' && *in_ <= '9')
-        || *in_ == '-' || *in_ == '_') {
-      s.push_back(*in_);
-      in_++;
+    if (IsAsciiIdentChar(*in_)) {
+      const char* begin = in_;
+      do {
+        in_++;
+      } while (in_ < end_ && IsAsciiIdentChar(*in_));
+      AppendAsciiRun(begin, in_, &s);
     } else if (!IsAscii(*in_)) {
       Rune rune;
       int len = charntorune(&rune, in_, end_-in_);
@@ -597,6 +640,13 @@ UnicodeText Parser::ParseString() {
             ReportParsingError(kUtf8Error, "UTF8 parsing error in string");
             in_++;
           }
+        } else if (IsPrintableAscii(*in_)) {
+          const char* begin = in_;
+          do {
+            in_++;
+          } while (in_ < end_ && IsPrintableAscii(*in_) && *in_ != delim &&
+                   *in_ != '\\');
+          AppendAsciiRun(begin, in_, &s);
         } else {
           s.push_back(*in_);
           in_++;
@@ -631,9 +681,9 @@ Value* Parser::ParseStringValue() {
   const char* oldin = in_;
   UnicodeText string_contents = ParseString<delim>();
   StringPiece verbatim_bytes(oldin, in_ - oldin);
-  Value* value = new Value(Value::STRING, string_contents);
+  Value* value = new (arena_) Value(Value::STRING, string_contents);
   if (preservation_mode_) {
-    value->set_bytes_in_original_buffer(verbatim_bytes);
+    SetBytesInOriginalBuffer(verbatim_bytes, value);
   }
 
   return value;
@@ -676,20 +726,20 @@ Value* Parser::ParseNumber() {
   StringPiece verbatim_bytes(begin, in_ - begin);
   Value* value;
   if (Done()) {
-    value = new Value(num, Value::NO_UNIT);
+    value = new (arena_) Value(num, Value::NO_UNIT);
   } else if (*in_ == '%') {
     in_++;
-    value = new Value(num, Value::PERCENT);
+    value = new (arena_) Value(num, Value::PERCENT);
   } else if (StartsIdent(*in_)) {
-    value = new Value(num, ParseIdent());
+    value = new (arena_) Value(num, ParseIdent());
   } else {
-    value = new Value(num, Value::NO_UNIT);
+    value = new (arena_) Value(num, Value::NO_UNIT);
   }
 
   if (preservation_mode_) {
     // Store verbatim bytes so that we can reconstruct this with exactly the
     // same precision.
-    value->set_bytes_in_original_buffer(verbatim_bytes);
+    SetBytesInOriginalBuffer(verbatim_bytes, value);
   }
 
   return value;
@@ -795,7 +845,7 @@ HtmlColor Parser::ParseColor() {
 // Both commas and spaces are allowed as separators and are remembered.
 FunctionParameters* Parser::ParseFunction(int max_function_depth) {
   Tracer trace(__func__, this);
-  scoped_ptr<FunctionParameters> params(new FunctionParameters);
+  scoped_ptr<FunctionParameters> params(new (arena_) FunctionParameters);
 
   SkipSpace();
   // Separator before next value. Initial value doesn't matter.
@@ -891,7 +941,7 @@ Value* Parser::ParseRgbColor() {
       break;
 
     if (*in_ == ')')
-      return new Value(HtmlColor(rgb[0], rgb[1], rgb[2]));
+      return new (arena_) Value(HtmlColor(rgb[0], rgb[1], rgb[2]));
 
     DCHECK_EQ(',', *in_);
     in_++;
@@ -930,6 +980,13 @@ Value* Parser::ParseUrl() {
           ReportParsingError(kUtf8Error, "UTF8 parsing error in URL");
           in_++;
         }
+      } else if (IsPrintableAscii(*in_)) {
+        const char* begin = in_;
+        do {
+          in_++;
+        } while (in_ < end_ && IsPrintableAscii(*in_) && *in_ != ' ' &&
+                 *in_ != ')' && *in_ != '\\');
+        AppendAsciiRun(begin, in_, &s);
       } else {
         s.push_back(*in_);
         in_++;
@@ -938,7 +995,7 @@ Value* Parser::ParseUrl() {
   }
   SkipSpace();
   if (!Done() && *in_ == ')')
-    return new Value(Value::URI, s);
+    return new (arena_) Value(Value::URI, s);
 
   return NULL;
 }
@@ -954,7 +1011,7 @@ Value* Parser::ParseAnyExpectingColor() {
   const char* oldin = in_;
   HtmlColor c = ParseColor();
   if (c.IsDefined()) {
-    toret = new Value(c);
+    toret = new (arena_) Value(c);
   } else {
     in_ = oldin;  // no valid color.  rollback.
     toret = ParseAny();
@@ -1009,14 +1066,14 @@ Value* Parser::ParseAnyWithFunctionDepth(int max_function_depth) {
     case '#': {
       HtmlColor color = ParseColor();
       if (color.IsDefined())
-        toret = new Value(color);
+        toret = new (arena_) Value(color);
       else
         toret = NULL;
       break;
     }
     case ',':
       // TODO(sligocki): Add other possible value tokens like DELIM.
-      toret = new Value(Value::COMMA);
+      toret = new (arena_) Value(Value::COMMA);
       in_++;
       break;
     case '+':
@@ -1045,7 +1102,7 @@ Value* Parser::ParseAnyWithFunctionDepth(int max_function_depth) {
             scoped_ptr<FunctionParameters> params(
                 ParseFunction(max_function_depth - 1));
             if (params.get() != NULL && params->size() == 4) {
-              toret = new Value(Value::RECT, params.release());
+              toret = new (arena_) Value(Value::RECT, params.release());
             } else {
               ReportParsingError(kFunctionError, "Could not parse parameters "
                                  "for function rect");
@@ -1054,7 +1111,7 @@ Value* Parser::ParseAnyWithFunctionDepth(int max_function_depth) {
             scoped_ptr<FunctionParameters> params(
                 ParseFunction(max_function_depth - 1));
             if (params.get() != NULL) {
-              toret = new Value(id, params.release());
+              toret = new (arena_) Value(id, params.release());
             } else {
               ReportParsingError(kFunctionError, StringPrintf(
                   "Could not parse function parameters for function %s",
@@ -1071,7 +1128,7 @@ Value* Parser::ParseAnyWithFunctionDepth(int max_function_depth) {
         }
         SkipPastDelimiter(')');
       } else {
-        toret = new Value(Identifier(id));
+        toret = new (arena_) Value(Identifier(id));
       }
       break;
     }
@@ -1114,13 +1171,13 @@ Values* Parser::ParseValues(Property::Prop prop) {
   Tracer trace(__func__, this);
 
   SkipSpace();
-  if (Done()) return new Values();
+  if (Done()) return new (arena_) Values();
   DCHECK_LT(in_, end_);
 
   // If expecting_color is true, color values are expected.
   bool expecting_color = IsPropExpectingColor(prop);
 
-  scoped_ptr<Values> values(new Values);
+  scoped_ptr<Values> values(new (arena_) Values);
   // Note: We skip over all blocks and at-keywords and only parse "any"s.
   //   value : [ any | block | ATKEYWORD S* ]+;
   // TODO(sligocki): According to the spec, if we cannot parse one of the
@@ -1368,7 +1425,7 @@ bool Parser::ParseFontFamily(Values* values) {
           family.push_back(static_cast<char32>(' '));
           family.append(v->GetIdentifierText());
         }
-        values->push_back(new Value(Identifier(family)));
+        values->push_back(new (arena_) Value(Identifier(family)));
         break;
       }
       default:
@@ -1402,7 +1459,7 @@ Values* Parser::ParseFont() {
   if (Done()) return NULL;
   DCHECK_LT(in_, end_);
 
-  scoped_ptr<Values> values(new Values);
+  scoped_ptr<Values> values(new (arena_) Values);
 
   if (!SkipToNextAny())
     return NULL;
@@ -1435,11 +1492,11 @@ Values* Parser::ParseFont() {
     }
   }
 
-  scoped_ptr<Value> font_style(new Value(Identifier::NORMAL));
-  scoped_ptr<Value> font_variant(new Value(Identifier::NORMAL));
-  scoped_ptr<Value> font_weight(new Value(Identifier::NORMAL));
-  scoped_ptr<Value> font_size(new Value(Identifier::MEDIUM));
-  scoped_ptr<Value> line_height(new Value(Identifier::NORMAL));
+  scoped_ptr<Value> font_style(new (arena_) Value(Identifier::NORMAL));
+  scoped_ptr<Value> font_variant(new (arena_) Value(Identifier::NORMAL));
+  scoped_ptr<Value> font_weight(new (arena_) Value(Identifier::NORMAL));
+  scoped_ptr<Value> font_size(new (arena_) Value(Identifier::MEDIUM));
+  scoped_ptr<Value> line_height(new (arena_) Value(Identifier::NORMAL));
   scoped_ptr<Value> font_family;
 
   // parse style, variant and weight
@@ -1642,10 +1699,10 @@ Declarations* Parser::ParseRawDeclarations() {
   Tracer trace(__func__, this);
 
   SkipSpace();
-  if (Done()) return new Declarations();
+  if (Done()) return new (arena_) Declarations();
   DCHECK_LT(in_, end_);
 
-  Declarations* declarations = new Declarations();
+  Declarations* declarations = new (arena_) Declarations();
   while (in_ < end_) {
     // decl_start is saved so that we may pass through verbatim text
     // in case declaration could not be parsed correctly.
@@ -1685,7 +1742,7 @@ Declarations* Parser::ParseRawDeclarations() {
             vals.reset(ParseFont());
             break;
           case Property::FONT_FAMILY:
-            vals.reset(new Values());
+            vals.reset(new (arena_) Values());
             if (!ParseFontFamily(vals.get()) || vals->empty()) {
               vals.reset(NULL);
             }
@@ -1742,7 +1799,7 @@ Declarations* Parser::ParseRawDeclarations() {
         // For example: "foo: bar !important really;" is not valid.
         if (Done() || *in_ == ';' || *in_ == '}') {
           declarations->push_back(
-              new Declaration(prop, vals.release(), important));
+              new (arena_) Declaration(prop, vals.release(), important));
         } else {
           ReportParsingError(kDeclarationError, StringPrintf(
               "Unexpected char %c at end of declaration", *in_));
@@ -1780,7 +1837,9 @@ Declarations* Parser::ParseRawDeclarations() {
         // serialized back out in case it was actually meaningful even though
         // we could not understand it.
         StringPiece bytes_in_original_buffer(decl_start, in_ - decl_start);
-        declarations->push_back(new Declaration(bytes_in_original_buffer));
+        Declaration* declaration = new (arena_) Declaration(StringPiece());
+        SetBytesInOriginalBuffer(bytes_in_original_buffer, declaration);
+        declarations->push_back(declaration);
         // All errors that occurred sinse we started this declaration are
         // demoted to unparseable sections now that we've saved the dummy
         // element.
@@ -1793,7 +1852,7 @@ Declarations* Parser::ParseRawDeclarations() {
 }
 
 Declarations* Parser::ExpandDeclarations(Declarations* orig_declarations) {
-  scoped_ptr<Declarations> new_declarations(new Declarations);
+  scoped_ptr<Declarations> new_declarations(new (arena_) Declarations);
   for (int j = 0; j < orig_declarations->size(); ++j) {
     // new_declarations takes ownership of declaration.
     Declaration* declaration = orig_declarations->at(j);
@@ -1980,7 +2039,8 @@ SimpleSelectors* Parser::ParseSimpleSelectors(bool expecting_combinator) {
         break;
     }
 
-  scoped_ptr<SimpleSelectors> selectors(new SimpleSelectors(combinator));
+  scoped_ptr<SimpleSelectors> selectors(
+      new (arena_) SimpleSelectors(combinator));
 
   SkipSpace();
   if (Done()) return NULL;
@@ -2011,8 +2071,8 @@ Selectors* Parser::ParseSelectors() {
   // selectors.
   bool success = true;
 
-  scoped_ptr<Selectors> selectors(new Selectors());
-  Selector* selector = new Selector();
+  scoped_ptr<Selectors> selectors(new (arena_) Selectors());
+  Selector* selector = new (arena_) Selector();
   selectors->push_back(selector);
 
   // The first simple selector sequence in a chain of simple selector
@@ -2028,7 +2088,7 @@ Selectors* Parser::ParseSelectors() {
           ReportParsingError(kSelectorError,
                              "Could not parse ruleset: unexpected ,");
         } else {
-          selector = new Selector();
+          selector = new (arena_) Selector();
           selectors->push_back(selector);
         }
         in_++;
@@ -2167,7 +2227,7 @@ Ruleset* Parser::ParseRuleset() {
   const char* start_pos = in_;
   const uint64 start_errors_seen_mask = errors_seen_mask_;
 
-  scoped_ptr<Ruleset> ruleset(new Ruleset());
+  scoped_ptr<Ruleset> ruleset(new (arena_) Ruleset());
   scoped_ptr<Selectors> selectors(ParseSelectors());
 
   if (Done()) {
@@ -2185,7 +2245,9 @@ Ruleset* Parser::ParseRuleset() {
   if (selectors.get() == NULL) {
     ReportParsingError(kSelectorError, "Failed to parse selector");
     if (preservation_mode_) {
-      selectors.reset(new Selectors(StringPiece(start_pos, in_ - start_pos)));
+      selectors.reset(new (arena_) Selectors(StringPiece()));
+      SetBytesInOriginalBuffer(StringPiece(start_pos, in_ - start_pos),
+                               selectors.get());
       ruleset->set_selectors(selectors.release());
       // All errors that occurred sinse we started this declaration are
       // demoted to unparseable sections now that we've saved the dummy
@@ -2224,7 +2286,7 @@ Ruleset* Parser::ParseRuleset() {
 MediaQueries* Parser::ParseMediaQueries() {
   Tracer trace(__func__, this);
 
-  scoped_ptr<MediaQueries> media_queries(new MediaQueries);
+  scoped_ptr<MediaQueries> media_queries(new (arena_) MediaQueries);
 
   SkipSpace();
   if (Done() || (*in_ == ';' || *in_ == '{')) {
@@ -2241,7 +2303,7 @@ MediaQueries* Parser::ParseMediaQueries() {
       // For example, if there is only one media query and it's invalid,
       // then the contents don't apply, whereas if there were 0 queries,
       // the contents would apply.
-      query.reset(new MediaQuery);
+      query.reset(new (arena_) MediaQuery);
       query->set_qualifier(MediaQuery::NOT);
       query->set_media_type(UTF8ToUnicodeText("all"));
     }
@@ -2276,7 +2338,7 @@ MediaQuery* Parser::ParseMediaQuery() {
   Tracer trace(__func__, this);
   SkipSpace();
 
-  scoped_ptr<MediaQuery> query(new MediaQuery);
+  scoped_ptr<MediaQuery> query(new (arena_) MediaQuery);
   UnicodeText id = ParseIdent();
   SkipSpace();
 
@@ -2332,7 +2394,7 @@ MediaQuery* Parser::ParseMediaQuery() {
           case ')':
             in_++;
             // Expression with no value. Ex: (color)
-            query->add_expression(new MediaExpression(name));
+            query->add_expression(new (arena_) MediaExpression(name));
             break;
           case ':': {
             in_++;
@@ -2350,7 +2412,7 @@ MediaQuery* Parser::ParseMediaQuery() {
               // it has always run ++in_ at the end. So this is safe.
               CHECK_LE(begin, end);
               value.CopyUTF8(begin, end - begin);
-              query->add_expression(new MediaExpression(name, value));
+              query->add_expression(new (arena_) MediaExpression(name, value));
             } else {
               ReportParsingError(kMediaError, "Unclosed media query.");
               SkipToMediaQueryEnd();
@@ -2444,12 +2506,12 @@ Import* Parser::ParseImport() {
     return NULL;
   }
 
-  scoped_ptr<Import> import(new Import());
+  scoped_ptr<Import> import(new (arena_) Import());
   import->set_link(v->GetStringValue());
   SkipSpace();
   if (Done() || *in_ == ';') {
     // Set empty media queries.
-    import->set_media_queries(new MediaQueries);
+    import->set_media_queries(new (arena_) MediaQueries);
   } else {
     const uint64 start_errors_seen_mask = errors_seen_mask_;
     scoped_ptr<MediaQueries> media(ParseMediaQueries());
@@ -2466,7 +2528,7 @@ Import* Parser::ParseImport() {
 FontFace* Parser::ParseFontFace() {
   Tracer trace(__func__, this);
 
-  scoped_ptr<FontFace> font_face(new FontFace());
+  scoped_ptr<FontFace> font_face(new (arena_) FontFace());
   SkipSpace();
   if (Done()) {
     ReportParsingError(kAtRuleError, "Unexpected EOF in @font-face.");
@@ -2638,7 +2700,7 @@ void Parser::ParseStatement(const MediaQueries* media_queries,
           font_face->set_media_queries(media_queries->DeepCopy());
         } else {
           // Blank media queries.
-          font_face->set_media_queries(new MediaQueries);
+          font_face->set_media_queries(new (arena_) MediaQueries);
         }
         stylesheet->mutable_font_faces().push_back(font_face.release());
       }
@@ -2662,8 +2724,10 @@ void Parser::ParseStatement(const MediaQueries* media_queries,
       // we could not understand it.
       StringPiece bytes_in_original_buffer(oldin, in_ - oldin);
 
-      Ruleset* ruleset =
-          new Ruleset(new UnparsedRegion(bytes_in_original_buffer));
+      UnparsedRegion* unparsed_region =
+          new (arena_) UnparsedRegion(StringPiece());
+      SetBytesInOriginalBuffer(bytes_in_original_buffer, unparsed_region);
+      Ruleset* ruleset = new (arena_) Ruleset(unparsed_region);
       if (media_queries != NULL) {
         ruleset->set_media_queries(media_queries->DeepCopy());
       }
@@ -2695,10 +2759,10 @@ Stylesheet* Parser::ParseRawStylesheet() {
   Tracer trace(__func__, this);
 
   SkipSpace();
-  if (Done()) return new Stylesheet();
+  if (Done()) return new (arena_) Stylesheet();
   DCHECK_LT(in_, end_);
 
-  Stylesheet* stylesheet = new Stylesheet();
+  Stylesheet* stylesheet = new (arena_) Stylesheet();
   while (in_ < end_) {
     switch (*in_) {
       // HTML-style comments are not allowed in CSS.
@@ -29,6 +29,7 @@
 #include "strings/stringpiece.h"
 #include "testing/production_stub/public/gunit_prod.h"
 #include "util/utf8/public/unicodetext.h"
+#include "webutil/css/arena.h"
 #include "webutil/css/media.h"
 #include "webutil/css/property.h"  // while these CSS includes can be
 #include "webutil/css/selector.h"  // forward-declared, who is really
@@ -195,6 +196,16 @@ class Parser {
   void set_max_function_depth(int x) { max_function_depth_ = x; }
   static const int kDefaultMaxFunctionDepth = 10;
 
+  // Allocates every node of the parsed tree from arena rather than the heap
+  // (default NULL: use the heap). The input is copied into the arena and
+  // verbatim bytes saved in preservation mode refer to that copy, so the
+  // returned tree must be destroyed before arena, and the caller may
+  // release the original buffer as soon as parsing is done. Deleting nodes
+  // is still fine, but only releases their heap-allocated members.
+  // Must be called before parsing begins.
+  Arena* arena() const { return arena_; }
+  void set_arena(Arena* arena);
+
   // This is a bitmask of errors seen during the parse.  This is decidedly
   // incomplete --- there are definitely many errors that are not reported here.
   static const uint64 kNoError           = 0;
@@ -598,10 +609,23 @@ class Parser {
   // error_flag should be one of the static const k*Error's above.
   void ReportParsingError(uint64 error_flag, const StringPiece& message);
 
+  // Records bytes as node's verbatim bytes, pointing into the arena copy of
+  // the input when there is one and copying them otherwise.
+  template<class T>
+  void SetBytesInOriginalBuffer(const StringPiece& bytes, T* node) {
+    if (arena_ != NULL) {
+      node->set_bytes_in_original_buffer_view(bytes);
+    } else {
+      node->set_bytes_in_original_buffer(bytes);
+    }
+  }
+
   const char *begin_;  // The beginning of the doc (used to report offset).
   const char *in_;     // The current point in the parse.
   const char *end_;    // The end of the document to parse.
 
+  Arena* arena_;  // Where tree nodes are allocated, or NULL for the heap.
+
   bool quirks_mode_;  // Whether we are in quirks mode.
   // In preservation mode, we attempt to save all information from the
   // stylesheet (including unparseable constructs such as proprietary CSS
@@ -659,7 +683,7 @@ class Parser {
 // A declaration consists of a property name (Property) and a list
 // of values (Values*).
 // It could also be important (font: 12pt Arial !important).
-class Declaration {
+class Declaration : public ArenaAllocated {
  public:
   // constructor.  We take ownership of v.
   Declaration(Property p, Values* v, bool important)
@@ -672,9 +696,9 @@ class Declaration {
   // Constructor for dummy declaration used to pass through unparseable
   // declaration text.
   explicit Declaration(const StringPiece& bytes_in_original_buffer)
-      : property_(Property::UNPARSEABLE), important_(false),
-        bytes_in_original_buffer_(bytes_in_original_buffer.data(),
-                                  bytes_in_original_buffer.length()) {}
+      : property_(Property::UNPARSEABLE), important_(false) {
+    bytes_in_original_buffer_.Copy(bytes_in_original_buffer);
+  }
 
   // accessors
   Property property() const { return property_; }
@@ -683,10 +707,15 @@ class Declaration {
 
   // Note: May be invalid UTF8.
   StringPiece bytes_in_original_buffer() const {
-    return bytes_in_original_buffer_;
+    return bytes_in_original_buffer_.get();
   }
   void set_bytes_in_original_buffer(const StringPiece& new_bytes) {
-    bytes_in_original_buffer_ = string(new_bytes.data(), new_bytes.length());
+    bytes_in_original_buffer_.Copy(new_bytes);
+  }
+  // Like set_bytes_in_original_buffer(), but refers to new_bytes instead of
+  // copying them, so they must outlive this object.
+  void set_bytes_in_original_buffer_view(const StringPiece& new_bytes) {
+    bytes_in_original_buffer_.PointTo(new_bytes);
   }
 
   // convenience accessors
@@ -711,7 +740,7 @@ class Declaration {
   // for unparseable declarations (stored with property_ == UNPARSEABLE).
   // TODO(sligocki): We may want to store verbatim text for all declarations
   // to preserve the details of the original text.
-  string bytes_in_original_buffer_;
+  VerbatimBytes bytes_in_original_buffer_;
 
   DISALLOW_COPY_AND_ASSIGN(Declaration);
 };
@@ -721,7 +750,7 @@ class Declaration {
 // Declarations, you are responsible for deleting them.
 // Also, be careful --- there's no virtual destructor, so this must be
 // deleted as a Declarations.
-class Declarations : public std::vector<Declaration*> {
+class Declarations : public std::vector<Declaration*>, public ArenaAllocated {
  public:
   Declarations() : std::vector<Declaration*>() { }
   ~Declarations();
@@ -739,24 +768,29 @@ class Declarations : public std::vector<Declaration*> {
 // parsed, so we simply collect the verbatim bytes from start to finish and
 // store them in an UnparsedRegion so that they can be re-emitted in
 // preservation mode.
-class UnparsedRegion {
+class UnparsedRegion : public ArenaAllocated {
  public:
-  explicit UnparsedRegion(const StringPiece& bytes_in_original_buffer)
-      : bytes_in_original_buffer_(bytes_in_original_buffer.data(),
-                                  bytes_in_original_buffer.size()) {}
+  explicit UnparsedRegion(const StringPiece& bytes_in_original_buffer) {
+    bytes_in_original_buffer_.Copy(bytes_in_original_buffer);
+  }
 
   StringPiece bytes_in_original_buffer() const {
-    return bytes_in_original_buffer_;
+    return bytes_in_original_buffer_.get();
   }
 
   void set_bytes_in_original_buffer(const StringPiece& bytes) {
-    bytes.CopyToString(&bytes_in_original_buffer_);
+    bytes_in_original_buffer_.Copy(bytes);
+  }
+  // Like set_bytes_in_original_buffer(), but refers to bytes instead of
+  // copying them, so they must outlive this object.
+  void set_bytes_in_original_buffer_view(const StringPiece& bytes) {
+    bytes_in_original_buffer_.PointTo(bytes);
   }
 
   string ToString() const;
 
  private:
-  string bytes_in_original_buffer_;
+  VerbatimBytes bytes_in_original_buffer_;
 
   DISALLOW_COPY_AND_ASSIGN(UnparsedRegion);
 };
@@ -767,7 +801,7 @@ class UnparsedRegion {
 // Unparsed regions between Rulesets can also be stored here in preservation
 // mode. For example, at-rules can be interspersed with Rulesets, for those
 // that we don't parse, they are stored in dummy Rulesets.
-class Ruleset {
+class Ruleset : public ArenaAllocated {
  public:
   // TODO(sligocki): Allow other parsed at-rules, like @page.
   enum Type { RULESET, UNPARSED_REGION, };
@@ -878,7 +912,7 @@ class Charsets : public std::vector<UnicodeText> {
   string ToString() const;
 };
 
-class Import {
+class Import : public ArenaAllocated {
  public:
   Import() {}
   ~Import() {}
@@ -907,7 +941,7 @@ class Imports : public std::vector<Css::Import*> {
   ~Imports();
 };
 
-class FontFace {
+class FontFace : public ArenaAllocated {
  public:
   FontFace() {}
   ~FontFace() {}
@@ -943,7 +977,7 @@ class FontFaces : public std::vector<Css::FontFace*> {
 
 // A stylesheet consists of a list of import information and a list of
 // rulesets.
-class Stylesheet {
+class Stylesheet : public ArenaAllocated {
  public:
   Stylesheet() : type_(AUTHOR) {}
 
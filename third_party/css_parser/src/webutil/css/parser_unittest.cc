@@ -2734,4 +2734,80 @@ TEST_F(ParserTest, BadPartialImportEncoding) {
   EXPECT_NE(Parser::kNoError, parser.errors_seen_mask());
 }
 
+// Parses css with or without an arena and returns the stylesheet (or, if
+// declarations is set, the declarations) printed, followed by the errors
+// seen.  The input buffer is overwritten right after parsing, since with an
+// arena the tree must not refer to it.
+static string ParseAndPrint(const string& css, bool use_arena,
+                            bool preservation_mode, bool declarations) {
+  Arena arena;
+  string buffer(css);
+  Parser parser(buffer);
+  parser.set_preservation_mode(preservation_mode);
+  if (use_arena) {
+    parser.set_arena(&arena);
+  }
+  string printed;
+  if (declarations) {
+    scoped_ptr<Declarations> parsed(parser.ParseDeclarations());
+    buffer.assign(buffer.size(), 'X');
+    printed = parsed->ToString();
+  } else {
+    scoped_ptr<Stylesheet> parsed(parser.ParseStylesheet());
+    buffer.assign(buffer.size(), 'X');
+    printed = parsed->ToString();
+  }
+  uint64 errors = parser.errors_seen_mask();
+  printed.append("\nerrors: ");
+  for (int bit = 63; bit >= 0; --bit) {
+    printed.push_back((errors >> bit) & 1 ? '1' : '0');
+  }
+  return printed;
+}
+
+TEST_F(ParserTest, ArenaMatchesHeap) {
+  const char* kStylesheets[] = {
+    "",
+    "a { color: red }",
+    "@charset \"utf-8\"; @import url(\"a.css\") screen;\n"
+    "a.b > c + d ~ e:hover, #id[title=\"x\"]::before { "
+    "color: #123; background: url(image.png) no-repeat top left; "
+    "font: italic bold 12px/30px Georgia, serif; margin: 0 auto !important }",
+    "@media screen and (max-width: 100px), print { .a { width: 50% } }\n"
+    "@font-face { font-family: Foo; src: url(foo.woff) format(\"woff\") }\n"
+    "@page :first { margin: 1in }",
+    "/* comment */ a { content: \"\\201C  caf\xc3\xa9\"; "
+    "width: calc(100% - 2*3px); "
+    "filter: progid:DXImageTransform.Microsoft.Alpha(Opacity=80); "
+    "*zoom: 1; _height: 1px }",
+    "a { color: rgb(1, 2, 3); b: rect(1px, 2px, 3px, 4px); "
+    "transform: rotate(45deg) translate(-50%, -50%) }",
+    // Errors, which preservation mode keeps verbatim.
+    "a { color: red; ;; ; foo: }\n"
+    "@unknown stuff { more stuff }\n"
+    "b { width: 1px;; height: \"unterminated\n }\n"
+    "@media screen { c { {{ } } }\n"
+    "d[ { color: blue }\n"
+    "e { x: \xff\xfe }",
+    "@import url(R\xd5\x9b",
+    "<!-- a { color: red } -->",
+  };
+  const char* kDeclarations[] = {
+    "color: red; background: white url(x.png); margin: 0 1px 2px",
+    "color: red; ; junk junk; width: 10px !important; font: 12px bogus(",
+  };
+  for (int preservation = 0; preservation < 2; ++preservation) {
+    for (int i = 0; i < arraysize(kStylesheets); ++i) {
+      EXPECT_EQ(ParseAndPrint(kStylesheets[i], false, preservation, false),
+                ParseAndPrint(kStylesheets[i], true, preservation, false))
+          << kStylesheets[i];
+    }
+    for (int i = 0; i < arraysize(kDeclarations); ++i) {
+      EXPECT_EQ(ParseAndPrint(kDeclarations[i], false, preservation, true),
+                ParseAndPrint(kDeclarations[i], true, preservation, true))
+          << kDeclarations[i];
+    }
+  }
+}
+
 }  // namespace Css
@@ -28,6 +28,7 @@
 #include "base/logging.h"
 #include "strings/stringpiece.h"
 #include "util/utf8/public/unicodetext.h"
+#include "webutil/css/arena.h"
 #include "webutil/css/string.h"
 #include "webutil/html/htmltagenum.h"
 #include "webutil/html/htmltagindex.h"
@@ -83,7 +84,7 @@ namespace Css {
 // values are also set by the factory and accessed with the various
 // accessors.  Each accessor is valid with certain types.
 // ------------
-class SimpleSelector {
+class SimpleSelector : public ArenaAllocated {
  public:
   enum Type {
     // An element type selector matches the HTML element type (e.g., h1, h2, h3)
@@ -250,7 +251,8 @@ class SimpleSelector {
 // combinator() is NONE, F's combinator is CHILD, and G's combinator
 // is SIBLING.
 // ------------
-class SimpleSelectors : public std::vector<SimpleSelector*> {
+class SimpleSelectors : public std::vector<SimpleSelector*>,
+                        public ArenaAllocated {
  public:
   enum Combinator {
     NONE,         // first one in the chain
@@ -281,7 +283,7 @@ class SimpleSelectors : public std::vector<SimpleSelector*> {
 // combinators.  Each SimpleSelectors stores the combinator between
 // it and the previous one in the chain.
 // ------------
-class Selector: public std::vector<SimpleSelectors*> {
+class Selector: public std::vector<SimpleSelectors*>, public ArenaAllocated {
  public:
   Selector() { }
   ~Selector();
@@ -300,7 +302,7 @@ class Selector: public std::vector<SimpleSelectors*> {
 // When several selectors share the same declarations, they may be
 // grouped into a comma-separated list:
 // ------------
-class Selectors: public std::vector<Selector*> {
+class Selectors: public std::vector<Selector*>, public ArenaAllocated {
  public:
   Selectors() : is_dummy_(false) {}
   // Dummy Selectors
@@ -308,19 +310,24 @@ class Selectors: public std::vector<Selector*> {
   // dummy selectors? This would make sure users don't accidentally treat
   // dummy selectors as normal selectors.
   explicit Selectors(const StringPiece& bytes_in_original_buffer)
-      : is_dummy_(true),
-        bytes_in_original_buffer_(bytes_in_original_buffer.data(),
-                                  bytes_in_original_buffer.length()) {}
+      : is_dummy_(true) {
+    bytes_in_original_buffer_.Copy(bytes_in_original_buffer);
+  }
   ~Selectors();
   const Selector* get(int i) const { return (*this)[i]; }
 
   bool is_dummy() const { return is_dummy_; }
   // Note: May be invalid UTF8.
   StringPiece bytes_in_original_buffer() const {
-    return bytes_in_original_buffer_;
+    return bytes_in_original_buffer_.get();
   }
   void set_bytes_in_original_buffer(const StringPiece& new_bytes) {
-    new_bytes.CopyToString(&bytes_in_original_buffer_);
+    bytes_in_original_buffer_.Copy(new_bytes);
+  }
+  // Like set_bytes_in_original_buffer(), but refers to new_bytes instead of
+  // copying them, so they must outlive this object.
+  void set_bytes_in_original_buffer_view(const StringPiece& new_bytes) {
+    bytes_in_original_buffer_.PointTo(new_bytes);
   }
 
   string ToString() const;
@@ -334,7 +341,7 @@ class Selectors: public std::vector<Selector*> {
   // for unparseable selectors (stored with is_dummy_ == true).
   // TODO(sligocki): We may want to store verbatim text for all selectors
   // to preserve the details of the original text.
-  string bytes_in_original_buffer_;
+  VerbatimBytes bytes_in_original_buffer_;
 
   DISALLOW_COPY_AND_ASSIGN(Selectors);
 };
@@ -31,6 +31,7 @@
 #include "base/macros.h"
 #include "strings/stringpiece.h"
 #include "util/utf8/public/unicodetext.h"
+#include "webutil/css/arena.h"
 #include "webutil/css/identifier.h"
 #include "webutil/css/string.h"
 #include "webutil/html/htmlcolor.h"
@@ -53,7 +54,7 @@ class Values;
 // is set by the constructor and accessed with GetLexicalUnitType().
 // The values are also set by the constructor and accessed with the
 // various accessors.
-class Value {
+class Value : public ArenaAllocated {
  public:
   enum ValueType { NUMBER, URI, FUNCTION, RECT, COLOR, STRING, IDENT, COMMA,
                    UNKNOWN, DEFAULT };
@@ -144,10 +145,15 @@ class Value {
   // recoverable after value parsing.
   // Note: May be invalid UTF8.
   StringPiece bytes_in_original_buffer() const {
-    return bytes_in_original_buffer_;
+    return bytes_in_original_buffer_.get();
   }
   void set_bytes_in_original_buffer(const StringPiece& bytes) {
-    bytes.CopyToString(&bytes_in_original_buffer_);
+    bytes_in_original_buffer_.Copy(bytes);
+  }
+  // Like set_bytes_in_original_buffer(), but refers to bytes instead of
+  // copying them, so they must outlive this Value (though not its copies).
+  void set_bytes_in_original_buffer_view(const StringPiece& bytes) {
+    bytes_in_original_buffer_.PointTo(bytes);
   }
 
  private:
@@ -159,7 +165,7 @@ class Value {
   scoped_ptr<FunctionParameters> params_;  // FUNCTION and RECT params
   HtmlColor color_;           // COLOR
 
-  string bytes_in_original_buffer_;
+  VerbatimBytes bytes_in_original_buffer_;
 
   // kDimensionUnitText stores the name of each unit (see TextFromUnit)
   static const char* const kDimensionUnitText[];
@@ -170,7 +176,7 @@ class Value {
 // responsible for deleting them.
 // Also, be careful --- there's no virtual destructor, so this must be
 // deleted as a Values.
-class Values : public std::vector<Value*> {
+class Values : public std::vector<Value*>, public ArenaAllocated {
  public:
   Values() : std::vector<Value*>() { }
   ~Values();
@@ -196,7 +202,7 @@ class Values : public std::vector<Value*> {
 // are interpretted correctly. Only the original mix of spaces and commas.
 //
 // FunctionParameters will delete all of its stored Value*'s on destruction.
-class FunctionParameters {
+class FunctionParameters : public ArenaAllocated {
  public:
   enum Separator {
     COMMA_SEPARATED,